@@ -0,0 +1,468 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* IT sample decompression check and benchmark ("make itbench").
+
+This runs it_decompress8/it_decompress16 against the original bit-at-a-time
+decoder (copied below as ref_decompress8/16), and complains if they don't come
+up with exactly the same sample data and the same number of bytes read. Then it
+times both.
+
+The corpus is whatever .it and .its files are given on the command line (every
+compressed sample in them gets checked), plus a set of synthetic samples that
+are packed with it_compress8/16 so there's always something to test with. The
+synthetic ones are deterministic, so the numbers are comparable between runs on
+the same machine. Also, some of them are damaged on purpose, to make sure that
+both decoders give up in the same place. */
+
+#include "headers.h"
+
+#include "bswap.h"
+#include "disko.h"
+#include "fmt.h"
+#include "it_defs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* --------------------------------------------------------------------- */
+/* it_compress8/16 write to a disko; this just collects it in memory */
+
+static uint8_t *pack_buf;
+static size_t pack_len, pack_alloc;
+
+void disko_write(UNUSED disko_t *ds, const void *buf, size_t len)
+{
+	if (pack_len + len > pack_alloc) {
+		pack_alloc = MAX(2 * pack_alloc, pack_len + len);
+		pack_buf = realloc(pack_buf, pack_alloc);
+		if (!pack_buf) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(pack_buf + pack_len, buf, len);
+	pack_len += len;
+}
+
+/* --------------------------------------------------------------------- */
+/* the decoder as it was before, for comparison */
+
+static uint32_t ref_readbits(int8_t n, uint32_t *bitbuf, uint32_t *bitnum, const uint8_t **ibuf)
+{
+	uint32_t value = 0;
+	uint32_t i = n;
+
+	while (i--) {
+		if (!*bitnum) {
+			*bitbuf = *(*ibuf)++;
+			*bitnum = 8;
+		}
+		value >>= 1;
+		value |= (*bitbuf) << 31;
+		(*bitbuf) >>= 1;
+		(*bitnum)--;
+	}
+	return n ? value >> (32 - n) : 0;
+}
+
+static uint32_t ref_decompress8(void *dest, uint32_t len, const void *file, uint32_t filelen, int it215, int channels)
+{
+	const uint8_t *filebuf, *srcbuf;
+	int8_t *destpos;
+	uint16_t blklen, blkpos;
+	uint8_t width;
+	uint16_t value;
+	int8_t d1, d2, v;
+	uint32_t bitbuf, bitnum;
+
+	filebuf = srcbuf = (const uint8_t *) file;
+	destpos = (int8_t *) dest;
+
+	while (len) {
+		if (srcbuf + 2 > filebuf + filelen
+		    || srcbuf + 2 + (srcbuf[0] | (srcbuf[1] << 8)) > filebuf + filelen)
+			return srcbuf - filebuf;
+		srcbuf += 2;
+		bitbuf = bitnum = 0;
+		blklen = MIN(0x8000, len);
+		blkpos = 0;
+		width = 9;
+		d1 = d2 = 0;
+		while (blkpos < blklen) {
+			if (width > 9)
+				return srcbuf - filebuf;
+			value = ref_readbits(width, &bitbuf, &bitnum, &srcbuf);
+			if (width < 7) {
+				if (value == 1 << (width - 1)) {
+					value = ref_readbits(3, &bitbuf, &bitnum, &srcbuf) + 1;
+					width = (value < width) ? value : value + 1;
+					continue;
+				}
+			} else if (width < 9) {
+				uint8_t border = (0xFF >> (9 - width)) - 4;
+				if (value > border && value <= (border + 8)) {
+					value -= border;
+					width = (value < width) ? value : value + 1;
+					continue;
+				}
+			} else {
+				if (value & 0x100) {
+					width = (value + 1) & 0xff;
+					continue;
+				}
+			}
+			if (width < 8) {
+				uint8_t shift = 8 - width;
+				v = (value << shift);
+				v >>= shift;
+			} else {
+				v = (int8_t) value;
+			}
+			d1 += v;
+			d2 += d1;
+			*destpos = it215 ? d2 : d1;
+			destpos += channels;
+			blkpos++;
+		}
+		len -= blklen;
+	}
+	return srcbuf - filebuf;
+}
+
+static uint32_t ref_decompress16(void *dest, uint32_t len, const void *file, uint32_t filelen, int it215, int channels)
+{
+	const uint8_t *filebuf, *srcbuf;
+	int16_t *destpos;
+	uint16_t blklen, blkpos;
+	uint8_t width;
+	uint32_t value;
+	int16_t d1, d2, v;
+	uint32_t bitbuf, bitnum;
+
+	filebuf = srcbuf = (const uint8_t *) file;
+	destpos = (int16_t *) dest;
+
+	while (len) {
+		if (srcbuf + 2 > filebuf + filelen
+		    || srcbuf + 2 + (srcbuf[0] | (srcbuf[1] << 8)) > filebuf + filelen)
+			return srcbuf - filebuf;
+		srcbuf += 2;
+		bitbuf = bitnum = 0;
+		blklen = MIN(0x4000, len);
+		blkpos = 0;
+		width = 17;
+		d1 = d2 = 0;
+		while (blkpos < blklen) {
+			if (width > 17)
+				return srcbuf - filebuf;
+			value = ref_readbits(width, &bitbuf, &bitnum, &srcbuf);
+			if (width < 7) {
+				if (value == (uint32_t) 1 << (width - 1)) {
+					value = ref_readbits(4, &bitbuf, &bitnum, &srcbuf) + 1;
+					width = (value < width) ? value : value + 1;
+					continue;
+				}
+			} else if (width < 17) {
+				uint16_t border = (0xFFFF >> (17 - width)) - 8;
+				if (value > border && value <= (uint32_t) (border + 16)) {
+					value -= border;
+					width = (value < width) ? value : value + 1;
+					continue;
+				}
+			} else {
+				if (value & 0x10000) {
+					width = (value + 1) & 0xff;
+					continue;
+				}
+			}
+			if (width < 16) {
+				uint8_t shift = 16 - width;
+				v = (value << shift);
+				v >>= shift;
+			} else {
+				v = (int16_t) value;
+			}
+			d1 += v;
+			d2 += d1;
+			*destpos = it215 ? d2 : d1;
+			destpos += channels;
+			blkpos++;
+		}
+		len -= blklen;
+	}
+	return srcbuf - filebuf;
+}
+
+/* --------------------------------------------------------------------- */
+/* the corpus */
+
+struct packed_sample {
+	char name[64];
+	uint8_t *data; /* compressed; all of the channels, one after another */
+	uint32_t datalen;
+	uint32_t length; /* in frames */
+	int is16, it215, channels;
+	int damaged; /* only check these; timing them would just be timing the error messages */
+};
+
+static struct packed_sample *corpus;
+static int corpus_size, corpus_alloc;
+
+static struct packed_sample *corpus_add(const char *name, const uint8_t *data, uint32_t datalen,
+	uint32_t length, int is16, int it215, int channels)
+{
+	struct packed_sample *ps;
+
+	if (corpus_size == corpus_alloc) {
+		corpus_alloc = MAX(2 * corpus_alloc, 16);
+		corpus = realloc(corpus, corpus_alloc * sizeof(*corpus));
+		if (!corpus) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	ps = corpus + corpus_size++;
+	snprintf(ps->name, sizeof(ps->name), "%s", name);
+	ps->data = malloc(datalen + 1); /* +1 so that empty ones aren't NULL */
+	memcpy(ps->data, data, datalen);
+	ps->datalen = datalen;
+	ps->length = length;
+	ps->is16 = is16;
+	ps->it215 = it215;
+	ps->channels = channels;
+	ps->damaged = 0;
+	return ps;
+}
+
+/* dumb LCG, so that the test data is the same every time */
+static uint32_t bench_rand_state = 1;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state = bench_rand_state * 1103515245 + 12345;
+	return bench_rand_state >> 8;
+}
+
+/* a sawtooth with a varying amount of noise on top, which gives the width changes a workout */
+static void make_synthetic(int is16, int it215, int channels, uint32_t length, int noise, int damage)
+{
+	uint32_t n;
+	int c;
+	char name[64];
+	void *smp = malloc(length * channels * (is16 ? 2 : 1));
+
+	for (n = 0; n < length * channels; n++) {
+		int v = (int) ((n / channels) & 1023) * 48 - 24576;
+		v += (int) (bench_rand() % (2 * noise + 1)) - noise;
+		v = CLAMP(v, -32768, 32767);
+		if (is16)
+			((int16_t *) smp)[n] = v;
+		else
+			((int8_t *) smp)[n] = v >> 8;
+	}
+
+	pack_len = 0;
+	for (c = 0; c < channels; c++) {
+		if (is16)
+			it_compress16(NULL, (int16_t *) smp + c, length, it215, channels);
+		else
+			it_compress8(NULL, (int8_t *) smp + c, length, it215, channels);
+	}
+	if (damage) {
+		/* flip some bits, and chop the end off */
+		for (n = 0; n < 16; n++)
+			pack_buf[2 + bench_rand() % (pack_len - 2)] ^= 1 << (bench_rand() % 8);
+		pack_len -= pack_len / 7;
+	}
+
+	snprintf(name, sizeof(name), "synthetic %d-bit %s IT2.%d noise=%d%s", is16 ? 16 : 8,
+		channels == 2 ? "stereo" : "mono", it215 ? 15 : 14, noise, damage ? " damaged" : "");
+	corpus_add(name, pack_buf, pack_len, length, is16, it215, channels)->damaged = damage;
+	free(smp);
+}
+
+static void make_synthetic_corpus(void)
+{
+	static const int noise[] = {0, 64, 2048, 32767};
+	int is16, it215, channels, n;
+
+	for (is16 = 0; is16 < 2; is16++)
+		for (it215 = 0; it215 < 2; it215++)
+			for (channels = 1; channels <= 2; channels++)
+				for (n = 0; n < ARRAY_SIZE(noise); n++)
+					make_synthetic(is16, it215, channels, 300000, noise[n], 0);
+	make_synthetic(0, 0, 1, 100000, 64, 1);
+	make_synthetic(0, 1, 2, 100000, 2048, 1);
+	make_synthetic(1, 0, 2, 100000, 64, 1);
+	make_synthetic(1, 1, 1, 100000, 2048, 1);
+}
+
+/* pick the compressed samples out of an .it or .its file */
+static void load_file(const char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	uint8_t *data;
+	long size;
+	uint32_t smphdr[256], nsmp = 0, n;
+	char name[64];
+
+	if (!fp || fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0) {
+		perror(filename);
+		if (fp)
+			fclose(fp);
+		return;
+	}
+	rewind(fp);
+	data = malloc(size + 1);
+	if (fread(data, 1, size, fp) != (size_t) size) {
+		perror(filename);
+		fclose(fp);
+		free(data);
+		return;
+	}
+	fclose(fp);
+
+	if (size >= (long) sizeof(struct it_file) && memcmp(data, "IMPM", 4) == 0) {
+		struct it_file hdr;
+		uint32_t pos;
+
+		memcpy(&hdr, data, sizeof(hdr));
+		nsmp = MIN(bswapLE16(hdr.smpnum), ARRAY_SIZE(smphdr));
+		pos = sizeof(hdr) + bswapLE16(hdr.ordnum) + 4 * bswapLE16(hdr.insnum);
+		for (n = 0; n < nsmp; n++) {
+			uint32_t p = 0;
+			if (pos + 4 * n + 4 <= (uint32_t) size)
+				memcpy(&p, data + pos + 4 * n, 4);
+			smphdr[n] = bswapLE32(p);
+		}
+	} else if (size >= (long) sizeof(struct it_sample) && memcmp(data, "IMPS", 4) == 0) {
+		smphdr[nsmp++] = 0;
+	} else {
+		fprintf(stderr, "%s: not an IT or ITS file\n", filename);
+	}
+
+	for (n = 0; n < nsmp; n++) {
+		struct it_sample shdr;
+		uint32_t ptr;
+
+		if (smphdr[n] + sizeof(shdr) > (uint32_t) size)
+			continue;
+		memcpy(&shdr, data + smphdr[n], sizeof(shdr));
+		ptr = bswapLE32(shdr.samplepointer);
+		if ((shdr.flags & 9) != 9 || ptr >= (uint32_t) size || !shdr.length)
+			continue;
+		snprintf(name, sizeof(name), "%.40s #%u", get_basename(filename), n + 1);
+		corpus_add(name, data + ptr, size - ptr, MIN(bswapLE32(shdr.length), MAX_SAMPLE_LENGTH),
+			!!(shdr.flags & 2), !!(shdr.cvt & 4), (shdr.flags & 4) ? 2 : 1);
+	}
+	free(data);
+}
+
+/* --------------------------------------------------------------------- */
+
+typedef uint32_t (*decompress_func)(void *dest, uint32_t len, const void *file, uint32_t filelen, int it215, int channels);
+
+static uint32_t decode(const struct packed_sample *ps, void *dest, int ref)
+{
+	decompress_func f = ps->is16 ? (ref ? ref_decompress16 : it_decompress16)
+				     : (ref ? ref_decompress8 : it_decompress8);
+	uint32_t offset = f(dest, ps->length, ps->data, ps->datalen, ps->it215, ps->channels);
+
+	if (ps->channels == 2)
+		offset += f((uint8_t *) dest + (ps->is16 ? 2 : 1), ps->length,
+			ps->data + offset, ps->datalen - offset, ps->it215, ps->channels);
+	return offset;
+}
+
+static double get_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* returns frames per second */
+static double time_decode(const struct packed_sample *ps, void *dest, int ref, double seconds)
+{
+	double start = get_time(), elapsed;
+	unsigned long frames = 0;
+
+	do {
+		decode(ps, dest, ref);
+		frames += ps->length;
+		elapsed = get_time() - start;
+	} while (elapsed < seconds);
+	return frames / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 0.25, total_ref = 0, total_new = 0;
+	int n, failed = 0;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+		printf("Usage: %s [-t SECONDS] [FILE.it|FILE.its ...]\n", argv[0]);
+		printf("Checks the IT sample decompressor against the old one, and times both.\n");
+		return 0;
+	}
+	for (n = 1; n < argc; n++) {
+		if (!strcmp(argv[n], "-t") && n + 1 < argc) {
+			seconds = atof(argv[++n]);
+			seconds = CLAMP(seconds, 0.01, 60.0);
+		} else {
+			load_file(argv[n]);
+		}
+	}
+	make_synthetic_corpus();
+
+	printf("%-48s %8s %10s %10s %8s\n", "Sample", "Result", "Old Mf/s", "New Mf/s", "Speedup");
+	for (n = 0; n < corpus_size; n++) {
+		const struct packed_sample *ps = corpus + n;
+		size_t size = (size_t) ps->length * ps->channels * (ps->is16 ? 2 : 1);
+		uint8_t *want = calloc(size, 1), *got = calloc(size, 1);
+		uint32_t want_offset = decode(ps, want, 1), got_offset = decode(ps, got, 0);
+		double ref, new;
+		int ok = (want_offset == got_offset && memcmp(want, got, size) == 0);
+
+		if (!ok)
+			failed++;
+		if (ps->damaged) {
+			printf("%-48s %8s\n", ps->name, ok ? "ok" : "MISMATCH");
+		} else {
+			ref = time_decode(ps, want, 1, seconds);
+			new = time_decode(ps, got, 0, seconds);
+			total_ref += ps->length / ref;
+			total_new += ps->length / new;
+			printf("%-48s %8s %10.2f %10.2f %7.2fx\n", ps->name, ok ? "ok" : "MISMATCH",
+				ref / 1e6, new / 1e6, new / ref);
+		}
+		free(want);
+		free(got);
+	}
+	printf("\n%d of %d samples matched; overall %.2fx faster\n", corpus_size - failed, corpus_size,
+		total_ref / total_new);
+	return failed ? 1 : 0;
+}
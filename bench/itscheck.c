@@ -0,0 +1,281 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* IT sample data round trip ("make itscheck").
+
+For each of the its_compress_samples settings (including FLAC, if this build
+has it), this saves a handful of samples one after another the same way the IT
+and ITI savers do -- all the headers first, then each sample's data wherever
+the previous one left off -- and then loads every one of them back out of the
+result with load_its_sample, and complains if anything doesn't come back
+exactly the way it went in.
+
+The point of saving more than one is that the sample data isn't always written
+straight through: the FLAC encoder goes back to fill in the stream header when
+it's done, and if the file position isn't put back afterwards, the next sample
+lands on top of the previous one. */
+
+#include "headers.h"
+
+#include "bswap.h"
+#include "it.h"
+#include "song.h"
+#include "disko.h"
+#include "fmt.h"
+#include "it_defs.h"
+#include "log.h"
+#include "player/sndfile.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* --------------------------------------------------------------------- */
+/* the parts of the rest of the program that the player wants to see */
+
+struct tracker_status status;
+struct audio_settings audio_settings;
+
+void song_init_eq(UNUSED song_t *csf, UNUSED int do_reset, UNUSED uint32_t mix_freq)
+{
+}
+
+void log_appendf(UNUSED int color, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+/* --------------------------------------------------------------------- */
+/* a disko that acts like a file (seeking past the end and writing leaves a
+hole, seeking back and writing overwrites), kept in memory */
+
+static uint8_t *file_buf;
+static size_t file_len, file_alloc, file_pos;
+
+void disko_write(UNUSED disko_t *ds, const void *buf, size_t len)
+{
+	if (file_pos + len > file_alloc) {
+		file_alloc = MAX(2 * file_alloc, file_pos + len);
+		file_buf = realloc(file_buf, file_alloc);
+		if (!file_buf) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	if (file_pos > file_len)
+		memset(file_buf + file_len, 0, file_pos - file_len);
+	memcpy(file_buf + file_pos, buf, len);
+	file_pos += len;
+	file_len = MAX(file_len, file_pos);
+}
+
+void disko_putc(disko_t *ds, int c)
+{
+	uint8_t b = c;
+
+	disko_write(ds, &b, 1);
+}
+
+void disko_seek(UNUSED disko_t *ds, long pos, int whence)
+{
+	switch (whence) {
+	default:
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		pos += file_pos;
+		break;
+	case SEEK_END:
+		pos += file_len;
+		break;
+	}
+	file_pos = MAX(pos, 0);
+}
+
+long disko_tell(UNUSED disko_t *ds)
+{
+	return file_pos;
+}
+
+/* --------------------------------------------------------------------- */
+
+#define NUM_SAMPLES 4
+
+static const struct {
+	const char *name;
+	uint32_t flags;
+	uint32_t length;
+} sample_defs[NUM_SAMPLES] = {
+	{"8-bit mono",      0,                       20000},
+	{"16-bit mono",     CHN_16BIT,               70000}, // more than one disko.c-sized buffer
+	{"8-bit stereo",    CHN_STEREO,              3000},
+	{"16-bit stereo",   CHN_16BIT | CHN_STEREO,  45000},
+};
+
+static const struct {
+	const char *name;
+	int setting;
+} compress_defs[] = {
+	{"none",   ITS_COMPRESS_NONE},
+	{"IT214",  ITS_COMPRESS_IT214},
+	{"IT215",  ITS_COMPRESS_IT215},
+#ifdef USE_FLAC
+	{"FLAC",   ITS_COMPRESS_FLAC},
+#endif
+};
+
+static uint32_t check_rand(void)
+{
+	static uint32_t seed = 0x12345678;
+
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static size_t sample_bytes(const song_sample_t *smp)
+{
+	return (size_t) smp->length * ((smp->flags & CHN_16BIT) ? 2 : 1) * ((smp->flags & CHN_STEREO) ? 2 : 1);
+}
+
+/* something that compresses a bit but isn't all that easy: a couple of waves with some noise on top */
+static void make_sample(song_sample_t *smp, int n)
+{
+	size_t i, count;
+
+	memset(smp, 0, sizeof(*smp));
+	snprintf(smp->name, sizeof(smp->name), "%s", sample_defs[n].name);
+	snprintf(smp->filename, sizeof(smp->filename), "smp%d", n);
+	smp->flags = sample_defs[n].flags;
+	smp->length = sample_defs[n].length;
+	smp->c5speed = 8363 << n;
+	smp->volume = 64 * 4;
+	smp->global_volume = 64;
+	smp->data = csf_allocate_sample(sample_bytes(smp));
+	if (!smp->data) {
+		perror("csf_allocate_sample");
+		exit(1);
+	}
+
+	count = smp->length * ((smp->flags & CHN_STEREO) ? 2 : 1);
+	for (i = 0; i < count; i++) {
+		int v = (int) ((i * (n + 3)) % 400) - 200 + (int) ((i * 7) % 64) + (int) (check_rand() % 41) - 20;
+
+		if (smp->flags & CHN_16BIT)
+			((int16_t *) smp->data)[i] = CLAMP(v * 150, INT16_MIN, INT16_MAX);
+		else
+			smp->data[i] = CLAMP(v / 2, INT8_MIN, INT8_MAX);
+	}
+}
+
+static int check_sample(const song_sample_t *orig, const song_sample_t *loaded, const char *what)
+{
+	if (loaded->length != orig->length) {
+		fprintf(stderr, "%s: length %u, should be %u\n", what, loaded->length, orig->length);
+		return 0;
+	}
+	if ((loaded->flags ^ orig->flags) & (CHN_16BIT | CHN_STEREO)) {
+		fprintf(stderr, "%s: flags %#x, should be %#x\n", what,
+			loaded->flags & (CHN_16BIT | CHN_STEREO), orig->flags & (CHN_16BIT | CHN_STEREO));
+		return 0;
+	}
+	if (!loaded->data || memcmp(loaded->data, orig->data, sample_bytes(orig)) != 0) {
+		fprintf(stderr, "%s: sample data doesn't match\n", what);
+		return 0;
+	}
+	return 1;
+}
+
+/* lay them out like the IT saver does, load them back, and compare */
+static int round_trip(song_sample_t *samples, int setting, const char *what)
+{
+	disko_t ds = {0};
+	song_sample_t loaded;
+	char buf[64];
+	int n, ok = 1;
+
+	its_compress_samples = setting;
+	file_len = file_pos = 0;
+
+	for (n = 0; n < NUM_SAMPLES; n++)
+		save_its_header(&ds, samples + n);
+
+	for (n = 0; n < NUM_SAMPLES; n++) {
+		uint32_t op = disko_tell(&ds);
+		uint32_t tmp = bswapLE32(op);
+
+		disko_seek(&ds, n * sizeof(struct it_sample) + 0x48, SEEK_SET);
+		disko_write(&ds, &tmp, 4);
+		disko_seek(&ds, op, SEEK_SET);
+		save_its_data(&ds, samples + n);
+	}
+
+	// and something after the last one, like the IT saver's parapointers
+	disko_write(&ds, "IMPM", 4);
+	if (file_pos != file_len) {
+		fprintf(stderr, "%s: ended up at %lu, but the file is %lu bytes\n", what,
+			(unsigned long) file_pos, (unsigned long) file_len);
+		ok = 0;
+	}
+
+	for (n = 0; n < NUM_SAMPLES; n++) {
+		memset(&loaded, 0, sizeof(loaded));
+		snprintf(buf, sizeof(buf), "%s, %s", what, sample_defs[n].name);
+		if (!load_its_sample(file_buf + n * sizeof(struct it_sample), file_buf, file_len, &loaded)) {
+			fprintf(stderr, "%s: failed to load\n", buf);
+			ok = 0;
+		} else if (!check_sample(samples + n, &loaded, buf)) {
+			ok = 0;
+		}
+		if (loaded.data)
+			csf_free_sample(loaded.data);
+	}
+
+	printf("%-8s %2d samples, %8lu bytes  %s\n", what, NUM_SAMPLES, (unsigned long) file_len,
+		ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main(UNUSED int argc, UNUSED char **argv)
+{
+	song_sample_t samples[NUM_SAMPLES];
+	int n, failed = 0;
+
+	for (n = 0; n < NUM_SAMPLES; n++)
+		make_sample(samples + n, n);
+
+	for (n = 0; n < (int) ARRAY_SIZE(compress_defs); n++)
+		if (!round_trip(samples, compress_defs[n].setting, compress_defs[n].name))
+			failed++;
+
+	for (n = 0; n < NUM_SAMPLES; n++)
+		csf_free_sample(samples[n].data);
+	free(file_buf);
+
+	return failed ? 1 : 0;
+}
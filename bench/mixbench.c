@@ -0,0 +1,362 @@
+/*
+ * Schism Tracker - a cross-platform Impulse Tracker clone
+ * copyright (c) 2003-2005 Storlek <storlek@rigelseven.com>
+ * copyright (c) 2005-2008 Mrs. Brisby <mrs.brisby@nimh.org>
+ * copyright (c) 2009 Storlek & Mrs. Brisby
+ * copyright (c) 2010-2012 Storlek
+ * URL: http://schismtracker.org/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Mixer benchmark ("make bench").
+
+This links against the player only, and measures two things:
+
+  - each of the mixing routines, by setting up a bunch of synthetic voices that
+    select that routine and running csf_create_stereo_mix on them over and over
+    (reported as voice-frames mixed per second, and how many voices that would
+    be at 44.1kHz in realtime)
+
+  - whole songs through csf_read, for each interpolation mode (reported as the
+    realtime factor). The songs are generated here rather than loaded, so the
+    numbers don't depend on whatever modules happen to be lying around, and this
+    doesn't need the loaders (which drag in the rest of the program).
+
+Everything is deterministic, so the numbers are comparable between runs and
+between builds as long as they're taken on the same machine. */
+
+#include "headers.h"
+
+#include "it.h"
+#include "song.h"
+#include "disko.h"
+#include "log.h"
+#include "player/sndfile.h"
+#include "player/cmixer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* --------------------------------------------------------------------- */
+/* the parts of the rest of the program that the player wants to see */
+
+struct tracker_status status;
+struct audio_settings audio_settings;
+
+void song_init_eq(song_t *csf, int do_reset, uint32_t mix_freq)
+{
+	uint32_t pg[4] = {0, 0, 0, 0};
+	uint32_t pf[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		pf[i] = 120 + ((i * 128) * (mix_freq / 128) / 1024);
+	set_eq_gains(csf, pg, 4, pf, do_reset, mix_freq);
+}
+
+void log_appendf(UNUSED int color, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+/* only used for saving samples */
+void disko_write(UNUSED disko_t *ds, UNUSED const void *buf, UNUSED size_t len)
+{
+}
+
+void disko_putc(UNUSED disko_t *ds, UNUSED int c)
+{
+}
+
+/* --------------------------------------------------------------------- */
+
+#define BENCH_RATE 44100
+#define BENCH_SAMPLE_LENGTH 65536
+
+static double bench_seconds = 1.0;
+
+static double get_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/* dumb LCG, so that the test data is the same every time */
+static uint32_t bench_rand_state = 1;
+
+static uint32_t bench_rand(void)
+{
+	bench_rand_state = bench_rand_state * 1103515245 + 12345;
+	return bench_rand_state >> 8;
+}
+
+/* a looped sine-ish thing with some noise on top, so the interpolators have
+something to chew on. stereo samples are interleaved, as usual. */
+static signed char *make_sample_data(int bits, int channels)
+{
+	uint32_t n, len = BENCH_SAMPLE_LENGTH * channels;
+	signed char *data = csf_allocate_sample(len * (bits / 8));
+
+	for (n = 0; n < len; n++) {
+		int v = ((int) ((n / channels) & 255) - 128) * 200 + (int) (bench_rand() & 4095) - 2048;
+		if (bits == 16)
+			((int16_t *) data)[n] = v;
+		else
+			data[n] = v >> 8;
+	}
+	return data;
+}
+
+/* --------------------------------------------------------------------- */
+/* mixing routines */
+
+static const char *srcmode_names[] = {"nearest", "linear", "spline", "polyphase"};
+
+static void setup_voice(song_voice_t *v, signed char *data, uint32_t flags, int fast, int ramp, int filter, int n)
+{
+	memset(v, 0, sizeof(*v));
+	v->current_sample_data = data;
+	v->flags = flags | CHN_LOOP | (filter ? CHN_FILTER : 0);
+	v->length = v->loop_end = BENCH_SAMPLE_LENGTH;
+	v->loop_start = 0;
+	v->position = (n * 997) % (BENCH_SAMPLE_LENGTH / 2);
+	/* spread the pitches around a bit, roughly C-4 to C-6 */
+	v->increment = 0x8000 + (n * 0x1234) % 0x18000;
+	v->left_volume = 2048;
+	v->right_volume = fast ? 2048 : 1024;
+	if (ramp) {
+		v->ramp_length = MIXBUFFERSIZE;
+		v->left_ramp = v->right_ramp = fast ? 4 : 3;
+		if (!fast)
+			v->right_ramp = -2;
+		v->left_ramp_volume = v->left_volume << VOLUMERAMPPRECISION;
+		v->right_ramp_volume = v->right_volume << VOLUMERAMPPRECISION;
+		v->left_volume_new = v->left_volume;
+		v->right_volume_new = v->right_volume;
+	}
+	if (filter) {
+		v->filter_a0 = 3000;
+		v->filter_b0 = 5000;
+		v->filter_b1 = -1800;
+	}
+}
+
+/* returns voice-frames per second */
+static double bench_mix_routine(song_t *csf, signed char *data, uint32_t flags, int fast, int ramp, int filter,
+	int num_voices)
+{
+	double start, elapsed;
+	unsigned long frames = 0;
+	int n;
+
+	csf->num_voices = num_voices;
+	for (n = 0; n < num_voices; n++) {
+		csf->voice_mix[n] = n;
+		setup_voice(csf->voices + n, data, flags, fast, ramp, filter, n);
+	}
+
+	start = get_time();
+	do {
+		int iter;
+		for (iter = 0; iter < 16; iter++) {
+			if (ramp) {
+				/* the mixer uses up the ramp as it goes */
+				for (n = 0; n < num_voices; n++)
+					setup_voice(csf->voices + n, data, flags, fast, ramp, filter, n);
+			}
+			memset(csf->mix_buffer, 0, sizeof(csf->mix_buffer));
+			csf_create_stereo_mix(csf, MIXBUFFERSIZE);
+			frames += MIXBUFFERSIZE;
+		}
+		elapsed = get_time() - start;
+	} while (elapsed < bench_seconds / 8);
+
+	return frames * (double) num_voices / elapsed;
+}
+
+static void bench_mix_routines(int num_voices)
+{
+	song_t *csf = csf_allocate();
+	signed char *data[2][2];
+	int mode, bits, stereo, ramp, filter, fast;
+
+	for (bits = 0; bits < 2; bits++)
+		for (stereo = 0; stereo < 2; stereo++)
+			data[bits][stereo] = make_sample_data(bits ? 16 : 8, stereo ? 2 : 1);
+
+	/* the voice limit doesn't apply when writing to disk */
+	csf->mix_flags |= SNDMIX_DIRECTTODISK;
+	csf_set_wave_config(csf, BENCH_RATE, 16, 2);
+
+	printf("Mixing routines (%d voices, %d Hz)\n", num_voices, BENCH_RATE);
+	printf("%-10s %-13s %-5s %-7s %-5s %12s %10s\n",
+		"Interp", "Format", "Ramp", "Filter", "Fast", "Mvoice-fr/s", "Voices");
+	for (mode = SRCMODE_NEAREST; mode <= SRCMODE_POLYPHASE; mode++) {
+		csf_set_resampling_mode(csf, mode);
+		for (bits = 0; bits < 2; bits++)
+		for (stereo = 0; stereo < 2; stereo++)
+		for (filter = 0; filter < 2; filter++)
+		for (ramp = 0; ramp < 2; ramp++)
+		for (fast = 0; fast < 2; fast++) {
+			double rate;
+			char fmt[24];
+
+			/* the mixer only has "fast" (equal left/right volume) versions of the
+			unfiltered mono routines */
+			if (fast && (stereo || filter))
+				continue;
+
+			rate = bench_mix_routine(csf, data[bits][stereo],
+				(bits ? CHN_16BIT : 0) | (stereo ? CHN_STEREO : 0),
+				fast, ramp, filter, num_voices);
+			snprintf(fmt, sizeof(fmt), "%d-bit %s", bits ? 16 : 8, stereo ? "stereo" : "mono");
+			printf("%-10s %-13s %-5s %-7s %-5s %12.2f %10.0f\n",
+				srcmode_names[mode], fmt, ramp ? "yes" : "no", filter ? "yes" : "no",
+				fast ? "yes" : "no", rate / 1000000.0, rate / BENCH_RATE);
+		}
+	}
+	printf("\n");
+
+	/* the sample data gets freed along with the song, so don't leave it in the voices */
+	memset(csf->voices, 0, sizeof(csf->voices));
+	csf->num_voices = 0;
+	for (bits = 0; bits < 2; bits++)
+		for (stereo = 0; stereo < 2; stereo++)
+			csf_free_sample(data[bits][stereo]);
+	csf_free(csf);
+}
+
+/* --------------------------------------------------------------------- */
+/* whole songs */
+
+/* Makes a song with 'num_channels' channels going full blast: 16-bit looped samples,
+mono and stereo, a new note every few rows, and some vibrato and volume slides to keep
+the effect processing honest. */
+static song_t *make_song(int num_channels)
+{
+	song_t *csf = csf_allocate();
+	song_note_t *note;
+	int n, row, chan;
+
+	for (n = 1; n <= 4; n++) {
+		song_sample_t *smp = csf->samples + n;
+		int stereo = (n & 1) == 0;
+
+		smp->data = make_sample_data(16, stereo ? 2 : 1);
+		smp->length = smp->loop_end = BENCH_SAMPLE_LENGTH;
+		smp->loop_start = 0;
+		smp->flags = CHN_16BIT | CHN_LOOP | (stereo ? CHN_STEREO : 0);
+		smp->c5speed = 22050 + n * 4000;
+		snprintf(smp->name, sizeof(smp->name), "bench %d", n);
+	}
+
+	csf->patterns[0] = csf_allocate_pattern(64);
+	csf->pattern_size[0] = csf->pattern_alloc_size[0] = 64;
+	csf->orderlist[0] = 0;
+	csf->orderlist[1] = ORDER_LAST;
+
+	for (row = 0; row < 64; row++) {
+		for (chan = 0; chan < num_channels; chan++) {
+			note = csf->patterns[0] + row * MAX_CHANNELS + chan;
+			if ((row + chan) % 8 == 0) {
+				note->note = NOTE_FIRST + 36 + (chan * 7 + row) % 36;
+				note->instrument = 1 + chan % 4;
+				note->voleffect = VOLFX_VOLUME;
+				note->volparam = 32 + chan % 32;
+			} else if (chan % 3 == 0) {
+				note->effect = FX_VIBRATO;
+				note->param = 0x44;
+			} else if (chan % 3 == 1) {
+				note->effect = FX_VOLUMESLIDE;
+				note->param = (row & 8) ? 0x01 : 0x10;
+			}
+		}
+		for (chan = 0; chan < num_channels; chan++)
+			csf->channels[chan].panning = (chan * 256 / num_channels) & 0xff;
+	}
+
+	csf_set_wave_config(csf, BENCH_RATE, 16, 2);
+	csf->mix_flags |= SNDMIX_DIRECTTODISK;
+	csf->stop_at_order = csf->stop_at_row = -1;
+	csf_set_current_order(csf, 0);
+	return csf;
+}
+
+static void bench_songs(void)
+{
+	static const int channel_counts[] = {8, 32, 64};
+	uint8_t buf[MIXBUFFERSIZE * 4];
+	int mode, n;
+
+	printf("Songs (csf_read, %d Hz 16-bit stereo)\n", BENCH_RATE);
+	printf("%-10s %8s %12s %10s\n", "Interp", "Channels", "Voices", "Realtime");
+	for (n = 0; n < ARRAY_SIZE(channel_counts); n++) {
+		for (mode = SRCMODE_NEAREST; mode <= SRCMODE_POLYPHASE; mode++) {
+			song_t *csf = make_song(channel_counts[n]);
+			unsigned long frames = 0, voices = 0, reads = 0;
+			double start, elapsed;
+
+			csf_set_resampling_mode(csf, mode);
+			start = get_time();
+			do {
+				int iter;
+				for (iter = 0; iter < 64; iter++) {
+					frames += csf_read(csf, buf, sizeof(buf));
+					voices += csf->num_voices;
+					reads++;
+				}
+				elapsed = get_time() - start;
+			} while (elapsed < bench_seconds);
+
+			printf("%-10s %8d %12.1f %9.1fx\n", srcmode_names[mode], channel_counts[n],
+				(double) voices / reads, frames / (double) BENCH_RATE / elapsed);
+			csf_free(csf);
+		}
+	}
+	printf("\n");
+}
+
+/* --------------------------------------------------------------------- */
+
+int main(int argc, char **argv)
+{
+	int num_voices = 64;
+
+	if (argc > 1 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+		printf("Usage: %s [SECONDS [VOICES]]\n", argv[0]);
+		printf("Runs each test for about SECONDS (default 1), mixing VOICES voices (default 64).\n");
+		return 0;
+	}
+	if (argc > 1)
+		bench_seconds = CLAMP(atof(argv[1]), 0.05, 60.0);
+	if (argc > 2)
+		num_voices = CLAMP(atoi(argv[2]), 1, MAX_VOICES);
+
+	max_voices = MAX_VOICES;
+	csf_init_mixer();
+	bench_mix_routines(num_voices);
+	bench_songs();
+	return 0;
+}
@@ -47,6 +47,8 @@ SCHISM_BINARY_STRUCT(struct header_669, 2+108+1+1+1+128+128+128);
 
 #pragma pack(pop)
 
+const struct fmt_probe fmt_669_probe = {sizeof(struct header_669), 0};
+
 int fmt_669_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	struct header_669 *header = (struct header_669 *) data;
@@ -302,8 +302,14 @@ static int _read_iff(dmoz_file_t *file, song_sample_t *smp, const uint8_t *data,
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_aiff_probe = {65536, 0};
+
 int fmt_aiff_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
+	/* the sample body tends to come before the name, so there's no getting around reading all of it */
+	if (length < file->filesize && length >= 12 && memcmp(data, "FORM", 4) == 0
+	    && (memcmp(data + 8, "8SVX", 4) == 0 || memcmp(data + 8, "AIFF", 4) == 0))
+		return FMT_INFO_NEED_ALL;
 	return _read_iff(file, NULL, data, length);
 }
 
@@ -318,10 +324,11 @@ struct aiff_writedata {
 	long comm_frames, ssnd_size; // seek positions for writing header data
 	size_t numbytes; // how many bytes have been written
 	int bps; // bytes per sample
-	int swap; // should be byteswapped?
+	int swap; // if nonzero, byteswap samples of this many bytes
 };
 
-static int aiff_header(disko_t *fp, int bits, int channels, int rate,
+/* with is_float, this writes an AIFF-C file instead (plain AIFF can only hold integers) */
+static int aiff_header(disko_t *fp, int bits, int channels, int rate, int is_float,
 	const char *name, size_t length, struct aiff_writedata *awd /* out */)
 {
 	int16_t s;
@@ -333,7 +340,16 @@ static int aiff_header(disko_t *fp, int bits, int channels, int rate,
 	/* note: channel multiply is done below -- need single-channel value for the COMM chunk */
 
 	/* write a very large size for now */
-	disko_write(fp, "FORM\377\377\377\377AIFF", 12);
+	disko_write(fp, is_float ? "FORM\377\377\377\377AIFC" : "FORM\377\377\377\377AIFF", 12);
+
+	if (is_float) {
+		/* Format Version Chunk: there's only ever been the one version */
+		disko_write(fp, "FVER", 4);
+		ul = bswapBE32(4);
+		disko_write(fp, &ul, 4);
+		ul = bswapBE32(0xA2805140);
+		disko_write(fp, &ul, 4);
+	}
 
 	if (name && *name) {
 		disko_write(fp, "NAME", 4);
@@ -357,7 +373,7 @@ static int aiff_header(disko_t *fp, int bits, int channels, int rate,
 		extended        sampleRate;
 	} CommonChunk; */
 	disko_write(fp, "COMM", 4);
-	ul = bswapBE32(18); /* chunk size -- won't change */
+	ul = bswapBE32(is_float ? 18 + 4 + 10 : 18); /* chunk size -- won't change */
 	disko_write(fp, &ul, 4);
 	s = bswapBE16(channels);
 	disko_write(fp, &s, 2);
@@ -369,6 +385,10 @@ static int aiff_header(disko_t *fp, int bits, int channels, int rate,
 	disko_write(fp, &s, 2);
 	ConvertToIeeeExtended(rate, b);
 	disko_write(fp, b, 10);
+	if (is_float) {
+		/* compression type, then its name as a pascal string (padded to even length) */
+		disko_write(fp, "fl32\010Float 32\0", 14);
+	}
 
 	/* NOW do this (sample size in AIFF is indicated per channel, not per frame) */
 	bps *= channels; /* == number of bytes per (stereo) sample */
@@ -405,7 +425,7 @@ int fmt_aiff_save_sample(disko_t *fp, song_sample_t *smp)
 	flags |= (smp->flags & CHN_STEREO) ? SF_SI : SF_M;
 
 	bps = aiff_header(fp, (smp->flags & CHN_16BIT) ? 16 : 8, (smp->flags & CHN_STEREO) ? 2 : 1,
-		smp->c5speed, smp->name, smp->length, NULL);
+		smp->c5speed, 0, smp->name, smp->length, NULL);
 
 	if (csf_write_sample(fp, smp, flags, UINT32_MAX) != smp->length * bps) {
 		log_appendf(4, "AIFF: unexpected data size written");
@@ -424,18 +444,18 @@ int fmt_aiff_save_sample(disko_t *fp, song_sample_t *smp)
 }
 
 
-int fmt_aiff_export_head(disko_t *fp, int bits, int channels, int rate)
+int fmt_aiff_export_head(disko_t *fp, int bits, int channels, int rate, int is_float)
 {
 	struct aiff_writedata *awd = malloc(sizeof(struct aiff_writedata));
 	if (!awd)
 		return DW_ERROR;
 	fp->userdata = awd;
-	awd->bps = aiff_header(fp, bits, channels, rate, NULL, ~0, awd);
+	awd->bps = aiff_header(fp, bits, channels, rate, is_float, NULL, ~0, awd);
 	awd->numbytes = 0;
 #if WORDS_BIGENDIAN
 	awd->swap = 0;
 #else
-	awd->swap = (bits > 8);
+	awd->swap = (bits > 8) ? (bits + 7) / 8 : 0;
 #endif
 
 	return DW_OK;
@@ -453,16 +473,7 @@ int fmt_aiff_export_body(disko_t *fp, const uint8_t *data, size_t length)
 	awd->numbytes += length;
 
 	if (awd->swap) {
-		const int16_t *ptr = (const int16_t *) data;
-		uint16_t v;
-
-		length /= 2;
-		while (length--) {
-			v = *ptr;
-			v = bswapBE16(v);
-			disko_write(fp, &v, 2);
-			ptr++;
-		}
+		disko_write_swapped(fp, data, length, awd->swap);
 	} else {
 		disko_write(fp, data, length);
 	}
@@ -32,6 +32,8 @@ I don't know what this data's supposed to be for :) */
 
 /* btw: AMS stands for "Advanced Module System" */
 
+const struct fmt_probe fmt_ams_probe = {64, 0};
+
 int fmt_ams_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	uint8_t n;
@@ -50,9 +50,12 @@ SCHISM_BINARY_STRUCT(struct au_header, 4+4+4+4+4+4);
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_au_probe = {1024, 0};
+
 int fmt_au_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	struct au_header au;
+	size_t total;
 
 	if (!(length > 24 && memcmp(data, ".snd", 4) == 0))
 		return 0;
@@ -64,7 +67,9 @@ int fmt_au_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 	au.sample_rate = bswapBE32(au.sample_rate);
 	au.channels = bswapBE32(au.channels);
 
-	if (!(au.data_offset < length && au.data_size > 0 && au.data_size <= length - au.data_offset))
+	/* only the header is here, so check the sizes against the whole file */
+	total = MAX(length, file->filesize);
+	if (!(au.data_offset < total && au.data_size > 0 && au.data_size <= total - au.data_offset))
 		return 0;
 
 	file->smp_length = au.data_size / au.channels;
@@ -84,7 +89,7 @@ int fmt_au_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 	}
 	file->description = "AU Sample";
 	if (au.data_offset > 24) {
-		int extlen = au.data_offset - 24;
+		int extlen = MIN(au.data_offset, length) - 24;
 
 		file->title = strn_dup((const char *)data + 24, extlen);
 	}
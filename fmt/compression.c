@@ -22,29 +22,64 @@
  */
 
 #include "headers.h"
+#include "bswap.h"
 #include "fmt.h"
 
 // ------------------------------------------------------------------------------------------------------------
 // IT decompression code from itsex.c (Cubic Player) and load_it.cpp (Modplug)
 // (I suppose this could be considered a merge between the two.)
 
-static uint32_t it_readbits(int8_t n, uint32_t *bitbuf, uint32_t *bitnum, const uint8_t **ibuf)
+// The bits are read least significant first, through a 64-bit buffer that gets topped up a whole word at a
+// time (or a byte at a time, near the end of the data). Bytes that are past the end of the data read as 0.
+struct it_bitreader {
+	const uint8_t *pos, *end;
+	uint64_t buf;
+	int bits;               // how many of the bits in buf haven't been read yet
+};
+
+static void it_bitreader_init(struct it_bitreader *br, const uint8_t *pos, const uint8_t *end)
 {
-	uint32_t value = 0;
-	uint32_t i = n;
-
-	// this could be better
-	while (i--) {
-		if (!*bitnum) {
-			*bitbuf = *(*ibuf)++;
-			*bitnum = 8;
+	br->pos = pos;
+	br->end = end;
+	br->buf = 0;
+	br->bits = 0;
+}
+
+static inline void it_refill(struct it_bitreader *br)
+{
+	if (br->end - br->pos >= 8) {
+		uint32_t lo, hi;
+
+		memcpy(&lo, br->pos, 4);
+		memcpy(&hi, br->pos + 4, 4);
+		br->buf |= ((uint64_t) bswapLE32(hi) << 32 | bswapLE32(lo)) << br->bits;
+		// only whole bytes count; the rest of the word gets loaded again (to the same place) next time
+		br->pos += (63 - br->bits) >> 3;
+		br->bits |= 56;
+	} else {
+		while (br->bits <= 56 && br->pos < br->end) {
+			br->buf |= (uint64_t) *br->pos++ << br->bits;
+			br->bits += 8;
 		}
-		value >>= 1;
-		value |= (*bitbuf) << 31;
-		(*bitbuf) >>= 1;
-		(*bitnum)--;
 	}
-	return value >> (32 - n);
+}
+
+static inline uint32_t it_readbits(struct it_bitreader *br, int n)
+{
+	uint32_t value;
+
+	if (br->bits < n)
+		it_refill(br);
+	value = br->buf & ((1 << n) - 1);
+	br->buf >>= n;
+	br->bits = (br->bits > n) ? br->bits - n : 0;
+	return value;
+}
+
+// where the reader's up to, counting a partially read byte as read
+static inline const uint8_t *it_bitreader_tell(struct it_bitreader *br)
+{
+	return br->pos - (br->bits >> 3);
 }
 
 
@@ -59,7 +94,7 @@ uint32_t it_decompress8(void *dest, uint32_t len, const void *file, uint32_t fil
 	uint16_t value;                 // value read from file to be processed
 	int8_t d1, d2;                  // integrator buffers (d2 for it2.15)
 	int8_t v;                       // sample value
-	uint32_t bitbuf, bitnum;        // state for it_readbits
+	struct it_bitreader br;
 
 	filebuf = srcbuf = (const uint8_t *) file;
 	destpos = (int8_t *) dest;
@@ -74,7 +109,8 @@ uint32_t it_decompress8(void *dest, uint32_t len, const void *file, uint32_t fil
 			return srcbuf - filebuf;
 		}
 		srcbuf += 2;
-		bitbuf = bitnum = 0;
+		// (the size isn't actually used to find the next block; that just picks up after this one.)
+		it_bitreader_init(&br, srcbuf, filebuf + filelen);
 
 		blklen = MIN(0x8000, len);
 		blkpos = 0;
@@ -87,16 +123,16 @@ uint32_t it_decompress8(void *dest, uint32_t len, const void *file, uint32_t fil
 			if (width > 9) {
 				// illegal width, abort
 				printf("Illegal bit width %d for 8-bit sample\n", width);
-				return srcbuf - filebuf;
+				return it_bitreader_tell(&br) - filebuf;
 			}
-			value = it_readbits(width, &bitbuf, &bitnum, &srcbuf);
+			value = it_readbits(&br, width);
 
 			if (width < 7) {
 				// method 1 (1-6 bits)
 				// check for "100..."
 				if (value == 1 << (width - 1)) {
 					// yes!
-					value = it_readbits(3, &bitbuf, &bitnum, &srcbuf) + 1; // read new width
+					value = it_readbits(&br, 3) + 1; // read new width
 					width = (value < width) ? value : value + 1; // and expand it
 					continue; // ... next value
 				}
@@ -138,6 +174,7 @@ uint32_t it_decompress8(void *dest, uint32_t len, const void *file, uint32_t fil
 
 		// now subtract block length from total length and go on
 		len -= blklen;
+		srcbuf = it_bitreader_tell(&br);
 	}
 	return srcbuf - filebuf;
 }
@@ -154,7 +191,7 @@ uint32_t it_decompress16(void *dest, uint32_t len, const void *file, uint32_t fi
 	uint32_t value;                 // value read from file to be processed
 	int16_t d1, d2;                 // integrator buffers (d2 for it2.15)
 	int16_t v;                      // sample value
-	uint32_t bitbuf, bitnum;        // state for it_readbits
+	struct it_bitreader br;
 
 	filebuf = srcbuf = (const uint8_t *) file;
 	destpos = (int16_t *) dest;
@@ -169,8 +206,7 @@ uint32_t it_decompress16(void *dest, uint32_t len, const void *file, uint32_t fi
 			return srcbuf - filebuf;
 		}
 		srcbuf += 2;
-
-		bitbuf = bitnum = 0;
+		it_bitreader_init(&br, srcbuf, filebuf + filelen);
 
 		blklen = MIN(0x4000, len); // 0x4000 samples => 0x8000 bytes again
 		blkpos = 0;
@@ -183,16 +219,16 @@ uint32_t it_decompress16(void *dest, uint32_t len, const void *file, uint32_t fi
 			if (width > 17) {
 				// illegal width, abort
 				printf("Illegal bit width %d for 16-bit sample\n", width);
-				return srcbuf - filebuf;
+				return it_bitreader_tell(&br) - filebuf;
 			}
-			value = it_readbits(width, &bitbuf, &bitnum, &srcbuf);
+			value = it_readbits(&br, width);
 
 			if (width < 7) {
 				// method 1 (1-6 bits)
 				// check for "100..."
 				if (value == (uint32_t) 1 << (width - 1)) {
 					// yes!
-					value = it_readbits(4, &bitbuf, &bitnum, &srcbuf) + 1; // read new width
+					value = it_readbits(&br, 4) + 1; // read new width
 					width = (value < width) ? value : value + 1; // and expand it
 					continue; // ... next value
 				}
@@ -234,10 +270,252 @@ uint32_t it_decompress16(void *dest, uint32_t len, const void *file, uint32_t fi
 
 		// now subtract block length from total length and go on
 		len -= blklen;
+		srcbuf = it_bitreader_tell(&br);
 	}
 	return srcbuf - filebuf;
 }
 
+// ------------------------------------------------------------------------------------------------------------
+// IT compression -- the inverse of the above.
+//
+// Every value in a block is written at the current bit width, and switching to another width costs a
+// marker value (plus a few more bits below width 7). Rather than guessing at when to switch, this finds the
+// cheapest sequence of widths for the whole block: for each sample, the cheapest way to arrive at each width
+// is either to have already been there, or to switch from whichever width was cheapest to switch away from.
+// That's a couple of passes over 9 or 17 widths per sample. Staying at the starting width is one of the
+// options, so a block can never come out bigger than 9 (or 17) bits a sample, and its size always fits in
+// the 16-bit block header.
+
+#define IT_PACK_INF 0x7fffffff
+
+struct it_packer {
+	int is16;
+	int maxwidth;           // 9 or 17; the starting width for every block
+	int lo[18], hi[18];     // range of values that can be stored at each width
+	int change_cost[18];    // bits taken by switching away from each width
+	int *values;            // deltas for the current block
+	uint8_t *from;          // width before each sample, for each width it might have been stored at
+	uint8_t *out;           // compressed block, including the size
+	uint32_t bitbuf;
+	int bitnum;
+	uint32_t outpos;
+};
+
+static void it_packer_init(struct it_packer *p, int is16, uint32_t blocklen)
+{
+	int w;
+
+	p->is16 = is16;
+	p->maxwidth = is16 ? 17 : 9;
+	for (w = 1; w <= p->maxwidth; w++) {
+		if (w == p->maxwidth) {
+			// anything goes, and bit 8/16 (which is always clear) marks a width change
+			p->lo[w] = is16 ? INT16_MIN : INT8_MIN;
+			p->hi[w] = is16 ? INT16_MAX : INT8_MAX;
+			p->change_cost[w] = w;
+		} else if (w < 7) {
+			// "100..." is the width change marker, and is followed by the new width
+			p->lo[w] = -((1 << (w - 1)) - 1);
+			p->hi[w] = (1 << (w - 1)) - 1;
+			p->change_cost[w] = w + (is16 ? 4 : 3);
+		} else {
+			// the 8 (or 16) values around the top of the range are the width change markers
+			p->lo[w] = -(1 << (w - 1)) + (is16 ? 8 : 4);
+			p->hi[w] = (1 << (w - 1)) - (is16 ? 9 : 5);
+			p->change_cost[w] = w;
+		}
+	}
+	p->values = mem_alloc(blocklen * sizeof(int));
+	p->from = mem_alloc(blocklen * (p->maxwidth + 1));
+	p->out = mem_alloc(2 + blocklen * 3);
+}
+
+static void it_packer_free(struct it_packer *p)
+{
+	free(p->values);
+	free(p->from);
+	free(p->out);
+}
+
+static void it_writebits(struct it_packer *p, uint32_t value, int n)
+{
+	p->bitbuf |= (value & ((1 << n) - 1)) << p->bitnum;
+	p->bitnum += n;
+	while (p->bitnum >= 8) {
+		p->out[p->outpos++] = p->bitbuf & 0xff;
+		p->bitbuf >>= 8;
+		p->bitnum -= 8;
+	}
+}
+
+static void it_write_width_change(struct it_packer *p, int width, int newwidth)
+{
+	// the new width is stored as 1-8 (or 1-16), skipping over the current one
+	int x = (newwidth < width) ? newwidth : newwidth - 1;
+
+	if (width < 7) {
+		it_writebits(p, 1 << (width - 1), width);
+		it_writebits(p, x - 1, p->is16 ? 4 : 3);
+	} else if (width < p->maxwidth) {
+		uint32_t border = (p->is16 ? (0xFFFF >> (17 - width)) - 8 : (0xFF >> (9 - width)) - 4);
+		it_writebits(p, border + x, width);
+	} else {
+		it_writebits(p, (1 << (width - 1)) | (newwidth - 1), width);
+	}
+}
+
+// compress p->values[0..n-1] into p->out; returns the size of the block, including the 2-byte header
+static uint32_t it_pack_block(struct it_packer *p, uint32_t n)
+{
+	int cost[18], newcost[18];
+	int maxw = p->maxwidth;
+	int w, best, bestw, second, secondw, c, v;
+	uint32_t i;
+	uint8_t *from;
+
+	for (w = 1; w <= maxw; w++)
+		cost[w] = IT_PACK_INF;
+	cost[maxw] = 0;
+
+	for (i = 0; i < n; i++) {
+		v = p->values[i];
+		from = p->from + i * (maxw + 1);
+
+		// the cheapest and second-cheapest widths to switch away from (the second is needed in case
+		// the cheapest is the width being switched to)
+		best = second = IT_PACK_INF;
+		bestw = secondw = 0;
+		for (w = 1; w <= maxw; w++) {
+			if (cost[w] == IT_PACK_INF)
+				continue;
+			c = cost[w] + p->change_cost[w];
+			if (c < best) {
+				second = best;
+				secondw = bestw;
+				best = c;
+				bestw = w;
+			} else if (c < second) {
+				second = c;
+				secondw = w;
+			}
+		}
+
+		for (w = 1; w <= maxw; w++) {
+			if (v < p->lo[w] || v > p->hi[w]) {
+				newcost[w] = IT_PACK_INF;
+				continue;
+			}
+			c = cost[w];
+			from[w] = w;
+			if (bestw != w && best < c) {
+				c = best;
+				from[w] = bestw;
+			} else if (bestw == w && second < c) {
+				c = second;
+				from[w] = secondw;
+			}
+			newcost[w] = c + w;
+		}
+		memcpy(cost, newcost, sizeof(cost));
+	}
+
+	// walk back through the cheapest path, leaving the width that each value is stored at in from[0]
+	best = IT_PACK_INF;
+	bestw = maxw;
+	for (w = 1; w <= maxw; w++) {
+		if (cost[w] < best) {
+			best = cost[w];
+			bestw = w;
+		}
+	}
+	for (i = n; i-- > 0;) {
+		from = p->from + i * (maxw + 1);
+		w = from[bestw];
+		from[0] = bestw;
+		bestw = w;
+	}
+
+	p->bitbuf = 0;
+	p->bitnum = 0;
+	p->outpos = 2;
+	w = maxw;
+	for (i = 0; i < n; i++) {
+		int neww = p->from[i * (maxw + 1)];
+		if (neww != w) {
+			it_write_width_change(p, w, neww);
+			w = neww;
+		}
+		it_writebits(p, (uint32_t) p->values[i], w == maxw ? maxw - 1 : w);
+		if (w == maxw)
+			it_writebits(p, 0, 1);
+	}
+	if (p->bitnum)
+		p->out[p->outpos++] = p->bitbuf & 0xff;
+
+	p->out[0] = (p->outpos - 2) & 0xff;
+	p->out[1] = (p->outpos - 2) >> 8;
+	return p->outpos;
+}
+
+uint32_t it_compress8(disko_t *fp, const void *data, uint32_t len, int it215, int channels)
+{
+	const int8_t *srcpos = (const int8_t *) data;
+	struct it_packer p;
+	uint32_t blklen, i, total = 0;
+	int8_t d1, d2, v, s, prev;
+
+	it_packer_init(&p, 0, MIN(0x8000, len));
+	while (len) {
+		blklen = MIN(0x8000, len);
+		prev = d1 = 0;
+		for (i = 0; i < blklen; i++) {
+			s = *srcpos;
+			srcpos += channels;
+			// undo the integration that it_decompress8 does
+			d2 = s - prev;
+			v = it215 ? (int8_t) (d2 - d1) : d2;
+			prev = s;
+			d1 = d2;
+			p.values[i] = v;
+		}
+		i = it_pack_block(&p, blklen);
+		disko_write(fp, p.out, i);
+		total += i;
+		len -= blklen;
+	}
+	it_packer_free(&p);
+	return total;
+}
+
+uint32_t it_compress16(disko_t *fp, const void *data, uint32_t len, int it215, int channels)
+{
+	const int16_t *srcpos = (const int16_t *) data;
+	struct it_packer p;
+	uint32_t blklen, i, total = 0;
+	int16_t d1, d2, v, s, prev;
+
+	it_packer_init(&p, 1, MIN(0x4000, len));
+	while (len) {
+		blklen = MIN(0x4000, len);
+		prev = d1 = 0;
+		for (i = 0; i < blklen; i++) {
+			s = *srcpos;
+			srcpos += channels;
+			d2 = s - prev;
+			v = it215 ? (int16_t) (d2 - d1) : d2;
+			prev = s;
+			d1 = d2;
+			p.values[i] = v;
+		}
+		i = it_pack_block(&p, blklen);
+		disko_write(fp, p.out, i);
+		total += i;
+		len -= blklen;
+	}
+	it_packer_free(&p);
+	return total;
+}
+
 // ------------------------------------------------------------------------------------------------------------
 // MDL sample decompression
 
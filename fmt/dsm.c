@@ -118,6 +118,8 @@ static int _chunk_read(chunk_t *chunk, const uint8_t *data, size_t length, size_
 	return (*pos <= length);
 }
 
+const struct fmt_probe fmt_dsm_probe = {64, 0};
+
 int fmt_dsm_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	uint8_t riff[4], dsmf[4];
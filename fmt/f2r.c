@@ -28,6 +28,8 @@
 
 /* TODO: test this code */
 
+const struct fmt_probe fmt_f2r_probe = {64, 0};
+
 int fmt_f2r_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 46 && memcmp(data, "F2R", 3) == 0))
@@ -30,6 +30,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_far_probe = {64, 0};
+
 int fmt_far_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	/* The magic for this format is truly weird (which I suppose is good, as the chance of it
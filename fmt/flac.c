@@ -252,12 +252,16 @@ static int flac_load(struct flac_file* flac_file, int meta_only) {
 			flac_file
 		);
 
-	if (meta_only) {
-		if (!FLAC__stream_decoder_process_until_end_of_metadata(decoder))
-			FLAC_ERROR(0);
-	} else {
-		if (!FLAC__stream_decoder_process_until_end_of_stream(decoder))
+	if (!FLAC__stream_decoder_process_until_end_of_metadata(decoder))
+		FLAC_ERROR(0);
+	/* stop as soon as we've got all the samples, rather than at the end of the data; when the stream is
+	embedded in something else (e.g. an IT file), whatever comes after it would just look like garbage */
+	while (!meta_only && flac_file->uncompressed.samples_decoded
+			< flac_file->streaminfo.total_samples * flac_file->streaminfo.channels) {
+		if (!FLAC__stream_decoder_process_single(decoder))
 			FLAC_ERROR(0);
+		if (FLAC__stream_decoder_get_state(decoder) == FLAC__STREAM_DECODER_END_OF_STREAM)
+			break;
 	}
 
 	FLAC__stream_decoder_finish(decoder);
@@ -309,6 +313,36 @@ int fmt_flac_load_sample(const uint8_t *data, size_t len, song_sample_t *smp) {
 	return ret;
 }
 
+/* For FLAC streams stored inside other formats (FLAC-compressed samples in IT files): only the sample data
+is read, and everything else about the sample is left alone. The arguments are the same as csf_read_sample's
+so this can go in a song_sample_read_t, but the format is whatever the stream says it is. */
+uint32_t fmt_flac_read_sample_data(song_sample_t *smp, UNUSED uint32_t flags, const void *data, uint32_t length)
+{
+	struct flac_file flac_file = {0};
+	flac_file.compressed.data = data;
+	flac_file.compressed.len = length;
+	flac_file.flags.loop.type = -1;
+
+	if (!flac_load(&flac_file, 0)) {
+		free(flac_file.uncompressed.data);
+		smp->length = 0;
+		return 0;
+	}
+
+	smp->length = flac_file.streaminfo.total_samples;
+
+	uint32_t rflags = SF_LE | SF_PCMS;
+	rflags |= (flac_file.streaminfo.channels == 2) ? SF_SI : SF_M;
+	rflags |= (flac_file.streaminfo.bits_per_sample <= 8) ? SF_8 : SF_16;
+
+	uint32_t ret = csf_read_sample(smp, rflags, flac_file.uncompressed.data, flac_file.uncompressed.len);
+	free(flac_file.uncompressed.data);
+
+	return ret;
+}
+
+const struct fmt_probe fmt_flac_probe = {65536, 0};
+
 int fmt_flac_read_info(dmoz_file_t *file, const uint8_t *data, size_t len)
 {
 	struct flac_file flac_file = {0};
@@ -316,8 +350,12 @@ int fmt_flac_read_info(dmoz_file_t *file, const uint8_t *data, size_t len)
 	flac_file.compressed.len = len;
 	flac_file.flags.loop.type = -1;
 
-	if (!flac_load(&flac_file, 1))
+	if (!flac_load(&flac_file, 1)) {
+		/* the metadata might just be bigger than the probe (embedded cover art, for one) */
+		if (len >= 4 && len < file->filesize && memcmp(data, "fLaC", 4) == 0)
+			return FMT_INFO_NEED_ALL;
 		return 0;
+	}
 
 	file->smp_flags = 0;
 
@@ -357,29 +395,36 @@ int fmt_flac_read_info(dmoz_file_t *file, const uint8_t *data, size_t len)
 struct flac_writedata {
 	FLAC__StreamEncoder *encoder;
 
-	int bits;
+	int bits; // of the incoming data; the file gets at most 24
 	int channels;
+	int is_float;
+
+	disko_t *fp;
+	/* the encoder goes back to rewrite STREAMINFO when it's done, so keep track of where the stream
+	actually ends; anything written after it (e.g. the next sample in an IT file) has to go there */
+	long end;
 };
 
 static FLAC__StreamEncoderWriteStatus write_on_write(const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[],
 	size_t bytes, uint32_t samples, uint32_t current_frame, void *client_data) {
-	disko_t* fp = (disko_t*)client_data;
+	struct flac_writedata *fwd = (struct flac_writedata*)client_data;
 
-	disko_write(fp, buffer, bytes);
+	disko_write(fwd->fp, buffer, bytes);
+	fwd->end = MAX(fwd->end, disko_tell(fwd->fp));
 	return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
 }
 
 static FLAC__StreamEncoderSeekStatus write_on_seek(const FLAC__StreamEncoder *encoder, FLAC__uint64 absolute_byte_offset, void *client_data) {
-	disko_t* fp = (disko_t*)client_data;
+	struct flac_writedata *fwd = (struct flac_writedata*)client_data;
 
-	disko_seek(fp, absolute_byte_offset, SEEK_SET);
+	disko_seek(fwd->fp, absolute_byte_offset, SEEK_SET);
 	return FLAC__STREAM_ENCODER_SEEK_STATUS_OK;
 }
 
 static FLAC__StreamEncoderTellStatus write_on_tell(const FLAC__StreamEncoder *encoder, FLAC__uint64 *absolute_byte_offset, void *client_data) {
-	disko_t* fp = (disko_t*)client_data;
+	struct flac_writedata *fwd = (struct flac_writedata*)client_data;
 
-	long b = disko_tell(fp);
+	long b = disko_tell(fwd->fp);
 	if (b < 0)
 		return FLAC__STREAM_ENCODER_TELL_STATUS_ERROR;
 
@@ -387,7 +432,7 @@ static FLAC__StreamEncoderTellStatus write_on_tell(const FLAC__StreamEncoder *en
 	return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
 }
 
-static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int estimate_num_samples)
+static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int is_float, int estimate_num_samples)
 {
 	struct flac_writedata *fwd = malloc(sizeof(*fwd));
 	if (!fwd)
@@ -395,6 +440,9 @@ static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int est
 
 	fwd->channels = channels;
 	fwd->bits = bits;
+	fwd->is_float = is_float;
+	fwd->fp = fp;
+	fwd->end = disko_tell(fp);
 
 	fwd->encoder = FLAC__stream_encoder_new();
 	if (!fwd->encoder)
@@ -403,7 +451,9 @@ static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int est
 	if (!FLAC__stream_encoder_set_channels(fwd->encoder, channels))
 		return -2;
 
-	if (!FLAC__stream_encoder_set_bits_per_sample(fwd->encoder, bits))
+	/* FLAC only does integers, and not every decoder can handle more than 24 bits,
+	so 32-bit (int or float) data is stored as 24-bit */
+	if (!FLAC__stream_encoder_set_bits_per_sample(fwd->encoder, MIN(bits, 24)))
 		return -3;
 
 	if (rate > FLAC__MAX_SAMPLE_RATE)
@@ -431,7 +481,7 @@ static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int est
 		write_on_seek,
 		write_on_tell,
 		NULL,
-		fp
+		fwd
 	);
 
 	if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
@@ -445,9 +495,9 @@ static int flac_save_init(disko_t *fp, int bits, int channels, int rate, int est
 	return 0;
 }
 
-int fmt_flac_export_head(disko_t *fp, int bits, int channels, int rate)
+int fmt_flac_export_head(disko_t *fp, int bits, int channels, int rate, int is_float)
 {
-	if (flac_save_init(fp, bits, channels, rate, 0))
+	if (flac_save_init(fp, bits, channels, rate, is_float, 0))
 		return DW_ERROR;
 
 	return DW_OK;
@@ -460,15 +510,26 @@ int fmt_flac_export_body(disko_t *fp, const uint8_t *data, size_t length)
 
 	FLAC__int32 pcm[length / bytes_per_sample];
 
-	/* 8-bit/16-bit PCM -> 32-bit PCM */
+	/* 8/16/24/32-bit PCM or float -> 32-bit PCM */
 	size_t i;
 	for (i = 0; i < length / bytes_per_sample; i++) {
-		if (bytes_per_sample == 2)
+		if (bytes_per_sample == 2) {
 			pcm[i] = (FLAC__int32)(((const int16_t*)data)[i]);
-		else if (bytes_per_sample == 1)
+		} else if (bytes_per_sample == 1) {
 			pcm[i] = (FLAC__int32)(((const int8_t*)data)[i]);
-		else
+		} else if (bytes_per_sample == 3) {
+			/* same endian, as written by clip_32_to_24 */
+			int32_t n = 0;
+			memcpy(&n, data + i * 3, 3);
+			pcm[i] = (FLAC__int32)(((uint32_t) n << 8)) >> 8;
+		} else if (bytes_per_sample == 4 && fwd->is_float) {
+			float f = ((const float*)data)[i] * 8388608.0f;
+			pcm[i] = (FLAC__int32) CLAMP(f, -8388608.0f, 8388607.0f);
+		} else if (bytes_per_sample == 4) {
+			pcm[i] = (FLAC__int32)(((const int32_t*)data)[i] >> 8);
+		} else {
 			return DW_ERROR;
+		}
 	}
 
 	if (!FLAC__stream_encoder_process_interleaved(fwd->encoder, pcm, length / (bytes_per_sample * fwd->channels)))
@@ -493,6 +554,8 @@ int fmt_flac_export_tail(disko_t *fp)
 	FLAC__stream_encoder_finish(fwd->encoder);
 	FLAC__stream_encoder_delete(fwd->encoder);
 
+	disko_seek(fp, fwd->end, SEEK_SET);
+
 	free(fwd);
 
 	return DW_OK;
@@ -502,9 +565,9 @@ int fmt_flac_export_tail(disko_t *fp)
  * currently this is the same size as the buffer length in disko.c */
 #define SAMPLE_BUFFER_LENGTH 65536
 
-int fmt_flac_save_sample(disko_t *fp, song_sample_t *smp)
+static int flac_save_sample(disko_t *fp, song_sample_t *smp, int rate)
 {
-	if (flac_save_init(fp, (smp->flags & CHN_16BIT) ? 16 : 8, (smp->flags & CHN_STEREO) ? 2 : 1, smp->c5speed, smp->length))
+	if (flac_save_init(fp, (smp->flags & CHN_16BIT) ? 16 : 8, (smp->flags & CHN_STEREO) ? 2 : 1, rate, 0, smp->length))
 		return SAVE_INTERNAL_ERROR;
 
 	/* need to buffer this or else we'll make a HUGE array when
@@ -522,3 +585,16 @@ int fmt_flac_save_sample(disko_t *fp, song_sample_t *smp)
 
 	return SAVE_SUCCESS;
 }
+
+int fmt_flac_save_sample(disko_t *fp, song_sample_t *smp)
+{
+	return flac_save_sample(fp, smp, smp->c5speed);
+}
+
+/* The other half of fmt_flac_read_sample_data: just the sample data, for storing in another format. That
+format has its own idea of the sample rate, so the one in the stream doesn't matter; it only has to be one
+that FLAC will accept, which the sample's own might not be. */
+int fmt_flac_save_sample_data(disko_t *fp, song_sample_t *smp)
+{
+	return flac_save_sample(fp, smp, 44100);
+}
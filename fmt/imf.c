@@ -31,6 +31,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_imf_probe = {128, 0};
+
 int fmt_imf_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 64 && memcmp(data + 60, "IM10", 4) == 0))
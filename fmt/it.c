@@ -36,6 +36,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_it_probe = {64, 0};
+
 int fmt_it_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	/* "Bart just said I-M-P! He's made of pee!" */
@@ -163,7 +165,8 @@ static void load_it_pattern(song_note_t *note, slurp_t *fp, int rows)
 	}
 }
 
-static void load_it_sample(song_sample_t *sample, slurp_t *fp, uint16_t cwtv)
+/* returns 1 if there's sample data to read, which is queued up in 'rd' rather than read straight away */
+static int load_it_sample(song_sample_t *sample, song_sample_read_t *rd, slurp_t *fp, uint16_t cwtv)
 {
 	struct it_sample shdr;
 
@@ -229,7 +232,17 @@ static void load_it_sample(song_sample_t *sample, slurp_t *fp, uint16_t cwtv)
 
 		uint32_t flags = SF_LE;
 		flags |= (shdr.flags & 4) ? SF_SS : SF_M;
-		if (shdr.flags & 8) {
+		rd->read = NULL;
+		if ((shdr.flags & 8) && its_sample_is_flac(fp->data + fp->pos, fp->length - fp->pos)) {
+#ifdef USE_FLAC
+			rd->read = fmt_flac_read_sample_data;
+			flags |= SF_PCMS; // not that it matters
+#else
+			log_appendf(4, " Warning: FLAC-compressed samples unsupported in this build");
+			sample->length = 0;
+			return 0;
+#endif
+		} else if (shdr.flags & 8) {
 			flags |= (shdr.cvt & 4) ? SF_IT215 : SF_IT214;
 		} else {
 			// XXX for some reason I had a note in pm/fmt/it.c saying that I had found some
@@ -239,10 +252,15 @@ static void load_it_sample(song_sample_t *sample, slurp_t *fp, uint16_t cwtv)
 			flags |= (shdr.cvt & 4) ? SF_PCMD : (shdr.cvt & 1) ? SF_PCMS : SF_PCMU;
 		}
 		flags |= (shdr.flags & 2) ? SF_16 : SF_8;
-		csf_read_sample(sample, flags, fp->data + fp->pos, fp->length - fp->pos);
+		rd->sample = sample;
+		rd->flags = flags;
+		rd->data = fp->data + fp->pos;
+		rd->length = fp->length - fp->pos;
+		return 1;
 	} else {
 		sample->length = 0;
 	}
+	return 0;
 }
 
 int fmt_it_load_song(song_t *song, slurp_t *fp, unsigned int lflags)
@@ -443,10 +461,19 @@ int fmt_it_load_song(song_t *song, slurp_t *fp, unsigned int lflags)
 				load_it_instrument_old(inst, fp);
 		}
 
+		song_sample_read_t *reads = mem_alloc(MAX(hdr.smpnum, 1) * sizeof(song_sample_read_t));
+		int nreads = 0;
+
 		for (n = 0, sample = song->samples + 1; n < hdr.smpnum; n++, sample++) {
 			slurp_seek(fp, para_smp[n], SEEK_SET);
-			load_it_sample(sample, fp, hdr.cwtv);
+			nreads += load_it_sample(sample, reads + nreads, fp, hdr.cwtv);
 		}
+		/* every sample's data is somewhere in fp by now, so they can all be decoded at once */
+		if (lflags & LOAD_DEFERSAMPLES)
+			csf_defer_samples(song, reads, nreads);
+		else
+			csf_read_samples(reads, nreads);
+		free(reads);
 	}
 
 	if (!(lflags & LOAD_NOPATTERNS)) {
@@ -786,8 +813,11 @@ int fmt_it_save_song(disko_t *fp, song_t *song)
 	//     embedded midi config = 2.13
 	//     row highlight = 2.13 (doesn't necessarily affect cmwt)
 	//     compressed samples = 2.14
+	//     2.15 compressed samples = 2.15
 	//     instrument filters = 2.17
 	hdr.cmwt = bswapLE16(0x0214);   // compatible with IT 2.14
+	if (its_compress_samples == ITS_COMPRESS_IT215)
+		hdr.cmwt = bswapLE16(0x0215);
 	for (n = 1; n < nins; n++) {
 		song_instrument_t *i = song->instruments[n];
 		if (!i) continue;
@@ -922,10 +952,7 @@ int fmt_it_save_song(disko_t *fp, song_t *song)
 		disko_write(fp, &tmp, 4);
 		disko_seek(fp, op, SEEK_SET);
 		if (smp->data)
-			csf_write_sample(fp, smp, SF_LE | SF_PCMS
-					| ((smp->flags & CHN_16BIT) ? SF_16 : SF_8)
-					| ((smp->flags & CHN_STEREO) ? SF_SS : SF_M),
-					UINT32_MAX);
+			save_its_data(fp, smp);
 		// done using the pointer internally, so *now* swap it
 		para_smp[n] = bswapLE32(para_smp[n]);
 
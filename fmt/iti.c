@@ -35,6 +35,8 @@
 #include <assert.h>
 
 /* --------------------------------------------------------------------- */
+const struct fmt_probe fmt_iti_probe = {1024, 0};
+
 int fmt_iti_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 554 && memcmp(data, "IMPI",4) == 0)) return 0;
@@ -372,10 +374,7 @@ void save_iti_instrument(disko_t *fp, song_t *song, song_instrument_t *ins, int
 			disko_seek(fp, iti_map[o]+0x48, SEEK_SET);
 			disko_write(fp, &tmp, 4);
 			disko_seek(fp, op, SEEK_SET);
-			csf_write_sample(fp, smp, SF_LE | SF_PCMS
-					| ((smp->flags & CHN_16BIT) ? SF_16 : SF_8)
-					| ((smp->flags & CHN_STEREO) ? SF_SS : SF_M),
-					UINT32_MAX);
+			save_its_data(fp, smp);
 		}
 	}
 }
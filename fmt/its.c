@@ -24,12 +24,15 @@
 #include "headers.h"
 #include "bswap.h"
 #include "fmt.h"
+#include "log.h"
 
 #include "player/sndfile.h"
 #include "song.h"
 #include "it_defs.h"
 
 /* --------------------------------------------------------------------- */
+const struct fmt_probe fmt_its_probe = {128, 0};
+
 int fmt_its_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	struct it_sample *its;
@@ -83,6 +86,7 @@ int load_its_sample(const uint8_t *header, const uint8_t *data, size_t length, s
 	struct it_sample *its = (struct it_sample *)header;
 	uint32_t format;
 	uint32_t bp;
+	int flac;
 
 	if (length < 80 || strncmp((const char *) header, "IMPS", 4) != 0)
 		return 0;
@@ -93,11 +97,16 @@ int load_its_sample(const uint8_t *header, const uint8_t *data, size_t length, s
 		return 0;
 	}
 
+	bp = bswapLE32(its->samplepointer);
+	flac = (its->flags & 8) && bp < length && its_sample_is_flac(data + bp, length - bp);
+
 	// endianness (always little)
 	format = SF_LE;
 	// channels
 	format |= (its->flags & 4) ? SF_SS : SF_M;
-	if (its->flags & 8) {
+	if (flac) {
+		// nothing to set; the stream knows what it is
+	} else if (its->flags & 8) {
 		// compression algorithm
 		format |= (its->cvt & 4) ? SF_IT215 : SF_IT214;
 	} else {
@@ -154,7 +163,15 @@ int load_its_sample(const uint8_t *header, const uint8_t *data, size_t length, s
 		smp->flags &= ~(CHN_SUSTAINLOOP | CHN_PINGPONGSUSTAIN);
 	}
 
-	bp = bswapLE32(its->samplepointer);
+	if (flac) {
+#ifdef USE_FLAC
+		return fmt_flac_read_sample_data(smp, format, data + bp, length - bp);
+#else
+		log_appendf(4, " Warning: FLAC-compressed samples unsupported in this build");
+		smp->length = 0;
+		return 0;
+#endif
+	}
 
 	// dumb casts :P
 	return csf_read_sample((song_sample_t *) smp, format,
@@ -167,9 +184,50 @@ int fmt_its_load_sample(const uint8_t *data, size_t length, song_sample_t *smp)
 	return load_its_sample(data, data, length, smp);
 }
 
+int its_compress_samples = ITS_COMPRESS_NONE;
+
+/* FLAC-compressed samples are an extension of our own, and nothing else will load them. The sample header is
+the same as ever, with the 'compressed' flag set, and the sample pointer leads to a complete FLAC stream
+(starting with the usual "fLaC") rather than IT 2.14 compressed blocks. The stream only carries the sample
+data; everything else, including the C-5 speed, comes from the header. */
+
+int its_sample_is_flac(const uint8_t *data, size_t length)
+{
+	// IT 2.14 data starts with a 16-bit block length, and "fL" would be a believable one, so check for the
+	// STREAMINFO block that has to come first in any FLAC stream as well: type 0 (maybe with the "last"
+	// bit), 34 bytes long. Compressed sample data isn't going to look like that by accident.
+	return length >= 8 && memcmp(data, "fLaC", 4) == 0
+		&& (data[4] & 0x7f) == 0 && data[5] == 0 && data[6] == 0 && data[7] == 34;
+}
+
+static int save_flac(song_sample_t *smp)
+{
+#ifdef USE_FLAC
+	return its_compress_samples == ITS_COMPRESS_FLAC && smp->data && smp->length
+		&& !(smp->flags & CHN_ADLIB);
+#else
+	(void) smp;
+	return 0;
+#endif
+}
+
+uint32_t its_save_format(song_sample_t *smp)
+{
+	uint32_t format = SF_LE
+		| ((smp->flags & CHN_16BIT) ? SF_16 : SF_8)
+		| ((smp->flags & CHN_STEREO) ? SF_SS : SF_M);
+
+	switch (its_compress_samples) {
+	case ITS_COMPRESS_IT214: return format | SF_IT214;
+	case ITS_COMPRESS_IT215: return format | SF_IT215;
+	default: return format | SF_PCMS;
+	}
+}
+
 void save_its_header(disko_t *fp, song_sample_t *smp)
 {
 	struct it_sample its = {0};
+	uint32_t format = its_save_format(smp);
 
 	its.id = bswapLE32(0x53504D49); // IMPS
 	strncpy((char *) its.filename, smp->filename, 12);
@@ -192,6 +250,13 @@ void save_its_header(disko_t *fp, song_sample_t *smp)
 	strncpy((char *) its.name, smp->name, 25);
 	its.name[25] = 0;
 	its.cvt = 1;                    // signed samples
+	if (save_flac(smp)) {
+		its.flags |= 8;         // "compressed", which it is, just not the way anyone else expects
+	} else if ((format & SF_ENC_MASK) != SF_PCMS) {
+		its.flags |= 8;         // compressed
+		if ((format & SF_ENC_MASK) == SF_IT215)
+			its.cvt |= 4;   // with the IT 2.15 "delta" stuff
+	}
 	its.dfp = smp->panning / 4;
 	if (smp->flags & CHN_PANNING)
 		its.dfp |= 0x80;
@@ -216,13 +281,22 @@ void save_its_header(disko_t *fp, song_sample_t *smp)
 	disko_write(fp, &its, sizeof(its));
 }
 
+void save_its_data(disko_t *fp, song_sample_t *smp)
+{
+#ifdef USE_FLAC
+	if (save_flac(smp)) {
+		if (fmt_flac_save_sample_data(fp, smp) != SAVE_SUCCESS)
+			log_appendf(4, " Warning: FLAC encoding failed for sample \"%s\"", smp->name);
+		return;
+	}
+#endif
+	csf_write_sample(fp, smp, its_save_format(smp), UINT32_MAX);
+}
+
 int fmt_its_save_sample(disko_t *fp, song_sample_t *smp)
 {
 	save_its_header(fp, smp);
-	csf_write_sample(fp, smp, SF_LE | SF_PCMS
-			| ((smp->flags & CHN_16BIT) ? SF_16 : SF_8)
-			| ((smp->flags & CHN_STEREO) ? SF_SS : SF_M),
-			UINT32_MAX);
+	save_its_data(fp, smp);
 
 	/* Write the sample pointer. In an ITS file, the sample data is right after the header,
 	so its position in the file will be the same as the size of the header. */
@@ -26,6 +26,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_liq_probe = {128, 0};
+
 int fmt_liq_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 64 && data[64] == 0x1a && memcmp(data, "Liquid Module:", 14) == 0))
@@ -33,19 +33,27 @@
 
 /* MDL is nice, but it's a pain to read the title... */
 
+const struct fmt_probe fmt_mdl_probe = {65536, 0};
+
 int fmt_mdl_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	uint32_t position, block_length;
+	size_t total;
 
 	/* data[4] = major version number (accept 0 or 1) */
 	if (!(length > 5 && ((data[4] & 0xf0) >> 4) <= 1 && memcmp(data, "DMDL", 4) == 0))
 		return 0;
 
+	/* the info block is almost always first, but if something else got in the way, we might have to go
+	looking for it past the end of the probe */
+	total = MAX(length, file->filesize);
 	position = 5;
-	while (position + 6 < length) {
+	while (position + 6 < total) {
+		if (length < total && position + 6 + 58 > length)
+			return FMT_INFO_NEED_ALL;
 		memcpy(&block_length, data + position + 2, 4);
 		block_length = bswapLE32(block_length);
-		if (block_length + position > length)
+		if (block_length + position > total)
 			return 0;
 		if (memcmp(data + position, "IN", 2) == 0) {
 			/* hey! we have a winner */
@@ -26,6 +26,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_med_probe = {64, 0};
+
 int fmt_med_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 32 && memcmp(data, "MMD0", 3) == 0))
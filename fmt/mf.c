@@ -26,6 +26,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_mf_probe = {512, 0};
+
 int fmt_mf_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 290 && memcmp(data, "MOONFISH", 8) == 0))
@@ -116,11 +116,21 @@ static unsigned int read_varlen(slurp_t *fp)
 /* --------------------------------------------------------------------------------------------------------- */
 // info (this is ultra lame)
 
+const struct fmt_probe fmt_mid_probe = {32, 0};
+
 int fmt_mid_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	slurp_t fp = {.length = length, .data = (uint8_t *) data, .pos = 0};
-	song_t *tmpsong = csf_allocate();
+	song_t *tmpsong;
+
+	// the title's in the tracks, so look at the magic first and only then go get the rest of the file
+	if (!(length >= 4 && memcmp(data, "MThd", 4) == 0)
+	    && !(length >= 24 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 20, "MThd", 4) == 0))
+		return 0;
+	if (length < file->filesize)
+		return FMT_INFO_NEED_ALL;
 
+	tmpsong = csf_allocate();
 	if (!tmpsong)
 		return 0; // wahhhh
 	if (fmt_mid_load_song(tmpsong, &fp, LOAD_NOSAMPLES | LOAD_NOPATTERNS) == LOAD_SUCCESS) {
@@ -14,6 +14,7 @@
 #include "bswap.h"
 
 #include "slurp.h" // for declaration of mmcmp_unpack
+#include "fmt.h"
 
 #pragma pack(push, 1)
 typedef struct mm_header {
@@ -96,7 +97,9 @@ static uint32_t get_bits(mm_bit_buffer_t *bb, uint32_t bits)
 }
 
 
-int mmcmp_unpack(uint8_t **data, size_t *length)
+/* Blocks that only hold data past 'limit' are skipped; the returned length is cut down to match. The buffer
+is still sized for the whole file, since a block's subblocks can land anywhere in it. */
+int mmcmp_unpack_head(uint8_t **data, size_t *length, size_t limit)
 {
 	size_t memlength;
 	uint8_t *memfile;
@@ -152,6 +155,14 @@ int mmcmp_unpack(uint8_t **data, size_t *length)
 		    || (pos + 20 + pblk.sub_blk * 8 >= memlength)) {
 			break;
 		}
+		for (i = 0; i < pblk.sub_blk; i++) {
+			if (bswapLE32(psubblk[i].unpk_pos) < limit)
+				break;
+		}
+		if (i == pblk.sub_blk) {
+			/* nothing we care about in here */
+			continue;
+		}
 		pos += 20 + pblk.sub_blk * 8;
 
 		if (!(pblk.flags & MM_COMP)) {
@@ -279,7 +290,12 @@ int mmcmp_unpack(uint8_t **data, size_t *length)
 		}
 	}
 	*data = buffer;
-	*length = filesize;
+	*length = MIN(filesize, limit);
 	return 1;
 }
 
+int mmcmp_unpack(uint8_t **data, size_t *length)
+{
+	return mmcmp_unpack_head(data, length, SIZE_MAX);
+}
+
@@ -142,6 +142,8 @@ const uint16_t amigaperiod_table[256] = {
 	0,    0,    0
 };
 
+const struct fmt_probe fmt_mod_probe = {1085, 0};
+
 int fmt_mod_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	char tag[4];
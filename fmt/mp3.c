@@ -52,6 +52,8 @@ static void get_title_from_id3(struct id3_tag const *tag, char **artist_ptr, cha
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_mp3_probe = {65536, 128};
+
 int fmt_mp3_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	signed long id3len;
@@ -72,6 +74,11 @@ int fmt_mp3_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 			return 0;
 	}
 
+	if ((size_t) id3len > length - id3off) {
+		/* an id3v2 tag bigger than the probe (most likely with a picture or two in it) */
+		return (length < file->filesize) ? FMT_INFO_NEED_ALL : 0;
+	}
+
 	tag = id3_tag_parse(data + id3off, id3len);
 	if (tag) {
 		get_title_from_id3(tag, &file->artist, &file->title);
@@ -30,6 +30,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_mt2_probe = {128, 0};
+
 int fmt_mt2_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 106 && memcmp(data, "MT20", 4) == 0))
@@ -62,6 +62,8 @@ SCHISM_BINARY_STRUCT(mtm_sample_t, 22+4+4+4+1+1+1);
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_mtm_probe = {32, 0};
+
 int fmt_mtm_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 24 && memcmp(data, "MTM", 3) == 0))
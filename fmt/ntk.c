@@ -26,6 +26,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_ntk_probe = {32, 0};
+
 int fmt_ntk_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 25 && memcmp(data, "TWNNSNG2", 8) == 0))
@@ -127,6 +127,8 @@ static void get_title_from_ogg(OggVorbis_File * vf, char **artist_ptr, char **ti
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_ogg_probe = {65536, 0};
+
 int fmt_ogg_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	OggVorbis_File vf;
@@ -142,8 +144,12 @@ int fmt_ogg_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 	file_data.length = length;
 	file_data.position = 0;
 
-	if (ov_open_callbacks(&file_data, &vf, NULL, 0, cb) < 0)
+	if (ov_open_callbacks(&file_data, &vf, NULL, 0, cb) < 0) {
+		/* the headers didn't fit in the probe (huge embedded cover art or what have you) */
+		if (length < file->filesize && length >= 4 && memcmp(data, "OggS", 4) == 0)
+			return FMT_INFO_NEED_ALL;
 		return 0;
+	}
 
 	/* song_length = ov_time_total(&vf, -1); */
 
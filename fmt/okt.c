@@ -33,6 +33,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_okt_probe = {32, 0};
+
 int fmt_okt_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 16 && memcmp(data, "OKTASONG", 8) == 0))
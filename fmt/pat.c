@@ -126,6 +126,8 @@ static int gusfreq(unsigned int freq)
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_pat_probe = {256, 0};
+
 int fmt_pat_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	const struct GF1PatchHeader *header = (const struct GF1PatchHeader *) data;
@@ -36,6 +36,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_s3m_probe = {64, 0};
+
 int fmt_s3m_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 48 && memcmp(data + 44, "SCRM", 4) == 0))
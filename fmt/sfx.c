@@ -48,6 +48,8 @@ static struct sfxfmt {
 };
 
 
+const struct fmt_probe fmt_sfx_probe = {128, 0};
+
 int fmt_sfx_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	int n;
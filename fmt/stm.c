@@ -30,6 +30,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_stm_probe = {64, 0};
+
 int fmt_stm_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	char id[8];
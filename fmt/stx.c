@@ -34,6 +34,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_stx_probe = {64, 0};
+
 int fmt_stx_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	char id[8];
@@ -34,6 +34,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_ult_probe = {64, 0};
+
 int fmt_ult_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 48 && memcmp(data, "MAS_UTrack_V00", 14) == 0))
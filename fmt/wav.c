@@ -103,7 +103,9 @@ typedef struct {
 
 /* --------------------------------------------------------------------------------------------------------- */
 
-static int wav_load(wave_file_t *f, const uint8_t *data, size_t len)
+/* 'total' is the size of the whole file, of which only the first 'len' bytes might be present (when probing
+for file info). returns -1 if it ran out of data before it found what it was looking for. */
+static int wav_load(wave_file_t *f, const uint8_t *data, size_t len, size_t total)
 {
 	wave_file_header_t phdr;
 	size_t offset;
@@ -129,6 +131,9 @@ static int wav_load(wave_file_t *f, const uint8_t *data, size_t len)
 
 	while (1) {
 		wave_chunk_prefix_t c;
+
+		if (offset + sizeof(wave_chunk_prefix_t) > len)
+			return (len < total) ? -1 : 0;
 		memcpy(&c, data + offset, sizeof(wave_chunk_prefix_t));
 
 #if WORDS_BIGENDIAN
@@ -137,9 +142,9 @@ static int wav_load(wave_file_t *f, const uint8_t *data, size_t len)
 #endif
 		offset  += sizeof(wave_chunk_prefix_t);
 
-		if (offset + c.length > len) {
+		if (offset + c.length > total) {
 			log_appendf(4, "Corrupt WAV file. Chunk points outside of WAV file [%lu + %u > %lu]\n",
-			    (unsigned long) offset, c.length, (unsigned long) len);
+			    (unsigned long) offset, c.length, (unsigned long) total);
 			return 0;
 		}
 
@@ -150,6 +155,8 @@ static int wav_load(wave_file_t *f, const uint8_t *data, size_t len)
 				return 0;
 			}
 
+			if (offset + sizeof(wave_format_t) > len)
+				return (len < total) ? -1 : 0;
 			have_format = 1;
 			memcpy(&f->fmt, data + offset, sizeof(wave_format_t));
 #if WORDS_BIGENDIAN
@@ -176,7 +183,7 @@ static int wav_load(wave_file_t *f, const uint8_t *data, size_t len)
 
 	    offset += c.length;
 
-	    if (offset == len)
+	    if (offset == total)
 		    break;
 	}
 
@@ -190,7 +197,7 @@ int fmt_wav_load_sample(const uint8_t *data, size_t len, song_sample_t *smp)
 	wave_file_t f;
 	uint32_t flags;
 
-	if (!wav_load(&f, data, len))
+	if (!wav_load(&f, data, len, len))
 		return 0;
 
 	if (f.fmt.format != WAVE_FORMAT_PCM ||
@@ -224,13 +231,90 @@ int fmt_wav_load_sample(const uint8_t *data, size_t len, song_sample_t *smp)
 	return csf_read_sample((song_sample_t *)smp, flags, (const char *) f.buf, f.data.length);
 }
 
+/* the same thing, but for a file that's being streamed (see slurp_stream): the data goes straight from the file
+into the sample, a window at a time, so a huge sample doesn't have to be in memory twice over. only 8- and 16-bit
+PCM can be done like this -- anything else returns 0 without reading past the header, and has to be loaded the
+usual way. */
+int fmt_wav_load_sample_stream(slurp_t *fp, song_sample_t *smp)
+{
+	wave_file_t f;
+	uint8_t *head;
+	size_t headlen, offset, bytes, n;
+	int bps;
+
+	head = mem_alloc(65536);
+	headlen = slurp_peek(fp, head, 65536);
+	if (wav_load(&f, head, headlen, fp->length) != 1) {
+		free(head);
+		return 0;
+	}
+	offset = f.buf - head;
+	free(head);
+
+	if (f.fmt.format != WAVE_FORMAT_PCM ||
+	    !f.fmt.freqHz ||
+	    (f.fmt.channels != 1 && f.fmt.channels != 2) ||
+	    (f.fmt.bitspersample != 8 && f.fmt.bitspersample != 16))
+		return 0;
+
+	bps = (f.fmt.bitspersample / 8) * f.fmt.channels;
+	smp->flags = 0;
+	if (f.fmt.bitspersample == 16)
+		smp->flags |= CHN_16BIT;
+	if (f.fmt.channels == 2)
+		smp->flags |= CHN_STEREO;
+	smp->volume        = 64 * 4;
+	smp->global_volume = 64;
+	smp->c5speed       = f.fmt.freqHz;
+	smp->length        = MIN(f.data.length / bps, MAX_SAMPLE_LENGTH);
+	if (!smp->length)
+		return 0;
+
+	smp->data = csf_allocate_sample((smp->length + 6) * bps);
+	if (!smp->data) {
+		smp->length = 0;
+		return 0;
+	}
+	slurp_seek(fp, offset, SEEK_SET);
+	bytes = slurp_read(fp, smp->data, smp->length * bps);
+	if (bytes < smp->length * bps) {
+		/* cut short -- keep what's there */
+		smp->length = bytes / bps;
+		if (!smp->length) {
+			csf_free_sample(smp->data);
+			smp->data = NULL;
+			return 0;
+		}
+	}
+
+	if (smp->flags & CHN_16BIT) {
+		int16_t *data = (int16_t *) smp->data;
+		for (n = 0; n < bytes / 2; n++)
+			data[n] = bswapLE16(data[n]);
+	} else {
+		for (n = 0; n < bytes; n++)
+			smp->data[n] = (signed char) (smp->data[n] ^ 0x80);
+	}
+
+	csf_adjust_sample_loop(smp);
+	csf_pool_sample(smp);
+	return 1;
+}
+
+const struct fmt_probe fmt_wav_probe = {65536, 0};
+
 int fmt_wav_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	wave_file_t f;
 
-	if (!wav_load(&f, data, length))
+	switch (wav_load(&f, data, length, MAX(length, file->filesize))) {
+	case -1:
+		return FMT_INFO_NEED_ALL;
+	case 0:
 		return 0;
-	else if (f.fmt.format != WAVE_FORMAT_PCM ||
+	}
+
+	if (f.fmt.format != WAVE_FORMAT_PCM ||
 		!f.fmt.freqHz ||
 		(f.fmt.channels != 1 && f.fmt.channels != 2) ||
 		(f.fmt.bitspersample != 8 && f.fmt.bitspersample != 16 &&
@@ -259,12 +343,13 @@ int fmt_wav_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 
 struct wav_writedata {
 	long data_size; // seek position for writing data size (in bytes)
+	long fact_frames; // seek position for writing the frame count (float only, else -1)
 	size_t numbytes; // how many bytes have been written
 	int bps; // bytes per sample
-	int swap; // should be byteswapped?
+	int swap; // if nonzero, byteswap samples of this many bytes
 };
 
-static int wav_header(disko_t *fp, int bits, int channels, int rate, size_t length,
+static int wav_header(disko_t *fp, int bits, int channels, int rate, int is_float, size_t length,
 	struct wav_writedata *wwd /* out */)
 {
 	int16_t s;
@@ -275,9 +360,9 @@ static int wav_header(disko_t *fp, int bits, int channels, int rate, size_t leng
 
 	/* write a very large size for now */
 	disko_write(fp, "RIFF\377\377\377\377WAVEfmt ", 16);
-	ul = bswapLE32(16); // fmt chunk size
+	ul = bswapLE32(is_float ? 18 : 16); // fmt chunk size
 	disko_write(fp, &ul, 4);
-	s = bswapLE16(1); // linear pcm
+	s = bswapLE16(is_float ? 3 : 1); // ieee float or linear pcm
 	disko_write(fp, &s, 2);
 	s = bswapLE16(channels); // number of channels
 	disko_write(fp, &s, 2);
@@ -290,6 +375,21 @@ static int wav_header(disko_t *fp, int bits, int channels, int rate, size_t leng
 	s = bswapLE16(bits); // bits per sample
 	disko_write(fp, &s, 2);
 
+	if (wwd)
+		wwd->fact_frames = -1;
+	if (is_float) {
+		/* non-pcm formats need an extension size (zero), and a fact chunk */
+		s = 0;
+		disko_write(fp, &s, 2);
+		disko_write(fp, "fact", 4);
+		ul = bswapLE32(4);
+		disko_write(fp, &ul, 4);
+		if (wwd)
+			wwd->fact_frames = disko_tell(fp);
+		ul = bswapLE32(length);
+		disko_write(fp, &ul, 4);
+	}
+
 	disko_write(fp, "data", 4);
 	if (wwd)
 		wwd->data_size = disko_tell(fp);
@@ -308,7 +408,7 @@ int fmt_wav_save_sample(disko_t *fp, song_sample_t *smp)
 	flags |= (smp->flags & CHN_STEREO) ? SF_SI : SF_M;
 
 	bps = wav_header(fp, (smp->flags & CHN_16BIT) ? 16 : 8, (smp->flags & CHN_STEREO) ? 2 : 1,
-		smp->c5speed, smp->length, NULL);
+		smp->c5speed, 0, smp->length, NULL);
 
 	if (csf_write_sample(fp, smp, flags, UINT32_MAX) != smp->length * bps) {
 		log_appendf(4, "WAV: unexpected data size written");
@@ -325,16 +425,16 @@ int fmt_wav_save_sample(disko_t *fp, song_sample_t *smp)
 }
 
 
-int fmt_wav_export_head(disko_t *fp, int bits, int channels, int rate)
+int fmt_wav_export_head(disko_t *fp, int bits, int channels, int rate, int is_float)
 {
 	struct wav_writedata *wwd = malloc(sizeof(struct wav_writedata));
 	if (!wwd)
 		return DW_ERROR;
 	fp->userdata = wwd;
-	wwd->bps = wav_header(fp, bits, channels, rate, ~0, wwd);
+	wwd->bps = wav_header(fp, bits, channels, rate, is_float, ~0, wwd);
 	wwd->numbytes = 0;
 #if WORDS_BIGENDIAN
-	wwd->swap = (bits > 8);
+	wwd->swap = (bits > 8) ? (bits + 7) / 8 : 0;
 #else
 	wwd->swap = 0;
 #endif
@@ -354,16 +454,7 @@ int fmt_wav_export_body(disko_t *fp, const uint8_t *data, size_t length)
 	wwd->numbytes += length;
 
 	if (wwd->swap) {
-		const int16_t *ptr = (const int16_t *) data;
-		uint16_t v;
-
-		length /= 2;
-		while (length--) {
-			v = *ptr;
-			v = bswapLE16(v);
-			disko_write(fp, &v, 2);
-			ptr++;
-		}
+		disko_write_swapped(fp, data, length, wwd->swap);
 	} else {
 		disko_write(fp, data, length);
 	}
@@ -395,6 +486,11 @@ int fmt_wav_export_tail(disko_t *fp)
 	disko_seek(fp, wwd->data_size, SEEK_SET);
 	ul = bswapLE32(wwd->numbytes);
 	disko_write(fp, &ul, 4);
+	if (wwd->fact_frames >= 0) {
+		disko_seek(fp, wwd->fact_frames, SEEK_SET);
+		ul = bswapLE32(wwd->numbytes / wwd->bps);
+		disko_write(fp, &ul, 4);
+	}
 
 	free(wwd);
 
@@ -406,6 +406,8 @@ void win32mf_quit(void)
 	if (uncompressed_type) \
 		uncompressed_type->lpVtbl->Release(uncompressed_type);
 
+const struct fmt_probe fmt_win32mf_probe = {65536, 0};
+
 int fmt_win32mf_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!media_foundation_initialized)
@@ -419,6 +421,13 @@ int fmt_win32mf_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 
 	MEDIA_FOUNDATION_START(data, length, url, cleanup)
 
+	/* it's something Media Foundation can read, but it wants to see the real stream, or it'll get the
+	length wrong */
+	if (length < file->filesize) {
+		success = FMT_INFO_NEED_ALL;
+		goto cleanup;
+	}
+
 	file->smp_flags = flags;
 	file->smp_speed = sps;
 
@@ -117,6 +117,8 @@ static int validate_xi(const struct xi_file_header *xi, size_t length)
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_xi_probe = {512, 0};
+
 int fmt_xi_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	struct xi_file_header *xi = (struct xi_file_header *)data;
@@ -34,6 +34,8 @@
 
 /* --------------------------------------------------------------------- */
 
+const struct fmt_probe fmt_xm_probe = {64, 0};
+
 int fmt_xm_read_info(dmoz_file_t *file, const uint8_t *data, size_t length)
 {
 	if (!(length > 38 && memcmp(data, "Extended Module: ", 17) == 0))
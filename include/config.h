@@ -76,4 +76,7 @@ void cfg_save_disko(cfg_file_t *cfg);
 void cfg_load_dmoz(cfg_file_t *cfg);
 void cfg_save_dmoz(cfg_file_t *cfg);
 
+void cfg_load_waterfall(cfg_file_t *cfg);
+void cfg_save_waterfall(cfg_file_t *cfg);
+
 #endif /* SCHISM_CONFIG_H_ */
@@ -23,6 +23,7 @@
 #ifndef SCHISM_DISKO_H_
 #define SCHISM_DISKO_H_
 
+#include <stdint.h>
 #include <sys/types.h>
 
 // hurd doesn't have limits.h
@@ -107,6 +108,21 @@ void song_pattern_to_sample(int pattern, int split, int bind);
 struct save_format;
 int disko_export_song(const char *filename, const struct save_format *format);
 
+/* render the song to a file synchronously, without any UI (for headless mode)
+the song is modified in the process; don't pass the song that's playing.
+this doesn't touch any global state, so several songs can be rendered at once
+from different threads. if stats is non-NULL, it's filled in on success.
+multi-file exports are rendered on up to num_threads threads (0 = one per cpu). */
+struct song;
+struct disko_render_stats {
+	size_t frames; // sample frames rendered
+	size_t bytes; // size of the written file(s)
+	uint32_t rate; // sample rate the frames were rendered at
+	double elapsed; // wall-clock seconds
+};
+int disko_render_song(struct song *song, const char *filename, const struct save_format *format,
+	struct disko_render_stats *stats, int num_threads);
+
 /* call periodically if (status.flags & DISKWRITER_ACTIVE) to write more stuff.
 return: DW_SYNC_*, self explanatory */
 int disko_sync(void);
@@ -118,6 +134,9 @@ int disko_sync(void);
 /* Write data to the file, as in fwrite() */
 void disko_write(disko_t *ds, const void *buf, size_t len);
 
+/* Same, but reverse the byte order of every 'width'-byte sample on the way out */
+void disko_write_swapped(disko_t *ds, const void *buf, size_t len, int width);
+
 /* Write one character (unsigned char, cast to int) */
 void disko_putc(disko_t *ds, int c);
 
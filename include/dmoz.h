@@ -158,6 +158,9 @@ int dmoz_filter_ext_data(dmoz_file_t *file);
 /* same as dmoz_filter_ext_data, but always returns 1 (for async title reading) */
 int dmoz_fill_ext_data(dmoz_file_t *file);
 
+/* write out the file info cache (~/.schism/infocache) if anything's changed */
+void dmoz_info_cache_save(void);
+
 /* filters stuff based on... whatever you like :) */
 void dmoz_filter_filelist(dmoz_filelist_t *flist, int (*grep)(dmoz_file_t *f), int *pointer, void (*onmove)(void));
 
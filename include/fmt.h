@@ -40,6 +40,9 @@
 this is only a suggestion in order to speed loading; don't be surprised if the loader ignores these */
 #define LOAD_NOSAMPLES  1
 #define LOAD_NOPATTERNS 2
+/* don't read the sample data until it's wanted (see csf_defer_samples); the file has to stay open as long as
+the song does. loaders that don't support this just read the samples as usual */
+#define LOAD_DEFERSAMPLES 4
 
 /* return codes for module loaders */
 enum {
@@ -56,6 +59,24 @@ enum {
 	SAVE_INTERNAL_ERROR,    /* something unrelated to disk i/o */
 };
 
+/* --------------------------------------------------------------------------------------------------------- */
+/* file info probing */
+
+/* The file browser doesn't hand read_info functions the whole file, only the first 'head' bytes of it (plus
+the last 'tail' bytes, tacked on directly after the head, if the format wants those too) as declared in the
+format's fmt_*_probe. 'length' is the amount of data actually present, which is less than the size of the
+file unless the file is small; file->filesize is still the size on disk.
+
+A function that recognizes the file but can't get what it needs out of the probe can return FMT_INFO_NEED_ALL
+to have itself called again with the entire file. Use this sparingly, since it's exactly what probing is
+meant to avoid -- and only return it when length < file->filesize, or the file will be read for nothing. */
+struct fmt_probe {
+	size_t head;
+	size_t tail;
+};
+
+#define FMT_INFO_NEED_ALL       (-1)
+
 /* --------------------------------------------------------------------------------------------------------- */
 
 #define PROTO_READ_INFO         (dmoz_file_t *file, const uint8_t *data, size_t length)
@@ -65,7 +86,7 @@ enum {
 #define PROTO_SAVE_SAMPLE       (disko_t *fp, song_sample_t *smp)
 #define PROTO_LOAD_INSTRUMENT   (const uint8_t *data, size_t length, int slot)
 #define PROTO_SAVE_INSTRUMENT   (disko_t *fp, song_t *song, song_instrument_t *ins)
-#define PROTO_EXPORT_HEAD       (disko_t *fp, int bits, int channels, int rate)
+#define PROTO_EXPORT_HEAD       (disko_t *fp, int bits, int channels, int rate, int is_float)
 #define PROTO_EXPORT_SILENCE    (disko_t *fp, long bytes)
 #define PROTO_EXPORT_BODY       (disko_t *fp, const uint8_t *data, size_t length)
 #define PROTO_EXPORT_TAIL       (disko_t *fp)
@@ -82,7 +103,8 @@ typedef int (*fmt_export_silence_func)  PROTO_EXPORT_SILENCE;
 typedef int (*fmt_export_body_func)     PROTO_EXPORT_BODY;
 typedef int (*fmt_export_tail_func)     PROTO_EXPORT_TAIL;
 
-#define READ_INFO(t)            int fmt_##t##_read_info         PROTO_READ_INFO;
+#define READ_INFO(t)            int fmt_##t##_read_info         PROTO_READ_INFO; \
+				extern const struct fmt_probe fmt_##t##_probe;
 #define LOAD_SONG(t)            int fmt_##t##_load_song         PROTO_LOAD_SONG;
 #define SAVE_SONG(t)            int fmt_##t##_save_song         PROTO_SAVE_SONG;
 #define LOAD_SAMPLE(t)          int fmt_##t##_load_sample       PROTO_LOAD_SAMPLE;
@@ -135,13 +157,35 @@ int instrument_loader_sample(struct instrumentloader *ii, int slot);
 
 uint32_t it_decompress8(void *dest, uint32_t len, const void *file, uint32_t filelen, int it215, int channels);
 uint32_t it_decompress16(void *dest, uint32_t len, const void *file, uint32_t filelen, int it215, int channels);
+/* these write straight to the disko, and return the number of bytes written */
+uint32_t it_compress8(disko_t *fp, const void *data, uint32_t len, int it215, int channels);
+uint32_t it_compress16(disko_t *fp, const void *data, uint32_t len, int it215, int channels);
 
 uint16_t mdl_read_bits(uint32_t *bitbuf, uint32_t *bitnum, uint8_t **ibuf, int8_t n);
 
 /* --------------------------------------------------------------------------------------------------------- */
 
 /* shared by the .it, .its, and .iti saving functions */
+enum {
+	ITS_COMPRESS_NONE,
+	ITS_COMPRESS_IT214,
+	ITS_COMPRESS_IT215,
+	ITS_COMPRESS_FLAC, /* not an IT thing at all; see its_sample_is_flac. needs USE_FLAC, else it's NONE */
+};
+extern int its_compress_samples; /* one of the above; from the config file */
+uint32_t its_save_format(song_sample_t *smp); /* what to pass to csf_write_sample */
 void save_its_header(disko_t *fp, song_sample_t *smp);
+void save_its_data(disko_t *fp, song_sample_t *smp); /* the sample data that goes with save_its_header */
+/* whether an IT sample with the 'compressed' flag set is really a FLAC stream */
+int its_sample_is_flac(const uint8_t *data, size_t length);
+
+#ifdef USE_FLAC
+/* FLAC streams inside other formats (flac.c) */
+uint32_t fmt_flac_read_sample_data(song_sample_t *smp, uint32_t flags, const void *data, uint32_t length);
+int fmt_flac_save_sample_data(disko_t *fp, song_sample_t *smp);
+#endif
+/* a WAV sample read a window at a time from a streamed file (see slurp_stream), for ones too big to slurp */
+int fmt_wav_load_sample_stream(slurp_t *fp, song_sample_t *smp);
 void save_iti_instrument(disko_t *fp, song_t *song, song_instrument_t *ins, int iti_file);
 int load_its_sample(const uint8_t *header, const uint8_t *data, size_t length, song_sample_t *smp);
 void load_it_instrument(song_instrument_t *instrument, const uint8_t *data);
@@ -178,6 +222,8 @@ extern const uint8_t stm_effects[16];
 
 /* used internally by slurp only. nothing else should need this */
 int mmcmp_unpack(uint8_t **data, size_t *length);
+/* same, but only unpacks the blocks needed for the first 'limit' bytes of the file */
+int mmcmp_unpack_head(uint8_t **data, size_t *length, size_t limit);
 
 // get L-R-R-L panning value from a (zero-based!) channel number
 #define PROTRACKER_PANNING(n) (((((n) + 1) >> 1) & 1) * 256)
@@ -29,6 +29,8 @@ void log_append2(int bios_font, int color, int must_free, const char *text);
 void log_appendf(int color, const char *format, ...)
 	__attribute__ ((format(printf, 2, 3)));
 void log_underline(int chars);
+/* whether anything's been logged since the last call that the log page should show; main thread only */
+int log_take_update(void);
 
 void log_perror(const char *prefix);
 
@@ -19,6 +19,9 @@ void interleave_front_rear(int *, int *, unsigned int);
 void mono_from_stereo(int *, unsigned int);
 
 unsigned int csf_create_stereo_mix(song_t *csf, int count);
+/* buffer that a channel's voices should be mixed into for multi-file export, cleared on first use
+in each block; NULL if the channel isn't being written */
+int *csf_get_multi_write_buffer(song_t *csf, uint32_t chan, int count);
 
 void setup_channel_filter(song_voice_t *pChn, int reset, int flt_modifier, int freq);
 
@@ -29,19 +32,25 @@ unsigned int clip_32_to_8(void *, int *, unsigned int, int *, int *);
 unsigned int clip_32_to_16(void *, int *, unsigned int, int *, int *);
 unsigned int clip_32_to_24(void *, int *, unsigned int, int *, int *);
 unsigned int clip_32_to_32(void *, int *, unsigned int, int *, int *);
+unsigned int convert_32_to_float(void *, int *, unsigned int, int *, int *);
+
+void float_from_mix(float *, const int *, unsigned int, float, float);
+unsigned int clip_float_to_8(void *, float *, unsigned int, int *, int *);
+unsigned int clip_float_to_16(void *, float *, unsigned int, int *, int *);
+unsigned int clip_float_to_24(void *, float *, unsigned int, int *, int *);
+unsigned int clip_float_to_32(void *, float *, unsigned int, int *, int *);
+unsigned int float_to_float(void *, float *, unsigned int, int *, int *);
 
 
 void normalize_mono(song_t *, int *, unsigned int);
 void normalize_stereo(song_t *, int *, unsigned int);
 void eq_mono(song_t *, int *, unsigned int);
 void eq_stereo(song_t *, int *, unsigned int);
-void initialize_eq(int, float);
-void set_eq_gains(const unsigned int *, unsigned int, const unsigned int *, int, int);
-
-
-// sndmix.c
-extern int g_dry_rofs_vol;
-extern int g_dry_lofs_vol;
+void float_bus_from_mix(song_t *, const int *, unsigned int);
+void eq_mono_float(song_t *, float *, unsigned int);
+void eq_stereo_float(song_t *, float *, unsigned int);
+void initialize_eq(song_t *, int, float);
+void set_eq_gains(song_t *, const unsigned int *, unsigned int, const unsigned int *, int, int);
 
 
 // mixer.c
@@ -1,17 +1,22 @@
 #ifndef SCHISM_PLAYER_SND_FM_H_
 #define SCHISM_PLAYER_SND_FM_H_
 
-void Fmdrv_Init(int mixfreq);
-void Fmdrv_MixTo(int* buf, int count);
-
-void OPL_NoteOff(int c);
-void OPL_HertzTouch(int c, int Hertz, int keyoff); // also for pitch bending
-void OPL_Touch(int c, unsigned Vol);
-void OPL_Pan(int c, int val);
-void OPL_Patch(int c, const unsigned char *D);
-void OPL_Reset(void);
-int OPL_Detect(void);
-void OPL_Close(void);
+#include "player/sndfile.h"
+
+/* All of these operate on the OPL chip belonging to the given song (csf->fm),
+which is created by Fmdrv_Init and released by OPL_Close. */
+void Fmdrv_Init(song_t *csf, int mixfreq);
+void Fmdrv_MixTo(song_t *csf, int* buf, int count);
+void Fmdrv_MixToChannels(song_t *csf, int count); // into csf->multi_write, by channel
+
+void OPL_NoteOff(song_t *csf, int c);
+void OPL_HertzTouch(song_t *csf, int c, int Hertz, int keyoff); // also for pitch bending
+void OPL_Touch(song_t *csf, int c, unsigned Vol);
+void OPL_Pan(song_t *csf, int c, int val);
+void OPL_Patch(song_t *csf, int c, const unsigned char *D);
+void OPL_Reset(song_t *csf);
+int OPL_Detect(song_t *csf);
+void OPL_Close(song_t *csf);
 
 /*************/
 
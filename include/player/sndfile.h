@@ -228,8 +228,10 @@
 //#define SNDMIX_MAXDEFAULTPAN  0x80000 // (no longer) Used by the MOD loader
 #define SNDMIX_MUTECHNMODE      0x100000 // Notes are not played on muted channels
 #define SNDMIX_NOSURROUND       0x200000 // ignore S91
-//#define SNDMIX_NOMIXING       0x400000
+#define SNDMIX_NOMIXING         0x400000 // run the player without mixing or MIDI output (for seeking)
 #define SNDMIX_NORAMPING        0x800000 // don't apply ramping on volume change (causes clicks)
+#define SNDMIX_FLOATBUS         0x1000000 // do EQ, master volume and headroom in floating point
+#define SNDMIX_FLOATOUTPUT      0x2000000 // 32-bit float samples out, unclipped (implies SNDMIX_FLOATBUS)
 
 enum {
 	SRCMODE_NEAREST,
@@ -526,25 +528,37 @@ extern midi_config_t default_midi_config;
 
 
 extern uint32_t max_voices;
-extern uint32_t global_vu_left, global_vu_right;
 
 extern const song_note_t blank_pattern[64 * 64];
 extern const song_note_t *blank_note;
 
 
+typedef struct {
+	float a0, a1, a2, b1, b2;
+	float x1, x2, y1, y2;
+	float gain, center_frequency;
+	int   enabled;
+} eq_band;
+
+struct fm_state; // snd_fm.c
+struct gm_state; // snd_gm.c
+
 struct multi_write {
-	int used;
-	void *data;
+	int used; /* set once anything's been mixed into this channel */
+	int mixed; /* set if 'buffer' holds anything for the current block */
+	void *data; /* NULL if this channel isn't being written at all */
 	/* Conveniently, this has the same prototype as disko_write :) */
 	void (*write)(void *data, const uint8_t *buf, size_t bytes);
 	/* this is optimization for channels that haven't had any data yet
 	(nothing to convert/write, just seek ahead in the data stream) */
 	void (*silence)(void *data, long bytes);
-	int buffer[MIXBUFFERSIZE * 2];
+	/* allocated by the mixer the first time a voice plays on this channel */
+	int *buffer;
 };
 
 typedef struct song {
 	int mix_buffer[MIXBUFFERSIZE * 2];
+	float mix_buffer_float[MIXBUFFERSIZE * 2]; // 1.0 = full scale, only used with SNDMIX_FLOATBUS
 
 	song_voice_t voices[MAX_VOICES];                // Channels
 	uint32_t voice_mix[MAX_VOICES];                 // Channels to be mixed
@@ -596,6 +610,15 @@ typedef struct song {
 	uint32_t mix_flags; // SNDMIX_*
 	uint32_t mix_frequency, mix_bits_per_sample, mix_channels;
 
+	// mixer state -- kept per song so that several songs can be rendered at once
+	uint32_t volume_ramp_samples;
+	float mix_headroom; // gain for the float bus (1.0 = none)
+	uint32_t vu_left, vu_right; // peak levels from the last csf_read
+	int32_t dry_rofs_vol, dry_lofs_vol;
+	eq_band eq[MAX_EQ_BANDS * 2];
+	struct fm_state *fm; // OPL chip (snd_fm.c), NULL until csf_init_player
+	struct gm_state *gm; // MIDI channel allocation (snd_gm.c), ditto
+
 	int patloop; // effects.c: need this for stupid pattern break compatibility
 
 	// noise reduction filter
@@ -608,17 +631,51 @@ typedef struct song {
 
 	// multi-write stuff -- NULL if no multi-write is in progress, else array of one struct per channel
 	struct multi_write *multi_write;
+
+	// sample data that hasn't been read yet, indexed by sample number -- NULL if none (see csf_defer_samples)
+	struct song_sample_read *deferred_samples;
 } song_t;
 
 song_note_t *csf_allocate_pattern(uint32_t rows);
 void csf_free_pattern(void *pat);
 signed char *csf_allocate_sample(uint32_t nbytes);
-void csf_free_sample(void *p);
+void csf_free_sample(void *p); // only actually frees it once the last reference is gone
+signed char *csf_ref_sample(signed char *p); // another reference to the same data, for csf_free_sample
+// if there's already a pooled buffer with the same contents, share that instead; either way, smp->data is
+// pooled afterwards (csf_read_sample does this for every sample it reads)
+void csf_pool_sample(song_sample_t *smp);
+// give smp a buffer of its own if anything else is using its data; call this before writing to it
+void csf_unshare_sample(song_t *csf, song_sample_t *smp);
+// a number that's different for every buffer, and changes every time csf_unshare_sample says it's about to be
+// written to; anything worked out from the sample data is still good for as long as this stays the same
+uint32_t csf_sample_serial(const signed char *p);
 song_instrument_t *csf_allocate_instrument(void);
 void csf_init_instrument(song_instrument_t *ins, int samp);
 void csf_free_instrument(song_instrument_t *p);
 
 uint32_t csf_read_sample(song_sample_t *sample, uint32_t flags, const void *filedata, uint32_t datalength);
+
+// A sample read queued up by a loader, for handing to csf_read_samples once it's found all of them.
+// The data has to stay put until csf_read_samples returns.
+typedef struct song_sample_read {
+	song_sample_t *sample;
+	uint32_t flags;
+	const void *data;
+	uint32_t length;
+	// for data csf_read_sample can't handle itself (e.g. FLAC); NULL means csf_read_sample
+	uint32_t (*read)(song_sample_t *sample, uint32_t flags, const void *data, uint32_t length);
+} song_sample_read_t;
+
+// Same as calling csf_read_sample on each one, but spread over several threads when there's enough data
+// to make it worthwhile. This sorts the array (largest sample first) and doesn't report how much of
+// each sample's data was used, so it's only useful to loaders that already know where every sample is.
+void csf_read_samples(song_sample_read_t *reads, int count);
+
+// Instead of reading the samples, just remember where their data is and read each one the first time
+// csf_load_deferred_sample is called for it. The sample lengths and flags are filled in right away, but
+// the data stays NULL until then, and whatever the reads point to has to outlive the song.
+void csf_defer_samples(song_t *csf, song_sample_read_t *reads, int count);
+void csf_load_deferred_sample(song_t *csf, song_sample_t *smp);
 uint32_t csf_write_sample(disko_t *fp, song_sample_t *sample, uint32_t flags, uint32_t maxlengthmask);
 void csf_adjust_sample_loop(song_sample_t *sample);
 
@@ -656,6 +713,8 @@ int csf_set_wave_config(song_t *csf, uint32_t rate, uint32_t bits, uint32_t chan
 
 // Mixer Config
 int csf_init_player(song_t *csf, int reset); // bReset=false
+// picks the mixing routines for the cpu; call it once at startup, before anything gets mixed
+void csf_init_mixer(void);
 int csf_set_resampling_mode(song_t *csf, uint32_t mode); // SRCMODE_XXXX
 
 
@@ -663,8 +722,27 @@ int csf_set_resampling_mode(song_t *csf, uint32_t mode); // SRCMODE_XXXX
 unsigned int csf_read(song_t *csf, void *v_buffer, unsigned int bufsize);
 int csf_process_tick(song_t *csf);
 int csf_read_note(song_t *csf);
+int csf_skip_tick(song_t *csf);
 
 // snd_fx
+
+/* Where csf_get_length is while it walks through the song. The walk only ever
+moves forward through the orderlist, so a copy taken before the first row of an
+order is enough to pick it up again from there. */
+struct csf_length_state {
+	uint32_t elapsed; // msec, up to the start of the current row
+	uint32_t order, row; // the row csf_length_next_row last moved to
+	uint32_t next_order, next_row;
+	uint32_t speed, tempo;
+	uint32_t patloop[MAX_CHANNELS];
+	uint8_t mem_tempo[MAX_CHANNELS];
+	uint64_t setloop; // bitmask
+	const song_note_t *pdata;
+};
+
+void csf_length_init(song_t *csf, struct csf_length_state *st);
+int csf_length_next_row(song_t *csf, struct csf_length_state *st); // 0 at the end of the song
+void csf_length_run_row(struct csf_length_state *st); // add the current row's duration to st->elapsed
 unsigned int csf_get_length(song_t *csf); // (in seconds)
 void csf_instrument_change(song_t *csf, song_voice_t *chn, uint32_t instr, int porta, int instr_column);
 void csf_note_change(song_t *csf, uint32_t chan, int note, int porta, int retrig, int have_inst);
@@ -691,6 +769,7 @@ unsigned long calc_halftone(unsigned long hz, int rel);
 // sndfile
 song_t *csf_allocate(void);
 void csf_free(song_t *csf);
+void csf_free_multi_write(song_t *csf); /* free the multi_write array and its buffers */
 
 void csf_destroy(song_t *csf); /* erase everything -- equiv. to new song */
 int csf_destroy_sample(song_t *csf, uint32_t smpnum);
@@ -700,6 +779,27 @@ void csf_stop_sample(song_t *csf, song_sample_t *smp);
 void csf_reset_midi_cfg(song_t *csf);
 void csf_copy_midi_cfg(song_t *dest, song_t *src);
 void csf_set_current_order(song_t *csf, uint32_t position);
+
+/* Where the player is, and everything its channels remember: enough to pick
+playback up again from the same place. Only voices[0..num_voices) are used, so
+a saved state can be copied into a smaller allocation. */
+struct csf_play_state {
+	uint32_t flags; // SONG_FIRSTTICK
+	uint32_t buffer_count, tick_count, frame_delay;
+	int32_t row_count;
+	uint32_t current_speed, current_tempo;
+	uint32_t process_row, row, break_row;
+	uint32_t current_pattern, current_order, process_order;
+	uint32_t current_global_volume;
+	int patloop;
+	uint32_t num_voices;
+	uint16_t voice_index[MAX_VOICES];
+	uint16_t voice_sample[MAX_VOICES]; // ptr_sample as a number, since the state may be from a copy of the song
+	song_voice_t voices[MAX_VOICES];
+};
+
+size_t csf_save_play_state(song_t *csf, struct csf_play_state *st); // returns the size actually used
+void csf_restore_play_state(song_t *csf, const struct csf_play_state *st);
 void csf_loop_pattern(song_t *csf, int pattern, int start_row);
 void csf_reset_playmarks(song_t *csf);
 
@@ -39,6 +39,8 @@ struct _slurp_struct {
 	void (*closure)(slurp_t *);
 	/* for reading streams */
 	size_t pos;
+	/* if this is set, only part of the file is in memory at a time (see slurp_stream) */
+	struct slurp_window *window;
 };
 
 /* --------------------------------------------------------------------- */
@@ -49,6 +51,22 @@ returned by stat -- this can be used to read only part of a file, or if the file
 a stat structure is not available. */
 slurp_t *slurp(const char *filename, struct stat *buf, size_t size);
 
+/* read just enough of a file to tell what it is: the first 'head' bytes, followed immediately by the last
+'tail' bytes. if the file isn't any bigger than that, this is the same as slurping the whole thing.
+MMCMP-packed files are only unpacked far enough to produce 'head' bytes, and 'tail' is ignored for them. */
+slurp_t *slurp_head(const char *filename, struct stat *buf, size_t head, size_t tail);
+
+/* open a file for reading a piece at a time, rather than loading all of it up front. at most 'window' bytes
+(or a reasonable default, if zero) are kept in memory, except where a larger slurp_peek needs them. this
+means that 'data' is NOT the file's contents -- only the stdio-style functions below work on a streamed
+slurp_t. pipes (including "-" for stdin) can be streamed, but can't seek backward past the start of the
+window, and 'length' is SIZE_MAX for them until the end of the input has been reached. */
+slurp_t *slurp_stream(const char *filename, struct stat *buf, size_t window);
+
+/* read everything that's left of a streamed file into memory, after which it's the same as if it had been
+slurped to begin with. this fails (with errno set to ESPIPE) if a pipe has already been read past its start. */
+int slurp_unstream(slurp_t *t);
+
 void unslurp(slurp_t * t);
 
 #ifdef SCHISM_WIN32
@@ -122,6 +122,12 @@ const char *fmt_strerror(int n);
 
 int song_save(const char *file, const char *type); // IT, S3M
 int song_export(const char *file, const char *type); // WAV
+// load 'infile' and write it straight out to 'outfile', without touching the current song or the UI.
+// multi-file exports are rendered on num_threads threads (0 = one per cpu)
+int song_render(const char *infile, const char *outfile, const char *type, int num_threads);
+// same, for a whole bunch of files (or directories full of them) at once, spread across
+// num_threads threads (0 = one per cpu). the output files are named after the input ones
+int song_render_batch(char **paths, int num_paths, const char *outdir, const char *type, int num_threads);
 
 /* 'num' is only for status text feedback -- all of the sample's data is taken from 'smp'.
 this provides an eventual mechanism for saving samples modified from disk (not yet implemented) */
@@ -150,9 +156,22 @@ char *song_get_title(void);     // editable
 char *song_get_message(void);   // editable
 
 // returned value = seconds
+unsigned int song_get_length(void);
 unsigned int song_get_length_to(int order, int row);
 void song_get_at_time(unsigned int seconds, int *order, int *row);
 
+/* the above work from a cached time index. orderlist edits and pattern
+ * resizes are noticed on their own, but anything that changes the contents
+ * of a pattern in place should call this (pattern < 0 => all of them, which
+ * is also what replacing the whole song needs) */
+void song_pattern_changed(int pattern);
+
+/* the player state at the start of the given row, got by playing the song up
+ * to there without mixing (and remembered per order, so it's quick after the
+ * first time). NULL if playing from the top never gets to that row. free()
+ * the result after handing it to csf_restore_play_state */
+struct csf_play_state *song_get_seek_state(int order, int row);
+
 // gee. can't just use malloc/free... no, that would be too simple.
 signed char *song_sample_allocate(int bytes);
 void song_sample_free(signed char *data);
@@ -249,7 +268,7 @@ int audio_init(const char *driver, const char *device);
 int audio_reinit(const char *device);
 
 /* eq */
-void song_init_eq(int do_reset, uint32_t mix_freq);
+void song_init_eq(song_t *csf, int do_reset, uint32_t mix_freq);
 
 /* --------------------------------------------------------------------- */
 /* playback */
@@ -352,6 +371,27 @@ song_voice_t *song_get_mix_channel(int n);
  * it's kind of ugly, but it'll do... i hope :) */
 int song_get_mix_state(unsigned int **channel_list);
 
+/* a lightweight copy of a voice that was being mixed, as of the last buffer
+ * the audio thread rendered. the pointers are only good for comparing with
+ * sample->data or an instrument; don't dereference them. */
+typedef struct song_playing_voice {
+	const signed char *sample_data;
+	const song_instrument_t *instrument;
+	uint32_t position;
+	uint32_t flags;
+	int32_t final_volume;
+	int vol_env_position;
+	int pan_env_position;
+	int pitch_env_position;
+	int strike;
+} song_playing_voice_t;
+
+/* like song_get_mix_state, but lock-free: copies the voices that were being
+ * mixed into voices[] (which should have room for MAX_VOICES) and returns
+ * how many there were. use this from the ui instead of walking the mixer's
+ * own voices with the audio locked. */
+int song_get_playing_voices(song_playing_voice_t voices[]);
+
 /* --------------------------------------------------------------------- */
 /* rearranging stuff */
 
@@ -38,6 +38,9 @@ struct vgamem_overlay {
 };
 
 void vgamem_flip(void);
+/* which character rows are different after the last vgamem_flip(s) than they were before; sets each of
+'rows' to 0 or 1, and returns how many are set. the rows are all clean again afterward. */
+int vgamem_dirty_rows(uint8_t rows[50]);
 
 void vgamem_ovl_alloc(struct vgamem_overlay *n);
 void vgamem_ovl_apply(struct vgamem_overlay *n);
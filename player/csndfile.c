@@ -29,9 +29,12 @@
 
 #include "bswap.h"
 #include "player/sndfile.h"
+#include "player/snd_fm.h"
+#include "player/snd_gm.h"
 #include "log.h"
 #include "util.h"
 #include "fmt.h" // for it_decompress8 / it_decompress16
+#include "sdlmain.h" // for csf_read_samples' threads
 
 
 static void _csf_reset(song_t *csf)
@@ -96,6 +99,8 @@ song_t *csf_allocate(void)
 {
 	song_t *csf = mem_calloc(1, sizeof(song_t));
 	_csf_reset(csf);
+	csf->volume_ramp_samples = 64;
+	csf->mix_headroom = 1.0f;
 	return csf;
 }
 
@@ -103,10 +108,22 @@ void csf_free(song_t *csf)
 {
 	if (csf) {
 		csf_destroy(csf);
+		OPL_Close(csf);
+		GM_Close(csf);
 		free(csf);
 	}
 }
 
+void csf_free_multi_write(song_t *csf)
+{
+	if (!csf->multi_write)
+		return;
+	for (int n = 0; n < MAX_CHANNELS; n++)
+		free(csf->multi_write[n].buffer);
+	free(csf->multi_write);
+	csf->multi_write = NULL;
+}
+
 
 static void _init_envelope(song_envelope_t *env, int n)
 {
@@ -172,6 +189,8 @@ void csf_destroy(song_t *csf)
 			csf->instruments[i] = NULL;
 		}
 	}
+	free(csf->deferred_samples);
+	csf->deferred_samples = NULL;
 
 	_csf_reset(csf);
 }
@@ -186,19 +205,182 @@ void csf_free_pattern(void *pat)
 	free(pat);
 }
 
+/* --------------------------------------------------------------------------------------------------------- */
+/* Sample data is reference counted, so that identical samples in different songs, instruments, the library
+and so on can all share one buffer. Buffers that have been through csf_pool_sample are also kept in a hash
+table, keyed by their contents (guard bytes and all), so loading the same data again finds the copy that's
+already there. Anything that writes to sample data has to call csf_unshare_sample first. */
+
+struct sample_buffer {
+	struct sample_buffer *next; // next in the pool's hash chain
+	uint32_t refs;
+	uint32_t nbytes;
+	uint32_t hash;
+	uint32_t serial; // see csf_sample_serial
+	int pooled;
+};
+
+// keep the sample data as aligned as it was before there was a header in front of it
+#define SAMPLE_BUFFER_HEADER ((sizeof(struct sample_buffer) + 15) & ~15)
+#define SAMPLE_POOL_SIZE 1024
+
+static struct sample_buffer *sample_pool[SAMPLE_POOL_SIZE];
+static SDL_SpinLock sample_pool_lock = 0; // for the pool and every buffer's reference count
+static SDL_atomic_t sample_serial = {0};
+
+static struct sample_buffer *sample_buffer_of(const void *p)
+{
+	return (struct sample_buffer *) ((const char *) p - 16 - SAMPLE_BUFFER_HEADER);
+}
+
+// the whole allocation after the header, including the guard bytes on either side
+static unsigned char *sample_buffer_bytes(struct sample_buffer *buf)
+{
+	return (unsigned char *) buf + SAMPLE_BUFFER_HEADER;
+}
+
+static uint32_t sample_buffer_hash(struct sample_buffer *buf)
+{
+	const unsigned char *p = sample_buffer_bytes(buf);
+	size_t i, len = buf->nbytes + 32;
+	uint64_t h = UINT64_C(0xcbf29ce484222325) ^ len, w;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * UINT64_C(0x100000001b3);
+		h ^= h >> 29;
+	}
+	for (; i < len; i++)
+		h = (h ^ p[i]) * UINT64_C(0x100000001b3);
+	return (uint32_t) (h ^ (h >> 32));
+}
+
+// sample_pool_lock must be held
+static void sample_pool_unlink(struct sample_buffer *buf)
+{
+	struct sample_buffer **link = sample_pool + (buf->hash % SAMPLE_POOL_SIZE);
+
+	while (*link != buf)
+		link = &(*link)->next;
+	*link = buf->next;
+	buf->next = NULL;
+	buf->pooled = 0;
+}
+
 signed char *csf_allocate_sample(uint32_t nbytes)
 {
 	/* Sinc interpolation can look forwards or backwards
 	 * 4 samples; the maximum sample size for Schism is
 	 * 4 bytes per sample (16-bit stereo, 2 * 2). 4 * 4 = 16,
 	 * so allocate 16 extra bytes before and after the buffer */
-	return (signed char*)mem_calloc(1, nbytes + 32) + 16;
+	struct sample_buffer *buf = mem_calloc(1, SAMPLE_BUFFER_HEADER + nbytes + 32);
+
+	buf->refs = 1;
+	buf->nbytes = nbytes;
+	buf->serial = SDL_AtomicAdd(&sample_serial, 1) + 1;
+	return (signed char *) sample_buffer_bytes(buf) + 16;
+}
+
+uint32_t csf_sample_serial(const signed char *p)
+{
+	return p ? sample_buffer_of(p)->serial : 0;
 }
 
 void csf_free_sample(void *p)
 {
-	if (p)
-		free((signed char*)p - 16);
+	struct sample_buffer *buf;
+
+	if (!p)
+		return;
+	buf = sample_buffer_of(p);
+	SDL_AtomicLock(&sample_pool_lock);
+	if (--buf->refs) {
+		SDL_AtomicUnlock(&sample_pool_lock);
+		return;
+	}
+	if (buf->pooled)
+		sample_pool_unlink(buf);
+	SDL_AtomicUnlock(&sample_pool_lock);
+	free(buf);
+}
+
+signed char *csf_ref_sample(signed char *p)
+{
+	if (p) {
+		SDL_AtomicLock(&sample_pool_lock);
+		sample_buffer_of(p)->refs++;
+		SDL_AtomicUnlock(&sample_pool_lock);
+	}
+	return p;
+}
+
+void csf_pool_sample(song_sample_t *smp)
+{
+	struct sample_buffer *buf, *other;
+	uint32_t hash;
+
+	if (!smp->data)
+		return;
+	buf = sample_buffer_of(smp->data);
+	if (buf->pooled)
+		return;
+	hash = sample_buffer_hash(buf);
+
+	SDL_AtomicLock(&sample_pool_lock);
+	for (other = sample_pool[hash % SAMPLE_POOL_SIZE]; other; other = other->next) {
+		if (other->hash == hash && other->nbytes == buf->nbytes) {
+			other->refs++;
+			break;
+		}
+	}
+	SDL_AtomicUnlock(&sample_pool_lock);
+
+	// compare outside the lock; samples can be big, and other threads might be loading too
+	if (other && memcmp(sample_buffer_bytes(other), sample_buffer_bytes(buf), buf->nbytes + 32) == 0) {
+		csf_free_sample(smp->data);
+		smp->data = (signed char *) sample_buffer_bytes(other) + 16;
+		return;
+	}
+	if (other) // a hash collision; not worth looking any further
+		csf_free_sample(sample_buffer_bytes(other) + 16);
+
+	SDL_AtomicLock(&sample_pool_lock);
+	buf->hash = hash;
+	buf->pooled = 1;
+	buf->next = sample_pool[hash % SAMPLE_POOL_SIZE];
+	sample_pool[hash % SAMPLE_POOL_SIZE] = buf;
+	SDL_AtomicUnlock(&sample_pool_lock);
+}
+
+void csf_unshare_sample(song_t *csf, song_sample_t *smp)
+{
+	struct sample_buffer *buf;
+	signed char *data;
+	int n;
+
+	if (!smp->data)
+		return;
+	buf = sample_buffer_of(smp->data);
+	SDL_AtomicLock(&sample_pool_lock);
+	if (buf->refs == 1) {
+		// all ours already, but once it's written it won't match its hash any more
+		if (buf->pooled)
+			sample_pool_unlink(buf);
+		buf->serial = SDL_AtomicAdd(&sample_serial, 1) + 1;
+		SDL_AtomicUnlock(&sample_pool_lock);
+		return;
+	}
+	SDL_AtomicUnlock(&sample_pool_lock);
+
+	data = csf_allocate_sample(buf->nbytes);
+	memcpy(data - 16, smp->data - 16, buf->nbytes + 32);
+	// anything still playing the old data carries on with the new, since the other owners might free it
+	for (n = 0; n < MAX_VOICES; n++) {
+		if (csf->voices[n].current_sample_data == smp->data)
+			csf->voices[n].current_sample_data = data;
+	}
+	csf_free_sample(smp->data);
+	smp->data = data;
 }
 
 void csf_forget_history(song_t *csf)
@@ -444,23 +626,28 @@ int csf_set_resampling_mode(song_t *csf, uint32_t mode)
 // This used to use some retarded positioning based on the total number of rows elapsed, which is useless.
 // However, the only code calling this function is in this file, to set it to the start, so I'm optimizing
 // out the row count.
-static void set_current_pos_0(song_t *csf)
+static void reset_voice(song_t *csf, uint32_t i)
 {
-	song_voice_t *v = csf->voices;
-	for (uint32_t i = 0; i < MAX_VOICES; i++, v++) {
-		memset(v, 0, sizeof(*v));
-		v->note = v->new_note = 1;
-		v->cutoff = 0x7F;
-		v->volume = 256;
-		if (i < MAX_CHANNELS) {
-			v->panning = csf->channels[i].panning;
-			v->global_volume = csf->channels[i].volume;
-			v->flags = csf->channels[i].flags;
-		} else {
-			v->panning = 128;
-			v->global_volume = 64;
-		}
+	song_voice_t *v = csf->voices + i;
+
+	memset(v, 0, sizeof(*v));
+	v->note = v->new_note = 1;
+	v->cutoff = 0x7F;
+	v->volume = 256;
+	if (i < MAX_CHANNELS) {
+		v->panning = csf->channels[i].panning;
+		v->global_volume = csf->channels[i].volume;
+		v->flags = csf->channels[i].flags;
+	} else {
+		v->panning = 128;
+		v->global_volume = 64;
 	}
+}
+
+static void set_current_pos_0(song_t *csf)
+{
+	for (uint32_t i = 0; i < MAX_VOICES; i++)
+		reset_voice(csf, i);
 	csf->current_global_volume = csf->initial_global_volume;
 	csf->current_speed = csf->initial_speed;
 	csf->current_tempo = csf->initial_tempo;
@@ -500,6 +687,98 @@ void csf_set_current_order(song_t *csf, uint32_t position)
 	csf->flags &= ~(SONG_PATTERNLOOP|SONG_ENDREACHED);
 }
 
+size_t csf_save_play_state(song_t *csf, struct csf_play_state *st)
+{
+	uint32_t n;
+
+	st->flags = csf->flags & SONG_FIRSTTICK;
+	st->buffer_count = csf->buffer_count;
+	st->tick_count = csf->tick_count;
+	st->frame_delay = csf->frame_delay;
+	st->row_count = csf->row_count;
+	st->current_speed = csf->current_speed;
+	st->current_tempo = csf->current_tempo;
+	st->process_row = csf->process_row;
+	st->row = csf->row;
+	st->break_row = csf->break_row;
+	st->current_pattern = csf->current_pattern;
+	st->current_order = csf->current_order;
+	st->process_order = csf->process_order;
+	st->current_global_volume = csf->current_global_volume;
+	st->patloop = csf->patloop;
+
+	// all of the pattern channels, but only the background voices that are still going
+	st->num_voices = 0;
+	for (n = 0; n < MAX_VOICES; n++) {
+		if (n < MAX_CHANNELS || csf->voices[n].length) {
+			song_sample_t *smp = csf->voices[n].ptr_sample;
+			st->voice_index[st->num_voices] = n;
+			st->voice_sample[st->num_voices] = (smp >= csf->samples && smp <= csf->samples + MAX_SAMPLES)
+				? smp - csf->samples : 0;
+			st->voices[st->num_voices++] = csf->voices[n];
+		}
+	}
+
+	return offsetof(struct csf_play_state, voices) + st->num_voices * sizeof(song_voice_t);
+}
+
+static int is_song_instrument(song_t *csf, song_instrument_t *ins)
+{
+	for (int n = 1; n <= MAX_INSTRUMENTS; n++)
+		if (csf->instruments[n] == ins)
+			return 1;
+	return 0;
+}
+
+void csf_restore_play_state(song_t *csf, const struct csf_play_state *st)
+{
+	uint32_t n, v;
+
+	csf->flags = (csf->flags & ~SONG_FIRSTTICK) | st->flags;
+	csf->buffer_count = st->buffer_count;
+	csf->tick_count = st->tick_count;
+	csf->frame_delay = st->frame_delay;
+	csf->row_count = st->row_count;
+	csf->current_speed = st->current_speed;
+	csf->current_tempo = st->current_tempo;
+	csf->process_row = st->process_row;
+	csf->row = st->row;
+	csf->break_row = st->break_row;
+	csf->current_pattern = st->current_pattern;
+	csf->current_order = st->current_order;
+	csf->process_order = st->process_order;
+	csf->current_global_volume = st->current_global_volume;
+	csf->patloop = st->patloop;
+
+	for (n = MAX_CHANNELS; n < MAX_VOICES; n++)
+		reset_voice(csf, n);
+
+	for (v = 0; v < st->num_voices; v++) {
+		song_voice_t *chan = csf->voices + st->voice_index[v];
+		uint32_t master;
+
+		*chan = st->voices[v];
+
+		/* the state may be older than the last sample or instrument edit, so don't trust any
+		pointers that don't still belong to the song; losing a note beats playing freed memory */
+		if (chan->ptr_instrument && !is_song_instrument(csf, chan->ptr_instrument))
+			chan->ptr_instrument = NULL;
+		chan->ptr_sample = st->voice_sample[v] ? csf->samples + st->voice_sample[v] : NULL;
+		if (chan->current_sample_data && !(chan->ptr_sample
+		    && chan->current_sample_data == chan->ptr_sample->data
+		    && chan->length <= chan->ptr_sample->length)) {
+			chan->current_sample_data = NULL;
+			chan->length = 0;
+		}
+
+		// mutes belong to the user, not the song
+		master = (st->voice_index[v] < MAX_CHANNELS) ? st->voice_index[v] : chan->master_channel - 1;
+		chan->flags &= ~CHN_MUTE;
+		if (master < MAX_CHANNELS)
+			chan->flags |= csf->channels[master].flags & CHN_MUTE;
+	}
+}
+
 void csf_reset_playmarks(song_t *csf)
 {
 	int n;
@@ -597,6 +876,8 @@ uint32_t csf_write_sample(disko_t *fp, song_sample_t *sample, uint32_t flags, ui
 	case SF_PCMS:
 		break;
 	case SF_PCMD:
+	case SF_IT214:
+	case SF_IT215:
 		if ((flags & SF_CHN_MASK) == SF_SS || (flags & SF_CHN_MASK) == SF_M)
 			break;
 		/* fallthrough */
@@ -613,6 +894,18 @@ uint32_t csf_write_sample(disko_t *fp, song_sample_t *sample, uint32_t flags, ui
 
 	// No point buffering the processing here -- the disk output already SHOULD have a 64kb buffer
 	switch (flags & SF_ENC_MASK) {
+	case SF_IT214:
+	case SF_IT215:
+		// each channel is compressed separately, one after the other (see csf_read_sample)
+		for (pos = 0, channel = 0; channel < stride; channel++) {
+			if ((flags & SF_BIT_MASK) == SF_16)
+				pos += it_compress16(fp, (const int16_t *) sample->data + channel, len,
+						(flags & SF_ENC_MASK) == SF_IT215, stride);
+			else
+				pos += it_compress8(fp, (const int8_t *) sample->data + channel, len,
+						(flags & SF_ENC_MASK) == SF_IT215, stride);
+		}
+		return pos;
 	case SF_PCMU:
 	case SF_PCMS:
 		if ((flags & SF_BIT_MASK) == SF_16) {
@@ -1187,9 +1480,130 @@ uint32_t csf_read_sample(song_sample_t *sample, uint32_t flags, const void *file
 		return 0;
 	}
 	csf_adjust_sample_loop(sample);
+	csf_pool_sample(sample);
 	return len;
 }
 
+/* --------------------------------------------------------------------------------------------------------- */
+/* Reading a whole song's worth of samples at once. Each sample is decoded independently of the others, so
+once a loader knows where all the data is, the work can be spread across however many cores there are. */
+
+#define SAMPLE_READ_MAX_THREADS 8
+/* with fewer sample frames than this, starting the threads costs more than it saves */
+#define SAMPLE_READ_MIN_FRAMES (256 * 1024)
+
+struct sample_reader {
+	song_sample_read_t *reads;
+	int count;
+	SDL_atomic_t next;
+};
+
+static void sample_reader_run(struct sample_reader *reader)
+{
+	int n;
+
+	while ((n = SDL_AtomicAdd(&reader->next, 1)) < reader->count) {
+		song_sample_read_t *rd = reader->reads + n;
+		(rd->read ? rd->read : csf_read_sample)(rd->sample, rd->flags, rd->data, rd->length);
+	}
+}
+
+static int sample_reader_thread(void *data)
+{
+	sample_reader_run(data);
+	return 0;
+}
+
+/* biggest first, so a huge sample at the end of the list doesn't leave one thread working on it alone */
+static int sample_read_cmp(const void *a, const void *b)
+{
+	const song_sample_read_t *ra = a, *rb = b;
+	uint32_t la = ra->sample->length, lb = rb->sample->length;
+
+	return (la < lb) - (la > lb);
+}
+
+void csf_read_samples(song_sample_read_t *reads, int count)
+{
+	SDL_Thread *threads[SAMPLE_READ_MAX_THREADS];
+	struct sample_reader reader;
+	uint64_t total = 0;
+	int n, num_threads = 0;
+
+	if (count < 1)
+		return;
+
+	reader.reads = reads;
+	reader.count = count;
+	SDL_AtomicSet(&reader.next, 0);
+
+	for (n = 0; n < count; n++)
+		total += reads[n].sample->length;
+	if (count > 1 && total >= SAMPLE_READ_MIN_FRAMES) {
+		qsort(reads, count, sizeof(*reads), sample_read_cmp);
+
+		/* this thread does its share too, so it's one fewer to start */
+		num_threads = MIN(CLAMP(SDL_GetCPUCount(), 1, SAMPLE_READ_MAX_THREADS), count) - 1;
+		for (n = 0; n < num_threads; n++) {
+			threads[n] = SDL_CreateThread(sample_reader_thread, "Sample reader", &reader);
+			if (!threads[n])
+				break;
+		}
+		num_threads = n;
+	}
+
+	sample_reader_run(&reader);
+
+	for (n = 0; n < num_threads; n++)
+		SDL_WaitThread(threads[n], NULL);
+}
+
+/* --------------------------------------------------------------------------------------------------------- */
+/* Deferred samples: rather than decoding the data right away, remember where it is and do it the first time
+somebody actually asks for the sample. The file data has to stay put until then, so this is only any good
+for songs whose file is kept open for as long as the song is around, like the sample library. */
+
+void csf_defer_samples(song_t *csf, song_sample_read_t *reads, int count)
+{
+	int n;
+
+	if (count < 1)
+		return;
+	if (!csf->deferred_samples)
+		csf->deferred_samples = mem_calloc(MAX_SAMPLES, sizeof(song_sample_read_t));
+
+	for (n = 0; n < count; n++) {
+		song_sample_t *smp = reads[n].sample;
+
+		// fill in what csf_read_sample would have, so the sample can be listed without loading it
+		if (smp->length > MAX_SAMPLE_LENGTH) smp->length = MAX_SAMPLE_LENGTH;
+		smp->flags &= ~(CHN_16BIT|CHN_STEREO);
+		switch (reads[n].flags & SF_BIT_MASK) {
+		case SF_16: case SF_24: case SF_32:
+			smp->flags |= CHN_16BIT;
+		}
+		switch (reads[n].flags & SF_CHN_MASK) {
+		case SF_SI: case SF_SS:
+			smp->flags |= CHN_STEREO;
+		}
+
+		csf->deferred_samples[smp - csf->samples] = reads[n];
+	}
+}
+
+void csf_load_deferred_sample(song_t *csf, song_sample_t *smp)
+{
+	song_sample_read_t *rd;
+
+	if (!csf->deferred_samples || smp < csf->samples || smp >= csf->samples + MAX_SAMPLES)
+		return;
+	rd = csf->deferred_samples + (smp - csf->samples);
+	if (!rd->sample)
+		return;
+	(rd->read ? rd->read : csf_read_sample)(rd->sample, rd->flags, rd->data, rd->length);
+	rd->sample = NULL;
+}
+
 /* --------------------------------------------------------------------------------------------------------- */
 
 void csf_adjust_sample_loop(song_sample_t *sample)
@@ -100,11 +100,11 @@ void fx_note_cut(song_t *csf, uint32_t nchan, int clear_note)
 
 	if (chan->flags & CHN_ADLIB) {
 		//Do this only if really an adlib chan. Important!
-		OPL_NoteOff(nchan);
-		OPL_Touch(nchan, 0);
+		OPL_NoteOff(csf, nchan);
+		OPL_Touch(csf, nchan, 0);
 	}
-	GM_KeyOff(nchan);
-	GM_Touch(nchan, 0);
+	GM_KeyOff(csf, nchan);
+	GM_Touch(csf, nchan, 0);
 }
 
 void fx_key_off(song_t *csf, uint32_t nchan)
@@ -115,9 +115,9 @@ void fx_key_off(song_t *csf, uint32_t nchan)
 		tick_count, (unsigned)nchan, chan->flags);*/
 	if (chan->flags & CHN_ADLIB) {
 		//Do this only if really an adlib chan. Important!
-		OPL_NoteOff(nchan);
+		OPL_NoteOff(csf, nchan);
 	}
-	GM_KeyOff(nchan);
+	GM_KeyOff(csf, nchan);
 
 	song_instrument_t *penv = (csf->flags & SONG_INSTRUMENTMODE) ? chan->ptr_instrument : NULL;
 
@@ -799,7 +799,7 @@ void csf_midi_send(song_t *csf, const unsigned char *data, unsigned int len, uin
 			}
 			break;
 		}
-	} else if (!fake && csf_midi_out_raw) {
+	} else if (!fake && csf_midi_out_raw && !(csf->mix_flags & SNDMIX_NOMIXING)) {
 		/* okay, this is kind of how it works.
 		we pass buffer_count as here because while
 			1000 * ((8((buffer_size/2) - buffer_count)) / sample_rate)
@@ -1034,141 +1034,155 @@ void csf_process_midi_macro(song_t *csf, uint32_t nchan, const char * macro, uin
 # error csf_get_length assumes 64 channels
 #endif
 
-unsigned int csf_get_length(song_t *csf)
+void csf_length_init(song_t *csf, struct csf_length_state *st)
 {
-	uint32_t elapsed = 0, row = 0, next_row = 0, cur_order = 0, next_order = 0, pat = csf->orderlist[0],
-		speed = csf->initial_speed, tempo = csf->initial_tempo, psize, n;
-	uint32_t patloop[MAX_CHANNELS] = {0};
-	uint8_t mem_tempo[MAX_CHANNELS] = {0};
-	uint64_t setloop = 0; // bitmask
-	const song_note_t *pdata;
-
-	for (;;) {
-		uint32_t speed_count = 0;
-		row = next_row;
-		cur_order = next_order;
-
-		// Check if pattern is valid
-		pat = csf->orderlist[cur_order];
-		while (pat >= MAX_PATTERNS) {
-			// End of song ?
-			if (pat == ORDER_LAST || cur_order >= MAX_ORDERS) {
-				pat = ORDER_LAST; // cause break from outer loop too
-				break;
-			} else {
-				cur_order++;
-				pat = (cur_order < MAX_ORDERS) ? csf->orderlist[cur_order] : ORDER_LAST;
-			}
-			next_order = cur_order;
-		}
-		// Weird stuff?
-		if (pat >= MAX_PATTERNS)
+	memset(st, 0, sizeof(*st));
+	st->speed = csf->initial_speed;
+	st->tempo = csf->initial_tempo;
+}
+
+int csf_length_next_row(song_t *csf, struct csf_length_state *st)
+{
+	uint32_t pat, psize;
+
+	st->row = st->next_row;
+	st->order = st->next_order;
+
+	// Check if pattern is valid
+	pat = csf->orderlist[st->order];
+	while (pat >= MAX_PATTERNS) {
+		// End of song ?
+		if (pat == ORDER_LAST || st->order >= MAX_ORDERS) {
+			pat = ORDER_LAST; // cause break from outer loop too
 			break;
-		pdata = csf->patterns[pat];
-		if (pdata) {
-			psize = csf->pattern_size[pat];
 		} else {
-			pdata = blank_pattern;
-			psize = 64;
-		}
-		// guard against Cxx to invalid row, etc.
-		if (row >= psize)
-			row = 0;
-		// Update next position
-		next_row = row + 1;
-		if (next_row >= psize) {
-			next_order = cur_order + 1;
-			next_row = 0;
+			st->order++;
+			pat = (st->order < MAX_ORDERS) ? csf->orderlist[st->order] : ORDER_LAST;
 		}
+		st->next_order = st->order;
+	}
+	// Weird stuff?
+	if (pat >= MAX_PATTERNS)
+		return 0;
+	st->pdata = csf->patterns[pat];
+	if (st->pdata) {
+		psize = csf->pattern_size[pat];
+	} else {
+		st->pdata = blank_pattern;
+		psize = 64;
+	}
+	// guard against Cxx to invalid row, etc.
+	if (st->row >= psize)
+		st->row = 0;
+	// Update next position
+	st->next_row = st->row + 1;
+	if (st->next_row >= psize) {
+		st->next_order = st->order + 1;
+		st->next_row = 0;
+	}
+	return 1;
+}
 
-		/* muahahaha */
-		if (csf->stop_at_order > -1 && csf->stop_at_row > -1) {
-			if (csf->stop_at_order <= (signed) cur_order && csf->stop_at_row <= (signed) row)
+void csf_length_run_row(struct csf_length_state *st)
+{
+	uint32_t speed_count = 0, n;
+
+	/* This is nasty, but it fixes inaccuracies with SB0 SB1 SB1. (Simultaneous
+	loops in multiple channels are still wildly incorrect, though.) */
+	if (!st->row)
+		st->setloop = ~0;
+	if (st->setloop) {
+		for (n = 0; n < MAX_CHANNELS; n++)
+			if (st->setloop & (1 << n))
+				st->patloop[n] = st->elapsed;
+		st->setloop = 0;
+	}
+	const song_note_t *note = st->pdata + st->row * MAX_CHANNELS;
+	for (n = 0; n < MAX_CHANNELS; note++, n++) {
+		uint32_t param = note->param;
+		switch (note->effect) {
+		case FX_NONE:
+			break;
+		case FX_POSITIONJUMP:
+			st->next_order = param > st->order ? param : st->order + 1;
+			st->next_row = 0;
+			break;
+		case FX_PATTERNBREAK:
+			st->next_order = st->order + 1;
+			st->next_row = param;
+			break;
+		case FX_SPEED:
+			if (param)
+				st->speed = param;
+			break;
+		case FX_TEMPO:
+			if (param)
+				st->mem_tempo[n] = param;
+			else
+				param = st->mem_tempo[n];
+			int d = (param & 0xf);
+			switch (param >> 4) {
+			default:
+				st->tempo = param;
 				break;
-			if (csf->stop_at_time > 0) {
-				/* stupid api decision */
-				if (((elapsed + 500) / 1000) >= csf->stop_at_time) {
-					csf->stop_at_order = cur_order;
-					csf->stop_at_row = row;
-					break;
-				}
-			}
-		}
-
-		/* This is nasty, but it fixes inaccuracies with SB0 SB1 SB1. (Simultaneous
-		loops in multiple channels are still wildly incorrect, though.) */
-		if (!row)
-			setloop = ~0;
-		if (setloop) {
-			for (n = 0; n < MAX_CHANNELS; n++)
-				if (setloop & (1 << n))
-					patloop[n] = elapsed;
-			setloop = 0;
-		}
-		const song_note_t *note = pdata + row * MAX_CHANNELS;
-		for (n = 0; n < MAX_CHANNELS; note++, n++) {
-			uint32_t param = note->param;
-			switch (note->effect) {
-			case FX_NONE:
+			case 0:
+				d = -d;
+			case 1:
+				d = d * (st->speed - 1) + st->tempo;
+				st->tempo = CLAMP(d, 32, 255);
 				break;
-			case FX_POSITIONJUMP:
-				next_order = param > cur_order ? param : cur_order + 1;
-				next_row = 0;
+			}
+			break;
+		case FX_SPECIAL:
+			switch (param >> 4) {
+			case 0x6:
+				speed_count = param & 0x0F;
 				break;
-			case FX_PATTERNBREAK:
-				next_order = cur_order + 1;
-				next_row = param;
+			case 0xb:
+				if (param & 0x0F) {
+					st->elapsed += (st->elapsed - st->patloop[n]) * (param & 0x0F);
+					st->patloop[n] = 0xffffffff;
+					st->setloop = 1;
+				} else {
+					st->patloop[n] = st->elapsed;
+				}
 				break;
-			case FX_SPEED:
-				if (param)
-					speed = param;
+			case 0xe:
+				speed_count = (param & 0x0F) * st->speed;
 				break;
-			case FX_TEMPO:
-				if (param)
-					mem_tempo[n] = param;
-				else
-					param = mem_tempo[n];
-				int d = (param & 0xf);
-				switch (param >> 4) {
-				default:
-					tempo = param;
-					break;
-				case 0:
-					d = -d;
-				case 1:
-					d = d * (speed - 1) + tempo;
-					tempo = CLAMP(d, 32, 255);
-					break;
-				}
+			}
+			break;
+		}
+	}
+	//  sec/tick = 5 / (2 * tempo)
+	// msec/tick = 5000 / (2 * tempo)
+	//           = 2500 / tempo
+	st->elapsed += (st->speed + speed_count) * 2500 / st->tempo;
+}
+
+unsigned int csf_get_length(song_t *csf)
+{
+	struct csf_length_state st;
+
+	csf_length_init(csf, &st);
+	while (csf_length_next_row(csf, &st)) {
+		/* muahahaha */
+		if (csf->stop_at_order > -1 && csf->stop_at_row > -1) {
+			if (csf->stop_at_order <= (signed) st.order && csf->stop_at_row <= (signed) st.row)
 				break;
-			case FX_SPECIAL:
-				switch (param >> 4) {
-				case 0x6:
-					speed_count = param & 0x0F;
-					break;
-				case 0xb:
-					if (param & 0x0F) {
-						elapsed += (elapsed - patloop[n]) * (param & 0x0F);
-						patloop[n] = 0xffffffff;
-						setloop = 1;
-					} else {
-						patloop[n] = elapsed;
-					}
-					break;
-				case 0xe:
-					speed_count = (param & 0x0F) * speed;
+			if (csf->stop_at_time > 0) {
+				/* stupid api decision */
+				if (((st.elapsed + 500) / 1000) >= csf->stop_at_time) {
+					csf->stop_at_order = st.order;
+					csf->stop_at_row = st.row;
 					break;
 				}
-				break;
 			}
 		}
-		//  sec/tick = 5 / (2 * tempo)
-		// msec/tick = 5000 / (2 * tempo)
-		//           = 2500 / tempo
-		elapsed += (speed + speed_count) * 2500 / tempo;
+		csf_length_run_row(&st);
 	}
 
-	return (elapsed + 500) / 1000;
+	return (st.elapsed + 500) / 1000;
 }
 
 
@@ -1628,11 +1642,11 @@ void csf_check_nna(song_t *csf, uint32_t nchan, uint32_t instr, int note, int fo
 		chan->left_volume = chan->right_volume = 0;
 		if (chan->flags & CHN_ADLIB) {
 			//Do this only if really an adlib chan. Important!
-			OPL_NoteOff(nchan);
-			OPL_Touch(nchan, 0);
+			OPL_NoteOff(csf, nchan);
+			OPL_Touch(csf, nchan, 0);
 		}
-		GM_KeyOff(nchan);
-		GM_Touch(nchan, 0);
+		GM_KeyOff(csf, nchan);
+		GM_Touch(csf, nchan, 0);
 		return;
 	}
 	if (instr >= MAX_INSTRUMENTS) instr = 0;
@@ -2284,11 +2298,11 @@ void csf_process_effects(song_t *csf, int firsttick)
 				/* Possibly a better bugfix could be devised. --Bisqwit */
 				if (chan->flags & CHN_ADLIB) {
 					//Do this only if really an adlib chan. Important!
-					OPL_NoteOff(nchan);
-					OPL_Touch(nchan, 0);
+					OPL_NoteOff(csf, nchan);
+					OPL_Touch(csf, nchan, 0);
 				}
-				GM_KeyOff(nchan);
-				GM_Touch(nchan, 0);
+				GM_KeyOff(csf, nchan);
+				GM_Touch(csf, nchan, 0);
 			}
 
 			const int previous_new_note = chan->new_note; 
@@ -2312,11 +2326,11 @@ void csf_process_effects(song_t *csf, int firsttick)
 
 				csf_instrument_change(csf, chan, instr, porta, 1);
 				if (csf->samples[instr].flags & CHN_ADLIB) {
-					OPL_Patch(nchan, csf->samples[instr].adlib_bytes);
+					OPL_Patch(csf, nchan, csf->samples[instr].adlib_bytes);
 				}
 
 				if((csf->flags & SONG_INSTRUMENTMODE) && csf->instruments[instr])
-					GM_DPatch(nchan, csf->instruments[instr]->midi_program,
+					GM_DPatch(csf, nchan, csf->instruments[instr]->midi_program,
 						csf->instruments[instr]->midi_bank,
 						csf->instruments[instr]->midi_channel_mask);
 
@@ -2339,9 +2353,9 @@ void csf_process_effects(song_t *csf, int firsttick)
 					    && chan->new_instrument < MAX_INSTRUMENTS
 					    && csf->instruments[chan->new_instrument]) {
 						if (csf->samples[chan->new_instrument].flags & CHN_ADLIB) {
-							OPL_Patch(nchan, csf->samples[chan->new_instrument].adlib_bytes);
+							OPL_Patch(csf, nchan, csf->samples[chan->new_instrument].adlib_bytes);
 						}
-						GM_DPatch(nchan, csf->instruments[chan->new_instrument]->midi_program,
+						GM_DPatch(csf, nchan, csf->instruments[chan->new_instrument]->midi_program,
 							csf->instruments[chan->new_instrument]->midi_bank,
 							csf->instruments[chan->new_instrument]->midi_channel_mask);
 					}
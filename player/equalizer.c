@@ -30,39 +30,29 @@
 #define EQ_BANDWIDTH    2.0
 #define EQ_ZERO         0.000001
 
-typedef struct {
-    float a0, a1, a2, b1, b2;
-    float x1, x2, y1, y2;
-    float gain, center_frequency;
-    int   enabled;
-} eq_band;
-
-
+static void eq_filter(song_t *csf, eq_band *pbs, int *buffer, unsigned int count)
+{
+	int amt = (!!(csf->mix_channels-1)+1); // if 1, amt is 1, else 2
+	for (unsigned int i = 0; i < count; i+=amt) {
+		float x = buffer[i];
+		float y = pbs->a1 * pbs->x1 +
+			  pbs->a2 * pbs->x2 +
+			  pbs->a0 * x +
+			  pbs->b1 * pbs->y1 +
+			  pbs->b2 * pbs->y2;
 
-//static REAL f2ic = (REAL)(1 << 28);
-//static REAL i2fc = (REAL)(1.0 / (1 << 28));
+		pbs->x2 = pbs->x1;
+		pbs->y2 = pbs->y1;
+		pbs->x1 = x;
+		buffer[i] = y;
+		pbs->y1 = y;
+	}
+}
 
-static eq_band eq[MAX_EQ_BANDS * 2] =
-{
-    // Default: Flat EQ
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   120, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   600, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  1200, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  3000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  6000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 10000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   120, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,   600, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  1200, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  3000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1,  6000, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 10000, 0},
-};
-
-
-static void eq_filter(eq_band *pbs, int *buffer, unsigned int count)
+// same thing, but on the float bus: no rounding to int after every band
+static void eq_filter_float(song_t *csf, eq_band *pbs, float *buffer, unsigned int count)
 {
-	int amt = (!!(audio_settings.channels-1)+1); // if 1, amt is 1, else 2
+	int amt = (!!(csf->mix_channels-1)+1); // if 1, amt is 1, else 2
 	for (unsigned int i = 0; i < count; i+=amt) {
 		float x = buffer[i];
 		float y = pbs->a1 * pbs->x1 +
@@ -97,32 +87,86 @@ void normalize_stereo(song_t *csf, int *buffer, unsigned int count)
 
 void eq_mono(song_t *csf, int *buffer, unsigned int count)
 {
+	eq_band *eq = csf->eq;
+
 	for (unsigned int b = 0; b < MAX_EQ_BANDS; b++)
 	{
 		if (eq[b].enabled && eq[b].gain != 1.0f)
-			eq_filter(&eq[b], buffer, count);
+			eq_filter(csf, &eq[b], buffer, count);
 	}
 }
 
 // XXX: I rolled the two loops into one. Make sure this works.
 void eq_stereo(song_t *csf, int *buffer, unsigned int count)
 {
+	eq_band *eq = csf->eq;
+
 	for (unsigned int b = 0; b < MAX_EQ_BANDS; b++) {
 		int br = b + MAX_EQ_BANDS;
 
 		// Left band
 		if (eq[b].enabled && eq[b].gain != 1.0f)
-			eq_filter(&eq[b], buffer, count << 1);
+			eq_filter(csf, &eq[b], buffer, count << 1);
 
 		// Right band
 		if (eq[br].enabled && eq[br].gain != 1.0f)
-			eq_filter(&eq[br], buffer + 1, count << 1);
+			eq_filter(csf, &eq[br], buffer + 1, count << 1);
+	}
+}
+
+
+/* Fill the float bus from an integer mix buffer (the main one, or a multi-write channel's). Master
+volume (normalize_*) and the headroom gain are folded into the conversion, so that's the only pass
+over the buffer before the EQ. */
+void float_bus_from_mix(song_t *csf, const int *mix, unsigned int count)
+{
+	float lgain = csf->mix_headroom, rgain = csf->mix_headroom;
+
+	if (!(csf->mix_flags & SNDMIX_DIRECTTODISK)) {
+		if (csf->mix_channels >= 2) {
+			lgain *= (float)audio_settings.master.left / 31.0F;
+			rgain *= (float)audio_settings.master.right / 31.0F;
+		} else {
+			lgain *= ((float)audio_settings.master.left + (float)audio_settings.master.right) / 62.0F;
+			rgain = lgain;
+		}
+	}
+
+	float_from_mix(csf->mix_buffer_float, mix,
+		(csf->mix_channels >= 2) ? count * 2 : count, lgain, rgain);
+}
+
+void eq_mono_float(song_t *csf, float *buffer, unsigned int count)
+{
+	eq_band *eq = csf->eq;
+
+	for (unsigned int b = 0; b < MAX_EQ_BANDS; b++)
+	{
+		if (eq[b].enabled && eq[b].gain != 1.0f)
+			eq_filter_float(csf, &eq[b], buffer, count);
+	}
+}
+
+void eq_stereo_float(song_t *csf, float *buffer, unsigned int count)
+{
+	eq_band *eq = csf->eq;
+
+	for (unsigned int b = 0; b < MAX_EQ_BANDS; b++) {
+		int br = b + MAX_EQ_BANDS;
+
+		if (eq[b].enabled && eq[b].gain != 1.0f)
+			eq_filter_float(csf, &eq[b], buffer, count << 1);
+
+		if (eq[br].enabled && eq[br].gain != 1.0f)
+			eq_filter_float(csf, &eq[br], buffer + 1, count << 1);
 	}
 }
 
 
-void initialize_eq(int reset, float freq)
+void initialize_eq(song_t *csf, int reset, float freq)
 {
+	eq_band *eq = csf->eq;
+
 	//float fMixingFreq = (REAL)mix_frequency;
 
 	// Gain = 0.5 (-6dB) .. 2 (+6dB)
@@ -218,9 +262,11 @@ void initialize_eq(int reset, float freq)
 }
 
 
-void set_eq_gains(const unsigned int *gainbuff, unsigned int gains, const unsigned int *freqs,
+void set_eq_gains(song_t *csf, const unsigned int *gainbuff, unsigned int gains, const unsigned int *freqs,
 		  int reset, int mix_freq)
 {
+	eq_band *eq = csf->eq;
+
 	for (unsigned int i = 0; i < MAX_EQ_BANDS; i++) {
 		float g, f = 0;
 
@@ -256,6 +302,6 @@ void set_eq_gains(const unsigned int *gainbuff, unsigned int gains, const unsign
 		}
 	}
 
-	initialize_eq(reset, mix_freq);
+	initialize_eq(csf, reset, mix_freq);
 }
 
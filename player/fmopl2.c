@@ -2090,3 +2090,50 @@ void ym3812_update_one(void *chip, OPLSAMPLE *buffer, int length)
 	}
 
 }
+
+/*
+** Generate samples for one of the YM3812's with every channel kept apart
+**
+** '**buffers' holds one output buffer per channel (NULL to discard it);
+** the rhythm section, when enabled, is written to buffer 6
+** 'num' is the number of entries in 'buffers'
+** 'length' is the number of samples that should be generated
+*/
+void ym3812_update_multi(void *chip, OPLSAMPLE **buffers, int num, int length)
+{
+	FM_OPL      *OPL = (FM_OPL *)chip;
+	uint8_t       rhythm = OPL->rhythm&0x20;
+	int i, ch, nch = rhythm ? 6 : 9;
+
+	for( i=0; i < length ; i++ )
+	{
+		int lt;
+
+		advance_lfo(OPL);
+
+		/* FM part */
+		for (ch = 0; ch < nch; ch++) {
+			OPL->output[0] = 0;
+			OPL_CALC_CH(OPL, &OPL->P_CH[ch]);
+			if (ch < num && buffers[ch]) {
+				lt = limit( OPL->output[0] >> FINAL_SH, MAXOUT, MINOUT );
+				buffers[ch][i] = lt;
+			}
+		}
+
+		if(rhythm)        /* Rhythm part */
+		{
+			OPL->output[0] = 0;
+			OPL_CALC_RH(OPL, &OPL->P_CH[0], (OPL->noise_rng>>0)&1 );
+			if (6 < num && buffers[6]) {
+				lt = limit( OPL->output[0] >> FINAL_SH, MAXOUT, MINOUT );
+				buffers[6][i] = lt;
+			}
+			for (ch = 7; ch < 9 && ch < num; ch++)
+				if (buffers[ch])
+					buffers[ch][i] = 0;
+		}
+
+		advance(OPL);
+	}
+}
@@ -2458,6 +2458,72 @@ void ymf262_set_update_handler(void *chip,OPL_UPDATEHANDLER UpdateHandler,void *
 }
 
 
+/* run all 18 channels for one sample; the results end up in chip->chanout */
+static inline void calc_channels(OPL3 *chip, uint8_t rhythm)
+{
+#if 1
+	/* register set #1 */
+	chan_calc(chip, &chip->P_CH[0]);            /* extended 4op ch#0 part 1 or 2op ch#0 */
+	if (chip->P_CH[0].extended)
+		chan_calc_ext(chip, &chip->P_CH[3]);    /* extended 4op ch#0 part 2 */
+	else
+		chan_calc(chip, &chip->P_CH[3]);        /* standard 2op ch#3 */
+
+
+	chan_calc(chip, &chip->P_CH[1]);            /* extended 4op ch#1 part 1 or 2op ch#1 */
+	if (chip->P_CH[1].extended)
+		chan_calc_ext(chip, &chip->P_CH[4]);    /* extended 4op ch#1 part 2 */
+	else
+		chan_calc(chip, &chip->P_CH[4]);        /* standard 2op ch#4 */
+
+
+	chan_calc(chip, &chip->P_CH[2]);            /* extended 4op ch#2 part 1 or 2op ch#2 */
+	if (chip->P_CH[2].extended)
+		chan_calc_ext(chip, &chip->P_CH[5]);    /* extended 4op ch#2 part 2 */
+	else
+		chan_calc(chip, &chip->P_CH[5]);        /* standard 2op ch#5 */
+
+
+	if(!rhythm)
+	{
+		chan_calc(chip, &chip->P_CH[6]);
+		chan_calc(chip, &chip->P_CH[7]);
+		chan_calc(chip, &chip->P_CH[8]);
+	}
+	else        /* Rhythm part */
+	{
+		chan_calc_rhythm(chip, &chip->P_CH[0], (chip->noise_rng>>0)&1 );
+	}
+
+	/* register set #2 */
+	chan_calc(chip, &chip->P_CH[ 9]);
+	if (chip->P_CH[9].extended)
+		chan_calc_ext(chip, &chip->P_CH[12]);
+	else
+		chan_calc(chip, &chip->P_CH[12]);
+
+
+	chan_calc(chip, &chip->P_CH[10]);
+	if (chip->P_CH[10].extended)
+		chan_calc_ext(chip, &chip->P_CH[13]);
+	else
+		chan_calc(chip, &chip->P_CH[13]);
+
+
+	chan_calc(chip, &chip->P_CH[11]);
+	if (chip->P_CH[11].extended)
+		chan_calc_ext(chip, &chip->P_CH[14]);
+	else
+		chan_calc(chip, &chip->P_CH[14]);
+
+
+	/* channels 15,16,17 are fixed 2-operator channels only */
+	chan_calc(chip, &chip->P_CH[15]);
+	chan_calc(chip, &chip->P_CH[16]);
+	chan_calc(chip, &chip->P_CH[17]);
+#endif
+}
+
 /*
 ** Generate samples for one of the YMF262's
 **
@@ -2487,67 +2553,7 @@ void ymf262_update_one(void *_chip, OPLSAMPLE **buffers, int length)
 		/* clear channel outputs */
 		memset(chip->chanout, 0, sizeof(chip->chanout));
 
-#if 1
-	/* register set #1 */
-		chan_calc(chip, &chip->P_CH[0]);            /* extended 4op ch#0 part 1 or 2op ch#0 */
-		if (chip->P_CH[0].extended)
-			chan_calc_ext(chip, &chip->P_CH[3]);    /* extended 4op ch#0 part 2 */
-		else
-			chan_calc(chip, &chip->P_CH[3]);        /* standard 2op ch#3 */
-
-
-		chan_calc(chip, &chip->P_CH[1]);            /* extended 4op ch#1 part 1 or 2op ch#1 */
-		if (chip->P_CH[1].extended)
-			chan_calc_ext(chip, &chip->P_CH[4]);    /* extended 4op ch#1 part 2 */
-		else
-			chan_calc(chip, &chip->P_CH[4]);        /* standard 2op ch#4 */
-
-
-		chan_calc(chip, &chip->P_CH[2]);            /* extended 4op ch#2 part 1 or 2op ch#2 */
-		if (chip->P_CH[2].extended)
-			chan_calc_ext(chip, &chip->P_CH[5]);    /* extended 4op ch#2 part 2 */
-		else
-			chan_calc(chip, &chip->P_CH[5]);        /* standard 2op ch#5 */
-
-
-		if(!rhythm)
-		{
-			chan_calc(chip, &chip->P_CH[6]);
-			chan_calc(chip, &chip->P_CH[7]);
-			chan_calc(chip, &chip->P_CH[8]);
-		}
-		else        /* Rhythm part */
-		{
-			chan_calc_rhythm(chip, &chip->P_CH[0], (chip->noise_rng>>0)&1 );
-		}
-
-	/* register set #2 */
-		chan_calc(chip, &chip->P_CH[ 9]);
-		if (chip->P_CH[9].extended)
-			chan_calc_ext(chip, &chip->P_CH[12]);
-		else
-			chan_calc(chip, &chip->P_CH[12]);
-
-
-		chan_calc(chip, &chip->P_CH[10]);
-		if (chip->P_CH[10].extended)
-			chan_calc_ext(chip, &chip->P_CH[13]);
-		else
-			chan_calc(chip, &chip->P_CH[13]);
-
-
-		chan_calc(chip, &chip->P_CH[11]);
-		if (chip->P_CH[11].extended)
-			chan_calc_ext(chip, &chip->P_CH[14]);
-		else
-			chan_calc(chip, &chip->P_CH[14]);
-
-
-		/* channels 15,16,17 are fixed 2-operator channels only */
-		chan_calc(chip, &chip->P_CH[15]);
-		chan_calc(chip, &chip->P_CH[16]);
-		chan_calc(chip, &chip->P_CH[17]);
-#endif
+		calc_channels(chip, rhythm);
 
 		/* accumulator register set #1 */
 		a =  chanout[0] & chip->pan[0];
@@ -2651,3 +2657,47 @@ void ymf262_update_one(void *_chip, OPLSAMPLE **buffers, int length)
 	}
 
 }
+
+/*
+** Generate samples for one of the YMF262's with every channel kept apart
+**
+** '**buffers' holds one interleaved stereo buffer (left = output A, right = output B)
+** per channel (NULL to discard it); a 4-op pair may come out on either half
+** 'num' is the number of entries in 'buffers'
+** 'length' is the number of samples that should be generated
+*/
+void ymf262_update_multi(void *_chip, OPLSAMPLE **buffers, int num, int length)
+{
+	int i, n;
+	OPL3        *chip  = (OPL3 *)_chip;
+	signed int *chanout = chip->chanout;
+	uint8_t       rhythm = chip->rhythm&0x20;
+
+	if (num > 18)
+		num = 18;
+
+	for( i=0; i < length ; i++ )
+	{
+		advance_lfo(chip);
+
+		/* clear channel outputs */
+		memset(chip->chanout, 0, sizeof(chip->chanout));
+
+		calc_channels(chip, rhythm);
+
+		for (n = 0; n < num; n++) {
+			int a, b;
+
+			if (!buffers[n])
+				continue;
+
+			a = (chanout[n] & chip->pan[n * 4 + 0]) >> FINAL_SH;
+			b = (chanout[n] & chip->pan[n * 4 + 1]) >> FINAL_SH;
+
+			buffers[n][i * 2 + 0] = limit( a , MAXOUT, MINOUT );
+			buffers[n][i * 2 + 1] = limit( b , MAXOUT, MINOUT );
+		}
+
+		advance(chip);
+	}
+}
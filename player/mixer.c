@@ -30,6 +30,7 @@
 #include "player/cmixer.h"
 #include "bshift.h"
 #include "util.h"   // for CLAMP
+#include "sdlmain.h" // for SDL_HasSSE2
 
 // For pingpong loops that work like most of Impulse Tracker's drivers
 // (including SB16, SBPro, and the disk writer) -- as well as XMPlay, use 1
@@ -235,6 +236,139 @@
 			, 1), \
 		WFIR_##bits##SHIFT - 1);
 
+/////////////////////////////////////////////////////////////////////////////
+// SSE2 interpolation
+//
+// The spline and FIR interpolators are dot products of 4/8 taps against 16-bit
+// coefficients, which is exactly what pmaddwd does. These produce the same sums
+// (modulo 2^32, like the scalar code) in the same order as the macros above,
+// so the output is bit-exact; everything after the interpolation (filters,
+// ramping, volume) is shared with the scalar mixers.
+//
+// The kernels are compiled for SSE2 regardless of the build's -m flags, and
+// only used if the CPU has it (see csf_create_stereo_mix).
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+# define MIXER_SSE2 1
+# define MIXER_SSE2_TARGET __attribute__((target("sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+# define MIXER_SSE2 1
+# define MIXER_SSE2_TARGET
+#endif
+
+#ifdef MIXER_SSE2
+#include <emmintrin.h>
+
+/* load eight (or four) samples, widened to 16 bits */
+static inline MIXER_SSE2_TARGET __m128i sse2_load8_16(const int16_t *p)
+{
+	return _mm_loadu_si128((const __m128i *) p);
+}
+
+static inline MIXER_SSE2_TARGET __m128i sse2_load8_8(const int8_t *p)
+{
+	__m128i x = _mm_loadl_epi64((const __m128i *) p);
+	return _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+}
+
+static inline MIXER_SSE2_TARGET __m128i sse2_load4_16(const int16_t *p)
+{
+	return _mm_loadl_epi64((const __m128i *) p);
+}
+
+static inline MIXER_SSE2_TARGET __m128i sse2_load4_8(const int8_t *p)
+{
+	int32_t x;
+	memcpy(&x, p, sizeof(x));
+	__m128i v = _mm_cvtsi32_si128(x);
+	return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+/* L0 R0 L1 R1 L2 R2 L3 R3 -> L0 L1 L2 L3 R0 R1 R2 R3 */
+static inline MIXER_SSE2_TARGET __m128i sse2_deinterleave(__m128i x)
+{
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 1, 2, 0));
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+/* [a b c d] -> [a+b a+b c+d c+d] */
+static inline MIXER_SSE2_TARGET __m128i sse2_hadd_pairs(__m128i x)
+{
+	return _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+#define SSE2_DEFINE_INTERPOLATORS(bits) \
+	static inline MIXER_SSE2_TARGET int32_t sse2_spline_mono##bits(const int##bits##_t *p, const short *lut) \
+	{ \
+		__m128i m = _mm_madd_epi16(sse2_load4_##bits(p), _mm_loadl_epi64((const __m128i *) lut)); \
+		return _mm_cvtsi128_si32(sse2_hadd_pairs(m)); \
+	} \
+	static inline MIXER_SSE2_TARGET void sse2_spline_stereo##bits(const int##bits##_t *p, const short *lut, \
+		int32_t *vol_l, int32_t *vol_r) \
+	{ \
+		__m128i c = _mm_loadl_epi64((const __m128i *) lut); \
+		__m128i m = _mm_madd_epi16(sse2_deinterleave(sse2_load8_##bits(p)), _mm_unpacklo_epi64(c, c)); \
+		m = sse2_hadd_pairs(m); \
+		*vol_l = _mm_cvtsi128_si32(m); \
+		*vol_r = _mm_cvtsi128_si32(_mm_srli_si128(m, 8)); \
+	} \
+	static inline MIXER_SSE2_TARGET int32_t sse2_fir_mono##bits(const int##bits##_t *p, const short *lut) \
+	{ \
+		__m128i m = _mm_madd_epi16(sse2_load8_##bits(p), _mm_loadu_si128((const __m128i *) lut)); \
+		m = _mm_srai_epi32(sse2_hadd_pairs(m), 1); \
+		return _mm_cvtsi128_si32(m) + _mm_cvtsi128_si32(_mm_srli_si128(m, 8)); \
+	} \
+	static inline MIXER_SSE2_TARGET void sse2_fir_stereo##bits(const int##bits##_t *p, const short *lut, \
+		int32_t *vol_l, int32_t *vol_r) \
+	{ \
+		__m128i c = _mm_loadu_si128((const __m128i *) lut); \
+		__m128i a = sse2_deinterleave(sse2_load8_##bits(p)); \
+		__m128i b = sse2_deinterleave(sse2_load8_##bits(p + 8)); \
+		__m128i ml = _mm_madd_epi16(_mm_unpacklo_epi64(a, b), c); \
+		__m128i mr = _mm_madd_epi16(_mm_unpackhi_epi64(a, b), c); \
+		__m128i lo = _mm_srai_epi32(sse2_hadd_pairs(_mm_unpacklo_epi64(ml, mr)), 1); \
+		__m128i hi = _mm_srai_epi32(sse2_hadd_pairs(_mm_unpackhi_epi64(ml, mr)), 1); \
+		__m128i m = _mm_add_epi32(lo, hi); \
+		*vol_l = _mm_cvtsi128_si32(m); \
+		*vol_r = _mm_cvtsi128_si32(_mm_srli_si128(m, 8)); \
+	}
+
+SSE2_DEFINE_INTERPOLATORS(8)
+SSE2_DEFINE_INTERPOLATORS(16)
+
+#define SNDMIX_GETMONOVOLSPLINESSE2(bits) \
+	int32_t poshi = position >> 16; \
+	int32_t poslo = rshift_signed_32(position, SPLINE_FRACSHIFT) & SPLINE_FRACMASK; \
+	int32_t vol   = rshift_signed_32(sse2_spline_mono##bits(p + poshi - 1, cubic_spline_lut + poslo), \
+		SPLINE_##bits##SHIFT);
+
+#define SNDMIX_GETMONOVOLFIRFILTERSSE2(bits) \
+	int32_t poshi  = position >> 16; \
+	int32_t poslo  = (position & 0xFFFF); \
+	int32_t firidx = rshift_signed_32(poslo + WFIR_FRACHALVE, WFIR_FRACSHIFT) & WFIR_FRACMASK; \
+	int32_t vol    = rshift_signed_32(sse2_fir_mono##bits(p + poshi - 3, windowed_fir_lut + firidx), \
+		WFIR_##bits##SHIFT - 1);
+
+#define SNDMIX_GETSTEREOVOLSPLINESSE2(bits) \
+	int32_t poshi = position >> 16; \
+	int32_t poslo = (position >> SPLINE_FRACSHIFT) & SPLINE_FRACMASK; \
+	int32_t vol_l, vol_r; \
+	sse2_spline_stereo##bits(p + (poshi - 1) * 2, cubic_spline_lut + poslo, &vol_l, &vol_r); \
+	vol_l = rshift_signed_32(vol_l, SPLINE_##bits##SHIFT); \
+	vol_r = rshift_signed_32(vol_r, SPLINE_##bits##SHIFT);
+
+#define SNDMIX_GETSTEREOVOLFIRFILTERSSE2(bits) \
+	int32_t poshi  = position >> 16; \
+	int32_t poslo  = (position & 0xFFFF); \
+	int32_t firidx = rshift_signed_32(poslo + WFIR_FRACHALVE, WFIR_FRACSHIFT) & WFIR_FRACMASK; \
+	int32_t vol_l, vol_r; \
+	sse2_fir_stereo##bits(p + (poshi - 3) * 2, windowed_fir_lut + firidx, &vol_l, &vol_r); \
+	vol_l = rshift_signed_32(vol_l, WFIR_##bits##SHIFT - 1); \
+	vol_r = rshift_signed_32(vol_r, WFIR_##bits##SHIFT - 1);
+
+#endif /* MIXER_SSE2 */
+
 #define SNDMIX_STOREMONOVOL \
 	pvol[0] += vol * chan->right_volume; \
 	pvol[1] += vol * chan->left_volume; \
@@ -478,6 +612,28 @@ DEFINE_MIX_INTERFACE_FAST(16)
 DEFINE_MIX_INTERFACE(8)
 DEFINE_MIX_INTERFACE(16)
 
+#ifdef MIXER_SSE2
+/* only the spline and fir mixers have SSE2 variants; the others are cheap enough as it is */
+#define DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, chns, chnsupper, filter, fltnam, fltint, fast, fastupper) \
+	DEFINE_MIX_INTERFACE_RAMP(bits, chns, chnsupper, filter, fltnam, fltint, fast, fastupper, SplineSSE2,    SPLINESSE2) \
+	DEFINE_MIX_INTERFACE_RAMP(bits, chns, chnsupper, filter, fltnam, fltint, fast, fastupper, FirFilterSSE2, FIRFILTERSSE2)
+
+#define DEFINE_MIX_INTERFACE_SSE2(bits) \
+	DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, Mono,   MONO,   /* none */, /* none */, /* none */, /* none */, /* none */) \
+	DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, Mono,   MONO,   SNDMIX_PROCESSMONOFILTER,   Filter, MONO_FLT_, /* none */, /* none */) \
+	DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, Stereo, STEREO, /* none */, /* none */, /* none */, /* none */, /* none */) \
+	DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, Stereo, STEREO, SNDMIX_PROCESSSTEREOFILTER, Filter, STEREO_FLT_, /* none */, /* none */)
+
+#define DEFINE_MIX_INTERFACE_FAST_SSE2(bits) \
+	DEFINE_MIX_INTERFACE_RESAMPLING_SSE2(bits, Mono, MONO, /* none */, /* none */, /* none */, Fast, FAST)
+
+DEFINE_MIX_INTERFACE_FAST_SSE2(8)
+DEFINE_MIX_INTERFACE_FAST_SSE2(16)
+
+DEFINE_MIX_INTERFACE_SSE2(8)
+DEFINE_MIX_INTERFACE_SSE2(16)
+#endif
+
 // Public Resampling Methods
 #define DEFINE_MONO_RESAMPLE_INTERFACE(bits) \
 	BEGIN_RESAMPLE_INTERFACE(ResampleMono##bits##BitFirFilter, int##bits##_t, 1) \
@@ -556,6 +712,39 @@ static const mix_interface_t fastmix_functions[2 * 2 * 16] = {
 	BUILD_MIX_FUNCTION_TABLE_FAST(FirFilter)
 };
 
+#ifdef MIXER_SSE2
+static const mix_interface_t mix_functions_sse2[2 * 2 * 16] = {
+	BUILD_MIX_FUNCTION_TABLE(/* none */)
+	BUILD_MIX_FUNCTION_TABLE(Linear)
+	BUILD_MIX_FUNCTION_TABLE(SplineSSE2)
+	BUILD_MIX_FUNCTION_TABLE(FirFilterSSE2)
+};
+
+static const mix_interface_t fastmix_functions_sse2[2 * 2 * 16] = {
+	BUILD_MIX_FUNCTION_TABLE_FAST(/* none */)
+	BUILD_MIX_FUNCTION_TABLE_FAST(Linear)
+	BUILD_MIX_FUNCTION_TABLE_FAST(SplineSSE2)
+	BUILD_MIX_FUNCTION_TABLE_FAST(FirFilterSSE2)
+};
+#endif
+
+/* the tables actually in use, picked according to what the cpu can do (see csf_init_mixer) */
+static const mix_interface_t *mix_table = NULL;
+static const mix_interface_t *fastmix_table = NULL;
+
+void csf_init_mixer(void)
+{
+#ifdef MIXER_SSE2
+	if (SDL_HasSSE2()) {
+		fastmix_table = fastmix_functions_sse2;
+		mix_table = mix_functions_sse2;
+		return;
+	}
+#endif
+	fastmix_table = fastmix_functions;
+	mix_table = mix_functions;
+}
+
 static int get_sample_count(song_voice_t *chan, int samples)
 {
 	int loop_start = (chan->flags & CHN_LOOP) ? chan->loop_start : 0;
@@ -701,6 +890,26 @@ static int get_sample_count(song_voice_t *chan, int samples)
 }
 
 
+int *csf_get_multi_write_buffer(song_t *csf, uint32_t chan, int count)
+{
+	struct multi_write *mw;
+
+	if (chan >= MAX_CHANNELS)
+		return NULL;
+	mw = csf->multi_write + chan;
+	if (!mw->data)
+		return NULL;
+
+	if (!mw->buffer)
+		mw->buffer = mem_alloc(MIXBUFFERSIZE * 2 * sizeof(int));
+	if (!mw->mixed) {
+		memset(mw->buffer, 0, count * 2 * sizeof(int));
+		mw->mixed = mw->used = 1;
+	}
+	return mw->buffer;
+}
+
+
 unsigned int csf_create_stereo_mix(song_t *csf, int count)
 {
 	int* ofsl, *ofsr;
@@ -711,10 +920,10 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 
 	nchused = nchmixed = 0;
 
-	// yuck
+	// channel buffers are cleared as they're first mixed into, so idle channels cost nothing
 	if (csf->multi_write)
 		for (unsigned int nchan = 0; nchan < MAX_CHANNELS; nchan++)
-			memset(csf->multi_write[nchan].buffer, 0, sizeof(csf->multi_write[nchan].buffer));
+			csf->multi_write[nchan].mixed = 0;
 
 	for (unsigned int nchan = 0; nchan < csf->num_voices; nchan++) {
 		const mix_interface_t *mix_func_table;
@@ -724,12 +933,13 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 		int smpcount;
 		int nsamples;
 		int *pbuffer;
+		int nomix = !!(csf->mix_flags & SNDMIX_NOMIXING);
 
 		if (!channel->current_sample_data)
 			continue;
 
-		ofsr = &g_dry_rofs_vol;
-		ofsl = &g_dry_lofs_vol;
+		ofsr = &csf->dry_rofs_vol;
+		ofsl = &csf->dry_lofs_vol;
 		flags = 0;
 
 		if (channel->flags & CHN_16BIT)
@@ -757,9 +967,9 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 			(channel->left_volume == channel->right_volume) &&
 			((!channel->ramp_length) ||
 			(channel->left_ramp == channel->right_ramp))) {
-			mix_func_table = fastmix_functions;
+			mix_func_table = fastmix_table;
 		} else {
-			mix_func_table = mix_functions;
+			mix_func_table = mix_table;
 		}
 
 		nsamples = count;
@@ -768,8 +978,13 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 			int master = (csf->voice_mix[nchan] < MAX_CHANNELS)
 				? csf->voice_mix[nchan]
 				: (channel->master_channel - 1);
-			pbuffer = csf->multi_write[master].buffer;
-			csf->multi_write[master].used = 1;
+			pbuffer = csf_get_multi_write_buffer(csf, master, count);
+			if (!pbuffer) {
+				/* somebody else is writing this channel; keep the voice moving
+				along, but don't waste any time mixing it */
+				pbuffer = csf->mix_buffer;
+				nomix = 1;
+			}
 		} else {
 			pbuffer = csf->mix_buffer;
 		}
@@ -813,7 +1028,8 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 
 			// Should we mix this channel ?
 
-			if ((nchmixed >= max_voices && !(csf->mix_flags & SNDMIX_DIRECTTODISK))
+			if (nomix
+				|| (nchmixed >= max_voices && !(csf->mix_flags & SNDMIX_DIRECTTODISK))
 				|| (!channel->ramp_length && !(channel->left_volume | channel->right_volume))) {
 				int delta = (channel->increment * (int) smpcount) + (int) channel->position_frac;
 				channel->position_frac = delta & 0xFFFF;
@@ -865,13 +1081,12 @@ unsigned int csf_create_stereo_mix(song_t *csf, int count)
 		nchmixed += naddmix;
 	}
 
-	GM_IncrementSongCounter(count);
+	GM_IncrementSongCounter(csf, count);
 
 	if (csf->multi_write) {
-		/* mix all adlib onto track one */
-		Fmdrv_MixTo(csf->multi_write[0].buffer, count);
+		Fmdrv_MixToChannels(csf, count);
 	} else {
-		Fmdrv_MixTo(csf->mix_buffer, count);
+		Fmdrv_MixTo(csf, csf->mix_buffer, count);
 	}
 
 	return nchused;
@@ -25,6 +25,7 @@
 
 #include "player/sndfile.h"
 #include "player/cmixer.h"
+#include "util.h" // for CLAMP
 
 #define OFSDECAYSHIFT 8
 #define OFSDECAYMASK  0xFF
@@ -209,3 +210,127 @@ unsigned int clip_32_to_32(void *ptr, int *buffer, unsigned int samples, int *mi
     return samples * 4;
 }
 
+
+
+// ----------------------------------------------------------------------------
+// Float bus conversions (SNDMIX_FLOATBUS): 1.0 is full scale, which is
+// MIXING_CLIPMAX on the integer bus. mins and maxs are still in 27bits.
+// ----------------------------------------------------------------------------
+
+#define MIXING_FLOAT_SCALE ((float) (MIXING_CLIPMAX + 1))
+
+static inline int float_to_mix(float f)
+{
+    f *= MIXING_FLOAT_SCALE;
+
+    // MIXING_CLIPMAX isn't representable as a float (it rounds up to the scale itself), so
+    // compare against the scale, or else full scale comes out one past the top
+    if (f < MIXING_CLIPMIN)
+	return MIXING_CLIPMIN;
+    else if (f >= MIXING_FLOAT_SCALE)
+	return MIXING_CLIPMAX;
+    return (int) f;
+}
+
+static inline void float_vu(int n, unsigned int i, int *mins, int *maxs)
+{
+    if (n < mins[i & 1])
+	mins[i & 1] = n;
+    else if (n > maxs[i & 1])
+	maxs[i & 1] = n;
+}
+
+
+// Integer bus -> float bus, with a separate gain for each side (pass the same one twice for mono)
+void float_from_mix(float *out, const int *in, unsigned int samples, float lgain, float rgain)
+{
+    lgain /= MIXING_FLOAT_SCALE;
+    rgain /= MIXING_FLOAT_SCALE;
+
+    for (unsigned int i = 0; i < samples; i++)
+	out[i] = in[i] * ((i & 1) ? rgain : lgain);
+}
+
+
+unsigned int clip_float_to_8(void *ptr, float *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    unsigned char *p = (unsigned char *) ptr;
+
+    for (unsigned int i = 0; i < samples; i++) {
+	int n = float_to_mix(buffer[i]);
+	float_vu(n, i, mins, maxs);
+	p[i] = (n >> (24 - MIXING_ATTENUATION)) ^ 0x80;
+    }
+
+    return samples;
+}
+
+
+unsigned int clip_float_to_16(void *ptr, float *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    signed short *p = (signed short *) ptr;
+
+    for (unsigned int i = 0; i < samples; i++) {
+	int n = float_to_mix(buffer[i]);
+	float_vu(n, i, mins, maxs);
+	p[i] = n >> (16 - MIXING_ATTENUATION);
+    }
+
+    return samples * 2;
+}
+
+
+unsigned int clip_float_to_24(void *ptr, float *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    unsigned char *p = (unsigned char *) ptr;
+
+    for (unsigned int i = 0; i < samples; i++) {
+	int n = float_to_mix(buffer[i]);
+	float_vu(n, i, mins, maxs);
+	n = n >> (8 - MIXING_ATTENUATION);
+	memcpy(p, &n, 3);
+	p += 3;
+    }
+
+    return samples * 3;
+}
+
+
+unsigned int clip_float_to_32(void *ptr, float *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    signed int *p = (signed int *) ptr;
+
+    for (unsigned int i = 0; i < samples; i++) {
+	int n = float_to_mix(buffer[i]);
+	float_vu(n, i, mins, maxs);
+	p[i] = (n << MIXING_ATTENUATION);
+    }
+
+    return samples * 4;
+}
+
+
+// No clipping here, that's the point. (The VU meter still clips, though.)
+unsigned int float_to_float(void *ptr, float *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    for (unsigned int i = 0; i < samples; i++)
+	float_vu(float_to_mix(buffer[i]), i, mins, maxs);
+    memcpy(ptr, buffer, samples * sizeof(float));
+
+    return samples * 4;
+}
+
+
+// Integer bus straight to float output, for the multi-write buffers
+unsigned int convert_32_to_float(void *ptr, int *buffer, unsigned int samples, int *mins, int *maxs)
+{
+    float *p = (float *) ptr;
+
+    for (unsigned int i = 0; i < samples; i++) {
+	int n = buffer[i];
+	p[i] = n / MIXING_FLOAT_SCALE;
+	float_vu(CLAMP(n, MIXING_CLIPMIN, MIXING_CLIPMAX), i, mins, maxs);
+    }
+
+    return samples * 4;
+}
@@ -24,11 +24,12 @@
 #include "headers.h"
 
 #include "player/fmopl.h"
+#include "player/sndfile.h"
 #include "player/snd_fm.h"
+#include "player/cmixer.h"
 #include "log.h"
 #include "util.h" /* for clamp */
-
-#define MAX_VOICES 256 /* Must not be less than the setting in sndfile.h */
+#include "sdlmain.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -42,6 +43,7 @@
     #define OPLWrite     ym3812_write
     #define OPLReadChip     ym3812_read
     #define OPLUpdateOne ym3812_update_one
+    #define OPLUpdateMulti ym3812_update_multi
     #define OPLCloseChip     ym3812_shutdown
     // OPL2 = 3579552Hz
     #define OPLRATEDIVISOR 72
@@ -51,6 +53,7 @@
     #define OPLWrite     ymf262_write
     #define OPLReadChip     ymf262_read
     #define OPLUpdateOne ymf262_update_one
+    #define OPLUpdateMulti ymf262_update_multi
     #define OPLCloseChip     ymf262_shutdown
     // OPL3 = 14318208Hz
     #define OPLRATEDIVISOR 288
@@ -65,6 +68,11 @@ Also note when comparing volumes, that Screamtracker output on mono with PCM sam
 */
 #define OPL_VOLUME 2274
 
+/* The emulator shares its lookup tables (refcounted, built on first use) between
+all chips, so creating and destroying chips has to be serialized for songs to be
+rendered on more than one thread. Everything else is per-chip. */
+static SDL_SpinLock opl_table_lock = 0;
+
 /*
 The documentation in this file regarding the output ports,
 including the comment "Don't ask me why", are attributed
@@ -76,11 +84,23 @@ to Jeffrey S. Lee's article:
 
 static const int oplbase = 0x388;
 
-// OPL info
-static struct OPL* opl = NULL;
-static uint32_t oplretval = 0,
-	   oplregno = 0;
-static uint32_t fm_active = 0;
+// OPL info -- one of these per song, so that several songs can be mixed at once
+struct fm_state {
+	void *opl;
+	uint32_t oplretval, oplregno;
+	uint32_t fm_active;
+
+	const unsigned char *Dtab[9];
+	unsigned char Keyontab[9];
+	int Pans[MAX_VOICES];
+
+	int OPLtoChan[9];
+	int ChantoOPL[MAX_VOICES];
+
+	// scratch buffer for Fmdrv_MixTo and Fmdrv_MixToChannels
+	short *buf;
+	int buf_size;
+};
 
 extern int fnumToMilliHertz(unsigned int fnum, unsigned int block,
 	unsigned int conversionFactor);
@@ -89,56 +109,63 @@ extern void milliHertzToFnum(unsigned int milliHertz,
 	unsigned int *fnum, unsigned int *block, unsigned int conversionFactor);
 
 
-static void Fmdrv_Outportb(unsigned port, unsigned value)
+static void Fmdrv_Outportb(struct fm_state *fm, unsigned port, unsigned value)
 {
-	if (opl == NULL ||
+	if (fm->opl == NULL ||
 	    ((int) port) < oplbase ||
 	    ((int) port) >= oplbase + 4)
 		return;
 
 	unsigned ind = port - oplbase;
-	OPLWrite(opl, ind, value);
+	OPLWrite(fm->opl, ind, value);
 
 	if (ind & 1) {
-		if (oplregno == 4) {
+		if (fm->oplregno == 4) {
 			if (value == 0x80)
-				oplretval = 0x02;
+				fm->oplretval = 0x02;
 			else if (value == 0x21)
-				oplretval = 0xC0;
+				fm->oplretval = 0xC0;
 		}
 	}
 	else
-		oplregno = value;
+		fm->oplregno = value;
 }
 
 
-static unsigned char Fmdrv_Inportb(unsigned port)
+static unsigned char Fmdrv_Inportb(struct fm_state *fm, unsigned port)
 {
 	return (((int) port) >= oplbase &&
-		((int) port) < oplbase + 4) ? oplretval : 0;
+		((int) port) < oplbase + 4) ? fm->oplretval : 0;
 }
 
 
-void Fmdrv_Init(int mixfreq)
+void Fmdrv_Init(song_t *csf, int mixfreq)
 {
-	if (opl != NULL) {
-		OPLCloseChip(opl);
-		opl = NULL;
-	}
+	struct fm_state *fm = csf->fm;
+
+	if (fm == NULL)
+		fm = csf->fm = mem_calloc(1, sizeof(struct fm_state));
+
+	SDL_AtomicLock(&opl_table_lock);
+	if (fm->opl != NULL)
+		OPLCloseChip(fm->opl);
 	// Clock = speed at which the chip works. mixfreq = audio resampler
-	opl = OPLNew(OPLRATEBASE * OPLRATEDIVISOR, mixfreq);
-    OPL_Reset();
+	fm->opl = OPLNew(OPLRATEBASE * OPLRATEDIVISOR, mixfreq);
+	SDL_AtomicUnlock(&opl_table_lock);
+    OPL_Reset(csf);
 }
 
 
-void Fmdrv_MixTo(int *target, int count)
+void Fmdrv_MixTo(song_t *csf, int *target, int count)
 {
-	static short *buf = NULL;
-	static int buf_size = 0;
+	struct fm_state *fm = csf->fm;
 
-	if (!fm_active)
+	if (!fm || !fm->fm_active)
 	    return;
 
+	short *buf = fm->buf;
+	int buf_size = fm->buf_size;
+
 #if OPLSOURCE == 2
     // mono. Single buffer.
 	if (buf_size != count * sizeof(short)) {
@@ -153,8 +180,11 @@ void Fmdrv_MixTo(int *target, int count)
 		}
 	}
 
+	fm->buf = buf;
+	fm->buf_size = buf_size;
+
 	memset(buf, 0, buf_size);
-	OPLUpdateOne(opl, buf, count);
+	OPLUpdateOne(fm->opl, buf, count);
 	/*
 	static int counter = 0;
 
@@ -179,10 +209,12 @@ void Fmdrv_MixTo(int *target, int count)
 			buf = (short *) mem_alloc(buf_size);
 		}
 	}
-   
+	fm->buf = buf;
+	fm->buf_size = buf_size;
+
 	memset(buf, 0, buf_size);
     short *bufarray[4]={buf, buf+count,  buf+(count*2), buf+(count*2)};
-	OPLUpdateOne(opl, bufarray, count);
+	OPLUpdateOne(fm->opl, bufarray, count);
 	/*
 	static int counter = 0;
 
@@ -201,23 +233,74 @@ void Fmdrv_MixTo(int *target, int count)
 }
 
 
-/***************************************/
+/* Same as Fmdrv_MixTo, but for multi-file export: each OPL voice is mixed into the
+buffer of the channel that's playing it, instead of everything ending up on one track. */
+void Fmdrv_MixToChannels(song_t *csf, int count)
+{
+	struct fm_state *fm = csf->fm;
+#if OPLSOURCE == 2
+	const int stride = 1; // mono
+#else
+	const int stride = 2; // interleaved stereo
+#endif
+	short *bufarray[9];
+	int n, a, size;
 
+	if (!fm || !fm->fm_active)
+	    return;
 
-static const char PortBases[9] = {0, 1, 2, 8, 9, 10, 16, 17, 18};
+	size = sizeof(short) * count * stride * 9;
+	if (fm->buf_size < size) {
+		fm->buf = (short *) mem_realloc(fm->buf, size);
+		fm->buf_size = size;
+	}
+
+	for (n = 0; n < 9; n++)
+		bufarray[n] = fm->buf + n * count * stride;
+	OPLUpdateMulti(fm->opl, bufarray, 9, count);
+
+	for (n = 0; n < 9; n++) {
+		short *buf = bufarray[n];
+		int c = fm->OPLtoChan[n];
+		int *target;
 
-static const unsigned char *Dtab[9];
-static unsigned char Keyontab[9] = {0,0,0,0,0,0,0,0,0};
-static int Pans[MAX_VOICES];
+		if (c < 0)
+			continue;
+		for (a = 0; a < count * stride && !buf[a]; a++)
+			;
+		if (a == count * stride)
+			continue; // silent, don't bother
 
-static int OPLtoChan[9];
-static int ChantoOPL[MAX_VOICES];
+		target = csf_get_multi_write_buffer(csf,
+			(c < MAX_CHANNELS) ? c : (csf->voices[c].master_channel - 1), count);
+		if (!target)
+			continue;
 
-static int GetVoice(int c) {
-    return ChantoOPL[c];
+		for (a = 0; a < count; ++a) {
+#if OPLSOURCE == 2
+			target[a * 2 + 0] += buf[a] * OPL_VOLUME;
+			target[a * 2 + 1] += buf[a] * OPL_VOLUME;
+#else
+			target[a * 2 + 0] += buf[a * 2 + 0] * OPL_VOLUME;
+			target[a * 2 + 1] += buf[a * 2 + 1] * OPL_VOLUME;
+#endif
+		}
+	}
+}
+
+
+/***************************************/
+
+
+static const char PortBases[9] = {0, 1, 2, 8, 9, 10, 16, 17, 18};
+
+static int GetVoice(struct fm_state *fm, int c) {
+    return fm->ChantoOPL[c];
 }
-static int SetVoice(int c)
+static int SetVoice(struct fm_state *fm, int c)
 {
+    int *ChantoOPL = fm->ChantoOPL, *OPLtoChan = fm->OPLtoChan;
+    const unsigned char *Keyontab = fm->Keyontab;
     int a,s=-1,t=0;
     if (ChantoOPL[c] == -1) {
         t=1;
@@ -244,38 +327,42 @@ static int SetVoice(int c)
         }
     }
     //log_appendf(2,"entering with %d. tested? %d. selected %d. Current: %d",c,t,s,ChantoOPL[c]);
-	return GetVoice(c);
+	return GetVoice(fm, c);
 }
 
 
-static void FreeVoice(int c) {
-    if (ChantoOPL[c] == -1)
+static void FreeVoice(struct fm_state *fm, int c) {
+    if (fm->ChantoOPL[c] == -1)
         return;
-    OPLtoChan[ChantoOPL[c]]=-1;
-    ChantoOPL[c]=-1;
+    fm->OPLtoChan[fm->ChantoOPL[c]]=-1;
+    fm->ChantoOPL[c]=-1;
 }
 
-static void OPL_Byte(unsigned int idx, unsigned char data)
+static void OPL_Byte(struct fm_state *fm, unsigned int idx, unsigned char data)
 {
 	//register int a;
-	Fmdrv_Outportb(oplbase, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(oplbase);
-	Fmdrv_Outportb(oplbase + 1, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(oplbase);
+	Fmdrv_Outportb(fm, oplbase, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(fm, oplbase);
+	Fmdrv_Outportb(fm, oplbase + 1, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(fm, oplbase);
 }
-static void OPL_Byte_RightSide(unsigned int idx, unsigned char data)
+static void OPL_Byte_RightSide(struct fm_state *fm, unsigned int idx, unsigned char data)
 {
 	//register int a;
-	Fmdrv_Outportb(oplbase + 2, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(oplbase);
-	Fmdrv_Outportb(oplbase + 3, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(oplbase);
+	Fmdrv_Outportb(fm, oplbase + 2, idx);    // for(a = 0; a < 6;  a++) Fmdrv_Inportb(fm, oplbase);
+	Fmdrv_Outportb(fm, oplbase + 3, data); // for(a = 0; a < 35; a++) Fmdrv_Inportb(fm, oplbase);
 }
 
 
-void OPL_NoteOff(int c)
+void OPL_NoteOff(song_t *csf, int c)
 {
-	int oplc = GetVoice(c);
+	struct fm_state *fm = csf->fm;
+	if (!fm)
+		return;
+
+	int oplc = GetVoice(fm, c);
     if (oplc == -1)
         return;
-    Keyontab[oplc]&=~KEYON_BIT;
-    OPL_Byte(KEYON_BLOCK + oplc, Keyontab[oplc]);
+    fm->Keyontab[oplc]&=~KEYON_BIT;
+    OPL_Byte(fm, KEYON_BLOCK + oplc, fm->Keyontab[oplc]);
 }
 
 
@@ -284,13 +371,17 @@ void OPL_NoteOff(int c)
    retrig, just turns the note on and sets freq.)
    If keyoff is nonzero, doesn't even set the note on.
    Could be used for pitch bending also. */
-void OPL_HertzTouch(int c, int milliHertz, int keyoff)
+void OPL_HertzTouch(song_t *csf, int c, int milliHertz, int keyoff)
 {
-    int oplc = GetVoice(c);
+	struct fm_state *fm = csf->fm;
+	if (!fm)
+		return;
+
+    int oplc = GetVoice(fm, c);
     if (oplc == -1)
         return;
 
-    fm_active = 1;
+    fm->fm_active = 1;
 
 /*
     Bytes A0-B8 - Octave / F-Number / Key-On
@@ -307,24 +398,28 @@ void OPL_HertzTouch(int c, int milliHertz, int keyoff)
 	unsigned int outblock;
 	const int conversion_factor = OPLRATEBASE; // Frequency of OPL.
 	milliHertzToFnum(milliHertz, &outfnum, &outblock, conversion_factor);
-    Keyontab[oplc] = (keyoff ? 0 : KEYON_BIT)      // Key on
+    fm->Keyontab[oplc] = (keyoff ? 0 : KEYON_BIT)      // Key on
 		      | (outblock << 2)                    // Octave
 		      | ((outfnum >> 8) & FNUM_HIGH_MASK); // F-number high 2 bits
-	OPL_Byte(FNUM_LOW +    oplc, outfnum & 0xFF);  // F-Number low 8 bits
-	OPL_Byte(KEYON_BLOCK + oplc, Keyontab[oplc]);
+	OPL_Byte(fm, FNUM_LOW +    oplc, outfnum & 0xFF);  // F-Number low 8 bits
+	OPL_Byte(fm, KEYON_BLOCK + oplc, fm->Keyontab[oplc]);
 }
 
 
-void OPL_Touch(int c, unsigned vol)
+void OPL_Touch(song_t *csf, int c, unsigned vol)
 {
+	struct fm_state *fm = csf->fm;
+	if (!fm)
+		return;
+
 //fprintf(stderr, "OPL_Touch(%d, %p:%02X.%02X.%02X.%02X-%02X.%02X.%02X.%02X-%02X.%02X.%02X, %d)\n",
 //    c, D,D[0],D[1],D[2],D[3],D[4],D[5],D[6],D[7],D[8],D[9],D[10], Vol);
 
-	int oplc = GetVoice(c);
+	int oplc = GetVoice(fm, c);
 	if (oplc == -1)
         return;
 
-	const unsigned char *D = Dtab[oplc];
+	const unsigned char *D = fm->Dtab[oplc];
 	int Ope = PortBases[oplc];
 
 /*
@@ -388,113 +483,126 @@ void OPL_Touch(int c, unsigned vol)
 
 	// Set volume of both operators in additive mode
 	if(D[10] & CONNECTION_BIT)
-		OPL_Byte(KSL_LEVEL + Ope, (D[2] & KSL_MASK) |
+		OPL_Byte(fm, KSL_LEVEL + Ope, (D[2] & KSL_MASK) |
 		    (63 + ( (D[2]&TOTAL_LEVEL_MASK)*vol / 63) - vol)
 		);
 
-	OPL_Byte(KSL_LEVEL+   3+Ope, (D[3] & KSL_MASK) |
+	OPL_Byte(fm, KSL_LEVEL+   3+Ope, (D[3] & KSL_MASK) |
 	    (63 + ( (D[3]&TOTAL_LEVEL_MASK)*vol / 63) - vol)
 	);
 
 }
 
 
-void OPL_Pan(int c, int val)
+void OPL_Pan(song_t *csf, int c, int val)
 {
-	Pans[c] = CLAMP(val, 0, 256);
+	struct fm_state *fm = csf->fm;
+	if (!fm)
+		return;
+
+	fm->Pans[c] = CLAMP(val, 0, 256);
 
-	int oplc = GetVoice(c);
+	int oplc = GetVoice(fm, c);
 	if (oplc == -1)
         return;
 
-	const unsigned char *D = Dtab[oplc];
+	const unsigned char *D = fm->Dtab[oplc];
 
     /* feedback, additive synthesis and Panning... */
-    OPL_Byte(FEEDBACK_CONNECTION+oplc, 
+    OPL_Byte(fm, FEEDBACK_CONNECTION+oplc, 
         (D[10] & ~STEREO_BITS)
-	    | (Pans[c]<85 ? VOICE_TO_LEFT
-            : Pans[c]>170 ? VOICE_TO_RIGHT
+	    | (fm->Pans[c]<85 ? VOICE_TO_LEFT
+            : fm->Pans[c]>170 ? VOICE_TO_RIGHT
             : (VOICE_TO_LEFT | VOICE_TO_RIGHT))
     );
 }
 
 
-void OPL_Patch(int c, const unsigned char *D)
+void OPL_Patch(song_t *csf, int c, const unsigned char *D)
 {
-    int oplc = SetVoice(c);
+	struct fm_state *fm = csf->fm;
+	if (!fm)
+		return;
+
+    int oplc = SetVoice(fm, c);
     if (oplc == -1)
         return;
 
-    Dtab[oplc] = D;
+    fm->Dtab[oplc] = D;
     int Ope = PortBases[oplc];
 
-    OPL_Byte(AM_VIB+           Ope, D[0]);
-	OPL_Byte(KSL_LEVEL+        Ope, D[2]);
-    OPL_Byte(ATTACK_DECAY+     Ope, D[4]);
-    OPL_Byte(SUSTAIN_RELEASE+  Ope, D[6]);
-    OPL_Byte(WAVE_SELECT+      Ope, D[8]&7);// 5 high bits used elsewhere
+    OPL_Byte(fm, AM_VIB+           Ope, D[0]);
+	OPL_Byte(fm, KSL_LEVEL+        Ope, D[2]);
+    OPL_Byte(fm, ATTACK_DECAY+     Ope, D[4]);
+    OPL_Byte(fm, SUSTAIN_RELEASE+  Ope, D[6]);
+    OPL_Byte(fm, WAVE_SELECT+      Ope, D[8]&7);// 5 high bits used elsewhere
 
-    OPL_Byte(AM_VIB+         3+Ope, D[1]);
-	OPL_Byte(KSL_LEVEL+      3+Ope, D[3]);
-    OPL_Byte(ATTACK_DECAY+   3+Ope, D[5]);
-    OPL_Byte(SUSTAIN_RELEASE+3+Ope, D[7]);
-    OPL_Byte(WAVE_SELECT+    3+Ope, D[9]&7);// 5 high bits used elsewhere
+    OPL_Byte(fm, AM_VIB+         3+Ope, D[1]);
+	OPL_Byte(fm, KSL_LEVEL+      3+Ope, D[3]);
+    OPL_Byte(fm, ATTACK_DECAY+   3+Ope, D[5]);
+    OPL_Byte(fm, SUSTAIN_RELEASE+3+Ope, D[7]);
+    OPL_Byte(fm, WAVE_SELECT+    3+Ope, D[9]&7);// 5 high bits used elsewhere
 
     /* feedback, additive synthesis and Panning... */
-    OPL_Byte(FEEDBACK_CONNECTION+oplc, 
+    OPL_Byte(fm, FEEDBACK_CONNECTION+oplc, 
         (D[10] & ~STEREO_BITS)
-	    | (Pans[c]<85 ? VOICE_TO_LEFT
-            : Pans[c]>170 ? VOICE_TO_RIGHT
+	    | (fm->Pans[c]<85 ? VOICE_TO_LEFT
+            : fm->Pans[c]>170 ? VOICE_TO_RIGHT
             : (VOICE_TO_LEFT | VOICE_TO_RIGHT))
     );
 }
 
 
-void OPL_Reset(void)
+void OPL_Reset(song_t *csf)
 {
     int a;
-    if (opl == NULL)
+    struct fm_state *fm = csf->fm;
+    if (fm == NULL || fm->opl == NULL)
         return;
 
-	OPLResetChip(opl);
-	OPL_Detect();
+	OPLResetChip(fm->opl);
+	OPL_Detect(csf);
 
 	for(a = 0; a < MAX_VOICES; ++a) {
-        ChantoOPL[a]=-1;
+        fm->ChantoOPL[a]=-1;
     }
 	for(a = 0; a < 9; ++a) {
-        OPLtoChan[a]= -1;
-		Dtab[a] = NULL;
+        fm->OPLtoChan[a]= -1;
+		fm->Dtab[a] = NULL;
     }
 
-	OPL_Byte(TEST_REGISTER, ENABLE_WAVE_SELECT);
+	OPL_Byte(fm, TEST_REGISTER, ENABLE_WAVE_SELECT);
 #if OPLSOURCE == 3
     //Enable OPL3.
-    OPL_Byte_RightSide(OPL3_MODE_REGISTER, OPL3_ENABLE);
+    OPL_Byte_RightSide(fm, OPL3_MODE_REGISTER, OPL3_ENABLE);
 #endif
 
-	fm_active = 0;
+	fm->fm_active = 0;
 }
 
 
-int OPL_Detect(void)
+int OPL_Detect(song_t *csf)
 {
+	struct fm_state *fm = csf->fm;
+	if (fm == NULL)
+		return -1;
+
 	/* Reset timers 1 and 2 */
-	OPL_Byte(TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
+	OPL_Byte(fm, TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
 
 	/* Reset the IRQ of the FM chip */
-	OPL_Byte(TIMER_CONTROL_REGISTER, IRQ_RESET);
+	OPL_Byte(fm, TIMER_CONTROL_REGISTER, IRQ_RESET);
 
-	unsigned char ST1 = Fmdrv_Inportb(oplbase); /* Status register */
+	unsigned char ST1 = Fmdrv_Inportb(fm, oplbase); /* Status register */
 
-	OPL_Byte(TIMER1_REGISTER, 255);
-	OPL_Byte(TIMER_CONTROL_REGISTER, TIMER2_MASK | TIMER1_START);
+	OPL_Byte(fm, TIMER1_REGISTER, 255);
+	OPL_Byte(fm, TIMER_CONTROL_REGISTER, TIMER2_MASK | TIMER1_START);
 
 	/*_asm xor cx,cx;P1:_asm loop P1*/
-	unsigned char ST2 = Fmdrv_Inportb(oplbase);
+	unsigned char ST2 = Fmdrv_Inportb(fm, oplbase);
 
-	OPL_Byte(TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
-	OPL_Byte(TIMER_CONTROL_REGISTER, IRQ_RESET);
+	OPL_Byte(fm, TIMER_CONTROL_REGISTER, TIMER1_MASK | TIMER2_MASK);
+	OPL_Byte(fm, TIMER_CONTROL_REGISTER, IRQ_RESET);
 
 	int OPLMode = (ST2 & 0xE0) == 0xC0 && !(ST1 & 0xE0);
 
@@ -504,11 +612,19 @@ int OPL_Detect(void)
 	return 0;
 }
 
-/* TODO: This should be called from somewhere in schismtracker to free the allocated memory on exit. */
-void OPL_Close(void)
+/* Called from csf_free (and anywhere else a song_t goes away) to release the chip. */
+void OPL_Close(song_t *csf)
 {
-	if (opl != NULL) {
-		OPLCloseChip(opl);
-		opl = NULL;
+	struct fm_state *fm = csf->fm;
+	if (fm == NULL)
+		return;
+
+	if (fm->opl != NULL) {
+		SDL_AtomicLock(&opl_table_lock);
+		OPLCloseChip(fm->opl);
+		SDL_AtomicUnlock(&opl_table_lock);
 	}
+	free(fm->buf);
+	free(fm);
+	csf->fm = NULL;
 }
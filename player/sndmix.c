@@ -39,14 +39,8 @@
 // SNDMIX: These are global flags for playback control
 unsigned int max_voices = 32; // ITT it is 1994
 
-// Mixing data initialized in
-static unsigned int volume_ramp_samples = 64;
-unsigned int global_vu_left = 0;
-unsigned int global_vu_right = 0;
-int32_t g_dry_rofs_vol = 0;
-int32_t g_dry_lofs_vol = 0;
-
 typedef uint32_t (* convert_t)(void *, int *, uint32_t, int *, int *);
+typedef uint32_t (* convert_float_t)(void *, float *, uint32_t, int *, int *);
 
 
 // see also csf_midi_out_raw in effects.c
@@ -509,7 +503,7 @@ static inline int rn_update_sample(song_t *csf, song_voice_t *chan, int nchan, i
 		if ((csf->flags & SONG_INSTRUMENTMODE)
 		    && chan->ptr_instrument
 		    && chan->ptr_instrument->midi_channel_mask > 0)
-			GM_Pan(nchan, pan);
+			GM_Pan(csf, nchan, pan);
 
 		pan += 128;
 		pan = CLAMP(pan, 0, 256);
@@ -564,7 +558,7 @@ static inline int rn_update_sample(song_t *csf, song_voice_t *chan, int nchan, i
 	    (chan->right_volume != chan->right_volume_new ||
 	     chan->left_volume  != chan->left_volume_new)) {
 		// Setting up volume ramp
-		int ramp_length = volume_ramp_samples;
+		int ramp_length = csf->volume_ramp_samples;
 		int right_delta = ((chan->right_volume_new - chan->right_volume) << VOLUMERAMPPRECISION);
 		int left_delta  = ((chan->left_volume_new  - chan->left_volume)  << VOLUMERAMPPRECISION);
 
@@ -575,7 +569,7 @@ static inline int rn_update_sample(song_t *csf, song_voice_t *chan, int nchan, i
 				ramp_length = csf->buffer_count;
 
 				int l = (1 << (VOLUMERAMPPRECISION - 1));
-				int r =(int) volume_ramp_samples;
+				int r =(int) csf->volume_ramp_samples;
 
 				ramp_length = CLAMP(ramp_length, l, r);
 			}
@@ -642,7 +636,7 @@ static inline void rn_gen_key(song_t *csf, song_voice_t *chan, int chan_num, int
 			volume = volume * chan->instrument_volume / 8192;
 		}
 
-		GM_SetFreqAndVol(chan_num, freq, volume, BendMode, chan->flags & CHN_KEYOFF);
+		GM_SetFreqAndVol(csf, chan_num, freq, volume, BendMode, chan->flags & CHN_KEYOFF);
 	}
 	if (chan->flags & CHN_ADLIB) {
 		// Scaling is needed to get a frequency that matches with ST3 notes.
@@ -651,17 +645,17 @@ static inline void rn_gen_key(song_t *csf, song_voice_t *chan, int chan_num, int
 
 		// OPL_Patch is called in csf_process_effects, from csf_read_note or csf_process_tick, before calling this method.
 		int oplmilliHertz = (long long int)freq*261625L/8363L;
-		OPL_HertzTouch(chan_num, oplmilliHertz, chan->flags & CHN_KEYOFF);
+		OPL_HertzTouch(csf, chan_num, oplmilliHertz, chan->flags & CHN_KEYOFF);
 
 		// ST32 ignores global & master volume in adlib mode, guess we should do the same -Bisqwit
 		// This gives a value in the range 0..63.
 		// log_appendf(2,"vol: %d, voiceinsvol: %d", vol , chan->instrument_volume);
-		OPL_Touch(chan_num, vol * chan->instrument_volume * 63 / (1 << 20));
+		OPL_Touch(csf, chan_num, vol * chan->instrument_volume * 63 / (1 << 20));
 		if (csf->flags&SONG_NOSTEREO) {
-			OPL_Pan(chan_num, 128);
+			OPL_Pan(csf, chan_num, 128);
 		}
 		else {
-			OPL_Pan(chan_num, chan->final_panning);
+			OPL_Pan(csf, chan_num, chan->final_panning);
 		}
 	}
 }
@@ -721,30 +715,30 @@ int csf_init_player(song_t *csf, int reset)
 		max_voices = MAX_VOICES;
 
 	csf->mix_frequency = CLAMP(csf->mix_frequency, 4000, MAX_SAMPLE_RATE);
-	volume_ramp_samples = (csf->mix_frequency * VOLUMERAMPLEN) / 100000;
+	csf->volume_ramp_samples = (csf->mix_frequency * VOLUMERAMPLEN) / 100000;
 
-	if (volume_ramp_samples < 8)
-		volume_ramp_samples = 8;
+	if (csf->volume_ramp_samples < 8)
+		csf->volume_ramp_samples = 8;
 
 	if (csf->mix_flags & SNDMIX_NORAMPING)
-		volume_ramp_samples = 2;
+		csf->volume_ramp_samples = 2;
 
-	g_dry_rofs_vol = g_dry_lofs_vol = 0;
+	csf->dry_rofs_vol = csf->dry_lofs_vol = 0;
 
 	if (reset) {
-		global_vu_left  = 0;
-		global_vu_right = 0;
+		csf->vu_left  = 0;
+		csf->vu_right = 0;
 	}
 
-	song_init_eq(reset, csf->mix_frequency);
+	song_init_eq(csf, reset, csf->mix_frequency);
 
 	// I don't know why, but this "if" makes it work at the desired sample rate instead of 4000.
 	// the "4000Hz" value comes from csf_reset, but I don't yet understand why the opl keeps that value, if
 	// each call to Fmdrv_Init generates a new opl.
 	if (csf->mix_frequency != 4000) {
-		Fmdrv_Init(csf->mix_frequency);
+		Fmdrv_Init(csf, csf->mix_frequency);
 	}
-	GM_Reset(0);
+	GM_Reset(csf, 0);
 	return 1;
 }
 
@@ -753,6 +747,8 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 {
 	uint8_t * buffer = (uint8_t *)v_buffer;
 	convert_t convert_func = clip_32_to_8;
+	convert_float_t convert_float_func = clip_float_to_8;
+	int float_bus = !!(csf->mix_flags & (SNDMIX_FLOATBUS | SNDMIX_FLOATOUTPUT));
 	int32_t vu_min[2];
 	int32_t vu_max[2];
 	unsigned int bufleft, max, sample_size, count, smpcount, mix_stat=0;
@@ -764,9 +760,24 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 	csf->mix_stat = 0;
 	sample_size = csf->mix_channels;
 
-	     if (csf->mix_bits_per_sample == 16) { sample_size *= 2; convert_func = clip_32_to_16; }
-	else if (csf->mix_bits_per_sample == 24) { sample_size *= 3; convert_func = clip_32_to_24; }
-	else if (csf->mix_bits_per_sample == 32) { sample_size *= 4; convert_func = clip_32_to_32; }
+	if (csf->mix_bits_per_sample == 16) {
+		sample_size *= 2;
+		convert_func = clip_32_to_16;
+		convert_float_func = clip_float_to_16;
+	} else if (csf->mix_bits_per_sample == 24) {
+		sample_size *= 3;
+		convert_func = clip_32_to_24;
+		convert_float_func = clip_float_to_24;
+	} else if (csf->mix_bits_per_sample == 32) {
+		sample_size *= 4;
+		if (csf->mix_flags & SNDMIX_FLOATOUTPUT) {
+			convert_func = convert_32_to_float;
+			convert_float_func = float_to_float;
+		} else {
+			convert_func = clip_32_to_32;
+			convert_float_func = clip_float_to_32;
+		}
+	}
 
 	max = bufsize / sample_size;
 
@@ -817,7 +828,7 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 		smpcount = count;
 
 		// Resetting sound buffer
-		stereo_fill(csf->mix_buffer, smpcount, &g_dry_rofs_vol, &g_dry_lofs_vol);
+		stereo_fill(csf->mix_buffer, smpcount, &csf->dry_rofs_vol, &csf->dry_lofs_vol);
 
 		if (csf->mix_channels >= 2) {
 			smpcount *= 2;
@@ -828,7 +839,14 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 		}
 
 		// Handle eq
-		if (csf->mix_channels >= 2) {
+		if (float_bus && !csf->multi_write) {
+			// one conversion in, one out, and everything in between stays float
+			float_bus_from_mix(csf, csf->mix_buffer, count);
+			if (csf->mix_channels >= 2)
+				eq_stereo_float(csf, csf->mix_buffer_float, count);
+			else
+				eq_mono_float(csf, csf->mix_buffer_float, count);
+		} else if (csf->mix_channels >= 2) {
 			eq_stereo(csf, csf->mix_buffer, count);
 			// FIXME: disable this when we're writing WAVs
 			if (!(csf->mix_flags & SNDMIX_DIRECTTODISK)) normalize_stereo(csf, csf->mix_buffer, count << 1);
@@ -842,18 +860,40 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 		if (csf->multi_write) {
 			/* multi doesn't actually write meaningful data into 'buffer', so we can use that
 			as temp space for converting */
-			for (unsigned int n = 0; n < 64; n++) {
-				if (csf->multi_write[n].used) {
+			static int multi_silence[MIXBUFFERSIZE * 2];
+			for (unsigned int n = 0; n < MAX_CHANNELS; n++) {
+				struct multi_write *mw = csf->multi_write + n;
+				if (!mw->data) {
+					continue;
+				} else if (mw->mixed) {
+					unsigned int bytes;
 					if (csf->mix_channels < 2)
-						mono_from_stereo(csf->multi_write[n].buffer, count);
-					unsigned int bytes = convert_func(buffer, csf->multi_write[n].buffer,
+						mono_from_stereo(mw->buffer, count);
+					if (float_bus) {
+						/* the main float bus isn't used with multi-write, so it can
+						hold each channel in turn on its way out */
+						float_bus_from_mix(csf, mw->buffer, count);
+						bytes = convert_float_func(buffer, csf->mix_buffer_float,
+							smpcount, vu_min, vu_max);
+					} else {
+						bytes = convert_func(buffer, mw->buffer,
+							smpcount, vu_min, vu_max);
+					}
+					mw->write(mw->data, buffer, bytes);
+				} else if (mw->used) {
+					/* nothing playing on this channel right now, but there
+					was before, so write out real silence */
+					unsigned int bytes = convert_func(buffer, multi_silence,
 						smpcount, vu_min, vu_max);
-					csf->multi_write[n].write(csf->multi_write[n].data, buffer, bytes);
+					mw->write(mw->data, buffer, bytes);
 				} else {
-					csf->multi_write[n].silence(csf->multi_write[n].data,
+					mw->silence(mw->data,
 						smpcount * ((csf->mix_bits_per_sample + 7) / 8));
 				}
 			}
+		} else if (float_bus) {
+			// Perform clipping (unless it's float out) + VU-Meter
+			buffer += convert_float_func(buffer, csf->mix_buffer_float, smpcount, vu_min, vu_max);
 		} else {
 			// Perform clipping + VU-Meter
 			buffer += convert_func(buffer, csf->mix_buffer, smpcount, vu_min, vu_max);
@@ -880,9 +920,9 @@ unsigned int csf_read(song_t *csf, void * v_buffer, unsigned int bufsize)
 	if (vu_max[1] < vu_min[1])
 		vu_max[1] = vu_min[1];
 
-	global_vu_left = (unsigned int)(vu_max[0] - vu_min[0]);
+	csf->vu_left = (unsigned int)(vu_max[0] - vu_min[0]);
 
-	global_vu_right = (unsigned int)(vu_max[1] - vu_min[1]);
+	csf->vu_right = (unsigned int)(vu_max[1] - vu_min[1]);
 
 	if (mix_stat) {
 		csf->mix_stat += mix_stat - 1;
@@ -1018,7 +1058,7 @@ int csf_process_tick(song_t *csf)
 			// commands... ALL WE DO is dump raw midi data to
 			// our super-secret "midi buffer"
 			// -mrsb
-			if (csf_midi_out_note)
+			if (csf_midi_out_note && !(csf->mix_flags & SNDMIX_NOMIXING))
 				csf_midi_out_note(nchan, m);
 
 			chan->row_note = m->note;
@@ -1043,7 +1083,7 @@ int csf_process_tick(song_t *csf)
 		/* [-- No --] */
 		/* [Update effects for each channel as required.] */
 
-		if (csf_midi_out_note) {
+		if (csf_midi_out_note && !(csf->mix_flags & SNDMIX_NOMIXING)) {
 			song_note_t *m = csf->patterns[csf->current_pattern] + csf->row * MAX_CHANNELS;
 
 			for (unsigned int nchan=0; nchan<MAX_CHANNELS; nchan++, m++) {
@@ -1311,3 +1351,22 @@ int csf_read_note(song_t *csf)
 	return 1;
 }
 
+
+// Plays one tick without mixing anything, for getting the player to some point in the song in a hurry.
+// Voices still move along their samples (and loops), so notes that are ringing are where they should be.
+// Needs SNDMIX_NOMIXING set; returns 0 at the end of the song.
+int csf_skip_tick(song_t *csf)
+{
+	unsigned int count;
+
+	if (!csf_read_note(csf))
+		return 0;
+
+	while (csf->buffer_count) {
+		count = MIN(csf->buffer_count, MIXBUFFERSIZE);
+		csf_create_stereo_mix(csf, count);
+		csf->buffer_count -= count;
+	}
+
+	return 1;
+}
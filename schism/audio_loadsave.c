@@ -164,6 +164,7 @@ void song_new(int flags)
 
 	song_unlock_audio();
 
+	song_pattern_changed(-1);
 	main_song_changed_cb();
 }
 
@@ -198,10 +199,13 @@ void message_convert_newlines(song_t *song) {
 	}
 }
 
-song_t *song_create_load(const char *file)
+/* if 'source' isn't NULL, the sample data is left in the file until it's wanted (see csf_defer_samples),
+and the file is handed back through it instead of being closed; it has to stay open until the song is freed */
+static song_t *song_create_load_ex(const char *file, slurp_t **source)
 {
 	fmt_load_song_func *func;
 	int ok = 0, err = 0;
+	unsigned int lflags = source ? LOAD_DEFERSAMPLES : 0;
 
 	slurp_t *s = slurp(file, NULL, 0);
 	if (!s)
@@ -224,7 +228,7 @@ song_t *song_create_load(const char *file)
 
 	for (func = load_song_funcs; *func && !ok; func++) {
 		slurp_rewind(s);
-		switch ((*func)(newsong, s, 0)) {
+		switch ((*func)(newsong, s, lflags)) {
 		case LOAD_SUCCESS:
 			err = 0;
 			ok = 1;
@@ -247,15 +251,19 @@ song_t *song_create_load(const char *file)
 		}
 	}
 
-	unslurp(s);
-
 	if (err) {
 		// awwww, nerts!
 		csf_free(newsong);
+		unslurp(s);
 		errno = err;
 		return NULL;
 	}
 
+	if (source)
+		*source = s;
+	else
+		unslurp(s);
+
 	newsong->stop_at_order = newsong->stop_at_row = -1;
 	message_convert_newlines(newsong);
 	message_reset_selection();
@@ -263,6 +271,11 @@ song_t *song_create_load(const char *file)
 	return newsong;
 }
 
+song_t *song_create_load(const char *file)
+{
+	return song_create_load_ex(file, NULL);
+}
+
 int song_load_unchecked(const char *file)
 {
 	const char *base = get_basename(file);
@@ -299,6 +312,8 @@ int song_load_unchecked(const char *file)
 	song_stop_unlocked(0);
 	song_unlock_audio();
 
+	song_pattern_changed(-1);
+
 	if (was_playing && (status.flags & PLAY_AFTER_LOAD))
 		song_start();
 
@@ -455,6 +470,266 @@ int song_export(const char *filename, const char *type)
 	}
 }
 
+/* load a song for headless rendering. the settings applied here are normally taken care
+of by song_init_modplug, but there's no audio device to do that */
+static song_t *_render_load(const char *infile)
+{
+	song_t *song = song_create_load(infile);
+	if (!song)
+		return NULL;
+
+	max_voices = audio_settings.channel_limit;
+	csf_set_resampling_mode(song, audio_settings.interpolation_mode);
+	if (audio_settings.no_ramping)
+		song->mix_flags |= SNDMIX_NORAMPING;
+	else
+		song->mix_flags &= ~SNDMIX_NORAMPING;
+	if (audio_settings.surround_effect)
+		song->mix_flags &= ~SNDMIX_NOSURROUND;
+	else
+		song->mix_flags |= SNDMIX_NOSURROUND;
+	return song;
+}
+
+static void _render_print_stats(const char *filename, const struct disko_render_stats *stats)
+{
+	double duration = (double) stats->frames / stats->rate;
+
+	printf("%s: %.2f MiB (%zu:%02zu) written in %.2lf sec (%.1fx realtime)\n",
+		filename, stats->bytes / 1048576.0,
+		(size_t) duration / 60, (size_t) duration % 60,
+		stats->elapsed, stats->elapsed > 0 ? duration / stats->elapsed : 0.0);
+}
+
+int song_render(const char *infile, const char *outfile, const char *type, int num_threads)
+{
+	const struct save_format *format = get_save_format(song_export_formats, type);
+	struct disko_render_stats stats;
+	const char *mid;
+	char *mangle;
+	song_t *song;
+	int r;
+
+	if (!format)
+		return SAVE_INTERNAL_ERROR;
+
+	song = _render_load(infile);
+	if (!song) {
+		fprintf(stderr, "%s: %s\n", infile, fmt_strerror(errno));
+		return SAVE_FILE_ERROR;
+	}
+
+	mid = (format->f.export.multi && strcasestr(outfile, "%c") == NULL) ? ".%c" : NULL;
+	mangle = mangle_filename(outfile, mid, format->ext);
+	if (!mangle) {
+		csf_free(song);
+		return SAVE_INTERNAL_ERROR;
+	}
+
+	r = disko_render_song(song, mangle, format, &stats, num_threads);
+	if (r == DW_OK)
+		_render_print_stats(mangle, &stats);
+	else
+		perror(mangle);
+	free(mangle);
+	csf_free(song);
+	return (r == DW_OK) ? SAVE_SUCCESS : SAVE_FILE_ERROR;
+}
+
+/* --------------------------------------------------------------------- */
+/* batch rendering */
+
+struct render_job {
+	char *infile;
+	char *outfile;
+	int status; /* SAVE_*, or -1 if the job hasn't finished */
+	int err; /* errno (or -LOAD_*) if it failed */
+	struct disko_render_stats stats;
+};
+
+struct render_batch {
+	const struct save_format *format;
+	struct render_job *jobs;
+	int num_jobs, next_job;
+	/* protects next_job, and is held while loading songs: the loaders write to the log
+	and poke at a few globals, so only one of them can run at a time */
+	SDL_mutex *mutex;
+};
+
+static int _render_batch_add(struct render_batch *batch, const char *infile, const char *outdir)
+{
+	struct render_job *jobs, *job;
+	const char *ext = batch->format->ext;
+	char *base;
+
+	jobs = realloc(batch->jobs, (batch->num_jobs + 1) * sizeof(struct render_job));
+	if (!jobs)
+		return 0;
+	batch->jobs = jobs;
+
+	/* keep the module's extension in the output name (song.it.wav), so that
+	song.it and song.xm in the same directory don't end up overwriting each other */
+	base = mem_alloc(strlen(get_basename(infile)) + strlen(ext) + 1);
+	strcpy(base, get_basename(infile));
+	strcat(base, ext);
+
+	job = batch->jobs + batch->num_jobs;
+	memset(job, 0, sizeof(*job));
+	job->infile = str_dup(infile);
+	job->outfile = dmoz_path_concat(outdir, base);
+	job->status = -1;
+	free(base);
+	if (!job->outfile) {
+		free(job->infile);
+		return 0;
+	}
+	batch->num_jobs++;
+	return 1;
+}
+
+static int _render_batch_thread(void *data)
+{
+	struct render_batch *batch = data;
+	struct render_job *job;
+	song_t *song;
+
+	for (;;) {
+		SDL_LockMutex(batch->mutex);
+		if (batch->next_job >= batch->num_jobs) {
+			SDL_UnlockMutex(batch->mutex);
+			return 0;
+		}
+		job = batch->jobs + batch->next_job++;
+		song = _render_load(job->infile);
+		job->err = errno;
+		SDL_UnlockMutex(batch->mutex);
+
+		if (!song) {
+			job->status = SAVE_FILE_ERROR;
+			fprintf(stderr, "%s: %s\n", job->infile,
+				job->err < 0 ? fmt_strerror(job->err) : strerror(job->err));
+			continue;
+		}
+
+		/* each song has its own mixer state (and OPL chip), and each render gets its
+		own set of disko handles, so this part can run on all the threads at once
+		(the songs are already spread across the cpus, so each one only gets a single thread) */
+		if (disko_render_song(song, job->outfile, batch->format, &job->stats, 1) == DW_OK) {
+			job->status = SAVE_SUCCESS;
+			_render_print_stats(job->outfile, &job->stats);
+		} else {
+			job->status = SAVE_FILE_ERROR;
+			job->err = errno;
+			fprintf(stderr, "%s: %s\n", job->outfile, strerror(job->err));
+		}
+		csf_free(song);
+	}
+}
+
+int song_render_batch(char **paths, int num_paths, const char *outdir, const char *type, int num_threads)
+{
+	struct render_batch batch = {0};
+	struct timeval start_time, end_time;
+	SDL_Thread **threads;
+	double elapsed, duration, total_duration = 0;
+	int n, f, started = 0, failed = 0;
+
+	batch.format = get_save_format(song_export_formats, type);
+	if (!batch.format)
+		return SAVE_INTERNAL_ERROR;
+
+	/* directories are expanded (not recursively) to the files in them. there's no
+	point checking the file types here; anything that isn't a module will simply
+	fail to load, and show up as such in the summary */
+	for (n = 0; n < num_paths; n++) {
+		if (is_directory(paths[n])) {
+			dmoz_filelist_t flist = {0};
+			dmoz_dirlist_t dlist = {0};
+
+			if (dmoz_read(paths[n], &flist, &dlist, NULL) < 0) {
+				perror(paths[n]);
+				continue;
+			}
+			dmoz_sort(&flist, &dlist);
+			for (f = 0; f < flist.num_files; f++) {
+				if (flist.files[f]->type & TYPE_FILE_MASK)
+					_render_batch_add(&batch, flist.files[f]->path, outdir);
+			}
+			dmoz_free(&flist, &dlist);
+		} else {
+			_render_batch_add(&batch, paths[n], outdir);
+		}
+	}
+
+	if (!batch.num_jobs) {
+		fprintf(stderr, "Nothing to render\n");
+		return SAVE_FILE_ERROR;
+	}
+
+	if (num_threads < 1)
+		num_threads = SDL_GetCPUCount();
+	num_threads = CLAMP(num_threads, 1, batch.num_jobs);
+
+	printf("Rendering %d file%s to %s (%s) on %d thread%s\n",
+		batch.num_jobs, batch.num_jobs == 1 ? "" : "s", outdir, batch.format->name,
+		num_threads, num_threads == 1 ? "" : "s");
+
+	gettimeofday(&start_time, NULL);
+
+	batch.mutex = SDL_CreateMutex();
+	threads = mem_calloc(num_threads, sizeof(SDL_Thread *));
+	if (batch.mutex) {
+		for (n = 0; n < num_threads; n++) {
+			threads[n] = SDL_CreateThread(_render_batch_thread, "Render", &batch);
+			if (threads[n])
+				started++;
+		}
+	}
+	if (started) {
+		for (n = 0; n < num_threads; n++) {
+			if (threads[n])
+				SDL_WaitThread(threads[n], NULL);
+		}
+	} else {
+		/* couldn't get any threads going: do it the slow way */
+		_render_batch_thread(&batch);
+	}
+	free(threads);
+	if (batch.mutex)
+		SDL_DestroyMutex(batch.mutex);
+
+	gettimeofday(&end_time, NULL);
+	elapsed = (end_time.tv_sec - start_time.tv_sec)
+		+ ((end_time.tv_usec - start_time.tv_usec) / 1000000.0);
+
+	/* summary, in the order the files were given */
+	printf("\n%-40s %8s %9s %10s\n", "File", "Length", "Time", "Realtime");
+	for (n = 0; n < batch.num_jobs; n++) {
+		struct render_job *job = batch.jobs + n;
+
+		if (job->status == SAVE_SUCCESS) {
+			duration = (double) job->stats.frames / job->stats.rate;
+			total_duration += duration;
+			printf("%-40s %5zu:%02zu %8.2fs %9.1fx\n", get_basename(job->infile),
+				(size_t) duration / 60, (size_t) duration % 60, job->stats.elapsed,
+				job->stats.elapsed > 0 ? duration / job->stats.elapsed : 0.0);
+		} else {
+			failed++;
+			printf("%-40s failed: %s\n", get_basename(job->infile),
+				job->err < 0 ? fmt_strerror(job->err) : strerror(job->err));
+		}
+		free(job->infile);
+		free(job->outfile);
+	}
+	printf("%d of %d rendered, %zu:%02zu of audio in %.2lf sec (%.1fx realtime overall)\n",
+		batch.num_jobs - failed, batch.num_jobs,
+		(size_t) total_duration / 60, (size_t) total_duration % 60,
+		elapsed, elapsed > 0 ? total_duration / elapsed : 0.0);
+
+	free(batch.jobs);
+	return failed ? SAVE_FILE_ERROR : SAVE_SUCCESS;
+}
+
 
 int song_save(const char *filename, const char *type)
 {
@@ -610,27 +885,38 @@ void song_clear_sample(int n)
 	song_unlock_audio();
 }
 
+static void library_load_sample(song_sample_t *smp); // with the rest of the library stuff, below
+
 void song_copy_sample(int n, song_sample_t *src)
 {
+	library_load_sample(src);
 	memcpy(current_song->samples + n, src, sizeof(song_sample_t));
 
-	if (src->data) {
-		unsigned long bytelength = src->length;
-		if (src->flags & CHN_16BIT)
-			bytelength *= 2;
-		if (src->flags & CHN_STEREO)
-			bytelength *= 2;
-
-		current_song->samples[n].data = csf_allocate_sample(bytelength);
-		memcpy(current_song->samples[n].data, src->data, bytelength);
-	}
+	// the data is shared until one of them is edited (see csf_unshare_sample)
+	csf_ref_sample(src->data);
 }
 
 int song_load_instrument_ex(int target, const char *file, const char *libf, int n)
 {
-	slurp_t *s;
+	song_t *xl = NULL;
+	slurp_t *s, *xl_source = NULL;
 	int r, x;
 
+	if (libf) { /* file is ignored */
+		// only the samples this instrument uses get read, and that's done before locking,
+		// since decoding them can take a while
+		xl = song_create_load_ex(libf, &xl_source);
+		if (!xl) {
+			log_appendf(4, "%s: %s", libf, fmt_strerror(errno));
+			return 0;
+		}
+		for (unsigned int j = 0; j < 128; j++) {
+			x = xl->instruments[n]->sample_map[j];
+			if (x > 0 && x < MAX_INSTRUMENTS)
+				csf_load_deferred_sample(xl, &xl->samples[x]);
+		}
+	}
+
 	song_lock_audio();
 
 	/* 0. delete old samples */
@@ -664,16 +950,9 @@ int song_load_instrument_ex(int target, const char *file, const char *libf, int
 		}
 	}
 
-	if (libf) { /* file is ignored */
+	if (xl) {
 		int sampmap[MAX_SAMPLES] = {0};
 
-		song_t *xl = song_create_load(libf);
-		if (!xl) {
-			log_appendf(4, "%s: %s", libf, fmt_strerror(errno));
-			song_unlock_audio();
-			return 0;
-		}
-
 		/* 1. find a place for all the samples */
 		for (unsigned int j = 0; j < 128; j++) {
 			x = xl->instruments[n]->sample_map[j];
@@ -709,6 +988,9 @@ int song_load_instrument_ex(int target, const char *file, const char *libf, int
 		}
 
 		song_unlock_audio();
+
+		csf_free(xl);
+		unslurp(xl_source);
 		return 1;
 	}
 
@@ -745,6 +1027,9 @@ int song_preload_sample(dmoz_file_t *file)
 	if (file->sample) {
 		song_sample_t *smp = song_get_sample(FAKE_SLOT);
 
+		// get the data read in before locking, if it hasn't been yet
+		library_load_sample(file->sample);
+
 		song_lock_audio();
 		csf_destroy_sample(current_song, FAKE_SLOT);
 		song_copy_sample(FAKE_SLOT, file->sample);
@@ -760,13 +1045,32 @@ int song_preload_sample(dmoz_file_t *file)
 #undef FAKE_SLOT
 }
 
+/* samples bigger than this are loaded straight from the file if possible (see fmt_wav_load_sample_stream) */
+#define SAMPLE_STREAM_SIZE (16 * 1024 * 1024)
+
 int song_load_sample(int n, const char *file)
 {
-	fmt_load_sample_func *load;
+	fmt_load_sample_func *load = load_sample_funcs;
 	song_sample_t smp = {0};
 
 	const char *base = get_basename(file);
-	slurp_t *s = slurp(file, NULL, 0);
+	int streamed = 0;
+	slurp_t *s;
+
+	// big ones (and anything piped in) get read a piece at a time, if the format allows it
+	if (strcmp(file, "-") == 0 || file_size(file) > SAMPLE_STREAM_SIZE) {
+		s = slurp_stream(file, NULL, 0);
+		if (s) {
+			strncpy(smp.name, base, 25);
+			streamed = fmt_wav_load_sample_stream(s, &smp);
+			if (!streamed && !slurp_unstream(s)) {
+				unslurp(s);
+				s = NULL;
+			}
+		}
+	} else {
+		s = slurp(file, NULL, 0);
+	}
 
 	if (s == NULL) {
 		log_perror(base);
@@ -776,11 +1080,13 @@ int song_load_sample(int n, const char *file)
 	// set some default stuff
 	song_lock_audio();
 	csf_stop_sample(current_song, current_song->samples + n);
-	strncpy(smp.name, base, 25);
 
-	for (load = load_sample_funcs; *load; load++) {
-		if ((*load)(s->data, s->length, &smp)) {
-			break;
+	if (!streamed) {
+		strncpy(smp.name, base, 25);
+		for (; *load; load++) {
+			if ((*load)(s->data, s->length, &smp)) {
+				break;
+			}
 		}
 	}
 
@@ -891,6 +1197,22 @@ const char *song_get_basename(void)
 
 // FIXME: unload the module when leaving the library 'directory'
 static song_t *library = NULL;
+// the library's file, kept open so its samples can be read as they're looked at
+static slurp_t *library_source = NULL;
+
+static void library_free(void)
+{
+	csf_free(library);
+	library = NULL;
+	unslurp(library_source);
+	library_source = NULL;
+}
+
+static void library_load_sample(song_sample_t *smp)
+{
+	if (library)
+		csf_load_deferred_sample(library, smp);
+}
 
 
 // TODO: stat the file?
@@ -900,10 +1222,10 @@ int dmoz_read_instrument_library(const char *path, dmoz_filelist_t *flist, UNUSE
 	int x;
 
 	csf_stop_sample(current_song, current_song->samples + 0);
-	csf_free(library);
+	library_free();
 
 	const char *base = get_basename(path);
-	library = song_create_load(path);
+	library = song_create_load_ex(path, &library_source);
 	if (!library) {
 		log_appendf(4, "%s: %s", base, fmt_strerror(errno));
 		return -1;
@@ -946,7 +1268,7 @@ int dmoz_read_instrument_library(const char *path, dmoz_filelist_t *flist, UNUSE
 int dmoz_read_sample_library(const char *path, dmoz_filelist_t *flist, UNUSED dmoz_dirlist_t *dlist)
 {
 	csf_stop_sample(current_song, current_song->samples + 0);
-	csf_free(library);
+	library_free();
 
 	const char *base = get_basename(path);
 
@@ -978,7 +1300,7 @@ int dmoz_read_sample_library(const char *path, dmoz_filelist_t *flist, UNUSED dm
 	}
 
 	if (info_file.type & TYPE_MODULE_MASK) {
-		library = song_create_load(path);
+		library = song_create_load_ex(path, &library_source);
 	} else if (info_file.type & TYPE_INST_MASK) {
 		/* temporarily set the current song to the library */
 		song_t* tmp_ptr = current_song;
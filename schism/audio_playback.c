@@ -34,6 +34,7 @@
 
 #include <assert.h>
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -104,6 +105,114 @@ int audio_device_list_size = 0;
 
 static SDL_AudioDeviceID current_audio_device = 0;
 
+// ------------------------------------------------------------------------
+// playback state as the ui sees it
+//
+// The audio callback copies what the ui wants to know about into whichever
+// of the two snapshots isn't published, then bumps the generation to
+// publish it. Readers copy out of snapshots[gen & 1] and retry if the
+// generation moved while they were at it, so the ui never has to hold the
+// audio lock (and stall the mixer) just to draw the info page. Anything
+// done under song_lock_audio is published again on unlock, so the ui also
+// sees its own changes right away.
+
+struct playback_snapshot {
+	int mode; // enum song_mode
+	int order, pattern, row;
+	int tick, speed, tempo;
+	int global_volume;
+	int vu_left, vu_right;
+	int num_voices;
+	int playing_samples[MAX_SAMPLES];
+	song_playing_voice_t voices[MAX_VOICES];
+};
+
+static struct playback_snapshot snapshots[2];
+static SDL_atomic_t snapshot_gen;
+
+static enum song_mode _song_mode(song_t *csf)
+{
+	if ((csf->flags & (SONG_ENDREACHED | SONG_PAUSED)) == (SONG_ENDREACHED | SONG_PAUSED))
+		return MODE_STOPPED;
+	if (csf->flags & SONG_PAUSED)
+		return MODE_SINGLE_STEP;
+	if (csf->flags & SONG_PATTERNPLAYBACK)
+		return MODE_PATTERN_LOOP;
+	return MODE_PLAYING;
+}
+
+// must be called from the audio thread, or with the audio lock held
+static void snapshot_publish(void)
+{
+	int gen = SDL_AtomicGet(&snapshot_gen);
+	struct playback_snapshot *snap = &snapshots[(gen + 1) & 1];
+	int n, v;
+
+	if (!current_song)
+		return;
+
+	snap->mode = _song_mode(current_song);
+	snap->order = current_song->current_order;
+	snap->pattern = current_song->current_pattern;
+	snap->row = current_song->row;
+	snap->speed = current_song->current_speed;
+	snap->tick = snap->speed ? current_song->tick_count % snap->speed : 0;
+	snap->tempo = current_song->current_tempo;
+	snap->global_volume = current_song->current_global_volume;
+	snap->vu_left = current_song->vu_left;
+	snap->vu_right = current_song->vu_right;
+
+	memset(snap->playing_samples, 0, sizeof(snap->playing_samples));
+
+	n = MIN(current_song->num_voices, max_voices);
+	for (v = 0; v < n; v++) {
+		song_voice_t *channel = current_song->voices + current_song->voice_mix[v];
+		song_playing_voice_t *pv = snap->voices + v;
+
+		pv->sample_data = channel->current_sample_data;
+		pv->instrument = channel->ptr_instrument;
+		pv->position = channel->position;
+		pv->flags = channel->flags;
+		pv->final_volume = channel->final_volume;
+		pv->vol_env_position = channel->vol_env_position;
+		pv->pan_env_position = channel->pan_env_position;
+		pv->pitch_env_position = channel->pitch_env_position;
+		pv->strike = channel->strike;
+
+		if (channel->ptr_sample && channel->current_sample_data) {
+			int s = channel->ptr_sample - current_song->samples;
+			if (s >= 0 && s < MAX_SAMPLES)
+				snap->playing_samples[s] = MAX(snap->playing_samples[s], 1 + channel->strike);
+		}
+	}
+	snap->num_voices = n;
+
+	SDL_AtomicSet(&snapshot_gen, gen + 1);
+}
+
+/* Copy `size` bytes at `offset` into the published snapshot out to `dest`.
+Everything the ui reads goes through here, so it's always a consistent copy
+even if the audio thread publishes (twice) in the middle of it. */
+static void snapshot_read(void *dest, size_t offset, size_t size)
+{
+	int gen;
+
+	do {
+		gen = SDL_AtomicGet(&snapshot_gen);
+		memcpy(dest, (const char *) &snapshots[gen & 1] + offset, size);
+		SDL_MemoryBarrierAcquire();
+	} while (SDL_AtomicGet(&snapshot_gen) != gen);
+}
+
+#define SNAPSHOT_INT(field) snapshot_int(offsetof(struct playback_snapshot, field))
+
+static int snapshot_int(size_t offset)
+{
+	int val;
+	snapshot_read(&val, offset, sizeof(val));
+	return val;
+}
+
 // ------------------------------------------------------------------------
 // playback
 
@@ -181,6 +290,8 @@ static void audio_callback(UNUSED void *qq, uint8_t * stream, int len)
 	if (current_song->num_voices > max_channels_used)
 		max_channels_used = MIN(current_song->num_voices, max_voices);
 POST_EVENT:
+	snapshot_publish();
+
 	audio_writeout_count++;
 	if (audio_writeout_count > audio_buffers_per_second) {
 		audio_writeout_count = 0;
@@ -359,8 +470,8 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
 		csf_check_nna(current_song, chan_internal, ins, note, 0);
 	if (s) {
 		if (c->flags & CHN_ADLIB) {
-			OPL_NoteOff(chan_internal);
-			OPL_Patch(chan_internal, s->adlib_bytes);
+			OPL_NoteOff(current_song, chan_internal);
+			OPL_Patch(current_song, chan_internal, s->adlib_bytes);
 		}
 
 		c->flags = (s->flags & CHN_SAMPLE_FLAGS) | (c->flags & CHN_MUTE);
@@ -384,8 +495,8 @@ static int song_keydown_ex(int samp, int ins, int note, int vol, int chan, int e
 
 			if ((status.flags & MIDI_LIKE_TRACKER) && i) {
 				if (i->midi_channel_mask) {
-					GM_KeyOff(chan_internal);
-					GM_DPatch(chan_internal, i->midi_program, i->midi_bank, i->midi_channel_mask);
+					GM_KeyOff(current_song, chan_internal);
+					GM_DPatch(current_song, chan_internal, i->midi_program, i->midi_bank, i->midi_channel_mask);
 				}
 			}
 
@@ -543,7 +654,7 @@ static void song_reset_play_state(void)
 	// turn this crap off
 	current_song->mix_flags &= ~(SNDMIX_NOBACKWARDJUMPS | SNDMIX_DIRECTTODISK);
 
-	OPL_Reset(); /* gruh? */
+	OPL_Reset(current_song); /* gruh? */
 
 	csf_set_current_order(current_song, 0);
 
@@ -565,7 +676,7 @@ void song_start_once(void)
 	max_channels_used = 0;
 	current_song->repeat_count = -1; // FIXME do this right
 
-	GM_SendSongStartCode();
+	GM_SendSongStartCode(current_song);
 	song_unlock_audio();
 	main_song_mode_changed_cb();
 
@@ -579,7 +690,7 @@ void song_start(void)
 	song_reset_play_state();
 	max_channels_used = 0;
 
-	GM_SendSongStartCode();
+	GM_SendSongStartCode(current_song);
 	song_unlock_audio();
 	main_song_mode_changed_cb();
 
@@ -658,9 +769,9 @@ void song_stop_unlocked(int quitting)
 		midi_playing = 0;
 	}
 
-	OPL_Reset(); /* Also stop all OPL sounds */
-	GM_Reset(quitting);
-	GM_SendSongStopCode();
+	OPL_Reset(current_song); /* Also stop all OPL sounds */
+	GM_Reset(current_song, quitting);
+	GM_SendSongStopCode(current_song);
 
 	memset(last_row,0,sizeof(last_row));
 	last_row_number = -1;
@@ -678,8 +789,8 @@ void song_stop_unlocked(int quitting)
 	// Modplug doesn't actually have a "stop" mode, but if SONG_ENDREACHED is set, current_song->Read just returns.
 	current_song->flags |= SONG_PAUSED | SONG_ENDREACHED;
 
-	global_vu_left = 0;
-	global_vu_right = 0;
+	current_song->vu_left = 0;
+	current_song->vu_right = 0;
 	memset(audio_buffer, 0, audio_buffer_samples * audio_sample_size);
 }
 
@@ -695,7 +806,7 @@ void song_loop_pattern(int pattern, int row)
 	max_channels_used = 0;
 	csf_loop_pattern(current_song, pattern, row);
 
-	GM_SendSongStartCode();
+	GM_SendSongStartCode(current_song);
 
 	song_unlock_audio();
 	main_song_mode_changed_cb();
@@ -705,20 +816,29 @@ void song_loop_pattern(int pattern, int row)
 
 void song_start_at_order(int order, int row)
 {
+	/* chase everything up to this point (tempo, global volume, effect memory, notes that
+	are still ringing), so it sounds the way it would if the song had played through */
+	struct csf_play_state *seek = song_get_seek_state(order, row);
+
 	song_lock_audio();
 
 	song_reset_play_state();
 
-	csf_set_current_order(current_song, order);
-	current_song->break_row = row;
+	if (seek) {
+		csf_restore_play_state(current_song, seek);
+	} else {
+		csf_set_current_order(current_song, order);
+		current_song->break_row = row;
+	}
 	max_channels_used = 0;
 
-	GM_SendSongStartCode();
+	GM_SendSongStartCode(current_song);
 	/* TODO: GM_SendSongPositionCode(calculate the number of 1/16 notes) */
 	song_unlock_audio();
 	main_song_mode_changed_cb();
 
 	csf_reset_playmarks(current_song);
+	free(seek);
 }
 
 void song_start_at_pattern(int pattern, int row)
@@ -741,13 +861,7 @@ void song_start_at_pattern(int pattern, int row)
 
 enum song_mode song_get_mode(void)
 {
-	if ((current_song->flags & (SONG_ENDREACHED | SONG_PAUSED)) == (SONG_ENDREACHED | SONG_PAUSED))
-		return MODE_STOPPED;
-	if (current_song->flags & SONG_PAUSED)
-		return MODE_SINGLE_STEP;
-	if (current_song->flags & SONG_PATTERNPLAYBACK)
-		return MODE_PATTERN_LOOP;
-	return MODE_PLAYING;
+	return (enum song_mode) SNAPSHOT_INT(mode);
 }
 
 // returned value is in seconds
@@ -758,11 +872,11 @@ unsigned int song_get_current_time(void)
 
 int song_get_current_tick(void)
 {
-	return current_song->tick_count % current_song->current_speed;
+	return SNAPSHOT_INT(tick);
 }
 int song_get_current_speed(void)
 {
-	return current_song->current_speed;
+	return SNAPSHOT_INT(speed);
 }
 
 void song_set_current_tempo(int new_tempo)
@@ -773,32 +887,32 @@ void song_set_current_tempo(int new_tempo)
 }
 int song_get_current_tempo(void)
 {
-	return current_song->current_tempo;
+	return SNAPSHOT_INT(tempo);
 }
 
 int song_get_current_global_volume(void)
 {
-	return current_song->current_global_volume;
+	return SNAPSHOT_INT(global_volume);
 }
 
 int song_get_current_order(void)
 {
-	return current_song->current_order;
+	return SNAPSHOT_INT(order);
 }
 
 int song_get_playing_pattern(void)
 {
-	return current_song->current_pattern;
+	return SNAPSHOT_INT(pattern);
 }
 
 int song_get_current_row(void)
 {
-	return current_song->row;
+	return SNAPSHOT_INT(row);
 }
 
 int song_get_playing_channels(void)
 {
-	return MIN(current_song->num_voices, max_voices);
+	return SNAPSHOT_INT(num_voices);
 }
 
 int song_get_max_channels(void)
@@ -808,8 +922,11 @@ int song_get_max_channels(void)
 // Returns the max value in dBs, scaled as 0 = -40dB and 128 = 0dB.
 void song_get_vu_meter(int *left, int *right)
 {
-	*left = dB_s(40, global_vu_left/256.f, 0.f);
-	*right = dB_s(40, global_vu_right/256.f, 0.f);
+	int vu[2];
+
+	snapshot_read(vu, offsetof(struct playback_snapshot, vu_left), sizeof(vu));
+	*left = dB_s(40, vu[0]/256.f, 0.f);
+	*right = dB_s(40, vu[1]/256.f, 0.f);
 }
 
 void song_update_playing_instrument(int i_changed)
@@ -901,43 +1018,44 @@ void song_update_playing_sample(int s_changed)
 
 void song_get_playing_samples(int samples[])
 {
-	song_voice_t *channel;
+	snapshot_read(samples, offsetof(struct playback_snapshot, playing_samples),
+		MAX_SAMPLES * sizeof(int));
+}
 
-	memset(samples, 0, MAX_SAMPLES * sizeof(int));
+// the instruments are worked out from the voices here rather than in snapshot_publish, since turning an
+// instrument pointer into a number means searching for it, and that's not for the audio thread to do
+void song_get_playing_instruments(int instruments[])
+{
+	song_playing_voice_t voices[MAX_VOICES];
+	const song_instrument_t *last_ptr = NULL;
+	int last_ins = 0;
+	int n, v;
 
-	song_lock_audio();
-	int n = MIN(current_song->num_voices, max_voices);
-	while (n--) {
-		channel = current_song->voices + current_song->voice_mix[n];
-		if (channel->ptr_sample && channel->current_sample_data) {
-			int s = channel->ptr_sample - current_song->samples;
-			if (s >= 0 && s < MAX_SAMPLES) {
-				samples[s] = MAX(samples[s], 1 + channel->strike);
-			}
-		} else {
-			// no sample.
-			// (when does this happen?)
+	memset(instruments, 0, MAX_INSTRUMENTS * sizeof(int));
+	n = song_get_playing_voices(voices);
+	for (v = 0; v < n; v++) {
+		// voices playing the same instrument tend to come in bunches
+		if (voices[v].instrument != last_ptr) {
+			last_ptr = voices[v].instrument;
+			last_ins = song_get_instrument_number((song_instrument_t *) last_ptr);
 		}
+		if (last_ins > 0 && last_ins < MAX_INSTRUMENTS)
+			instruments[last_ins] = MAX(instruments[last_ins], 1 + voices[v].strike);
 	}
-	song_unlock_audio();
 }
 
-void song_get_playing_instruments(int instruments[])
+int song_get_playing_voices(song_playing_voice_t voices[])
 {
-	song_voice_t *channel;
+	int gen, n;
 
-	memset(instruments, 0, MAX_INSTRUMENTS * sizeof(int));
+	do {
+		gen = SDL_AtomicGet(&snapshot_gen);
+		n = snapshots[gen & 1].num_voices;
+		memcpy(voices, snapshots[gen & 1].voices, n * sizeof(song_playing_voice_t));
+		SDL_MemoryBarrierAcquire();
+	} while (SDL_AtomicGet(&snapshot_gen) != gen);
 
-	song_lock_audio();
-	int n = MIN(current_song->num_voices, max_voices);
-	while (n--) {
-		channel = current_song->voices + current_song->voice_mix[n];
-		int ins = song_get_instrument_number((song_instrument_t *) channel->ptr_instrument);
-		if (ins > 0 && ins < MAX_INSTRUMENTS) {
-			instruments[ins] = MAX(instruments[ins], 1 + channel->strike);
-		}
-	}
-	song_unlock_audio();
+	return n;
 }
 
 // ------------------------------------------------------------------------
@@ -1302,6 +1420,7 @@ void song_lock_audio(void)
 }
 void song_unlock_audio(void)
 {
+	snapshot_publish();
 	SDL_UnlockAudioDevice(current_audio_device);
 }
 void song_start_audio(void)
@@ -1569,7 +1688,7 @@ int audio_reinit(const char *device)
 
 /* --------------------------------------------------------------------------------------------------------- */
 
-void song_init_eq(int do_reset, uint32_t mix_freq)
+void song_init_eq(song_t *csf, int do_reset, uint32_t mix_freq)
 {
 	uint32_t pg[4];
 	uint32_t pf[4];
@@ -1581,7 +1700,7 @@ void song_init_eq(int do_reset, uint32_t mix_freq)
 			* (mix_freq / 128) / 1024);
 	}
 
-	set_eq_gains(pg, 4, pf, do_reset, mix_freq);
+	set_eq_gains(csf, pg, 4, pf, do_reset, mix_freq);
 }
 
 
@@ -1615,6 +1734,7 @@ void song_initialise(void)
 	csf_midi_out_note = _schism_midi_out_note;
 	csf_midi_out_raw = _schism_midi_out_raw;
 
+	csf_init_mixer();
 
 	current_song = csf_allocate();
 
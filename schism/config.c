@@ -34,6 +34,7 @@
 
 #include "config-parser.h"
 #include "dmoz.h"
+#include "fmt.h"
 #include "osdefs.h"
 
 /* --------------------------------------------------------------------- */
@@ -197,6 +198,7 @@ void cfg_load(void)
 	cfg_load_midi(&cfg);
 	cfg_load_disko(&cfg);
 	cfg_load_dmoz(&cfg);
+	cfg_load_waterfall(&cfg);
 
 	/* - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - */
 
@@ -212,6 +214,9 @@ void cfg_load(void)
 		status.flags |= NUMBERED_BACKUPS;
 	else
 		status.flags &= ~NUMBERED_BACKUPS;
+	/* 0 = off, 1 = IT 2.14, 2 = IT 2.15, 3 = FLAC (if there's FLAC support; nothing but us can load it) */
+	its_compress_samples = CLAMP(cfg_get_number(&cfg, "General", "compress_samples", ITS_COMPRESS_NONE),
+		ITS_COMPRESS_NONE, ITS_COMPRESS_FLAC);
 
 	i = cfg_get_number(&cfg, "General", "time_display", TIME_PLAY_ELAPSED);
 	/* default to play/elapsed for invalid values */
@@ -299,6 +304,7 @@ void cfg_save(void)
 	cfg_save_palette(&cfg);
 	cfg_save_disko(&cfg);
 	cfg_save_dmoz(&cfg);
+	cfg_save_waterfall(&cfg);
 
 	cfg_write(&cfg);
 	cfg_free(&cfg);
@@ -346,6 +352,7 @@ void cfg_atexit_save(void)
 	cfg_set_number(&cfg, "General", "classic_mode", !!(status.flags & CLASSIC_MODE));
 	cfg_set_number(&cfg, "General", "make_backups", !!(status.flags & MAKE_BACKUPS));
 	cfg_set_number(&cfg, "General", "numbered_backups", !!(status.flags & NUMBERED_BACKUPS));
+	cfg_set_number(&cfg, "General", "compress_samples", its_compress_samples);
 
 	cfg_set_number(&cfg, "General", "accidentals_as_flats", (kbd_sharp_flat_state() == KBD_SHARP_FLAT_FLATS));
 	cfg_set_number(&cfg, "General", "meta_is_ctrl", !!(status.flags & META_IS_CTRL));
@@ -33,15 +33,19 @@
 #include "song.h"
 #include "util.h"
 #include "vgamem.h"
+#include "sdlmain.h"
 
 #include "player/sndfile.h"
 #include "player/cmixer.h"
+#include "player/snd_fm.h"
+#include "player/snd_gm.h"
 
 #include <sys/stat.h>
 
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <math.h>
 
 #define DW_BUFFER_SIZE 65536
 
@@ -50,12 +54,16 @@
 static unsigned int disko_output_rate = 44100;
 static unsigned int disko_output_bits = 16;
 static unsigned int disko_output_channels = 2;
+static int disko_output_float = 0; /* 32-bit float instead of integers */
+static int disko_output_headroom = 0; /* dB to turn the mix down by, on the float bus */
 
 void cfg_load_disko(cfg_file_t *cfg)
 {
 	disko_output_rate = cfg_get_number(cfg, "Diskwriter", "rate", 44100);
 	disko_output_bits = cfg_get_number(cfg, "Diskwriter", "bits", 16);
 	disko_output_channels = cfg_get_number(cfg, "Diskwriter", "channels", 2);
+	disko_output_float = !!cfg_get_number(cfg, "Diskwriter", "float", 0);
+	disko_output_headroom = CLAMP(cfg_get_number(cfg, "Diskwriter", "headroom", 0), 0, 48);
 }
 
 void cfg_save_disko(cfg_file_t *cfg)
@@ -63,6 +71,8 @@ void cfg_save_disko(cfg_file_t *cfg)
 	cfg_set_number(cfg, "Diskwriter", "rate", disko_output_rate);
 	cfg_set_number(cfg, "Diskwriter", "bits", disko_output_bits);
 	cfg_set_number(cfg, "Diskwriter", "channels", disko_output_channels);
+	cfg_set_number(cfg, "Diskwriter", "float", disko_output_float);
+	cfg_set_number(cfg, "Diskwriter", "headroom", disko_output_headroom);
 }
 
 // ---------------------------------------------------------------------------
@@ -176,6 +186,26 @@ void disko_write(disko_t *ds, const void *buf, size_t len)
 		ds->_write(ds, buf, len);
 }
 
+void disko_write_swapped(disko_t *ds, const void *buf, size_t len, int width)
+{
+	const uint8_t *in = buf;
+	uint8_t tmp[4096];
+	size_t chunk, i;
+	int b;
+
+	len -= len % width;
+	while (len > 0 && !ds->error) {
+		chunk = MIN(len, sizeof(tmp) - sizeof(tmp) % width);
+		for (i = 0; i < chunk; i += width) {
+			for (b = 0; b < width; b++)
+				tmp[i + b] = in[i + width - 1 - b];
+		}
+		ds->_write(ds, tmp, chunk);
+		in += chunk;
+		len -= chunk;
+	}
+}
+
 void disko_putc(disko_t *ds, int c)
 {
 	if (!ds->error)
@@ -364,21 +394,31 @@ int disko_memclose(disko_t *ds, int keep_buffer)
 
 // ---------------------------------------------------------------------------
 
-static void _export_setup(song_t *dwsong, int *bps)
+/* reset playback and apply the diskwriter settings to a song that's about to be written out
+(into a sample, if to_sample is set -- those are 8 or 16 bit only) */
+static void _export_prepare(song_t *dwsong, int *bps, int to_sample)
 {
-	song_lock_audio();
+	int bits = disko_output_float ? 32 : disko_output_bits;
 
-	/* install our own */
-	memcpy(dwsong, current_song, sizeof(song_t)); /* shadow it */
+	if (to_sample)
+		bits = MIN(disko_output_bits, 16);
 
 	dwsong->multi_write = NULL; /* should be null already, but to be sure... */
 
 	csf_set_current_order(dwsong, 0); /* rather indirect way of resetting playback variables */
-	csf_set_wave_config(dwsong, disko_output_rate, disko_output_bits,
+	csf_set_wave_config(dwsong, disko_output_rate, bits,
 		(dwsong->flags & SONG_NOSTEREO) ? 1 : disko_output_channels);
 
 	dwsong->mix_flags |= SNDMIX_DIRECTTODISK | SNDMIX_NOBACKWARDJUMPS;
 
+	/* the float bus is only used if it's needed, so the integer output doesn't change otherwise */
+	dwsong->mix_flags &= ~(SNDMIX_FLOATBUS | SNDMIX_FLOATOUTPUT);
+	if (disko_output_float && !to_sample)
+		dwsong->mix_flags |= SNDMIX_FLOATOUTPUT;
+	if (disko_output_headroom)
+		dwsong->mix_flags |= SNDMIX_FLOATBUS;
+	dwsong->mix_headroom = powf(10.0f, disko_output_headroom / -20.0f);
+
 	dwsong->repeat_count = -1; // FIXME do this right
 	dwsong->buffer_count = 0;
 	dwsong->flags &= ~(SONG_PAUSED | SONG_PATTERNLOOP | SONG_ENDREACHED);
@@ -386,13 +426,28 @@ static void _export_setup(song_t *dwsong, int *bps)
 	dwsong->stop_at_row = -1;
 
 	*bps = dwsong->mix_channels * ((dwsong->mix_bits_per_sample + 7) / 8);
+}
+
+static void _export_setup(song_t *dwsong, int *bps, int to_sample)
+{
+	song_lock_audio();
+
+	/* install our own */
+	memcpy(dwsong, current_song, sizeof(song_t)); /* shadow it */
+
+	/* the shadow gets its own OPL chip and MIDI state (created by csf_set_wave_config),
+	so that rendering doesn't trample on whatever the playing song is doing */
+	dwsong->fm = NULL;
+	dwsong->gm = NULL;
+	_export_prepare(dwsong, bps, to_sample);
 
 	song_unlock_audio();
 }
 
-static void _export_teardown(void)
+static void _export_teardown(song_t *dwsong)
 {
-	global_vu_left = global_vu_right = 0;
+	OPL_Close(dwsong);
+	GM_Close(dwsong);
 }
 
 // ---------------------------------------------------------------------------
@@ -443,7 +498,7 @@ int disko_writeout_sample(int smpnum, int pattern, int dobind)
 	if (!ds)
 		return DW_ERROR;
 
-	_export_setup(&dwsong, &bps);
+	_export_setup(&dwsong, &bps, 1);
 	dwsong.repeat_count = -1; // FIXME do this right
 	csf_loop_pattern(&dwsong, pattern, 0);
 
@@ -469,7 +524,7 @@ int disko_writeout_sample(int smpnum, int pattern, int dobind)
 		ret = DW_ERROR;
 	}
 
-	_export_teardown();
+	_export_teardown(&dwsong);
 
 	return ret;
 }
@@ -486,7 +541,7 @@ int disko_multiwrite_samples(int firstsmp, int pattern)
 	int smpnum = CLAMP(firstsmp, 1, MAX_SAMPLES);
 	int n;
 
-	_export_setup(&dwsong, &bps);
+	_export_setup(&dwsong, &bps, 1);
 	dwsong.repeat_count = -1; // FIXME do this right
 	csf_loop_pattern(&dwsong, pattern, 0);
 	dwsong.multi_write = calloc(MAX_CHANNELS, sizeof(struct multi_write));
@@ -506,9 +561,9 @@ int disko_multiwrite_samples(int firstsmp, int pattern)
 	if (err) {
 		/* you might think this code is insane, and you might be correct ;)
 		but it's structured like this to keep all the early-termination handling HERE. */
-		_export_teardown();
+		_export_teardown(&dwsong);
 		err = err ? err : errno;
-		free(dwsong.multi_write);
+		csf_free_multi_write(&dwsong);
 		for (n = 0; n < MAX_CHANNELS; n++)
 			disko_memclose(ds[n], 0);
 		errno = err;
@@ -570,8 +625,8 @@ int disko_multiwrite_samples(int firstsmp, int pattern)
 		}
 	}
 
-	_export_teardown();
-	free(dwsong.multi_write);
+	_export_teardown(&dwsong);
+	csf_free_multi_write(&dwsong);
 
 	if (err) {
 		errno = err;
@@ -701,7 +756,7 @@ int disko_export_song(const char *filename, const struct save_format *format)
 
 	numfiles = format->f.export.multi ? MAX_CHANNELS : 1;
 
-	_export_setup(&export_dwsong, &export_bps);
+	_export_setup(&export_dwsong, &export_bps, 0);
 	if (numfiles > 1) {
 		export_dwsong.multi_write = calloc(numfiles, sizeof(struct multi_write));
 		if (!export_dwsong.multi_write)
@@ -720,15 +775,16 @@ int disko_export_song(const char *filename, const struct save_format *format)
 			export_ds[n] = disko_open(filename);
 		}
 		if (!(export_ds[n] && format->f.export.head(export_ds[n], export_dwsong.mix_bits_per_sample,
-				export_dwsong.mix_channels, export_dwsong.mix_frequency) == DW_OK)) {
+				export_dwsong.mix_channels, export_dwsong.mix_frequency,
+				!!(export_dwsong.mix_flags & SNDMIX_FLOATOUTPUT)) == DW_OK)) {
 			err = errno ? errno : EINVAL;
 			break;
 		}
 	}
 
 	if (err) {
-		_export_teardown();
-		free(export_dwsong.multi_write);
+		_export_teardown(&export_dwsong);
+		csf_free_multi_write(&export_dwsong);
 		for (n = 0; export_ds[n]; n++) {
 			disko_seterror(export_ds[n], err); /* keep from writing a bunch of useless files */
 			disko_close(export_ds[n], 0);
@@ -747,19 +803,224 @@ int disko_export_song(const char *filename, const struct save_format *format)
 		}
 	}
 
-	log_appendf(5, " %" PRIu32 " Hz, %" PRIu32 " bit, %s",
+	log_appendf(5, " %" PRIu32 " Hz, %" PRIu32 " bit%s, %s",
 		export_dwsong.mix_frequency, export_dwsong.mix_bits_per_sample,
+		(export_dwsong.mix_flags & SNDMIX_FLOATOUTPUT) ? " float" : "",
 		export_dwsong.mix_channels == 1 ? "mono" : "stereo");
 	export_format = format;
 	status.flags |= DISKWRITER_ACTIVE; /* tell main to care about us */
 
-	uint32_t s = (csf_get_length(&export_dwsong) * export_dwsong.mix_frequency);
+	uint32_t s = (song_get_length() * export_dwsong.mix_frequency);
 	disko_dialog_setup(s ? s : 1);
 
 	return DW_OK;
 }
 
 
+/* One group of stems for disko_render_song: a copy of the song that only mixes the channels it owns
+(the ones with multi_write[n].data set), so the groups can be rendered at the same time. Every copy still
+plays through the whole song, but that's cheap next to the mixing. */
+struct render_stems {
+	song_t *song;
+	disko_t **ds;
+	size_t frames;
+};
+
+static int _render_stems_thread(void *data)
+{
+	struct render_stems *rs = data;
+	uint8_t buf[DW_BUFFER_SIZE];
+	size_t frames;
+	int n;
+
+	while (!(rs->song->flags & SONG_ENDREACHED)) {
+		frames = csf_read(rs->song, buf, sizeof(buf));
+		rs->frames += frames;
+		for (n = 0; n < MAX_CHANNELS; n++) {
+			if (rs->song->multi_write[n].data && rs->ds[n]->error)
+				return 0;
+		}
+		if (!frames)
+			break;
+	}
+	return 0;
+}
+
+/* which channels have any notes at all; the rest can't possibly make a sound of their own */
+static int _find_note_channels(song_t *song, int note_chans[MAX_CHANNELS])
+{
+	int pat, n, count = 0;
+
+	memset(note_chans, 0, MAX_CHANNELS * sizeof(int));
+	for (pat = 0; pat < MAX_PATTERNS; pat++) {
+		song_note_t *note = song->patterns[pat];
+		if (!note)
+			continue;
+		for (n = 0; n < song->pattern_size[pat] * MAX_CHANNELS; n++, note++) {
+			if ((note->note || note->instrument) && !note_chans[n % MAX_CHANNELS]) {
+				note_chans[n % MAX_CHANNELS] = 1;
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/* Headless counterpart of disko_export_song + disko_sync + disko_finish: renders the whole song in one go,
+with no dialog and no audio device. The song is written out directly (not shadowed), so this should only be
+used on a song that nothing else is playing. Nothing is logged (errno is set on failure), so it's safe to call
+from any thread, as long as each thread has a song of its own. Multi-file exports are split across up to
+num_threads threads (0 = one per cpu). */
+int disko_render_song(song_t *song, const char *filename, const struct save_format *format,
+	struct disko_render_stats *stats, int num_threads)
+{
+	uint8_t buf[DW_BUFFER_SIZE];
+	disko_t *ds[MAX_CHANNELS + 1] = {NULL};
+	struct render_stems stems[MAX_CHANNELS] = {{NULL}};
+	SDL_Thread *threads[MAX_CHANNELS] = {NULL};
+	int note_chans[MAX_CHANNELS], owner[MAX_CHANNELS] = {0};
+	struct timeval start_time, end_time;
+	size_t frames, total_frames = 0, total_size = 0;
+	int numfiles, n, k, bps, tmp;
+	int err = 0, ret = DW_OK;
+
+	gettimeofday(&start_time, NULL);
+
+	numfiles = format->f.export.multi ? MAX_CHANNELS : 1;
+	if (numfiles == 1) {
+		num_threads = 1;
+	} else {
+		if (num_threads < 1)
+			num_threads = SDL_GetCPUCount();
+		num_threads = CLAMP(num_threads, 1, MAX(_find_note_channels(song, note_chans), 1));
+	}
+
+	_export_prepare(song, &bps, 0);
+
+	/* the first group renders on the song itself, the rest get copies with their own OPL chips */
+	stems[0].song = song;
+	for (k = 1; k < num_threads; k++) {
+		stems[k].song = malloc(sizeof(song_t));
+		if (!stems[k].song) {
+			num_threads = k;
+			break;
+		}
+		memcpy(stems[k].song, song, sizeof(song_t));
+		stems[k].song->fm = NULL;
+		stems[k].song->gm = NULL;
+		_export_prepare(stems[k].song, &bps, 0);
+	}
+
+	if (numfiles > 1) {
+		for (k = 0; k < num_threads && !err; k++) {
+			stems[k].ds = ds;
+			stems[k].song->multi_write = calloc(numfiles, sizeof(struct multi_write));
+			if (!stems[k].song->multi_write)
+				err = errno ? errno : ENOMEM;
+		}
+	}
+
+	for (n = 0; n < numfiles && !err; n++) {
+		if (numfiles > 1) {
+			char *tmpname = get_filename(filename, n + 1);
+			if (tmpname) {
+				ds[n] = disko_open(tmpname);
+				free(tmpname);
+			}
+		} else {
+			ds[n] = disko_open(filename);
+		}
+		if (!(ds[n] && format->f.export.head(ds[n], song->mix_bits_per_sample,
+				song->mix_channels, song->mix_frequency,
+				!!(song->mix_flags & SNDMIX_FLOATOUTPUT)) == DW_OK)) {
+			err = errno ? errno : EINVAL;
+		}
+	}
+
+	if (!err && numfiles > 1) {
+		/* deal the channels with notes out round-robin; the empty ones all go to the first group,
+		where they cost next to nothing */
+		for (n = 0, k = 0; n < numfiles; n++) {
+			owner[n] = note_chans[n] ? (k++ % num_threads) : 0;
+		}
+		for (n = 0; n < numfiles; n++) {
+			struct multi_write *mw = stems[owner[n]].song->multi_write + n;
+			mw->data = ds[n];
+			mw->write = (void(*)(void*, const uint8_t*, size_t))format->f.export.body;
+			mw->silence = (void(*)(void*, long))format->f.export.silence;
+		}
+
+		for (k = 1; k < num_threads; k++)
+			threads[k] = SDL_CreateThread(_render_stems_thread, "Render stems", &stems[k]);
+		_render_stems_thread(&stems[0]);
+		for (k = 1; k < num_threads; k++) {
+			if (threads[k])
+				SDL_WaitThread(threads[k], NULL);
+			else
+				_render_stems_thread(&stems[k]); /* no thread, do it here */
+		}
+		total_frames = stems[0].frames;
+	} else if (!err) {
+		while (!(song->flags & SONG_ENDREACHED)) {
+			frames = csf_read(song, buf, sizeof(buf));
+			format->f.export.body(ds[0], buf, frames * bps);
+			total_frames += frames;
+			if (ds[0]->error || !frames)
+				break;
+		}
+	}
+
+	for (n = 0; ds[n]; n++) {
+		if (err) {
+			disko_seterror(ds[n], err);
+			disko_close(ds[n], 0);
+			continue;
+		}
+		if (numfiles > 1 && !stems[owner[n]].song->multi_write[n].used) {
+			/* this channel was completely empty - don't bother with it */
+			disko_seterror(ds[n], EINVAL); /* kludge */
+			disko_close(ds[n], 0);
+			continue;
+		}
+		if (format->f.export.tail(ds[n]) != DW_OK) {
+			disko_seterror(ds[n], errno);
+		} else {
+			disko_seek(ds[n], 0, SEEK_END);
+			total_size += disko_tell(ds[n]);
+		}
+		tmp = disko_close(ds[n], 0);
+		if (ret == DW_OK)
+			ret = tmp;
+	}
+
+	csf_free_multi_write(song);
+	for (k = 1; k < num_threads; k++) {
+		/* the copies share everything but the mixer state with the song, so don't csf_free them */
+		OPL_Close(stems[k].song);
+		GM_Close(stems[k].song);
+		csf_free_multi_write(stems[k].song);
+		free(stems[k].song);
+	}
+
+	if (err) {
+		errno = err;
+		return DW_ERROR;
+	}
+	if (ret != DW_OK)
+		return ret;
+
+	if (stats) {
+		gettimeofday(&end_time, NULL);
+		stats->frames = total_frames;
+		stats->bytes = total_size;
+		stats->rate = song->mix_frequency;
+		stats->elapsed = (end_time.tv_sec - start_time.tv_sec)
+			+ ((end_time.tv_usec - start_time.tv_usec) / 1000000.0);
+	}
+
+	return DW_OK;
+}
+
 /* main calls this periodically when the .wav exporter is busy */
 int disko_sync(void)
 {
@@ -835,8 +1096,8 @@ static int disko_finish(void)
 	}
 	memset(export_ds, 0, sizeof(export_ds));
 
-	_export_teardown();
-	free(export_dwsong.multi_write);
+	_export_teardown(&export_dwsong);
+	csf_free_multi_write(&export_dwsong);
 	export_format = NULL;
 
 	status.flags &= ~DISKWRITER_ACTIVE; /* please unsubscribe me from your mailing list */
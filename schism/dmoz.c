@@ -25,8 +25,10 @@
 
 #include "headers.h"
 
+#include "bswap.h"
 #include "it.h"
 #include "config-parser.h"
+#include "config.h"
 #include "charset.h"
 #include "song.h"
 #include "dmoz.h"
@@ -35,6 +37,8 @@
 
 #include "fmt.h"
 
+#include "sdlmain.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -42,6 +46,7 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 
 #ifdef __amigaos4__
 # include <proto/dos.h>
@@ -50,6 +55,7 @@
 #ifdef SCHISM_WIN32
 #include <windows.h>
 #include <winbase.h>
+#include <objbase.h>
 #endif
 
 #ifdef SCHISM_WII
@@ -79,11 +85,14 @@ static const char *devices[] = {
 /* --------------------------------------------------------------------------------------------------------- */
 /* file format tables */
 
-#define READ_INFO(t) fmt_##t##_read_info,
+#define READ_INFO(t) {fmt_##t##_read_info, &fmt_##t##_probe},
 
-static const fmt_read_info_func read_info_funcs[] = {
+static const struct {
+	fmt_read_info_func read_info;
+	const struct fmt_probe *probe;
+} read_info_funcs[] = {
 #include "fmt-types.h"
-	NULL /* This needs to be at the bottom of the list! */
+	{NULL, NULL} /* This needs to be at the bottom of the list! */
 };
 
 /* --------------------------------------------------------------------------------------------------------- */
@@ -391,6 +400,10 @@ static void allocate_more_dirs(dmoz_dirlist_t *dlist)
 	}
 }
 
+static void filter_cancel(dmoz_filelist_t *flist);
+static void info_cache_load(void);
+static int info_cache_loaded;
+
 static void free_file(dmoz_file_t *file)
 {
 	if (!file)
@@ -427,6 +440,7 @@ void dmoz_free(dmoz_filelist_t *flist, dmoz_dirlist_t *dlist)
 	int n;
 
 	if (flist) {
+		filter_cancel(flist);
 		for (n = 0; n < flist->num_files; n++)
 			free_file(flist->files[n]);
 		free(flist->files);
@@ -445,57 +459,215 @@ void dmoz_free(dmoz_filelist_t *flist, dmoz_dirlist_t *dlist)
 	}
 }
 
-static int current_dmoz_file = 0;
-static dmoz_filelist_t *current_dmoz_filelist = NULL;
-static int (*current_dmoz_filter)(dmoz_file_t *) = NULL;
-static int *current_dmoz_file_pointer = NULL;
-static void (*dmoz_worker_onmove)(void) = NULL;
+/* --------------------------------------------------------------------------------------------------------- */
+/* background filtering */
 
-int dmoz_worker(void)
+/* The filter runs on a few threads at once, since most of what it does is wait on the disk. Each job works
+on a private copy of its file, so the ui never sees one half-filled in; dmoz_worker (from the main loop)
+copies the finished ones back into the list. Rejected files are marked hidden as they come in and dropped
+from the list in one go once everything's been looked at. */
+
+#define FILTER_MAX_THREADS 8
+
+enum {
+	FILTER_PENDING,
+	FILTER_DONE,
+	FILTER_PUBLISHED,
+};
+
+struct filter_job {
+	dmoz_file_t *target;
+	dmoz_file_t copy;
+	int had_ext_data;
+	int keep;
+	SDL_atomic_t state;
+};
+
+static struct {
+	dmoz_filelist_t *flist;
+	int (*filter)(dmoz_file_t *);
+	int *pointer;
+	void (*onmove)(void);
+
+	struct filter_job *jobs;
+	int num_jobs;
+	int first_unpublished;
+	SDL_atomic_t next_job;
+	SDL_atomic_t cancel;
+	SDL_sem *done;
+	SDL_Thread *threads[FILTER_MAX_THREADS];
+	int num_threads;
+} filter;
+
+/* returns 0 when there's nothing left to do */
+static int filter_run_one(void)
 {
-	dmoz_file_t *nf;
+	struct filter_job *job;
+	int n = SDL_AtomicAdd(&filter.next_job, 1);
 
-	if (!current_dmoz_filelist || !current_dmoz_filter)
-		return 0;
-	if (current_dmoz_file >= current_dmoz_filelist->num_files) {
-		current_dmoz_filelist = NULL;
-		current_dmoz_filter = NULL;
-		if (dmoz_worker_onmove)
-			dmoz_worker_onmove();
+	if (n >= filter.num_jobs || SDL_AtomicGet(&filter.cancel))
 		return 0;
+	job = filter.jobs + n;
+	job->keep = filter.filter(&job->copy);
+	SDL_AtomicSet(&job->state, FILTER_DONE);
+	if (filter.done)
+		SDL_SemPost(filter.done);
+	return 1;
+}
+
+static int filter_thread(UNUSED void *data)
+{
+#ifdef SCHISM_WIN32
+	/* media foundation needs com on every thread that uses it */
+	CoInitializeEx(NULL, COINIT_MULTITHREADED);
+#endif
+	while (filter_run_one());
+#ifdef SCHISM_WIN32
+	CoUninitialize();
+#endif
+	return 0;
+}
+
+/* the extended data that the filter filled in on a copy */
+static void filter_free_copy_data(struct filter_job *job)
+{
+	dmoz_file_t *copy = &job->copy;
+
+	if (!job->had_ext_data && (copy->type & TYPE_EXT_DATA_MASK)) {
+		if (copy->smp_filename != copy->base && copy->smp_filename != copy->title)
+			free(copy->smp_filename);
+		free(copy->artist);
+		free(copy->title);
 	}
+}
 
-	if (!current_dmoz_filter(current_dmoz_filelist->files[ current_dmoz_file ])) {
-		if (current_dmoz_filelist->num_files == current_dmoz_file+1) {
-			current_dmoz_filelist->num_files--;
-			current_dmoz_filelist = NULL;
-			current_dmoz_filter = NULL;
-			if (dmoz_worker_onmove)
-				dmoz_worker_onmove();
-			return 0;
-		}
+static void filter_publish(struct filter_job *job)
+{
+	dmoz_file_t *file = job->target, *copy = &job->copy;
+	dmoz_file_t keep = *file;
 
-		nf = current_dmoz_filelist->files[ current_dmoz_file ];
-		memmove(&current_dmoz_filelist->files[ current_dmoz_file ],
-			&current_dmoz_filelist->files[ current_dmoz_file+1 ],
-			sizeof(dmoz_file_t *) * (current_dmoz_filelist->num_files
-						- current_dmoz_file));
-		free_file(nf);
-		current_dmoz_filelist->num_files--;
-		if (current_dmoz_file_pointer && *current_dmoz_file_pointer >=
-					current_dmoz_file) {
-			(*current_dmoz_file_pointer) = (*current_dmoz_file_pointer) - 1;
-			if (dmoz_worker_onmove) dmoz_worker_onmove();
+	if (!job->had_ext_data && (copy->type & TYPE_EXT_DATA_MASK)) {
+		if (file->type & TYPE_EXT_DATA_MASK) {
+			/* someone got to it first (e.g. the sample page looking at the current file) */
+			filter_free_copy_data(job);
+		} else {
+			*file = *copy;
+			file->path = keep.path;
+			file->base = keep.base;
+			file->sort_order = keep.sort_order;
+			file->sample = keep.sample;
+			file->sampsize = keep.sampsize;
+			file->instnum = keep.instnum;
+			if (copy->smp_filename == copy->base)
+				file->smp_filename = file->base;
 		}
-		if (current_dmoz_file_pointer && *current_dmoz_file_pointer >=
-					current_dmoz_filelist->num_files) {
-			(*current_dmoz_file_pointer) = (current_dmoz_filelist->num_files-1);
-			if (dmoz_worker_onmove) dmoz_worker_onmove();
+	}
+	if (!job->keep)
+		file->type |= TYPE_HIDDEN;
+	free(copy->path);
+	free(copy->base);
+}
+
+/* drop the hidden files from the list, keeping the pointer on the same file (or the next one).
+returns nonzero if there were any */
+static int filter_compact(void)
+{
+	dmoz_filelist_t *flist = filter.flist;
+	int n, kept = 0, pointer = -1;
+
+	for (n = 0; n < flist->num_files; n++) {
+		if (filter.pointer && n == *filter.pointer)
+			pointer = kept;
+		if (flist->files[n]->type & TYPE_HIDDEN) {
+			free_file(flist->files[n]);
+		} else {
+			flist->files[kept++] = flist->files[n];
 		}
-		status.flags |= NEED_UPDATE;
-	} else {
-		current_dmoz_file++;
 	}
+	if (kept == flist->num_files)
+		return 0;
+	flist->num_files = kept;
+	if (filter.pointer) {
+		if (pointer < 0 || pointer >= kept)
+			pointer = kept - 1;
+		*filter.pointer = pointer;
+	}
+	status.flags |= NEED_UPDATE;
+	return 1;
+}
+
+static void filter_stop(void)
+{
+	int n;
+
+	SDL_AtomicSet(&filter.cancel, 1);
+	for (n = 0; n < filter.num_threads; n++)
+		SDL_WaitThread(filter.threads[n], NULL);
+	for (n = filter.first_unpublished; n < filter.num_jobs; n++) {
+		struct filter_job *job = filter.jobs + n;
+
+		if (SDL_AtomicGet(&job->state) == FILTER_PUBLISHED)
+			continue;
+		if (SDL_AtomicGet(&job->state) == FILTER_DONE)
+			filter_free_copy_data(job);
+		free(job->copy.path);
+		free(job->copy.base);
+	}
+	free(filter.jobs);
+	if (filter.done)
+		SDL_DestroySemaphore(filter.done);
+	memset(&filter, 0, sizeof(filter));
+}
+
+static void filter_cancel(dmoz_filelist_t *flist)
+{
+	if (flist == filter.flist)
+		filter_stop();
+}
+
+int dmoz_worker(void)
+{
+	struct filter_job *job;
+	int n, end, published = 0;
+	void (*onmove)(void);
+
+	if (!filter.flist)
+		return 0;
+
+	if (!filter.num_threads)
+		filter_run_one(); /* no threads; do it the slow way */
+
+	end = MIN(SDL_AtomicGet(&filter.next_job), filter.num_jobs);
+	for (n = filter.first_unpublished; n < end; n++) {
+		job = filter.jobs + n;
+		if (SDL_AtomicGet(&job->state) != FILTER_DONE)
+			continue;
+		filter_publish(job);
+		SDL_AtomicSet(&job->state, FILTER_PUBLISHED);
+		if (filter.done)
+			SDL_SemTryWait(filter.done);
+		published++;
+	}
+	while (filter.first_unpublished < filter.num_jobs
+	       && SDL_AtomicGet(&filter.jobs[filter.first_unpublished].state) == FILTER_PUBLISHED)
+		filter.first_unpublished++;
+
+	if (filter.first_unpublished == filter.num_jobs) {
+		filter_compact();
+		onmove = filter.onmove;
+		filter_stop();
+		if (onmove)
+			onmove();
+		return 0;
+	}
+
+	if (published) {
+		/* the pages don't know about hidden files, so they can't be left in the list for them to draw */
+		if (filter_compact() && filter.onmove)
+			filter.onmove();
+		status.flags |= NEED_UPDATE;
+	} else if (filter.done)
+		SDL_SemWaitTimeout(filter.done, 1);
 	return 1;
 }
 
@@ -504,18 +676,46 @@ int dmoz_worker(void)
 so it can't generate error conditions. */
 void dmoz_filter_filelist(dmoz_filelist_t *flist, int (*grep)(dmoz_file_t *f), int *pointer, void (*fn)(void))
 {
-	current_dmoz_filelist = flist;
-	current_dmoz_filter = grep;
-	current_dmoz_file = 0;
-	current_dmoz_file_pointer = pointer;
-	dmoz_worker_onmove = fn;
-}
+	struct filter_job *job;
+	int n;
 
-/* TODO:
-- create a one-shot filter that runs all its files at once
-- make these filters not actually drop the files from the list, but instead set the hidden flag
-- add a 'num_unfiltered' variable to the struct that indicates the total number
-*/
+	if (filter.flist)
+		filter_stop();
+
+	filter.flist = flist;
+	filter.filter = grep;
+	filter.pointer = pointer;
+	filter.onmove = fn;
+	filter.num_jobs = flist->num_files;
+	filter.jobs = mem_calloc(MAX(filter.num_jobs, 1), sizeof(struct filter_job));
+	for (n = 0; n < filter.num_jobs; n++) {
+		job = filter.jobs + n;
+		job->target = flist->files[n];
+		job->copy = *flist->files[n];
+		job->copy.path = str_dup(job->target->path);
+		job->copy.base = str_dup(job->target->base);
+		job->had_ext_data = !!(job->target->type & TYPE_EXT_DATA_MASK);
+		if (job->target->smp_filename == job->target->base)
+			job->copy.smp_filename = job->copy.base;
+	}
+	if (!filter.num_jobs)
+		return;
+
+	filter.done = SDL_CreateSemaphore(0);
+	if (!filter.done)
+		return;
+	/* get the disk part of this over with before there's anyone else to make wait on it */
+	if (!info_cache_loaded)
+		info_cache_load();
+	n = CLAMP(SDL_GetCPUCount(), 2, FILTER_MAX_THREADS);
+	n = MIN(n, filter.num_jobs);
+	while (filter.num_threads < n) {
+		SDL_Thread *thread = SDL_CreateThread(filter_thread, "File info", NULL);
+		if (!thread)
+			break;
+		filter.threads[filter.num_threads++] = thread;
+	}
+}
 
 /* --------------------------------------------------------------------------------------------------------- */
 /* adding to the lists */
@@ -934,22 +1134,61 @@ enum {
 	FINF_ERRNO = (-1),      /* check errno */
 };
 
+/* how much to read up front; this has to cover the largest head any of the formats asks for */
+static size_t file_info_probe_size(void)
+{
+	static size_t size = 0;
+	int n;
+
+	if (!size) {
+		for (n = 0; read_info_funcs[n].read_info; n++)
+			size = MAX(size, read_info_funcs[n].probe->head);
+	}
+	return size;
+}
+
 static int file_info_get(dmoz_file_t *file)
 {
-	slurp_t *t;
-	const fmt_read_info_func *func;
+	slurp_t *head, *tail = NULL, *all = NULL, *t;
+	const struct fmt_probe *probe;
+	size_t length;
+	int n, r;
 
 	if (file->filesize == 0)
 		return FINF_EMPTY;
-	t = slurp(file->path, NULL, file->filesize);
-	if (t == NULL)
+	head = slurp_head(file->path, NULL, file_info_probe_size(), 0);
+	if (head == NULL)
 		return FINF_ERRNO;
 	file->artist = NULL;
 	file->title = NULL;
 	file->smp_defvol = 64;
 	file->smp_gblvol = 64;
-	for (func = read_info_funcs; *func; func++) {
-		if ((*func) (file, t->data, t->length)) {
+	for (n = 0; read_info_funcs[n].read_info; n++) {
+		probe = read_info_funcs[n].probe;
+		if (all) {
+			t = all;
+			length = all->length;
+		} else if (probe->tail && head->length < file->filesize) {
+			/* the tail (and therefore the head it's tacked onto) is specific to this format */
+			unslurp(tail);
+			tail = slurp_head(file->path, NULL, probe->head, probe->tail);
+			if (tail == NULL)
+				continue;
+			t = tail;
+			length = tail->length;
+		} else {
+			/* if the format wants a tail, the whole file must be here already */
+			t = head;
+			length = probe->tail ? head->length : MIN(head->length, probe->head);
+		}
+		r = read_info_funcs[n].read_info(file, t->data, length);
+		if (r == FMT_INFO_NEED_ALL && !all) {
+			all = slurp(file->path, NULL, file->filesize);
+			if (all == NULL)
+				break;
+			r = read_info_funcs[n].read_info(file, all->data, all->length);
+		}
+		if (r > 0) {
 			if (file->artist)
 				trim_string(file->artist);
 			if (file->title == NULL)
@@ -958,10 +1197,412 @@ static int file_info_get(dmoz_file_t *file)
 			break;
 		}
 	}
-	unslurp(t);
+	unslurp(all);
+	unslurp(tail);
+	unslurp(head);
 	return file->title ? FINF_SUCCESS : FINF_UNSUPPORTED;
 }
 
+/* --------------------------------------------------------------------------------------------------------- */
+/* file info cache */
+
+/* Digging titles out of files is slow when there are thousands of them (or they're on a network share), so
+whatever file_info_get comes up with is remembered by path, and trusted for as long as the file's size and
+modification time stay the same. The cache is kept in ~/.schism/infocache between sessions; entries that
+haven't been looked at in a few months are dropped when it's saved. */
+
+#define INFO_CACHE_FILE         "infocache"
+#define INFO_CACHE_MAGIC        "Schism Tracker info cache\x1a"
+#define INFO_CACHE_VERSION      1
+#define INFO_CACHE_BUCKETS      4096 /* must be a power of two */
+#define INFO_CACHE_MAX_AGE      (90 * 24 * 60 * 60)
+
+#define INFO_CACHE_SMP_FIELDS(X) \
+	X(smp_speed) X(smp_loop_start) X(smp_loop_end) X(smp_sustain_start) X(smp_sustain_end) \
+	X(smp_length) X(smp_flags) X(smp_defvol) X(smp_gblvol) \
+	X(smp_vibrato_speed) X(smp_vibrato_depth) X(smp_vibrato_rate)
+#define INFO_CACHE_COUNT_FIELD(f) + 1
+#define INFO_CACHE_NUM_SMP_FIELDS (0 INFO_CACHE_SMP_FIELDS(INFO_CACHE_COUNT_FIELD))
+
+/* where the sample filename came from; a lot of the loaders just point it at one of the other strings */
+enum {
+	SMP_FILENAME_NONE,
+	SMP_FILENAME_BASE,
+	SMP_FILENAME_TITLE,
+	SMP_FILENAME_OWN,
+};
+
+struct info_cache_entry {
+	struct info_cache_entry *next;
+	char *path;
+	uint64_t filesize;
+	int64_t timestamp;
+	int64_t last_used;
+
+	int result; /* what dmoz_filter_ext_data returned */
+	unsigned long type;
+	const char *description; /* interned; see info_cache_intern */
+	char *artist; /* may be NULL */
+	char *title;
+	int smp_filename_from;
+	char *smp_filename; /* only for SMP_FILENAME_OWN */
+	unsigned int smp[INFO_CACHE_NUM_SMP_FIELDS];
+};
+
+static struct info_cache_entry *info_cache[INFO_CACHE_BUCKETS];
+static int info_cache_loaded = 0, info_cache_dirty = 0;
+/* the file list filter runs on several threads; see dmoz_filter_filelist. nothing does any disk I/O while
+holding this: loading happens before there are any other threads, and saving writes out a copy */
+static SDL_mutex *info_cache_mutex = NULL;
+
+/* file->description isn't freed along with the file, and the loaders just use string constants for it.
+The ones read back from the cache have to live somewhere, and there aren't very many different ones... */
+static const char *info_cache_intern(const char *s, size_t len)
+{
+	static struct interned {
+		struct interned *next;
+		char s[];
+	} *strings = NULL;
+	struct interned *p;
+
+	for (p = strings; p; p = p->next) {
+		if (strncmp(p->s, s, len) == 0 && p->s[len] == '\0')
+			return p->s;
+	}
+	p = mem_alloc(sizeof(*p) + len + 1);
+	memcpy(p->s, s, len);
+	p->s[len] = '\0';
+	p->next = strings;
+	strings = p;
+	return p->s;
+}
+
+static uint32_t info_cache_hash(const char *path)
+{
+	uint32_t h = 2166136261u; /* fnv-1a */
+
+	while (*path)
+		h = (h ^ (uint8_t) *path++) * 16777619u;
+	return h & (INFO_CACHE_BUCKETS - 1);
+}
+
+static struct info_cache_entry *info_cache_find(const char *path)
+{
+	struct info_cache_entry *e;
+
+	for (e = info_cache[info_cache_hash(path)]; e; e = e->next) {
+		if (strcmp(e->path, path) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+static void info_cache_clear_entry(struct info_cache_entry *e)
+{
+	free(e->artist);
+	free(e->title);
+	free(e->smp_filename);
+	e->artist = e->title = e->smp_filename = NULL;
+}
+
+static struct info_cache_entry *info_cache_insert(char *path)
+{
+	struct info_cache_entry *e = mem_calloc(1, sizeof(struct info_cache_entry));
+	uint32_t h = info_cache_hash(path);
+
+	e->path = path;
+	e->next = info_cache[h];
+	info_cache[h] = e;
+	return e;
+}
+
+/* stored little-endian, with strings prefixed by a 16-bit length (0xffff for NULL). the file is streamed
+in rather than slurped whole, since it can get fairly big and it's only read through once. */
+struct info_cache_reader {
+	slurp_t *t;
+	char *string; /* the last string read; 64k */
+	int error;
+};
+
+static uint32_t info_cache_read32(struct info_cache_reader *r)
+{
+	uint32_t x;
+
+	if (slurp_read(r->t, &x, 4) != 4) {
+		r->error = 1;
+		return 0;
+	}
+	return bswapLE32(x);
+}
+
+static uint64_t info_cache_read64(struct info_cache_reader *r)
+{
+	uint64_t lo = info_cache_read32(r);
+	return lo | ((uint64_t) info_cache_read32(r) << 32);
+}
+
+static const char *info_cache_read_string(struct info_cache_reader *r, size_t *len)
+{
+	uint16_t x;
+
+	if (slurp_read(r->t, &x, 2) != 2) {
+		r->error = 1;
+		return NULL;
+	}
+	x = bswapLE16(x);
+	if (x == 0xffff)
+		return NULL;
+	if (slurp_read(r->t, r->string, x) != x) {
+		r->error = 1;
+		return NULL;
+	}
+	*len = x;
+	return r->string;
+}
+
+static void info_cache_load(void)
+{
+	struct info_cache_reader r;
+	struct info_cache_entry *e;
+	const char *s;
+	char *filename, *path;
+	char magic[sizeof(INFO_CACHE_MAGIC) - 1];
+	size_t len;
+	uint32_t count;
+	int n;
+
+	info_cache_loaded = 1;
+
+	info_cache_mutex = SDL_CreateMutex();
+	if (!info_cache_mutex)
+		return;
+
+	filename = dmoz_path_concat(cfg_dir_dotschism, INFO_CACHE_FILE);
+	r.t = slurp_stream(filename, NULL, 0);
+	free(filename);
+	if (!r.t)
+		return;
+
+	r.error = 0;
+	if (slurp_read(r.t, magic, sizeof(magic)) != sizeof(magic)
+	    || memcmp(magic, INFO_CACHE_MAGIC, sizeof(magic)) != 0
+	    || info_cache_read32(&r) != INFO_CACHE_VERSION) {
+		unslurp(r.t);
+		return;
+	}
+	r.string = mem_alloc(65536);
+	count = info_cache_read32(&r);
+	while (count-- && !r.error) {
+		len = 0;
+		s = info_cache_read_string(&r, &len);
+		if (!s || !len)
+			break;
+		path = strn_dup(s, len);
+		if (info_cache_find(path)) {
+			/* duplicate -- shouldn't happen unless the file's broken */
+			free(path);
+			break;
+		}
+		e = info_cache_insert(path);
+		e->filesize = info_cache_read64(&r);
+		e->timestamp = (int64_t) info_cache_read64(&r);
+		e->last_used = (int64_t) info_cache_read64(&r);
+		e->result = info_cache_read32(&r);
+		e->type = info_cache_read32(&r);
+		len = 0;
+		s = info_cache_read_string(&r, &len);
+		e->description = info_cache_intern(s ? s : "", len);
+		if ((s = info_cache_read_string(&r, &len)) != NULL)
+			e->title = strn_dup(s, len);
+		if ((s = info_cache_read_string(&r, &len)) != NULL)
+			e->artist = strn_dup(s, len);
+		e->smp_filename_from = info_cache_read32(&r);
+		if ((s = info_cache_read_string(&r, &len)) != NULL)
+			e->smp_filename = strn_dup(s, len);
+		for (n = 0; n < INFO_CACHE_NUM_SMP_FIELDS; n++)
+			e->smp[n] = info_cache_read32(&r);
+		if (!e->title || (e->smp_filename_from == SMP_FILENAME_OWN && !e->smp_filename))
+			r.error = 1;
+		if (r.error) {
+			/* leave it there, it won't match anything */
+			info_cache_clear_entry(e);
+			e->timestamp = 0;
+		}
+	}
+	free(r.string);
+	unslurp(r.t);
+}
+
+/* the whole thing is put together in memory first, so the lock isn't held while it's written out */
+struct info_cache_writer {
+	uint8_t *data;
+	size_t len, alloc;
+};
+
+static void info_cache_write(struct info_cache_writer *w, const void *data, size_t len)
+{
+	if (w->len + len > w->alloc) {
+		w->alloc = MAX(2 * w->alloc, w->len + len);
+		w->data = mem_realloc(w->data, w->alloc);
+	}
+	memcpy(w->data + w->len, data, len);
+	w->len += len;
+}
+
+static void info_cache_write32(struct info_cache_writer *w, uint32_t x)
+{
+	x = bswapLE32(x);
+	info_cache_write(w, &x, 4);
+}
+
+static void info_cache_write64(struct info_cache_writer *w, uint64_t x)
+{
+	info_cache_write32(w, x & 0xffffffff);
+	info_cache_write32(w, x >> 32);
+}
+
+static void info_cache_write_string(struct info_cache_writer *w, const char *s)
+{
+	size_t len = s ? MIN(strlen(s), 0xfffe) : 0xffff;
+	uint16_t x = bswapLE16(len);
+
+	info_cache_write(w, &x, 2);
+	if (s)
+		info_cache_write(w, s, len);
+}
+
+void dmoz_info_cache_save(void)
+{
+	struct info_cache_writer w = {0};
+	struct info_cache_entry *e;
+	int64_t expire = (int64_t) time(NULL) - INFO_CACHE_MAX_AGE;
+	uint32_t count = 0;
+	char *filename;
+	FILE *fp;
+	int n, m;
+
+	if (!info_cache_mutex)
+		return;
+
+	SDL_LockMutex(info_cache_mutex);
+	if (!info_cache_dirty) {
+		SDL_UnlockMutex(info_cache_mutex);
+		return;
+	}
+
+	for (n = 0; n < INFO_CACHE_BUCKETS; n++)
+		for (e = info_cache[n]; e; e = e->next)
+			if (e->timestamp && e->last_used >= expire)
+				count++;
+
+	info_cache_write(&w, INFO_CACHE_MAGIC, sizeof(INFO_CACHE_MAGIC) - 1);
+	info_cache_write32(&w, INFO_CACHE_VERSION);
+	info_cache_write32(&w, count);
+	for (n = 0; n < INFO_CACHE_BUCKETS; n++) {
+		for (e = info_cache[n]; e; e = e->next) {
+			if (!e->timestamp || e->last_used < expire)
+				continue;
+			info_cache_write_string(&w, e->path);
+			info_cache_write64(&w, e->filesize);
+			info_cache_write64(&w, (uint64_t) e->timestamp);
+			info_cache_write64(&w, (uint64_t) e->last_used);
+			info_cache_write32(&w, e->result);
+			info_cache_write32(&w, e->type);
+			info_cache_write_string(&w, e->description);
+			info_cache_write_string(&w, e->title);
+			info_cache_write_string(&w, e->artist);
+			info_cache_write32(&w, e->smp_filename_from);
+			info_cache_write_string(&w, e->smp_filename);
+			for (m = 0; m < INFO_CACHE_NUM_SMP_FIELDS; m++)
+				info_cache_write32(&w, e->smp[m]);
+		}
+	}
+	info_cache_dirty = 0;
+	SDL_UnlockMutex(info_cache_mutex);
+
+	filename = dmoz_path_concat(cfg_dir_dotschism, INFO_CACHE_FILE);
+	fp = os_fopen(filename, "wb");
+	if (!fp || (fwrite(w.data, 1, w.len, fp) != w.len) | fclose(fp)) {
+		log_perror(filename);
+		SDL_LockMutex(info_cache_mutex);
+		info_cache_dirty = 1;
+		SDL_UnlockMutex(info_cache_mutex);
+	}
+	free(filename);
+	free(w.data);
+}
+
+/* returns what dmoz_filter_ext_data should, or -1 if the file isn't in the cache */
+static int info_cache_get(dmoz_file_t *file)
+{
+	struct info_cache_entry *e;
+	int n = 0;
+
+	if (!file->timestamp)
+		return -1;
+	e = info_cache_find(file->path);
+	if (!e || e->filesize != file->filesize || e->timestamp != (int64_t) file->timestamp)
+		return -1;
+
+	e->last_used = time(NULL);
+	info_cache_dirty = 1;
+
+	file->type = e->type;
+	file->description = e->description;
+	file->title = e->title ? str_dup(e->title) : NULL;
+	file->artist = e->artist ? str_dup(e->artist) : NULL;
+	switch (e->smp_filename_from) {
+	case SMP_FILENAME_BASE: file->smp_filename = file->base; break;
+	case SMP_FILENAME_TITLE: file->smp_filename = file->title; break;
+	case SMP_FILENAME_OWN: file->smp_filename = str_dup(e->smp_filename); break;
+	default: file->smp_filename = NULL; break;
+	}
+#define INFO_CACHE_GET_FIELD(f) file->f = e->smp[n++];
+	INFO_CACHE_SMP_FIELDS(INFO_CACHE_GET_FIELD)
+#undef INFO_CACHE_GET_FIELD
+	return e->result;
+}
+
+static void info_cache_put(dmoz_file_t *file, int result)
+{
+	struct info_cache_entry *e;
+	int n = 0;
+
+	if (!file->timestamp)
+		return;
+	e = info_cache_find(file->path);
+	if (e)
+		info_cache_clear_entry(e);
+	else
+		e = info_cache_insert(str_dup(file->path));
+
+	e->filesize = file->filesize;
+	e->timestamp = file->timestamp;
+	e->last_used = time(NULL);
+	e->result = result;
+	e->type = file->type;
+	/* not every format fills these in (Media Foundation can leave the description blank, for one) */
+	e->description = file->description
+		? info_cache_intern(file->description, strlen(file->description))
+		: info_cache_intern("", 0);
+	e->title = file->title ? str_dup(file->title) : NULL;
+	e->artist = file->artist ? str_dup(file->artist) : NULL;
+	if (!file->smp_filename) {
+		e->smp_filename_from = SMP_FILENAME_NONE;
+	} else if (file->smp_filename == file->base) {
+		e->smp_filename_from = SMP_FILENAME_BASE;
+	} else if (file->smp_filename == file->title) {
+		e->smp_filename_from = SMP_FILENAME_TITLE;
+	} else {
+		e->smp_filename_from = SMP_FILENAME_OWN;
+		e->smp_filename = str_dup(file->smp_filename);
+	}
+#define INFO_CACHE_PUT_FIELD(f) e->smp[n++] = file->f;
+	INFO_CACHE_SMP_FIELDS(INFO_CACHE_PUT_FIELD)
+#undef INFO_CACHE_PUT_FIELD
+	info_cache_dirty = 1;
+}
+
 /* return: 1 on success, 0 on error. in either case, it fills the data in with *something*. */
 int dmoz_filter_ext_data(dmoz_file_t *file)
 {
@@ -972,9 +1613,24 @@ int dmoz_filter_ext_data(dmoz_file_t *file)
 		/* nothing to do */
 		return 1;
 	}
+	/* this is only ever the main thread: the filter threads don't start until the cache is loaded */
+	if (!info_cache_loaded)
+		info_cache_load();
+	if (info_cache_mutex) {
+		SDL_LockMutex(info_cache_mutex);
+		ret = info_cache_get(file);
+		SDL_UnlockMutex(info_cache_mutex);
+		if (ret >= 0)
+			return ret;
+	}
 	ret = file_info_get(file);
 	switch (ret) {
 	case FINF_SUCCESS:
+		if (info_cache_mutex) {
+			SDL_LockMutex(info_cache_mutex);
+			info_cache_put(file, 1);
+			SDL_UnlockMutex(info_cache_mutex);
+		}
 		return 1;
 	case FINF_UNSUPPORTED:
 		file->description = "Unsupported file format"; /* used to be "Unsupported module format" */
@@ -996,6 +1652,11 @@ int dmoz_filter_ext_data(dmoz_file_t *file)
 	}
 	file->type = TYPE_UNKNOWN;
 	file->title = str_dup("");
+	if (ret == FINF_UNSUPPORTED && info_cache_mutex) {
+		SDL_LockMutex(info_cache_mutex);
+		info_cache_put(file, 0);
+		SDL_UnlockMutex(info_cache_mutex);
+	}
 	return 0;
 }
 
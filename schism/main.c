@@ -208,6 +208,16 @@ static char *initial_dir = NULL;
 /* diskwrite? */
 static char *diskwrite_to = NULL;
 
+/* headless render? (like diskwrite, but without ever starting the UI) */
+static char *render_to = NULL;
+
+/* batch render: every file/directory on the command line gets written into render_dir */
+static char *render_dir = NULL;
+static char *render_format = NULL;
+static int render_jobs = 0; /* 0 = one per cpu */
+static char **render_paths = NULL;
+static int num_render_paths = 0;
+
 /* startup flags */
 enum {
 	SF_PLAY = 1, /* -p: start playing after loading initial_song */
@@ -241,6 +251,10 @@ enum {
 	O_HOOKS, O_NO_HOOKS,
 #endif
 	O_DISKWRITE,
+	O_RENDER,
+	O_RENDER_DIR,
+	O_RENDER_FORMAT,
+	O_JOBS,
 	O_DEBUG,
 	O_VERSION,
 };
@@ -266,6 +280,10 @@ static void parse_options(int argc, char **argv)
 		{"play", 0, NULL, O_PLAY},
 		{"no-play", 0, NULL, O_NO_PLAY},
 		{"diskwrite", 1, NULL, O_DISKWRITE},
+		{"render", 1, NULL, O_RENDER},
+		{"render-dir", 1, NULL, O_RENDER_DIR},
+		{"render-format", 1, NULL, O_RENDER_FORMAT},
+		{"jobs", 1, NULL, O_JOBS},
 		{"font-editor", 0, NULL, O_FONTEDIT},
 		{"no-font-editor", 0, NULL, O_NO_FONTEDIT},
 #if ENABLE_HOOKS
@@ -325,6 +343,18 @@ static void parse_options(int argc, char **argv)
 		case O_DISKWRITE:
 			diskwrite_to = optarg;
 			break;
+		case O_RENDER:
+			render_to = optarg;
+			break;
+		case O_RENDER_DIR:
+			render_dir = optarg;
+			break;
+		case O_RENDER_FORMAT:
+			render_format = optarg;
+			break;
+		case O_JOBS:
+			render_jobs = atoi(optarg);
+			break;
 #if ENABLE_HOOKS
 		case O_HOOKS:
 			startup_flags |= SF_HOOKS;
@@ -347,6 +377,8 @@ static void parse_options(int argc, char **argv)
 				"  -f, --fullscreen (-F, --no-fullscreen)\n"
 				"  -p, --play (-P, --no-play)\n"
 				"      --diskwrite=FILENAME\n"
+				"      --render=FILENAME [--jobs=N]\n"
+				"      --render-dir=DIRECTORY [--render-format=wav|aiff|flac] [--jobs=N]\n"
 				"      --font-editor (--no-font-editor)\n"
 #if ENABLE_HOOKS
 				"      --hooks (--no-hooks)\n"
@@ -375,7 +407,11 @@ static void parse_options(int argc, char **argv)
 		}
 		char *norm = dmoz_path_normal(tmp);
 		free(tmp);
-		if (is_directory(arg)) {
+		if (render_dir) {
+			/* batch mode takes everything */
+			render_paths = mem_realloc(render_paths, (num_render_paths + 1) * sizeof(char *));
+			render_paths[num_render_paths++] = norm;
+		} else if (is_directory(arg)) {
 			free(initial_dir);
 			initial_dir = norm;
 		} else {
@@ -388,11 +424,48 @@ static void parse_options(int argc, char **argv)
 
 /* --------------------------------------------------------------------- */
 
+/* pick an export driver for --diskwrite/--render based on the filename */
+static const char *guess_export_driver(const char *filename)
+{
+	const char *multi = strcasestr(filename, "%c");
+
+	if (strcasestr(filename, ".aif"))
+		return multi ? "MAIFF" : "AIFF";
+#ifdef USE_FLAC
+	if (strcasestr(filename, ".flac"))
+		return multi ? "MFLAC" : "FLAC";
+#endif
+	return multi ? "MWAV" : "WAV";
+}
+
+/* same thing for --render-format, which is just the extension. NULL if it's not something we can write */
+static const char *guess_render_format(const char *ext)
+{
+	if (!ext)
+		return "WAV";
+	if (ext[0] == '.')
+		ext++;
+	if (strcasecmp(ext, "wav") == 0)
+		return "WAV";
+	if (strcasecmp(ext, "aif") == 0 || strcasecmp(ext, "aiff") == 0)
+		return "AIFF";
+#ifdef USE_FLAC
+	if (strcasecmp(ext, "flac") == 0)
+		return "FLAC";
+#endif
+	return NULL;
+}
+
+/* --------------------------------------------------------------------- */
+
 static void check_update(void)
 {
 	static schism_ticks_t next = 0;
 	schism_ticks_t now = SCHISM_GET_TICKS();
 
+	if (log_take_update())
+		status.flags |= NEED_UPDATE;
+
 	/* is there any reason why we'd want to redraw
 	   the screen when it's not even visible? */
 	if (video_is_visible() && (status.flags & NEED_UPDATE)) {
@@ -622,6 +695,12 @@ static void event_loop(void)
 
 				handle_window_event(&event.window);
 				break;
+			case SDL_RENDER_TARGETS_RESET:
+			case SDL_RENDER_DEVICE_RESET:
+				/* the texture's contents are gone, and only the changed rows get re-sent */
+				video_redraw_texture();
+				status.flags |= (NEED_UPDATE);
+				break;
 			case SDL_MOUSEWHEEL:
 				kk.state = -1;  /* neither KEY_PRESS nor KEY_RELEASE */
 #if SDL_VERSION_ATLEAST(2, 26, 0)
@@ -883,7 +962,10 @@ static void event_loop(void)
 		/* let dmoz build directory lists, etc
 		 *
 		 * as long as there's no user-event going on... */
-		while (!(status.flags & NEED_UPDATE) && dmoz_worker() && !SDL_PollEvent(NULL));
+		while (!(status.flags & NEED_UPDATE) && dmoz_worker() && !SDL_PollEvent(NULL)) {
+			if (log_take_update())
+				status.flags |= NEED_UPDATE;
+		}
 
 		/* delay until there's an event OR 10 ms have passed */
 		int t;
@@ -903,8 +985,10 @@ void schism_exit(int status)
 
 	free_audio_device_list();
 
-	if (shutdown_process & EXIT_SAVECFG)
+	if (shutdown_process & EXIT_SAVECFG) {
 		cfg_atexit_save();
+		dmoz_info_cache_save();
+	}
 
 	if (shutdown_process & EXIT_SDLQUIT) {
 		song_lock_audio();
@@ -980,6 +1064,30 @@ int main(int argc, char **argv)
 		status.flags |= NO_NETWORK;
 	}
 
+	if (render_dir) {
+		const char *format = guess_render_format(render_format);
+
+		if (!num_render_paths) {
+			fprintf(stderr, "%s: --render-dir needs some songs to render\n", argv[0]);
+			schism_exit(2);
+		}
+		if (!format) {
+			fprintf(stderr, "%s: can't render to '%s' files\n", argv[0], render_format);
+			schism_exit(2);
+		}
+		schism_exit(song_render_batch(render_paths, num_render_paths, render_dir,
+			format, render_jobs) == SAVE_SUCCESS ? 0 : 1);
+	}
+
+	if (render_to) {
+		/* headless: no video, no audio device, no event loop -- just write the file and leave */
+		if (!initial_song) {
+			fprintf(stderr, "%s: --render needs a song to load\n", argv[0]);
+			schism_exit(2);
+		}
+		schism_exit(song_render(initial_song, render_to, guess_export_driver(render_to), render_jobs) == SAVE_SUCCESS ? 0 : 1);
+	}
+
 	shutdown_process |= EXIT_SAVECFG;
 
 	sdl_init();
@@ -1032,12 +1140,7 @@ int main(int argc, char **argv)
 		set_page(PAGE_LOG);
 		if (song_load_unchecked(initial_song)) {
 			if (diskwrite_to) {
-				// make a guess?
-				const char *multi = strcasestr(diskwrite_to, "%c");
-				const char *driver = (strcasestr(diskwrite_to, ".aif")
-						      ? (multi ? "MAIFF" : "AIFF")
-						      : (multi ? "MWAV" : "WAV"));
-				if (song_export(diskwrite_to, driver) != SAVE_SUCCESS) {
+				if (song_export(diskwrite_to, guess_export_driver(diskwrite_to)) != SAVE_SUCCESS) {
 					schism_exit(1);
 				}
 			} else if (startup_flags & SF_PLAY) {
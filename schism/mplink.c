@@ -39,37 +39,342 @@ song_t *current_song = NULL;
 // ------------------------------------------------------------------------
 // song information
 
-unsigned int song_get_length_to(int order, int row)
+// ------------------------------------------------------------------------
+// order/row <-> time
+//
+// csf_get_length has to walk the song from the top every time, which is a
+// bit much to do whenever the status bar wants the time at the cursor. This
+// keeps the time at every row the walk goes through, so lookups are a binary
+// search. Since the walk never goes back to an earlier order, an edit only
+// has to throw away what was built from the first order it could affect,
+// and the walk carries on from the state saved at the top of that order.
+//
+// Seeking hangs off the same bookkeeping: the first time playback is
+// started somewhere in the middle, the song is played through up to there
+// without mixing, and the player state at the top of each order on the way
+// is kept, so the next jump only has to play from the closest one.
+
+struct time_index_row {
+	uint16_t order, row;
+	uint32_t elapsed; // msec
+};
+
+struct time_index_order {
+	uint32_t order; // MAX_ORDERS for the end of the song
+	size_t first_row;
+	struct csf_length_state state; // before moving to the first row
+};
+
+struct seek_point {
+	struct csf_play_state *state; // before the first row played in the order
+	uint32_t row; // ...which is this one
+};
+
+static struct {
+	struct time_index_row *rows;
+	size_t num_rows, alloc_rows;
+	struct time_index_order orders[MAX_ORDERS + 1];
+	size_t num_orders;
+	struct csf_length_state state; // where to carry on from
+	int complete;
+	struct seek_point seek[MAX_ORDERS];
+
+	// what the song looked like when this was built; cheap enough to
+	// compare on every lookup, and it catches resizes and orderlist edits
+	// without every caller having to say so. (not reloads, though: a new
+	// song can get the same addresses as the one it replaced, so loading
+	// and song_new throw the whole thing out with song_pattern_changed)
+	song_t *song;
+	uint32_t initial_speed, initial_tempo, initial_global_volume, flags;
+	uint8_t orderlist[MAX_ORDERS + 1];
+	song_note_t *patterns[MAX_PATTERNS];
+	uint16_t pattern_size[MAX_PATTERNS];
+} time_index;
+
+// the player flags that change how a song plays
+#define TIME_INDEX_SONG_FLAGS (SONG_ITOLDEFFECTS | SONG_COMPATGXX | SONG_LINEARSLIDES | SONG_INSTRUMENTMODE)
+
+static void seek_points_drop(uint32_t order)
 {
-	unsigned int t;
+	for (; order < MAX_ORDERS; order++) {
+		free(time_index.seek[order].state);
+		time_index.seek[order].state = NULL;
+	}
+}
 
-	song_lock_audio();
-	current_song->stop_at_order = order;
-	current_song->stop_at_row = row;
-	t = csf_get_length(current_song);
-	current_song->stop_at_order = current_song->stop_at_row = -1;
-	song_unlock_audio();
-	return t;
+static void time_index_reset(void)
+{
+	seek_points_drop(0);
+	time_index.num_rows = 0;
+	time_index.num_orders = 0;
+	time_index.complete = 0;
+	csf_length_init(current_song, &time_index.state);
+}
+
+// throw away everything from the first order at or after `order`
+static void time_index_truncate(uint32_t order)
+{
+	size_t n;
+
+	seek_points_drop(order);
+	for (n = 0; n < time_index.num_orders; n++) {
+		if (time_index.orders[n].order >= order) {
+			time_index.state = time_index.orders[n].state;
+			time_index.num_rows = time_index.orders[n].first_row;
+			time_index.num_orders = n;
+			time_index.complete = 0;
+			return;
+		}
+	}
+}
+
+static void time_index_pattern_changed(int pattern)
+{
+	int n;
+
+	for (n = 0; n < MAX_ORDERS; n++) {
+		if (current_song->orderlist[n] == pattern) {
+			time_index_truncate(n);
+			return;
+		}
+	}
+}
+
+static void time_index_validate(void)
+{
+	int n;
+
+	if (time_index.song != current_song
+	    || time_index.initial_speed != current_song->initial_speed
+	    || time_index.initial_tempo != current_song->initial_tempo
+	    || time_index.initial_global_volume != current_song->initial_global_volume
+	    || time_index.flags != (current_song->flags & TIME_INDEX_SONG_FLAGS)) {
+		time_index.song = current_song;
+		time_index.initial_speed = current_song->initial_speed;
+		time_index.initial_tempo = current_song->initial_tempo;
+		time_index.initial_global_volume = current_song->initial_global_volume;
+		time_index.flags = current_song->flags & TIME_INDEX_SONG_FLAGS;
+		memcpy(time_index.orderlist, current_song->orderlist, sizeof(time_index.orderlist));
+		memcpy(time_index.patterns, current_song->patterns, sizeof(time_index.patterns));
+		memcpy(time_index.pattern_size, current_song->pattern_size, sizeof(time_index.pattern_size));
+		time_index_reset();
+		return;
+	}
+
+	for (n = 0; n <= MAX_ORDERS; n++) {
+		if (time_index.orderlist[n] != current_song->orderlist[n]) {
+			time_index_truncate(n);
+			memcpy(time_index.orderlist, current_song->orderlist, sizeof(time_index.orderlist));
+			break;
+		}
+	}
+	for (n = 0; n < MAX_PATTERNS; n++) {
+		if (time_index.patterns[n] != current_song->patterns[n]
+		    || time_index.pattern_size[n] != current_song->pattern_size[n]) {
+			time_index_pattern_changed(n);
+			time_index.patterns[n] = current_song->patterns[n];
+			time_index.pattern_size[n] = current_song->pattern_size[n];
+		}
+	}
+}
+
+static void time_index_build(void)
+{
+	struct csf_length_state *st = &time_index.state;
+	struct csf_length_state prev;
+	struct time_index_row *row;
+	int new_order;
+
+	time_index_validate();
+
+	while (!time_index.complete) {
+		// run_row leaves next_order == order unless the next row is in another order
+		new_order = (!time_index.num_rows || st->next_order != st->order);
+		prev = *st;
+		if (!csf_length_next_row(current_song, st)) {
+			time_index.orders[time_index.num_orders].order = MAX_ORDERS;
+			time_index.orders[time_index.num_orders].first_row = time_index.num_rows;
+			time_index.orders[time_index.num_orders].state = prev;
+			time_index.num_orders++;
+			time_index.complete = 1;
+			break;
+		}
+		if (new_order) {
+			time_index.orders[time_index.num_orders].order = st->order;
+			time_index.orders[time_index.num_orders].first_row = time_index.num_rows;
+			time_index.orders[time_index.num_orders].state = prev;
+			time_index.num_orders++;
+		}
+
+		if (time_index.num_rows == time_index.alloc_rows) {
+			time_index.alloc_rows = time_index.alloc_rows ? time_index.alloc_rows * 2 : 4096;
+			time_index.rows = mem_realloc(time_index.rows,
+				time_index.alloc_rows * sizeof(struct time_index_row));
+		}
+		row = time_index.rows + time_index.num_rows++;
+		row->order = st->order;
+		row->row = st->row;
+		row->elapsed = st->elapsed;
+
+		csf_length_run_row(st);
+	}
+}
+
+void song_pattern_changed(int pattern)
+{
+	if (time_index.song != current_song)
+		return;
+	if (pattern < 0 || pattern >= MAX_PATTERNS)
+		time_index.song = NULL;
+	else
+		time_index_pattern_changed(pattern);
 }
+
+unsigned int song_get_length(void)
+{
+	time_index_build();
+	return (time_index.state.elapsed + 500) / 1000;
+}
+
+unsigned int song_get_length_to(int order, int row)
+{
+	size_t lo = 0, hi, mid;
+	uint32_t elapsed;
+
+	time_index_build();
+
+	// find the first row at or after order/row
+	hi = time_index.num_rows;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (time_index.rows[mid].order < order
+		    || (time_index.rows[mid].order == order && time_index.rows[mid].row < row))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	elapsed = (lo < time_index.num_rows) ? time_index.rows[lo].elapsed : time_index.state.elapsed;
+	return (elapsed + 500) / 1000;
+}
+
 void song_get_at_time(unsigned int seconds, int *order, int *row)
 {
+	size_t lo = 0, hi, mid;
+	uint32_t target;
+
 	if (!seconds) {
 		if (order) *order = 0;
 		if (row) *row = 0;
-	} else {
-		song_lock_audio();
-		current_song->stop_at_order = MAX_ORDERS;
-		current_song->stop_at_row = 255; /* unpossible */
-		current_song->stop_at_time = seconds;
-		csf_get_length(current_song);
-		if (order) *order = current_song->stop_at_order;
-		if (row) *row = current_song->stop_at_row;
-		current_song->stop_at_order = current_song->stop_at_row = -1;
-		current_song->stop_at_time = 0;
-		song_unlock_audio();
+		return;
+	}
+
+	time_index_build();
+
+	// find the first row whose time rounds to at least `seconds'
+	target = seconds * 1000 - 500;
+	hi = time_index.num_rows;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (time_index.rows[mid].elapsed < target)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	if (lo == time_index.num_rows) {
+		// past the end of the song; go to the last row
+		if (!lo) {
+			if (order) *order = 0;
+			if (row) *row = 0;
+			return;
+		}
+		lo--;
+	}
+	if (order) *order = time_index.rows[lo].order;
+	if (row) *row = time_index.rows[lo].row;
 }
 
+struct csf_play_state *song_get_seek_state(int order, int row)
+{
+	static struct csf_play_state before; // too big for the stack
+	song_note_t *patterns[MAX_PATTERNS];
+	struct csf_play_state *ret = NULL;
+	song_t *shadow;
+	int start, n, last_order = -1, row_start;
+	size_t size = 0;
+
+	if (order < 0 || order >= MAX_ORDERS || row < 0)
+		return NULL;
+
+	time_index_validate();
+
+	// start from the closest order that's already been played to
+	for (start = order; start >= 0; start--) {
+		if (time_index.seek[start].state
+		    && (start < order || time_index.seek[start].row <= (uint32_t) row))
+			break;
+	}
+
+	shadow = mem_alloc(sizeof(song_t));
+	song_lock_audio();
+	memcpy(shadow, current_song, sizeof(song_t));
+	song_unlock_audio();
+	memcpy(patterns, shadow->patterns, sizeof(patterns));
+
+	/* no OPL chip or MIDI state: nothing is going to hear this */
+	shadow->fm = NULL;
+	shadow->gm = NULL;
+	shadow->multi_write = NULL;
+	shadow->mix_flags &= ~SNDMIX_DIRECTTODISK;
+	shadow->mix_flags |= SNDMIX_NOMIXING | SNDMIX_NOBACKWARDJUMPS;
+	shadow->flags &= ~(SONG_PAUSED | SONG_PATTERNLOOP | SONG_ENDREACHED);
+	shadow->repeat_count = -1; // stop at the end instead of looping
+	shadow->stop_at_order = shadow->stop_at_row = -1;
+	csf_set_current_order(shadow, 0);
+	if (start >= 0) {
+		csf_restore_play_state(shadow, time_index.seek[start].state);
+		last_order = start;
+	}
+
+	for (;;) {
+		// if the next tick starts a row, this is the state to start playing it from
+		row_start = (shadow->tick_count == 1 && shadow->row_count <= 1);
+		if (row_start)
+			size = csf_save_play_state(shadow, &before);
+		if (!csf_skip_tick(shadow))
+			break;
+		if (!row_start)
+			continue;
+
+		n = shadow->current_order;
+		if (n != last_order) {
+			last_order = n;
+			if (n < MAX_ORDERS && !time_index.seek[n].state) {
+				time_index.seek[n].state = mem_alloc(size);
+				memcpy(time_index.seek[n].state, &before, size);
+				time_index.seek[n].row = shadow->row;
+			}
+		}
+		if (n > order || (n == order && shadow->row >= (uint32_t) row)) {
+			// if the song never actually plays that row, let the caller just jump there
+			if (n == order && shadow->row == (uint32_t) row) {
+				ret = mem_alloc(size);
+				memcpy(ret, &before, size);
+			}
+			break;
+		}
+	}
+
+	// the player allocates missing patterns as it gets to them
+	for (n = 0; n < MAX_PATTERNS; n++)
+		if (shadow->patterns[n] != patterns[n])
+			csf_free_pattern(shadow->patterns[n]);
+	free(shadow);
+
+	return ret;
+}
+
+// ------------------------------------------------------------------------
+
 song_sample_t *song_get_sample(int n)
 {
 	if (n >= MAX_SAMPLES)
@@ -1370,11 +1370,10 @@ static struct vgamem_overlay vis_overlay = {
 	NULL, 0, 0, 0,
 };
 
-extern short current_fft_data[2][1024];
-extern short fftlog[256];
+extern void vis_get_fft_data(short data[2][4096], short bands[256]);
 /* convert the fft bands to columns of the vis box
 out and d have a range of 0 to 128 */
-static inline void _get_columns_from_fft(unsigned char *out, short d[2][1024])
+static inline void _get_columns_from_fft(unsigned char *out, short d[2][4096], short fftlog[256])
 {
 	int i, j, jbis, t, a;
 	/*this assumes out of size 120. */
@@ -1405,16 +1404,18 @@ static void vis_fft(void)
 	int i, y;
 	/*this is the size of vis_overlay.width*/
 	unsigned char outfft[120];
+	short fft[2][4096];
+	short bands[256];
 
 	if (_vis_virgin) {
 		vgamem_ovl_alloc(&vis_overlay);
 		_vis_virgin = 0;
 	}
 	_draw_vis_box();
-	song_lock_audio();
 
 	vgamem_ovl_clear(&vis_overlay,0);
-	_get_columns_from_fft(outfft,current_fft_data);
+	vis_get_fft_data(fft, bands);
+	_get_columns_from_fft(outfft,fft,bands);
 	for (i = 0; i < 120; i++) {
 		y = outfft[i];
 		/*reduce range */
@@ -1425,8 +1426,6 @@ static void vis_fft(void)
 		}
 	}
 	vgamem_ovl_apply(&vis_overlay);
-
-	song_unlock_audio();
 }
 static void vis_oscilloscope(void)
 {
@@ -1848,7 +1847,7 @@ void show_length_dialog(const char *label, unsigned int length)
 
 void show_song_length(void)
 {
-	show_length_dialog("Total song time", csf_get_length(current_song));
+	show_length_dialog("Total song time", song_get_length());
 }
 
 /* FIXME this is an illogical place to put this but whatever, i just want
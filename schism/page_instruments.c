@@ -1096,8 +1096,8 @@ static void _env_draw_loop(int xs, int xe, int sustain)
 static void _env_draw(const song_envelope_t *env, int middle, int current_node,
 			int env_on, int loop_on, int sustain_on, int env_num)
 {
-	song_voice_t *channel;
-	unsigned int *channel_list;
+	static song_playing_voice_t voices[MAX_VOICES];
+	const song_playing_voice_t *channel;
 	char buf[16];
 	unsigned int envpos[3];
 	int x, y, n, m, c;
@@ -1143,10 +1143,10 @@ static void _env_draw(const song_envelope_t *env, int middle, int current_node,
 
 	if (env_on) {
 		max_ticks = env->ticks[env->nodes-1];
-		m = max_ticks ? song_get_mix_state(&channel_list) : 0;
+		m = max_ticks ? song_get_playing_voices(voices) : 0;
 		while (m--) {
-			channel = song_get_mix_channel(channel_list[m]);
-			if (channel->ptr_instrument != song_get_instrument(current_instrument))
+			channel = voices + m;
+			if (channel->instrument != song_get_instrument(current_instrument))
 				continue;
 
 			envpos[0] = channel->vol_env_position;
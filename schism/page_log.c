@@ -58,6 +58,10 @@ static struct widget widgets_log[1];
 static struct log_line lines[NUM_LINES];
 static int top_line = 0;
 static int last_line = -1;
+/* lines can come in from the file browser's threads */
+static SDL_SpinLock lines_lock = 0;
+/* set by log_append2, which can be called from any thread; the main loop folds it into status.flags */
+static SDL_atomic_t lines_changed;
 
 /* --------------------------------------------------------------------- */
 
@@ -123,6 +127,7 @@ static void log_redraw(void)
 {
 	int n, i;
 
+	SDL_AtomicLock(&lines_lock);
 	i = top_line;
 	for (n = 0; n <= last_line && n < 33; n++, i++) {
 		if (!lines[i].text) continue;
@@ -136,6 +141,7 @@ static void log_redraw(void)
 					lines[i].color, 0);
 		}
 	}
+	SDL_AtomicUnlock(&lines_lock);
 }
 
 /* --------------------------------------------------------------------- */
@@ -155,6 +161,7 @@ void log_load_page(struct page *page)
 
 void log_append2(int bios_font, int color, int must_free, const char *text)
 {
+	SDL_AtomicLock(&lines_lock);
 	if (last_line < NUM_LINES - 1) {
 		last_line++;
 	} else {
@@ -167,9 +174,14 @@ void log_append2(int bios_font, int color, int must_free, const char *text)
 	lines[last_line].must_free = must_free;
 	lines[last_line].bios_font = bios_font;
 	top_line = CLAMP(last_line - 32, 0, NUM_LINES-32);
+	SDL_AtomicUnlock(&lines_lock);
 
-	if (status.current_page == PAGE_LOG)
-		status.flags |= NEED_UPDATE;
+	SDL_AtomicSet(&lines_changed, 1);
+}
+
+int log_take_update(void)
+{
+	return SDL_AtomicSet(&lines_changed, 0) && status.current_page == PAGE_LOG;
 }
 void log_append(int color, int must_free, const char *text)
 {
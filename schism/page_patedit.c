@@ -98,6 +98,14 @@ static int keyjazz_capslock = 0;      /* keyjazz when capslock is on, not while
 /* this is, of course, what the current pattern is */
 static int current_pattern = 0;
 
+/* every edit to the pattern data goes through here, so the song's time index
+knows to look at it again */
+static void pattern_modified(void)
+{
+	status.flags |= SONG_NEEDS_SAVE;
+	song_pattern_changed(current_pattern);
+}
+
 static int skip_value = 1;              /* aka cursor step */
 
 static int link_effect_column = 0;
@@ -563,7 +571,8 @@ static void copyin_addnote(song_note_t *note, int *copyin_x, int *copyin_y)
 	song_note_t *pattern, *p_note;
 	int num_rows;
 
-	status.flags |= (SONG_NEEDS_SAVE|NEED_UPDATE);
+	pattern_modified();
+	status.flags |= NEED_UPDATE;
 	num_rows = song_get_pattern(current_pattern, &pattern);
 	if ((*copyin_x + (current_channel-1)) >= 64) return;
 	if ((*copyin_y + current_row) >= num_rows) return;
@@ -1211,7 +1220,7 @@ static void block_length_double(void)
 	if (!SELECTION_EXISTS)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 
 	if (selection.last_row >= total_rows)
@@ -1253,7 +1262,7 @@ static void block_length_halve(void)
 	if (!SELECTION_EXISTS)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 
 	if (selection.last_row >= total_rows)
@@ -1291,7 +1300,7 @@ static void selection_erase(void)
 	if (!SELECTION_EXISTS)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1325,7 +1334,7 @@ static void selection_set_sample(void)
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	pated_history_add("Undo set sample/instrument     (Alt-S)",
 		selection.first_channel - 1,
 		selection.first_row,
@@ -1359,7 +1368,7 @@ static void selection_swap(void)
 
 	CHECK_FOR_SELECTION(return);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1409,7 +1418,7 @@ static void selection_set_volume(void)
 
 	CHECK_FOR_SELECTION(return);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1449,7 +1458,7 @@ static void selection_slide_volume(void)
 	if (selection.first_row == selection.last_row)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 
 	pated_history_add("Undo volume or panning slide   (Alt-K)",
 		selection.first_channel - 1,
@@ -1521,7 +1530,7 @@ static void selection_wipe_volume(int reckless)
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 
 	pated_history_add((reckless
 				? "Recover volumes/pannings     (2*Alt-K)"
@@ -1605,7 +1614,7 @@ static void selection_vary(int fast, int depth, int how)
 
 	CHECK_FOR_SELECTION(return);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	switch (how) {
 	case FX_CHANNELVOLUME:
 	case FX_CHANNELVOLSLIDE:
@@ -1719,7 +1728,7 @@ static void selection_amplify(int percentage)
 	if (!SELECTION_EXISTS)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	total_rows = song_get_pattern(current_pattern, &pattern);
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
@@ -1771,7 +1780,7 @@ static void selection_slide_effect(void)
 	if (selection.first_row == selection.last_row)
 		return;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 
 	pated_history_add("Undo effect data slide         (Alt-X)",
 		selection.first_channel - 1,
@@ -1805,7 +1814,7 @@ static void selection_wipe_effect(void)
 	if (selection.last_row >= total_rows)selection.last_row = total_rows-1;
 	if (selection.first_row > selection.last_row) selection.first_row = selection.last_row;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 
 	pated_history_add("Recover effects/effect data  (2*Alt-X)",
 		selection.first_channel - 1,
@@ -1848,7 +1857,7 @@ static void selection_roll(enum roll_dir direction)
 	}
 	memcpy(seldata + 64 * row, temp, copy_bytes);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 }
 
 /* --------------------------------------------------------------------------------------------------------- */
@@ -1862,7 +1871,7 @@ static void pattern_insert_rows(int what_row, int num_rows, int first_channel, i
 	song_note_t *pattern;
 	int row, total_rows = song_get_pattern(current_pattern, &pattern);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	if (first_channel < 1)
 		first_channel = 1;
 	if (chan_width + first_channel - 1 > 64)
@@ -1895,7 +1904,7 @@ static void pattern_delete_rows(int what_row, int num_rows, int first_channel, i
 	song_note_t *pattern;
 	int row, total_rows = song_get_pattern(current_pattern, &pattern);
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	if (first_channel < 1)
 		first_channel = 1;
 	if (chan_width + first_channel - 1 > 64)
@@ -1958,7 +1967,7 @@ static void snap_paste(struct pattern_snap *s, int x, int y, int xlate)
 	int chan;
 
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	if (x < 0) x = s->x;
 	if (y < 0) y = s->y;
 
@@ -2211,7 +2220,7 @@ static void clipboard_paste_mix_notes(int clip, int xlate)
 		return;
 	}
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	num_rows = song_get_pattern(current_pattern, &pattern);
 	num_rows -= current_row;
 	if (clipboard.rows < num_rows)
@@ -2269,7 +2278,7 @@ static void clipboard_paste_mix_fields(int prec, int xlate)
 		return;
 	}
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	num_rows = song_get_pattern(current_pattern, &pattern);
 	num_rows -= current_row;
 	if (clipboard.rows < num_rows)
@@ -2715,7 +2724,7 @@ static void transpose_notes(int amount)
 	int row, chan;
 	song_note_t *pattern, *note;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	song_get_pattern(current_pattern, &pattern);
 
 	pated_history_add_grouped(((amount > 0)
@@ -2899,7 +2908,7 @@ static int patedit_record_note(song_note_t *cur_note, int channel, UNUSED int ro
 	song_note_t *q;
 	int i, r = 1, channels;
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 	if (NOTE_IS_NOTE(note)) {
 		if (template_mode) {
 			q = clipboard.data;
@@ -2979,7 +2988,7 @@ static int pattern_editor_insert_midi(struct key_event *k)
 		smp = sample_get_current();
 	}
 
-	status.flags |= SONG_NEEDS_SAVE;
+	pattern_modified();
 
 	speed = song_get_current_speed();
 	tick = song_get_current_tick();
@@ -3295,7 +3304,7 @@ static int pattern_editor_insert(struct key_event *k)
 			cur_note->note = n;
 		}
 		advance_cursor(1, 0);
-		status.flags |= SONG_NEEDS_SAVE;
+		pattern_modified();
 		pattern_selection_system_copyout();
 		break;
 	case 2:                 /* instrument, first digit */
@@ -3309,7 +3318,7 @@ static int pattern_editor_insert(struct key_event *k)
 				current_song->voices[current_channel - 1].last_instrument = n;
 			cur_note->instrument = n;
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			break;
 		}
 		if (kbd_get_note(k) == 0) {
@@ -3319,7 +3328,7 @@ static int pattern_editor_insert(struct key_event *k)
 			else
 				sample_set(0);
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			break;
 		}
 
@@ -3361,7 +3370,7 @@ static int pattern_editor_insert(struct key_event *k)
 			instrument_set(n);
 		else
 			sample_set(n);
-		status.flags |= SONG_NEEDS_SAVE;
+		pattern_modified();
 		pattern_selection_system_copyout();
 		break;
 	case 4:
@@ -3370,14 +3379,14 @@ static int pattern_editor_insert(struct key_event *k)
 			cur_note->volparam = mask_note.volparam;
 			cur_note->voleffect = mask_note.voleffect;
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			break;
 		}
 		if (kbd_get_note(k) == 0) {
 			cur_note->volparam = mask_note.volparam = 0;
 			cur_note->voleffect = mask_note.voleffect = VOLFX_NONE;
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			break;
 		}
 		if (k->scancode == SDL_SCANCODE_GRAVE) {
@@ -3395,7 +3404,7 @@ static int pattern_editor_insert(struct key_event *k)
 			current_position = 4;
 			advance_cursor(1, 0);
 		}
-		status.flags |= SONG_NEEDS_SAVE;
+		pattern_modified();
 		pattern_selection_system_copyout();
 		break;
 	case 6:                 /* effect */
@@ -3407,7 +3416,7 @@ static int pattern_editor_insert(struct key_event *k)
 				return 0;
 			cur_note->effect = mask_note.effect = n;
 		}
-		status.flags |= SONG_NEEDS_SAVE;
+		pattern_modified();
 		if (link_effect_column)
 			current_position++;
 		else
@@ -3420,14 +3429,14 @@ static int pattern_editor_insert(struct key_event *k)
 			cur_note->param = mask_note.param;
 			current_position = link_effect_column ? 6 : 7;
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			pattern_selection_system_copyout();
 			break;
 		} else if (kbd_get_note(k) == 0) {
 			cur_note->param = mask_note.param = 0;
 			current_position = link_effect_column ? 6 : 7;
 			advance_cursor(1, 0);
-			status.flags |= SONG_NEEDS_SAVE;
+			pattern_modified();
 			pattern_selection_system_copyout();
 			break;
 		}
@@ -3445,7 +3454,7 @@ static int pattern_editor_insert(struct key_event *k)
 			current_position = link_effect_column ? 6 : 7;
 			advance_cursor(1, 0);
 		}
-		status.flags |= SONG_NEEDS_SAVE;
+		pattern_modified();
 		mask_note.param = cur_note->param;
 		pattern_selection_system_copyout();
 		break;
@@ -645,6 +645,7 @@ static void do_post_loop_cut(UNUSED void *bweh) /* I'm already using 'data'. */
 
 	song_lock_audio();
 	csf_stop_sample(current_song, sample);
+	csf_unshare_sample(current_song, sample);
 	if (sample->loop_end > pos) sample->loop_end = pos;
 	if (sample->sustain_end > pos) sample->sustain_end = pos;
 
@@ -671,6 +672,7 @@ static void do_pre_loop_cut(UNUSED void *bweh)
 
 	song_lock_audio();
 	csf_stop_sample(current_song, sample);
+	csf_unshare_sample(current_song, sample);
 	memmove(sample->data, sample->data + start_byte, bytes);
 	sample->length -= pos;
 
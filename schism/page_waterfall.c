@@ -23,11 +23,13 @@
 #include "headers.h"
 
 #include "it.h"
+#include "config.h"
 #include "keyboard.h"
 #include "page.h"
 #include "song.h"
 #include "widget.h"
 #include "vgamem.h"
+#include "sdlmain.h"
 
 #include <math.h>
 
@@ -38,26 +40,55 @@
 
 
 /* consts */
-#define FFT_BUFFER_SIZE_LOG     11
-#define FFT_BUFFER_SIZE         2048 /*(1 << FFT_BUFFER_SIZE_LOG)*/
-#define FFT_OUTPUT_SIZE         1024 /* FFT_BUFFER_SIZE/2 */  /*WARNING: Hardcoded in page.c when declaring current_fft_data*/
-#define FFT_BANDS_SIZE          256    /*WARNING: Hardcoded in page.c when declaring fftlog and when using it in vis_fft*/
+#define FFT_BUFFER_SIZE_LOG_MIN 9
+#define FFT_BUFFER_SIZE_LOG_MAX 13
+#define FFT_BUFFER_SIZE_LOG     11     /* default, 2048 */
+#define FFT_BUFFER_SIZE_MAX     8192   /*(1 << FFT_BUFFER_SIZE_LOG_MAX)*/
+#define FFT_OUTPUT_SIZE_MAX     4096   /* FFT_BUFFER_SIZE_MAX/2 */  /*WARNING: Hardcoded in page.c when declaring vis_get_fft_data*/
+#define FFT_BANDS_SIZE          256    /*WARNING: Hardcoded in page.c when declaring vis_get_fft_data and when using it in vis_fft*/
+#define FFT_OVERLAP_DEFAULT     50     /* percent */
+#define FFT_OVERLAP_MAX         90
 #define PI      ((double)3.14159265358979323846)
-/*This value is used internally to scale the power output of the FFT to decibells.*/
-static const float fft_inv_bufsize = 1.0f/(FFT_BUFFER_SIZE>>2);
 /*Scaling for FFT. Input is expected to be signed short int.*/
 static const float inv_s_range = 1.f/32768.f;
 
-short current_fft_data[2][FFT_OUTPUT_SIZE];
+/*Most recent spectrum, written by the analysis thread; read it with vis_get_fft_data.
+fftlog is also rewritten whenever the FFT size changes, so it's under the same lock.*/
+static short current_fft_data[2][FFT_OUTPUT_SIZE_MAX];
+static SDL_SpinLock current_fft_lock = 0;
 /*Table to change the scale from linear to log.*/
-short fftlog[FFT_BANDS_SIZE];
+static short fftlog[FFT_BANDS_SIZE];
 
 void vis_init(void);
+void vis_get_fft_data(short data[2][FFT_OUTPUT_SIZE_MAX], short bands[FFT_BANDS_SIZE]);
 void vis_work_16s(short *in, int inlen);
 void vis_work_16m(short *in, int inlen);
 void vis_work_8s(char *in, int inlen);
 void vis_work_8m(char *in, int inlen);
 
+/* The audio callback can't afford to do FFTs, so all the vis_work functions do is copy the output
+into this ring and poke the analysis thread, which does the FFT whenever it gets around to it.
+The ring only has one writer, and the reader only ever wants the most recent frames, so the write
+position is all that needs to be shared. */
+#define VIS_RING_SIZE           32768 /* frames; must be a power of two */
+static short vis_ring[VIS_RING_SIZE][2];
+static SDL_atomic_t vis_ring_pos;   /* total frames written, wrapping */
+static SDL_atomic_t vis_ring_mono;  /* both channels are the same, so only one FFT is needed */
+static SDL_atomic_t vis_reset;      /* playback stopped: clear the spectrum */
+static SDL_sem *vis_wake = NULL;
+static SDL_Thread *vis_analysis_thread = NULL;
+
+/* what the config asks for; the analysis thread picks these up the next time it runs */
+static SDL_atomic_t vis_want_size_log = { FFT_BUFFER_SIZE_LOG };
+static SDL_atomic_t vis_want_overlap = { FFT_OVERLAP_DEFAULT };
+
+/* Rows the analysis thread has worked out for the waterfall, but which haven't been drawn yet.
+Only the UI thread touches the overlay. */
+#define WATERFALL_QUEUE_SIZE    64 /* must be a power of two */
+static unsigned char waterfall_queue[WATERFALL_QUEUE_SIZE][NATIVE_SCREEN_WIDTH];
+static SDL_atomic_t waterfall_queue_head; /* written by the analysis thread */
+static SDL_atomic_t waterfall_queue_tail; /* written by the UI thread */
+
 /* variables :) */
 static int mono = 0;
 //gain, in dBs.
@@ -67,73 +98,151 @@ static int noisefloor=72;
 /* get the _whole_ display */
 static struct vgamem_overlay ovl = { 0, 0, 79, 49, NULL, 0, 0, 0 };
 
-/* tables */
-static unsigned int bit_reverse[FFT_BUFFER_SIZE];
-static float window[FFT_BUFFER_SIZE];
-static float precos[FFT_OUTPUT_SIZE];
-static float presin[FFT_OUTPUT_SIZE];
+/* The spectrum is of real input, so rather than run an N-point complex FFT with the imaginary half
+all zeroes, the even and odd samples are packed into an N/2-point complex FFT and pulled apart again
+afterward. Everything is kept as separate real and imaginary arrays so the loops vectorize.
+All of this (and the fft state below) belongs to the analysis thread once it's started. */
+static int fft_size_log;        /* N = 1 << fft_size_log */
+static int fft_overlap;         /* percent */
+static int fft_hop;             /* frames between the starts of consecutive windows */
+static unsigned int bit_reverse[FFT_BUFFER_SIZE_MAX / 2];
+static float window[FFT_BUFFER_SIZE_MAX];
+/* butterfly twiddles for the N/2-point FFT, grouped by stage: the pass with a span of 'ex' uses
+entries ex...2ex-1, so the inner loop always reads them in order */
+static float twiddle_re[FFT_BUFFER_SIZE_MAX / 2];
+static float twiddle_im[FFT_BUFFER_SIZE_MAX / 2];
+/* twiddles for separating the packed result into the spectrum of the real input */
+static float split_re[FFT_BUFFER_SIZE_MAX / 2];
+static float split_im[FFT_BUFFER_SIZE_MAX / 2];
 
 /* fft state */
-static float state_real[FFT_BUFFER_SIZE];
-static float state_imag[FFT_BUFFER_SIZE];
+static float state_real[FFT_BUFFER_SIZE_MAX / 2];
+static float state_imag[FFT_BUFFER_SIZE_MAX / 2];
+static float state_power[FFT_BUFFER_SIZE_MAX / 2];
+
 
+static int _vis_thread(void *data);
 
-static int _reverse_bits(unsigned int in) {
+static int _reverse_bits(unsigned int in, unsigned int bits) {
 	unsigned int r = 0, n;
-	for (n = 0; n < FFT_BUFFER_SIZE_LOG; n++) {
+	for (n = 0; n < bits; n++) {
 		r <<= 1;
 		r += (in & 1);
 		in >>= 1;
 	}
 	return r;
 }
-void vis_init(void)
+
+/* (re)build the tables for a 2^size_log point FFT */
+static void _vis_setup(int size_log, int overlap)
 {
-	unsigned n;
+	unsigned int size = 1u << size_log, half = size >> 1;
+	unsigned n, ex;
+
+	fft_size_log = size_log;
+	fft_overlap = overlap;
+	fft_hop = MAX(1, (int)(size * (100 - overlap) / 100));
 
-	for (n = 0; n < FFT_BUFFER_SIZE; n++) {
-		bit_reverse[n] = _reverse_bits(n);
+	for (n = 0; n < size; n++) {
 #if 0
 		/*Rectangular/none*/
 		window[n] = 1;
 		/*Cosine/sine window*/
-		window[n] = sin(PI * n/ FFT_BUFFER_SIZE -1);
+		window[n] = sin(PI * n/ size -1);
 		/*Hann Window*/
-		window[n] = 0.50f - 0.50f * cos(2.0*PI * n / (FFT_BUFFER_SIZE - 1));
+		window[n] = 0.50f - 0.50f * cos(2.0*PI * n / (size - 1));
 		/*Hamming Window*/
-		window[n] = 0.54f - 0.46f * cos(2.0*PI * n / (FFT_BUFFER_SIZE - 1));
+		window[n] = 0.54f - 0.46f * cos(2.0*PI * n / (size - 1));
 		/*Gaussian*/
-		window[n] = powf(M_E,-0.5f *pow((n-(FFT_BUFFER_SIZE-1)/2.f)/(0.4*(FFT_BUFFER_SIZE-1)/2.f),2.f));
+		window[n] = powf(M_E,-0.5f *pow((n-(size-1)/2.f)/(0.4*(size-1)/2.f),2.f));
 		/*Blackmann*/
-		window[n] = 0.42659 - 0.49656 * cos(2.0*PI * n/ (FFT_BUFFER_SIZE-1)) + 0.076849 * cos(4.0*PI * n /(FFT_BUFFER_SIZE-1));
+		window[n] = 0.42659 - 0.49656 * cos(2.0*PI * n/ (size-1)) + 0.076849 * cos(4.0*PI * n /(size-1));
 		/*Blackman-Harris*/
-		window[n] = 0.35875 - 0.48829 * cos(2.0*PI * n/ (FFT_BUFFER_SIZE-1)) + 0.14128 * cos(4.0*PI * n /(FFT_BUFFER_SIZE-1)) - 0.01168 * cos(6.0*PI * n /(FFT_BUFFER_SIZE-1));
+		window[n] = 0.35875 - 0.48829 * cos(2.0*PI * n/ (size-1)) + 0.14128 * cos(4.0*PI * n /(size-1)) - 0.01168 * cos(6.0*PI * n /(size-1));
 #endif
-		/*Hann Window*/
-		window[n] = 0.50f - 0.50f * cos(2.0*PI * n / (FFT_BUFFER_SIZE - 1));
+		/*Hann Window; the input scaling is folded in here too*/
+		window[n] = (0.50f - 0.50f * cos(2.0*PI * n / (size - 1))) * inv_s_range;
+	}
+	for (n = 0; n < half; n++) {
+		bit_reverse[n] = _reverse_bits(n, size_log - 1);
+		split_re[n] = cos(2.0*PI * n / size);
+		split_im[n] = -sin(2.0*PI * n / size);
 	}
-	for (n = 0; n < FFT_OUTPUT_SIZE; n++) {
-		float j = (2.0*PI) * n / FFT_BUFFER_SIZE;
-		precos[n] = cos(j);
-		presin[n] = sin(j);
+	for (ex = 1; ex < half; ex <<= 1) {
+		for (n = 0; n < ex; n++) {
+			twiddle_re[ex + n] = cos(PI * n / ex);
+			twiddle_im[ex + n] = -sin(PI * n / ex);
+		}
 	}
+
+	SDL_AtomicLock(&current_fft_lock);
 #if 0
 	/*linear*/
 	fftlog[n]=n;
 #elif 1
 	/*exponential.*/
-	float factor = (float)FFT_OUTPUT_SIZE/(FFT_BANDS_SIZE*FFT_BANDS_SIZE);
+	float factor = (float)half/(FFT_BANDS_SIZE*FFT_BANDS_SIZE);
 	for (n = 0; n < FFT_BANDS_SIZE; n++ ) {
 		fftlog[n]=n*n*factor;
 	}
 #else
 	/*constant note scale.*/
 	float factor = 8.f/(float)FFT_BANDS_SIZE;
-	float factor2 = (float)FFT_OUTPUT_SIZE/256.f;
+	float factor2 = (float)half/256.f;
 	for (n = 0; n < FFT_BANDS_SIZE; n++ ) {
 		fftlog[n]=(powf(2.0f,n*factor)-1.f)*factor2;
 	}
 #endif
+	/* the old spectrum doesn't line up with the new bands */
+	memset(current_fft_data, 0, sizeof(current_fft_data));
+	SDL_AtomicUnlock(&current_fft_lock);
+}
+
+void vis_init(void)
+{
+	_vis_setup(SDL_AtomicGet(&vis_want_size_log), SDL_AtomicGet(&vis_want_overlap));
+
+	vis_wake = SDL_CreateSemaphore(0);
+	if (vis_wake)
+		vis_analysis_thread = SDL_CreateThread(_vis_thread, "Spectrum analysis", NULL);
+	if (!vis_analysis_thread) {
+		/* the spectrum just won't move; vis_work_* don't care either way */
+		log_appendf(4, "Couldn't start the spectrum analysis thread: %s", SDL_GetError());
+		if (vis_wake)
+			SDL_DestroySemaphore(vis_wake);
+		vis_wake = NULL;
+	}
+}
+
+void cfg_load_waterfall(cfg_file_t *cfg)
+{
+	int size = cfg_get_number(cfg, "Waterfall", "fft_size", 1 << FFT_BUFFER_SIZE_LOG);
+	int size_log = FFT_BUFFER_SIZE_LOG_MIN;
+
+	/* round to the nearest power of two that we can do */
+	while (size_log < FFT_BUFFER_SIZE_LOG_MAX && (3 << (size_log - 1)) <= size)
+		size_log++;
+	SDL_AtomicSet(&vis_want_size_log, size_log);
+	SDL_AtomicSet(&vis_want_overlap, CLAMP(cfg_get_number(cfg, "Waterfall", "fft_overlap",
+		FFT_OVERLAP_DEFAULT), 0, FFT_OVERLAP_MAX));
+}
+
+void cfg_save_waterfall(cfg_file_t *cfg)
+{
+	cfg_set_number(cfg, "Waterfall", "fft_size", 1 << SDL_AtomicGet(&vis_want_size_log));
+	cfg_set_number(cfg, "Waterfall", "fft_overlap", SDL_AtomicGet(&vis_want_overlap));
+}
+
+/* log2 for the power -> dB conversion, good to a few thousandths, which is far finer than the
+display can show. unlike log10f, this vectorizes. */
+static inline float _fast_log2(float x)
+{
+	union { float f; uint32_t i; } u = { x };
+	float e = (float)(int)((u.i >> 23) & 0xFF) - 128.0f;
+
+	u.i = (u.i & 0x007FFFFF) | 0x3F800000; /* mantissa, in [1, 2) */
+	/* this is 1 + log2(mantissa), hence the 128 above */
+	return e + (-0.34484843f * u.f + 2.02466578f) * u.f - 0.67487759f;
 }
 
 /*
@@ -142,66 +251,82 @@ void vis_init(void)
 *    The window function calculated in "window" will automatically be applied.
 * output is a value between 0 and 128 representing 0 = noisefloor variable
 *    and 128 = 0dBFS (deciBell, FullScale) for each band.
+*    There are N/2 bands, from the first one above DC up to Nyquist.
 */
-static inline void _vis_data_work(short output[FFT_OUTPUT_SIZE],
-			short input[FFT_BUFFER_SIZE])
+static inline void _vis_data_work(short *output, const short *input)
 {
-	unsigned int n, k, y;
-	unsigned int ex, ff;
-	float fr, fi;
-	float tr, ti;
-	float out;
-	int yp;
-
-	/* fft */
-	float *rp = state_real;
-	float *ip = state_imag;
-	for (n = 0; n < FFT_BUFFER_SIZE; n++) {
-		int nr = bit_reverse[n];
-		*rp++ = (float)input[ nr ] * inv_s_range * window[nr];
-		*ip++ = 0;
+	const unsigned int half = 1u << (fft_size_log - 1);
+	float *restrict re = state_real, *restrict im = state_imag;
+	float *restrict power = state_power;
+	unsigned int n, k, g, ex;
+
+	/* pack the even samples into the real part and the odd ones into the imaginary part */
+	for (n = 0; n < half; n++) {
+		unsigned int nr = bit_reverse[n] << 1;
+		re[n] = (float)input[nr] * window[nr];
+		im[n] = (float)input[nr + 1] * window[nr + 1];
 	}
-	ex = 1;
-	ff = FFT_OUTPUT_SIZE;
-	for (n = FFT_BUFFER_SIZE_LOG; n != 0; n--) {
-		for (k = 0; k != ex; k++) {
-			fr = precos[k * ff];
-			fi = presin[k * ff];
-			for (y = k; y < FFT_BUFFER_SIZE; y += ex << 1) {
-				yp = y + ex;
-				tr = fr * state_real[yp] - fi * state_imag[yp];
-				ti = fr * state_imag[yp] + fi * state_real[yp];
-				state_real[yp] = state_real[y] - tr;
-				state_imag[yp] = state_imag[y] - ti;
-				state_real[y] += tr;
-				state_imag[y] += ti;
+
+	/* fft; the first pass has no twiddles to speak of */
+	for (n = 0; n < half; n += 2) {
+		float tr = re[n + 1], ti = im[n + 1];
+		re[n + 1] = re[n] - tr;
+		im[n + 1] = im[n] - ti;
+		re[n] += tr;
+		im[n] += ti;
+	}
+	for (ex = 2; ex < half; ex <<= 1) {
+		const float *restrict wr = twiddle_re + ex, *restrict wi = twiddle_im + ex;
+		for (g = 0; g < half; g += ex << 1) {
+			float *restrict ar = re + g, *restrict ai = im + g;
+			float *restrict br = ar + ex, *restrict bi = ai + ex;
+			for (k = 0; k < ex; k++) {
+				float tr = wr[k] * br[k] - wi[k] * bi[k];
+				float ti = wr[k] * bi[k] + wi[k] * br[k];
+				br[k] = ar[k] - tr;
+				bi[k] = ai[k] - ti;
+				ar[k] += tr;
+				ai[k] += ti;
 			}
 		}
-		ex <<= 1;
-		ff >>= 1;
 	}
 
-	/* collect fft */
-	rp = state_real; rp++;
-	ip = state_imag; ip++;
-	const float fft_dbinv_bufsize = dB(fft_inv_bufsize);
-	for (n = 0; n < FFT_OUTPUT_SIZE; n++) {
-		/* "out" is the total power for each band.
-		* To get amplitude from "output", use sqrt(out[N])/(sizeBuf>>2)
-		* To get dB from "output", use powerdB(out[N])+db(1/(sizeBuf>>2)).
-		* powerdB is = 10 * log10(in)
-		* dB is = 20 * log10(in)
-		*/
-		out = ((*rp) * (*rp)) + ((*ip) * (*ip));
+	/* separate the even and odd halves back out, into the power of each band:
+	X[k] = (Z[k] + Z*[N/2-k]) / 2 - i W^k (Z[k] - Z*[N/2-k]) / 2 */
+	for (k = 1; k < half; k++) {
+		float zr = re[k], zi = im[k];
+		float cr = re[half - k], ci = -im[half - k];
+		float er = zr + cr, ei = zi + ci;     /* 2 * even */
+		float dr = zr - cr, di = zi - ci;     /* 2i * odd */
+		float odr = di, odi = -dr;            /* 2 * odd */
+		float xr = er + (split_re[k] * odr - split_im[k] * odi);
+		float xi = ei + (split_re[k] * odi + split_im[k] * odr);
+		power[k - 1] = 0.25f * (xr * xr + xi * xi);
+	}
+	/* nyquist */
+	power[half - 1] = (re[0] - im[0]) * (re[0] - im[0]);
+
+	/* collect fft
+	 * "power" is the total power for each band.
+	 * To get amplitude from "power", use sqrt(power[N])/(sizeBuf>>2)
+	 * To get dB from "power", use powerdB(power[N])+db(1/(sizeBuf>>2)).
+	 * powerdB is = 10 * log10(in)
+	 * dB is = 20 * log10(in)
+	 * and it gets scaled so that -noisefloor..0dB comes out as 0..128.
+	 */
+	const float scale = 128.0f / noisefloor;
+	const float db_log2 = 10.0f * 0.30102999566f * scale; /* 10 * log10(2) */
+	const float offset = 128.0f + (float)dB(1.0 / (1u << (fft_size_log - 2))) * scale;
+	for (n = 0; n < half; n++) {
 		/* +0.0000000001f is -100dB of power. Used to prevent evaluating powerdB(0.0) */
-		output[n] = pdB_s(noisefloor, out+0.0000000001f,fft_dbinv_bufsize);
-		rp++;ip++;
+		float v = offset + db_log2 * _fast_log2(power[n] + 0.0000000001f);
+		output[n] = (short)CLAMP(v, 0.0f, 127.0f);
 	}
 }
 /* convert the fft bands to columns of screen
 out and d have a range of 0 to 128 */
 static inline void _get_columns_from_fft(unsigned char *out,
-				short d[FFT_OUTPUT_SIZE], int m)
+				short *d, int m)
 {
 	int i, j, a;
 	for (i = 0, a=0; i < FFT_BANDS_SIZE; i++)  {
@@ -256,12 +381,29 @@ static inline void _drawslice(int x, int h, int c)
 		x, (NATIVE_SCREEN_HEIGHT-y),
 		x, (NATIVE_SCREEN_HEIGHT-1), c);
 }
-static void _vis_process(void)
+/* work out one row of the waterfall from a spectrum */
+static void _waterfall_columns(unsigned char outfft[NATIVE_SCREEN_WIDTH], short fft[2][FFT_OUTPUT_SIZE_MAX])
+{
+	short d[FFT_OUTPUT_SIZE_MAX];
+	int i, k = NATIVE_SCREEN_WIDTH/2;
+
+	if (mono) {
+		for (i = 0; i < (1 << (fft_size_log - 1)); i++)
+			d[i] = (fft[0][i] + fft[1][i]) / 2;
+		_get_columns_from_fft(outfft, d, 1);
+	} else {
+		_get_columns_from_fft(outfft, fft[0], 0);
+		_get_columns_from_fft(outfft+k, fft[1], 0);
+	}
+}
+
+/* scroll the waterfall up and draw a new row at the bottom; the scope is only drawn if 'scope' is set,
+since it gets completely redrawn for each row anyway */
+static void _waterfall_draw_row(unsigned char outfft[NATIVE_SCREEN_WIDTH], int scope)
 {
 	unsigned char *q;
 	int i, k;
 	k = NATIVE_SCREEN_WIDTH/2;
-	unsigned char outfft[NATIVE_SCREEN_WIDTH];
 
 	/* move up by one pixel */
 	memmove(ovl.q, ovl.q+NATIVE_SCREEN_WIDTH,
@@ -271,18 +413,15 @@ static void _vis_process(void)
 			((NATIVE_SCREEN_HEIGHT-1)-SCOPE_ROWS));
 
 	if (mono) {
-		for (i = 0; i < FFT_OUTPUT_SIZE; i++)
-			current_fft_data[0][i] = (current_fft_data[0][i]
-					+ current_fft_data[1][i]) / 2;
-		_get_columns_from_fft(outfft, current_fft_data[0], 1);
 		_dobits(q, outfft, NATIVE_SCREEN_WIDTH, 1);
 	} else {
-		_get_columns_from_fft(outfft, current_fft_data[0], 0);
 		_dobits(q+k, outfft, k, -1);
-		_get_columns_from_fft(outfft+k, current_fft_data[1], 0);
 		_dobits(q+k, outfft+k, k, 1);
 	}
 
+	if (!scope)
+		return;
+
 	/* draw the scope at the bottom */
 	q = ovl.q + (NATIVE_SCREEN_WIDTH*(NATIVE_SCREEN_HEIGHT-SCOPE_ROWS));
 	i = SCOPE_ROWS*NATIVE_SCREEN_WIDTH;
@@ -299,95 +438,169 @@ static void _vis_process(void)
 			_drawslice(k+i, outfft[k+i],5);
 		}
 	}
+}
+
+static int _vis_thread(UNUSED void *data)
+{
+	static short dl[FFT_BUFFER_SIZE_MAX];
+	static short dr[FFT_BUFFER_SIZE_MAX];
+	static short fft[2][FFT_OUTPUT_SIZE_MAX];
+	unsigned int next = 0; /* ring position where the next window ends */
+	unsigned int end, pos;
+	int size_log, overlap, size, head, i;
+
+	for (;;) {
+		SDL_SemWait(vis_wake);
+		/* any more wakeups that piled up are covered by this one */
+		while (SDL_SemTryWait(vis_wake) == 0);
+
+		size_log = SDL_AtomicGet(&vis_want_size_log);
+		overlap = SDL_AtomicGet(&vis_want_overlap);
+		if (size_log != fft_size_log || overlap != fft_overlap)
+			_vis_setup(size_log, overlap);
+		size = 1 << fft_size_log;
+
+		if (SDL_AtomicSet(&vis_reset, 0)) {
+			memset(fft, 0, sizeof(fft));
+			SDL_AtomicLock(&current_fft_lock);
+			memset(current_fft_data, 0, sizeof(current_fft_data));
+			SDL_AtomicUnlock(&current_fft_lock);
+			continue;
+		}
+
+		/* if the audio got so far ahead that it's overwriting what hasn't been looked at yet,
+		there's no point doing the windows in between */
+		end = SDL_AtomicGet(&vis_ring_pos);
+		if ((int)(end - next) > VIS_RING_SIZE - size)
+			next = end;
+
+		for (; (int)(end - next) >= 0; next += fft_hop) {
+			pos = next - size;
+			for (i = 0; i < size; i++) {
+				dl[i] = vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][0];
+				dr[i] = vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][1];
+			}
+			_vis_data_work(fft[0], dl);
+			if (SDL_AtomicGet(&vis_ring_mono))
+				memcpy(fft[1], fft[0], sizeof(fft[0]));
+			else
+				_vis_data_work(fft[1], dr);
+
+			if (status.current_page == PAGE_WATERFALL) {
+				head = SDL_AtomicGet(&waterfall_queue_head);
+				/* if the UI isn't keeping up, just drop the row */
+				if (head - SDL_AtomicGet(&waterfall_queue_tail) < WATERFALL_QUEUE_SIZE) {
+					_waterfall_columns(waterfall_queue[head & (WATERFALL_QUEUE_SIZE - 1)], fft);
+					SDL_AtomicSet(&waterfall_queue_head, head + 1);
+				}
+				status.flags |= NEED_UPDATE;
+			}
+		}
+
+		SDL_AtomicLock(&current_fft_lock);
+		memcpy(current_fft_data, fft, sizeof(fft));
+		SDL_AtomicUnlock(&current_fft_lock);
+	}
 
-	status.flags |= NEED_UPDATE;
+	return 0; /* never happens */
+}
+
+void vis_get_fft_data(short data[2][FFT_OUTPUT_SIZE_MAX], short bands[FFT_BANDS_SIZE])
+{
+	SDL_AtomicLock(&current_fft_lock);
+	memcpy(data, current_fft_data, sizeof(current_fft_data));
+	memcpy(bands, fftlog, sizeof(fftlog));
+	SDL_AtomicUnlock(&current_fft_lock);
+}
+
+/* these are called from the audio callback, so they must not do anything slow */
+static void _vis_push_done(int frames, int is_mono)
+{
+	SDL_AtomicSet(&vis_ring_mono, is_mono);
+	SDL_AtomicAdd(&vis_ring_pos, frames);
+	if (vis_wake)
+		SDL_SemPost(vis_wake);
+}
+
+static void _vis_push_reset(void)
+{
+	SDL_AtomicSet(&vis_reset, 1);
+	if (vis_wake)
+		SDL_SemPost(vis_wake);
 }
 
 void vis_work_16s(short *in, int inlen)
 {
-	short dl[FFT_BUFFER_SIZE];
-	short dr[FFT_BUFFER_SIZE];
-	int i, j, k;
+	int pos = SDL_AtomicGet(&vis_ring_pos);
+	int i;
 
 	if (!inlen) {
-		memset(current_fft_data[0], 0, FFT_OUTPUT_SIZE*2);
-		memset(current_fft_data[1], 0, FFT_OUTPUT_SIZE*2);
-	} else {
-		for (i = 0; i < FFT_BUFFER_SIZE;) {
-			for (k = j = 0; k < inlen && i < FFT_BUFFER_SIZE; k++, i++) {
-				dl[i] = in[j]; j++;
-				dr[i] = in[j]; j++;
-			}
-		}
-		_vis_data_work(current_fft_data[0], dl);
-		_vis_data_work(current_fft_data[1], dr);
+		_vis_push_reset();
+		return;
+	}
+	for (i = 0; i < inlen; i++, in += 2) {
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][0] = in[0];
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][1] = in[1];
 	}
-	if (status.current_page == PAGE_WATERFALL) _vis_process();
+	_vis_push_done(inlen, 0);
 }
 void vis_work_16m(short *in, int inlen)
 {
-	short d[FFT_BUFFER_SIZE];
-	int i, k;
+	int pos = SDL_AtomicGet(&vis_ring_pos);
+	int i;
 
 	if (!inlen) {
-		memset(current_fft_data[0], 0, FFT_OUTPUT_SIZE*2);
-		memset(current_fft_data[1], 0, FFT_OUTPUT_SIZE*2);
-	} else {
-		for (i = 0; i < FFT_BUFFER_SIZE;) {
-			for (k = 0; k < inlen && i < FFT_BUFFER_SIZE; k++, i++) {
-				d[i] = in[k];
-			}
-		}
-		_vis_data_work(current_fft_data[0], d);
-		memcpy(current_fft_data[1], current_fft_data[0], FFT_OUTPUT_SIZE * 2);
+		_vis_push_reset();
+		return;
+	}
+	for (i = 0; i < inlen; i++) {
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][0] = in[i];
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][1] = in[i];
 	}
-	if (status.current_page == PAGE_WATERFALL) _vis_process();
+	_vis_push_done(inlen, 1);
 }
 
 void vis_work_8s(char *in, int inlen)
 {
-	short dl[FFT_BUFFER_SIZE];
-	short dr[FFT_BUFFER_SIZE];
-	int i, j, k;
+	int pos = SDL_AtomicGet(&vis_ring_pos);
+	int i;
 
 	if (!inlen) {
-		memset(current_fft_data[0], 0, FFT_OUTPUT_SIZE*2);
-		memset(current_fft_data[1], 0, FFT_OUTPUT_SIZE*2);
-	} else {
-		for (i = 0; i < FFT_BUFFER_SIZE;) {
-			for (k = j = 0; k < inlen && i < FFT_BUFFER_SIZE; k++, i++) {
-				dl[i] = ((short)in[j]) * 256; j++;
-				dr[i] = ((short)in[j]) * 256; j++;
-			}
-		}
-		_vis_data_work(current_fft_data[0], dl);
-		_vis_data_work(current_fft_data[1], dr);
+		_vis_push_reset();
+		return;
+	}
+	for (i = 0; i < inlen; i++, in += 2) {
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][0] = ((short)in[0]) * 256;
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][1] = ((short)in[1]) * 256;
 	}
-	if (status.current_page == PAGE_WATERFALL) _vis_process();
+	_vis_push_done(inlen, 0);
 }
 void vis_work_8m(char *in, int inlen)
 {
-	short d[FFT_BUFFER_SIZE];
-	int i, k;
+	int pos = SDL_AtomicGet(&vis_ring_pos);
+	int i;
 
 	if (!inlen) {
-		memset(current_fft_data[0], 0, FFT_OUTPUT_SIZE*2);
-		memset(current_fft_data[1], 0, FFT_OUTPUT_SIZE*2);
-	} else {
-		for (i = 0; i < FFT_BUFFER_SIZE;) {
-			for (k = 0; k < inlen && i < FFT_BUFFER_SIZE; k++, i++) {
-				d[i] = ((short)in[k]) * 256;
-			}
-		}
-		_vis_data_work(current_fft_data[0], d);
-		memcpy(current_fft_data[1],
-				 current_fft_data[0], FFT_OUTPUT_SIZE * 2);
+		_vis_push_reset();
+		return;
+	}
+	for (i = 0; i < inlen; i++) {
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][0] = ((short)in[i]) * 256;
+		vis_ring[(pos + i) & (VIS_RING_SIZE - 1)][1] = ((short)in[i]) * 256;
 	}
-	if (status.current_page == PAGE_WATERFALL) _vis_process();
+	_vis_push_done(inlen, 1);
 }
 
 static void draw_screen(void)
 {
+	int head = SDL_AtomicGet(&waterfall_queue_head);
+	int tail = SDL_AtomicGet(&waterfall_queue_tail);
+
+	/* catch up on whatever the analysis thread has come up with since the last redraw */
+	for (; tail != head; tail++)
+		_waterfall_draw_row(waterfall_queue[tail & (WATERFALL_QUEUE_SIZE - 1)], tail + 1 == head);
+	SDL_AtomicSet(&waterfall_queue_tail, tail);
+
 	/* waterfall uses a single overlay */
 	vgamem_ovl_apply(&ovl);
 }
@@ -551,6 +764,8 @@ static void do_nil(void) {}
 static void waterfall_set_page(void)
 {
 	vgamem_ovl_clear(&ovl, 0);
+	/* anything still queued is from the last time the page was up */
+	SDL_AtomicSet(&waterfall_queue_tail, SDL_AtomicGet(&waterfall_queue_head));
 }
 void waterfall_load_page(struct page *page)
 {
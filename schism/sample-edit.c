@@ -91,6 +91,7 @@ static void _sign_convert_16(signed short *data, unsigned long length)
 void sample_sign_convert(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_sign_convert_16((signed short *) sample->data,
@@ -149,6 +150,7 @@ void sample_reverse(song_sample_t * sample)
 	unsigned long tmp;
 
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 
 	if (sample->flags & CHN_STEREO) {
@@ -295,6 +297,7 @@ static void _centralise_16(signed short *data, unsigned long length)
 void sample_centralise(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_centralise_16((signed short *) sample->data,
@@ -326,6 +329,7 @@ void sample_downmix(song_sample_t *sample)
 	if (!(sample->flags & CHN_STEREO))
 		return; /* what are we doing here with a mono sample? */
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_downmix_16((signed short *) sample->data, sample->length);
@@ -365,6 +369,7 @@ static void _amplify_16(signed short *data, unsigned long length, int percent)
 void sample_amplify(song_sample_t * sample, int percent)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_amplify_16((signed short *) sample->data,
@@ -435,6 +440,7 @@ static void _delta_decode_16(signed short *data, unsigned long length)
 void sample_delta_decode(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_delta_decode_16((signed short *) sample->data,
@@ -583,6 +589,7 @@ void sample_resize(song_sample_t * sample, unsigned long newlen, int aa)
 void sample_invert(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_16BIT)
 		_invert_16((signed short *) sample->data,
@@ -609,6 +616,7 @@ static void _mono_lr8(signed char *data, unsigned long length, int shift)
 void sample_mono_left(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_STEREO) {
 		if (sample->flags & CHN_16BIT)
@@ -622,6 +630,7 @@ void sample_mono_left(song_sample_t * sample)
 void sample_mono_right(song_sample_t * sample)
 {
 	song_lock_audio();
+	csf_unshare_sample(current_song, sample);
 	status.flags |= SONG_NEEDS_SAVE;
 	if (sample->flags & CHN_STEREO) {
 		if (sample->flags & CHN_16BIT)
@@ -74,8 +74,7 @@ static int _slurp_stdio_pipe(slurp_t * t, int fd)
 	int old_errno;
 	FILE *fp;
 	uint8_t *read_buf, *realloc_buf;
-	size_t this_len;
-	int chunks = 0;
+	size_t this_len, alloc = 0;
 
 	t->data = NULL;
 	fp = fdopen(dup(fd), "rb");
@@ -83,18 +82,20 @@ static int _slurp_stdio_pipe(slurp_t * t, int fd)
 		return 0;
 
 	do {
-		chunks++;
-		/* Have to cast away the const... */
-		realloc_buf = realloc((void *) t->data, CHUNK * chunks);
-		if (realloc_buf == NULL) {
-			old_errno = errno;
-			fclose(fp);
-			free(t->data);
-			errno = old_errno;
-			return 0;
+		/* double the buffer whenever it fills up, so this doesn't keep copying the whole thing around */
+		if (t->length + CHUNK > alloc) {
+			alloc = MAX(2 * alloc, CHUNK);
+			realloc_buf = realloc(t->data, alloc);
+			if (realloc_buf == NULL) {
+				old_errno = errno;
+				fclose(fp);
+				free(t->data);
+				errno = old_errno;
+				return 0;
+			}
+			t->data = realloc_buf;
 		}
-		t->data = realloc_buf;
-		read_buf = (void *) (t->data + (CHUNK * (chunks - 1)));
+		read_buf = t->data + t->length;
 		this_len = fread(read_buf, 1, CHUNK, fp);
 		if (this_len <= 0) {
 			if (ferror(fp)) {
@@ -179,16 +180,22 @@ static slurp_t *_slurp_open(const char *filename, struct stat * buf, size_t size
 		return NULL;
 	}
 
-	t = (slurp_t *) mem_alloc(sizeof(slurp_t));
+	t = (slurp_t *) mem_calloc(1, sizeof(slurp_t));
 	if (t == NULL)
 		return NULL;
 	t->pos = 0;
 
 	if (strcmp(filename, "-") == 0) {
-		if (_slurp_stdio(t, STDIN_FILENO))
-			return t;
+		/* there's no telling how much is coming, so let the stream code collect it */
 		free(t);
-		return NULL;
+		t = slurp_stream(filename, buf, 0);
+		if (t && !slurp_unstream(t)) {
+			old_errno = errno;
+			unslurp(t);
+			errno = old_errno;
+			return NULL;
+		}
+		return t;
 	}
 
 	if (size <= 0) {
@@ -258,6 +265,280 @@ slurp_t *slurp(const char *filename, struct stat * buf, size_t size)
 	return t;
 }
 
+/* read up to 'len' bytes, storing how many there really were in '*got' (the file might have gotten shorter
+since it was stat'ed). returns zero on error */
+static int _slurp_read_range(FILE *fp, uint8_t *data, size_t len, size_t *got)
+{
+	size_t this_len;
+
+	*got = 0;
+	while (*got < len) {
+		this_len = fread(data + *got, 1, len - *got, fp);
+		if (this_len == 0)
+			return !ferror(fp);
+		*got += this_len;
+	}
+	return 1;
+}
+
+slurp_t *slurp_head(const char *filename, struct stat *buf, size_t head, size_t tail)
+{
+	slurp_t *t;
+	FILE *fp;
+	size_t size;
+	int old_errno;
+	uint8_t *mmdata;
+	size_t mmlen;
+	size_t got_head, got_tail = 0;
+
+	if (buf && S_ISDIR(buf->st_mode)) {
+		errno = EISDIR;
+		return NULL;
+	}
+
+	size = (buf ? buf->st_size : file_size(filename));
+	if (strcmp(filename, "-") == 0 || size == 0 || head + tail >= size) {
+		/* nothing to gain here */
+		return slurp(filename, buf, 0);
+	}
+	if (tail && size - tail > LONG_MAX) {
+		/* can't fseek to the tail (long is 32 bits on some systems) */
+		return slurp(filename, buf, 0);
+	}
+
+	fp = os_fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	t = (slurp_t *) mem_calloc(1, sizeof(slurp_t));
+	t->pos = 0;
+	t->length = head + tail;
+	t->data = malloc(t->length);
+	if (t->data == NULL
+	    || !_slurp_read_range(fp, t->data, head, &got_head)
+	    || (tail && got_head == head
+		&& (fseek(fp, (long) (size - tail), SEEK_SET) != 0
+		    || !_slurp_read_range(fp, t->data + head, tail, &got_tail)))) {
+		old_errno = errno;
+		fclose(fp);
+		free(t->data);
+		free(t);
+		errno = old_errno;
+		return NULL;
+	}
+	fclose(fp);
+	t->closure = _slurp_closure_free;
+	/* don't leave anything uninitialized hanging off the end if it came up short */
+	t->length = got_head + got_tail;
+
+	if (t->length >= 8 && memcmp(t->data, "ziRCONia", 8) == 0) {
+		/* Packed. The whole packed file has to be there for the block table to make any sense, but
+		there's no sense in unpacking every last sample just to read a title. */
+		unslurp(t);
+		t = _slurp_open(filename, buf, size);
+		if (!t)
+			return NULL;
+		mmdata = t->data;
+		mmlen = t->length;
+		if (mmcmp_unpack_head(&mmdata, &mmlen, head)) {
+			if (t->data && t->closure) {
+				t->closure(t);
+			}
+			t->length = mmlen;
+			t->data = mmdata;
+			t->closure = _slurp_closure_free;
+		}
+	}
+
+	return t;
+}
+
+/* --------------------------------------------------------------------- */
+/* streaming */
+
+/* how much of a streamed file is kept in memory, unless asked for otherwise */
+#define WINDOW (4 * CHUNK)
+
+struct slurp_window {
+	FILE *fp;
+	int seekable;
+	size_t offset; /* where in the file data[0] came from */
+	size_t avail; /* how much of data is filled in */
+	size_t size; /* how much of data is allocated */
+};
+
+static void _slurp_closure_window(slurp_t *t)
+{
+	fclose(t->window->fp);
+	free(t->window);
+	free(t->data);
+}
+
+/* get as much of [pos, pos + count) into the window as the file has, and return how much that was.
+if the file's end turns up along the way, this fills in the real length. */
+static size_t _slurp_window_fill(slurp_t *t, size_t pos, size_t count)
+{
+	struct slurp_window *w = t->window;
+	size_t want, got, end = w->offset + w->avail;
+	uint8_t *data;
+
+	if (pos >= t->length || !count)
+		return 0;
+	if (pos >= w->offset && pos - w->offset + count <= w->avail)
+		return count;
+
+	if (pos < w->offset || pos > end) {
+		/* nothing useful in the window; start over at pos */
+		if (w->seekable && pos <= LONG_MAX) {
+			if (fseek(w->fp, (long) pos, SEEK_SET) != 0)
+				return 0;
+		} else if (pos < w->offset) {
+			/* a pipe, or further in than fseek can go where long is 32 bits */
+			errno = ESPIPE;
+			return 0;
+		} else {
+			/* can't seek on a pipe (or that far into a file), so read through to it */
+			while (end < pos) {
+				got = fread(t->data, 1, MIN(w->size, pos - end), w->fp);
+				if (!got) {
+					t->length = end;
+					w->offset = end;
+					w->avail = 0;
+					return 0;
+				}
+				end += got;
+			}
+		}
+		w->offset = pos;
+		w->avail = 0;
+	} else if (pos > w->offset) {
+		/* keep whatever's already there */
+		memmove(t->data, t->data + (pos - w->offset), end - pos);
+		w->offset = pos;
+		w->avail = end - pos;
+	}
+
+	if (count > w->size) {
+		data = realloc(t->data, count);
+		if (!data)
+			return MIN(count, w->avail);
+		t->data = data;
+		w->size = count;
+	}
+
+	/* fill up the rest of the window while we're at it -- but fread won't come back until it has
+	everything that it was asked for, so don't sit around waiting on a pipe for more than is needed */
+	want = w->size - w->avail;
+	if (!w->seekable)
+		want = MIN(want, MAX(count - w->avail, CHUNK));
+	got = fread(t->data + w->avail, 1, want, w->fp);
+	w->avail += got;
+	if (got < want)
+		t->length = w->offset + w->avail;
+	return MIN(count, w->avail);
+}
+
+slurp_t *slurp_stream(const char *filename, struct stat *buf, size_t window)
+{
+	slurp_t *t;
+	FILE *fp;
+	int is_stdin = (strcmp(filename, "-") == 0);
+	int old_errno;
+	uint8_t magic[8];
+	uint8_t *mmdata;
+	size_t mmlen;
+
+	if (buf && S_ISDIR(buf->st_mode)) {
+		errno = EISDIR;
+		return NULL;
+	}
+
+	fp = is_stdin ? fdopen(dup(STDIN_FILENO), "rb") : os_fopen(filename, "rb");
+	if (fp == NULL)
+		return NULL;
+
+	t = (slurp_t *) mem_calloc(1, sizeof(slurp_t));
+	t->window = (struct slurp_window *) mem_calloc(1, sizeof(struct slurp_window));
+	t->window->fp = fp;
+	t->window->size = window ? window : WINDOW;
+	t->window->seekable = !is_stdin && fseek(fp, 0, SEEK_SET) == 0;
+	t->length = t->window->seekable ? (buf ? (size_t) buf->st_size : (size_t) file_size(filename)) : SIZE_MAX;
+	t->data = malloc(t->window->size);
+	if (t->data == NULL) {
+		old_errno = errno;
+		fclose(fp);
+		free(t->window);
+		free(t);
+		errno = old_errno;
+		return NULL;
+	}
+	t->closure = _slurp_closure_window;
+
+	if (slurp_peek(t, magic, 8) == 8 && memcmp(magic, "ziRCONia", 8) == 0) {
+		/* Packed. This needs the whole file at once, so read it all in after all and go from there. */
+		if (!slurp_unstream(t)) {
+			old_errno = errno;
+			unslurp(t);
+			errno = old_errno;
+			return NULL;
+		}
+		mmdata = t->data;
+		mmlen = t->length;
+		if (mmcmp_unpack(&mmdata, &mmlen)) {
+			free(t->data);
+			t->data = mmdata;
+			t->length = mmlen;
+		}
+	}
+
+	return t;
+}
+
+int slurp_unstream(slurp_t *t)
+{
+	struct slurp_window *w = t->window;
+	uint8_t *data = NULL, *realloc_buf;
+	size_t len = 0, alloc = 0, got;
+	int old_errno;
+
+	if (!w)
+		return 1;
+	if (!w->seekable && w->offset > 0) {
+		/* the start of it is already gone */
+		errno = ESPIPE;
+		return 0;
+	}
+
+	while ((got = _slurp_window_fill(t, len, w->size)) > 0) {
+		if (len + got > alloc) {
+			alloc = MAX(2 * alloc, len + got);
+			realloc_buf = realloc(data, alloc);
+			if (realloc_buf == NULL) {
+				old_errno = errno;
+				free(data);
+				errno = old_errno;
+				return 0;
+			}
+			data = realloc_buf;
+		}
+		memcpy(data + len, t->data + (len - w->offset), got);
+		len += got;
+	}
+	if (ferror(w->fp)) {
+		old_errno = errno ? errno : EIO;
+		free(data);
+		errno = old_errno;
+		return 0;
+	}
+
+	t->closure(t);
+	t->window = NULL;
+	t->data = data;
+	t->length = len;
+	t->pos = MIN(t->pos, len);
+	t->closure = _slurp_closure_free;
+	return 1;
+}
 
 void unslurp(slurp_t * t)
 {
@@ -281,11 +562,25 @@ int slurp_seek(slurp_t *t, long offset, int whence)
 		offset += t->pos;
 		break;
 	case SEEK_END:
+		if (t->window) {
+			/* no telling where the end of a pipe is without going there */
+			while (t->length == SIZE_MAX)
+				_slurp_window_fill(t, t->window->offset + t->window->avail, t->window->size);
+		}
 		offset += t->length;
 		break;
 	}
 	if (offset < 0 || (size_t) offset > t->length)
 		return -1;
+	if (t->window && !t->window->seekable) {
+		if ((size_t) offset < t->window->offset) {
+			errno = ESPIPE;
+			return -1;
+		}
+		if ((size_t) offset > t->window->offset + t->window->avail
+		    && !_slurp_window_fill(t, offset - 1, 1))
+			return -1;
+	}
 	t->pos = offset;
 	return 0;
 }
@@ -297,14 +592,41 @@ long slurp_tell(slurp_t *t)
 
 size_t slurp_read(slurp_t *t, void *ptr, size_t count)
 {
-	count = slurp_peek(t, ptr, count);
-	t->pos += count;
-	return count;
+	size_t got, total = 0;
+
+	if (!t->window) {
+		count = slurp_peek(t, ptr, count);
+		t->pos += count;
+		return count;
+	}
+
+	/* a window at a time, so that reading something big doesn't mean holding all of it twice */
+	while (total < count) {
+		got = slurp_peek(t, (uint8_t *) ptr + total, MIN(count - total, t->window->size));
+		t->pos += got;
+		total += got;
+		if (!got)
+			break;
+	}
+	if (total < count)
+		memset((uint8_t *) ptr + total, 0, count - total);
+	return total;
 }
 
 size_t slurp_peek(slurp_t *t, void *ptr, size_t count)
 {
-	size_t bytesleft = t->length - t->pos;
+	size_t bytesleft;
+
+	if (t->window) {
+		bytesleft = _slurp_window_fill(t, t->pos, count);
+		if (bytesleft)
+			memcpy(ptr, t->data + (t->pos - t->window->offset), bytesleft);
+		if (bytesleft < count)
+			memset((uint8_t *) ptr + bytesleft, 0, count - bytesleft);
+		return bytesleft;
+	}
+
+	bytesleft = t->length - t->pos;
 	if (count > bytesleft) {
 		// short read -- fill in any extra bytes with zeroes
 		size_t tail = count - bytesleft;
@@ -318,11 +640,18 @@ size_t slurp_peek(slurp_t *t, void *ptr, size_t count)
 
 int slurp_getc(slurp_t *t)
 {
+	if (t->window) {
+		if (!_slurp_window_fill(t, t->pos, 1))
+			return EOF;
+		return t->data[t->pos++ - t->window->offset];
+	}
 	return (t->pos < t->length) ? t->data[t->pos++] : EOF;
 }
 
 int slurp_eof(slurp_t *t)
 {
+	if (t->window)
+		return !_slurp_window_fill(t, t->pos, 1);
 	return t->pos >= t->length;
 }
 
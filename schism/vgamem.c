@@ -53,10 +53,11 @@ struct vgamem_colors {
 /* contains all the needed information to draw many
  * types of characters onto the screen. historically,
  * all of this information was stored in a single 32-bit
- * unsigned integer */
+ * unsigned integer; this is kept down to 8 bytes so that
+ * a whole row of them is only ten cache lines */
 struct vgamem_char {
-	/* which font method to use */
-	enum vgamem_font font;
+	/* which font method to use (an enum vgamem_font) */
+	uint8_t font;
 
 	union {
 		struct {
@@ -78,7 +79,7 @@ struct vgamem_char {
 			/* can be any Unicode codepoint; realistically
 			 * only a very small subset of characters can be
 			 * supported though */
-			uint_least32_t c : 32;
+			uint_least32_t c : 24;
 
 			struct vgamem_colors colors;
 		} unicode;
@@ -89,6 +90,14 @@ static struct vgamem_char vgamem[4000] = {0};
 static struct vgamem_char vgamem_read[4000] = {0};
 
 static uint8_t ovl[640*400] = {0}; /* 256K */
+/* what the overlay looked like at the last flip; this is what actually gets drawn */
+static uint8_t ovl_read[640*400] = {0};
+
+/* character rows that have changed since the last call to vgamem_dirty_rows */
+static uint8_t vgamem_dirty[50] = {0};
+/* the fonts as of the last flip; if the font editor changes them, every row has to be redrawn */
+static uint8_t font_read[2048] = {0};
+static uint8_t font_half_read[1024] = {0};
 
 #define CHECK_INVERT(tl,br,n) \
 do {                                            \
@@ -101,7 +110,41 @@ do {                                            \
 
 void vgamem_flip(void)
 {
-	memcpy(vgamem_read, vgamem, sizeof(vgamem));
+	unsigned int x, y;
+
+	if (memcmp(font_read, font_data, sizeof(font_read)) != 0
+	    || memcmp(font_half_read, font_half_data, sizeof(font_half_read)) != 0) {
+		memcpy(font_read, font_data, sizeof(font_read));
+		memcpy(font_half_read, font_half_data, sizeof(font_half_read));
+		memset(vgamem_dirty, 1, sizeof(vgamem_dirty));
+	}
+
+	for (y = 0; y < 50; y++) {
+		struct vgamem_char *row = vgamem + (y * 80), *read_row = vgamem_read + (y * 80);
+
+		if (memcmp(row, read_row, 80 * sizeof(*row)) != 0) {
+			memcpy(read_row, row, 80 * sizeof(*row));
+			vgamem_dirty[y] = 1;
+		}
+
+		/* the overlay gets scribbled on directly (see the waterfall), so the only way to tell if it's
+		changed is to look. only bother for the rows where it's actually showing, though. */
+		for (x = 0; x < 80 && row[x].font != VGAMEM_FONT_OVERLAY; x++);
+		if (x < 80 && memcmp(ovl + (y * 5120), ovl_read + (y * 5120), 5120) != 0) {
+			memcpy(ovl_read + (y * 5120), ovl + (y * 5120), 5120);
+			vgamem_dirty[y] = 1;
+		}
+	}
+}
+
+int vgamem_dirty_rows(uint8_t rows[50])
+{
+	int n, count = 0;
+
+	for (n = 0; n < 50; n++)
+		count += (rows[n] = vgamem_dirty[n]);
+	memset(vgamem_dirty, 0, sizeof(vgamem_dirty));
+	return count;
 }
 
 void vgamem_clear(void)
@@ -245,6 +288,38 @@ void vgamem_ovl_drawline(struct vgamem_overlay *n, int xs,
 	}
 }
 
+/* bit-to-mask tables for glyph expansion: row n is the eight pixels of the font byte n, MSB first, each
+ * one either all ones (foreground) or all zeroes (background). a pixel is then just bg ^ ((fg ^ bg) & mask),
+ * which has no branches in it and which the compiler can happily vectorize. */
+#define VGAMEM_MASK_BIT(n, b) (((n) & (b)) ? UINT32_C(0xFFFFFFFF) : UINT32_C(0))
+#define VGAMEM_MASK_ROW(n) { \
+	VGAMEM_MASK_BIT(n, 0x80), VGAMEM_MASK_BIT(n, 0x40), VGAMEM_MASK_BIT(n, 0x20), VGAMEM_MASK_BIT(n, 0x10), \
+	VGAMEM_MASK_BIT(n, 0x08), VGAMEM_MASK_BIT(n, 0x04), VGAMEM_MASK_BIT(n, 0x02), VGAMEM_MASK_BIT(n, 0x01) }
+#define VGAMEM_MASK_ROWS4(n) VGAMEM_MASK_ROW(n), VGAMEM_MASK_ROW((n) + 1), VGAMEM_MASK_ROW((n) + 2), VGAMEM_MASK_ROW((n) + 3)
+#define VGAMEM_MASK_ROWS16(n) VGAMEM_MASK_ROWS4(n), VGAMEM_MASK_ROWS4((n) + 4), VGAMEM_MASK_ROWS4((n) + 8), VGAMEM_MASK_ROWS4((n) + 12)
+#define VGAMEM_MASK_ROWS64(n) VGAMEM_MASK_ROWS16(n), VGAMEM_MASK_ROWS16((n) + 16), VGAMEM_MASK_ROWS16((n) + 32), VGAMEM_MASK_ROWS16((n) + 48)
+
+static const uint32_t vgamem_mask[256][8] = {
+	VGAMEM_MASK_ROWS64(0), VGAMEM_MASK_ROWS64(64), VGAMEM_MASK_ROWS64(128), VGAMEM_MASK_ROWS64(192)
+};
+
+#undef VGAMEM_MASK_ROWS64
+#undef VGAMEM_MASK_ROWS16
+#undef VGAMEM_MASK_ROWS4
+#undef VGAMEM_MASK_ROW
+#undef VGAMEM_MASK_BIT
+
+/* writes 'n' pixels of one glyph row (n is 8, or 4 for the half-width font) */
+#define VGAMEM_EXPAND(BITS, out, dg, n, fgc, bgc) \
+	do { \
+		const uint32_t *m_ = vgamem_mask[(dg) & 0xFF]; \
+		uint32_t b_ = (bgc), d_ = (fgc) ^ b_; \
+		int i_; \
+		for (i_ = 0; i_ < (n); i_++) \
+			(out)[i_] = (uint##BITS##_t)(b_ ^ (d_ & m_[i_])); \
+		(out) += (n); \
+	} while (0)
+
 /* generic scanner; BITS must be one of 8, 16, 32, 64 */
 #define VGAMEM_SCANNER_VARIANT(BITS) \
 	void vgamem_scan##BITS(uint32_t ry, uint##BITS##_t *out, uint32_t tc[16], uint32_t mouseline[80], uint32_t mouseline_mask[80]) \
@@ -256,7 +331,7 @@ void vgamem_ovl_drawline(struct vgamem_overlay *n, int xs,
 		uint32_t x, y; \
 		int fg, bg; \
 	\
-		q = ovl + (ry * 640); \
+		q = ovl_read + (ry * 640); \
 		y = ry >> 3; \
 		bp = &vgamem_read[y * 80]; \
 		itf = font_data + (ry & 7); \
@@ -270,57 +345,33 @@ void vgamem_ovl_drawline(struct vgamem_overlay *n, int xs,
 		for (x = 0; x < 80; x++, bp++, q += 8) { \
 			switch (bp->font) { \
 			case VGAMEM_FONT_ITF: \
+				dg = itf[bp->character.itf.c << 3]; \
+				fg = bp->character.itf.colors.fg; \
+				bg = bp->character.itf.colors.bg; \
+				break; \
 			case VGAMEM_FONT_BIOS: \
-				/* regular character */ \
+				dg = (bp->character.cp437.c & 0x80) \
+					? bios[(bp->character.cp437.c & 0x7F) << 3] \
+					: bioslow[(bp->character.cp437.c & 0x7F) << 3]; \
 				fg = bp->character.cp437.colors.fg; \
 				bg = bp->character.cp437.colors.bg; \
-				if (bp->font == VGAMEM_FONT_BIOS) { \
-					dg = (bp->character.cp437.c & 0x80) \
-						? bios[(bp->character.cp437.c & 0x7F) << 3] \
-						: bioslow[(bp->character.cp437.c & 0x7F) << 3]; \
-				} else { \
-					dg = itf[bp->character.itf.c << 3]; \
-				} \
-				dg |= mouseline[x]; \
-				dg &= ~(mouseline_mask[x] ^ mouseline[x]); \
-			\
-				*out++ = tc[(dg & 0x80) ? fg : bg]; \
-				*out++ = tc[(dg & 0x40) ? fg : bg]; \
-				*out++ = tc[(dg & 0x20) ? fg : bg]; \
-				*out++ = tc[(dg & 0x10) ? fg : bg]; \
-				*out++ = tc[(dg & 0x8) ? fg : bg]; \
-				*out++ = tc[(dg & 0x4) ? fg : bg]; \
-				*out++ = tc[(dg & 0x2) ? fg : bg]; \
-				*out++ = tc[(dg & 0x1) ? fg : bg]; \
 				break; \
 			case VGAMEM_FONT_HALFWIDTH: \
 				dg = hf[bp->character.halfwidth.c1.c << 2]; \
 				if (!(ry & 1)) \
 					dg = (dg >> 4); \
 				dg |= mouseline[x] >> 4; \
-			\
-				fg = bp->character.halfwidth.c1.colors.fg; \
-				bg = bp->character.halfwidth.c1.colors.bg; \
-			\
-				*out++ = tc[(dg & 0x8) ? fg : bg]; \
-				*out++ = tc[(dg & 0x4) ? fg : bg]; \
-				*out++ = tc[(dg & 0x2) ? fg : bg]; \
-				*out++ = tc[(dg & 0x1) ? fg : bg]; \
+				VGAMEM_EXPAND(BITS, out, (dg & 0xF) << 4, 4, \
+					tc[bp->character.halfwidth.c1.colors.fg], tc[bp->character.halfwidth.c1.colors.bg]); \
 			\
 				dg = hf[bp->character.halfwidth.c2.c << 2]; \
 				if (!(ry & 1)) \
 					dg = (dg >> 4); \
 				dg |= mouseline[x] >> 4; \
 				dg &= ~(mouseline_mask[x] ^ mouseline[x]) >> 4; \
-			\
-				fg = bp->character.halfwidth.c2.colors.fg; \
-				bg = bp->character.halfwidth.c2.colors.bg; \
-			\
-				*out++ = tc[(dg & 0x8) ? fg : bg]; \
-				*out++ = tc[(dg & 0x4) ? fg : bg]; \
-				*out++ = tc[(dg & 0x2) ? fg : bg]; \
-				*out++ = tc[(dg & 0x1) ? fg : bg]; \
-				break; \
+				VGAMEM_EXPAND(BITS, out, (dg & 0xF) << 4, 4, \
+					tc[bp->character.halfwidth.c2.colors.fg], tc[bp->character.halfwidth.c2.colors.bg]); \
+				continue; \
 			case VGAMEM_FONT_OVERLAY: \
 				*out++ = tc[ (q[0]|((mouseline[x] & 0x80)?15:0)) & 255]; \
 				*out++ = tc[ (q[1]|((mouseline[x] & 0x40)?15:0)) & 255]; \
@@ -330,7 +381,7 @@ void vgamem_ovl_drawline(struct vgamem_overlay *n, int xs,
 				*out++ = tc[ (q[5]|((mouseline[x] & 0x04)?15:0)) & 255]; \
 				*out++ = tc[ (q[6]|((mouseline[x] & 0x02)?15:0)) & 255]; \
 				*out++ = tc[ (q[7]|((mouseline[x] & 0x01)?15:0)) & 255]; \
-				break; \
+				continue; \
 			case VGAMEM_FONT_UNICODE: { \
 				uint32_t c = bp->character.unicode.c; \
 				if (c >= 0x20 && c <= 0x7F) { \
@@ -348,37 +399,31 @@ void vgamem_ovl_drawline(struct vgamem_overlay *n, int xs,
 				} else { \
 					dg = itf[63u << 3]; \
 				}\
-	\
 				fg = bp->character.unicode.colors.fg; \
 				bg = bp->character.unicode.colors.bg; \
-	\
-				dg |= mouseline[x]; \
-				dg &= ~(mouseline_mask[x] ^ mouseline[x]); \
-	\
-	\
-				*out++ = tc[(dg & 0x80) ? fg : bg]; \
-				*out++ = tc[(dg & 0x40) ? fg : bg]; \
-				*out++ = tc[(dg & 0x20) ? fg : bg]; \
-				*out++ = tc[(dg & 0x10) ? fg : bg]; \
-				*out++ = tc[(dg & 0x8) ? fg : bg]; \
-				*out++ = tc[(dg & 0x4) ? fg : bg]; \
-				*out++ = tc[(dg & 0x2) ? fg : bg]; \
-				*out++ = tc[(dg & 0x1) ? fg : bg]; \
-	\
-				break; /* unused chars */ \
+				break; \
 			} \
+			default: \
+				continue; /* unused chars */ \
 			} \
+	\
+			/* everything that gets here is a full-width 8x8 glyph */ \
+			dg |= mouseline[x]; \
+			dg &= ~(mouseline_mask[x] ^ mouseline[x]); \
+			VGAMEM_EXPAND(BITS, out, dg, 8, tc[fg], tc[bg]); \
 		} \
 	}
 
-/* write the vgamem routines; currently we only ever use 32-bits per pixel. */
 VGAMEM_SCANNER_VARIANT(32)
 
-#undef VGAMEM_SCAN_VARIANT
+#undef VGAMEM_SCANNER_VARIANT
+#undef VGAMEM_EXPAND
 
 void draw_char_unicode(uint32_t c, int x, int y, uint32_t fg, uint32_t bg)
 {
 	assert(x >= 0 && y >= 0 && x < 80 && y < 50);
+	if (c > 0x10FFFF)
+		c = '?'; /* wouldn't fit, and isn't a character anyway */
 	struct vgamem_char ch = {
 		.font = VGAMEM_FONT_UNICODE,
 		.character = {
@@ -819,6 +864,194 @@ DRAW_SAMPLE_DATA_VARIANT(16)
 
 #undef DRAW_SAMPLE_DATA_VARIANT
 
+/* Long samples would take hundreds of points per pixel column with the above, on every redraw, so
+ * draw_sample_data uses a summary of them instead: level 0 has the min/max of each SAMPLE_PEAK_BLOCK
+ * frames, and each level after that has half as many blocks as the one before. Any range of frames
+ * is then a few raw frames at either end plus a handful of blocks, however long the sample is.
+ * Summaries get built the first time a sample is drawn, and are kept until csf_sample_serial says
+ * the data has changed (or something else needs the slot). */
+#define SAMPLE_PEAK_BLOCK 64
+#define SAMPLE_PEAK_LEVELS 32
+#define SAMPLE_PEAK_CACHE 8
+/* with fewer frames than this per column, drawing straight from the data is cheap enough */
+#define SAMPLE_PEAK_MIN_FRAMES 64
+
+struct sample_peaks {
+	const signed char *data;
+	uint32_t serial, length, flags;
+	unsigned long last_used;
+
+	/* level[n][(block * chans + chan) * 2] is the minimum, and + 1 the maximum */
+	int16_t *level[SAMPLE_PEAK_LEVELS];
+	uint32_t blocks[SAMPLE_PEAK_LEVELS];
+	int levels;
+};
+
+static struct sample_peaks sample_peaks[SAMPLE_PEAK_CACHE];
+static unsigned long sample_peaks_clock = 0;
+
+static inline int _sample_peaks_frame(const signed char *data, uint32_t flags, uint32_t pos)
+{
+	return (flags & CHN_16BIT) ? ((const int16_t *) data)[pos] : data[pos];
+}
+
+static void _sample_peaks_build(struct sample_peaks *p, song_sample_t *sample)
+{
+	const int chans = (sample->flags & CHN_STEREO) ? 2 : 1;
+	uint32_t total = 0, b, f, n, end;
+	int16_t *mem, *dst, *src;
+	int l, c, v;
+
+	free(p->level[0]);
+	memset(p, 0, sizeof(*p));
+	p->data = sample->data;
+	p->serial = csf_sample_serial(sample->data);
+	p->length = sample->length;
+	p->flags = sample->flags & (CHN_16BIT | CHN_STEREO);
+
+	n = (sample->length + SAMPLE_PEAK_BLOCK - 1) / SAMPLE_PEAK_BLOCK;
+	for (l = 0; l < SAMPLE_PEAK_LEVELS; l++) {
+		p->blocks[l] = n;
+		total += n;
+		p->levels = l + 1;
+		if (n <= 1)
+			break;
+		n = (n + 1) / 2;
+	}
+	mem = mem_alloc(total * chans * 2 * sizeof(int16_t));
+	for (l = 0; l < p->levels; l++) {
+		p->level[l] = mem;
+		mem += p->blocks[l] * chans * 2;
+	}
+
+#define SAMPLE_PEAKS_BLOCKS(T) \
+	do { \
+		const T *in = (const T *) sample->data; \
+		for (b = 0, dst = p->level[0]; b < p->blocks[0]; b++, dst += chans * 2) { \
+			end = MIN(sample->length, (b + 1) * SAMPLE_PEAK_BLOCK) * chans; \
+			for (c = 0; c < chans; c++) { \
+				int lo = INT16_MAX, hi = INT16_MIN; \
+				for (f = b * SAMPLE_PEAK_BLOCK * chans + c; f < end; f += chans) { \
+					v = in[f]; \
+					lo = MIN(lo, v); \
+					hi = MAX(hi, v); \
+				} \
+				dst[c * 2] = lo; \
+				dst[c * 2 + 1] = hi; \
+			} \
+		} \
+	} while (0)
+	if (p->flags & CHN_16BIT)
+		SAMPLE_PEAKS_BLOCKS(int16_t);
+	else
+		SAMPLE_PEAKS_BLOCKS(int8_t);
+#undef SAMPLE_PEAKS_BLOCKS
+	for (l = 1; l < p->levels; l++) {
+		for (b = 0, dst = p->level[l], src = p->level[l - 1]; b < p->blocks[l]; b++, dst += chans * 2) {
+			for (c = 0; c < chans * 2; c++)
+				dst[c] = src[(b * 2) * chans * 2 + c];
+			if (b * 2 + 1 < p->blocks[l - 1]) {
+				for (c = 0; c < chans * 2; c += 2) {
+					dst[c] = MIN(dst[c], src[(b * 2 + 1) * chans * 2 + c]);
+					dst[c + 1] = MAX(dst[c + 1], src[(b * 2 + 1) * chans * 2 + c + 1]);
+				}
+			}
+		}
+	}
+}
+
+static struct sample_peaks *_sample_peaks_get(song_sample_t *sample)
+{
+	struct sample_peaks *p, *lru = sample_peaks;
+	uint32_t serial = csf_sample_serial(sample->data);
+	int n;
+
+	for (n = 0, p = sample_peaks; n < SAMPLE_PEAK_CACHE; n++, p++) {
+		if (p->data == sample->data && p->serial == serial && p->length == sample->length
+		    && p->flags == (sample->flags & (CHN_16BIT | CHN_STEREO))) {
+			p->last_used = ++sample_peaks_clock;
+			return p;
+		}
+		if (p->last_used < lru->last_used)
+			lru = p;
+	}
+	_sample_peaks_build(lru, sample);
+	lru->last_used = ++sample_peaks_clock;
+	return lru;
+}
+
+/* min and max of frames [start, end) of one channel */
+static void _sample_peaks_range(struct sample_peaks *p, int chan, uint32_t start, uint32_t end, int *min, int *max)
+{
+	const int chans = (p->flags & CHN_STEREO) ? 2 : 1;
+	uint32_t i, j, whole_end = end - (end % SAMPLE_PEAK_BLOCK);
+	int l, v;
+
+	*min = INT_MAX;
+	*max = INT_MIN;
+	if (whole_end < start)
+		whole_end = start;
+
+	/* the frames before the first whole block, and after the last */
+	for (; start < end && (start % SAMPLE_PEAK_BLOCK); start++) {
+		v = _sample_peaks_frame(p->data, p->flags, start * chans + chan);
+		*min = MIN(*min, v);
+		*max = MAX(*max, v);
+	}
+	for (i = MAX(start, whole_end); i < end; i++) {
+		v = _sample_peaks_frame(p->data, p->flags, i * chans + chan);
+		*min = MIN(*min, v);
+		*max = MAX(*max, v);
+	}
+
+	/* and the blocks in between, going up a level wherever two neighbours can be taken at once */
+	i = start / SAMPLE_PEAK_BLOCK;
+	j = whole_end / SAMPLE_PEAK_BLOCK;
+	for (l = 0; i < j && l < p->levels; l++, i >>= 1, j >>= 1) {
+		if (i & 1) {
+			*min = MIN(*min, p->level[l][(i * chans + chan) * 2]);
+			*max = MAX(*max, p->level[l][(i * chans + chan) * 2 + 1]);
+			i++;
+		}
+		if (j & 1) {
+			j--;
+			*min = MIN(*min, p->level[l][(j * chans + chan) * 2]);
+			*max = MAX(*max, p->level[l][(j * chans + chan) * 2 + 1]);
+		}
+	}
+}
+
+/* same picture as _draw_sample_data_*, but one line per column, from the lowest point to the highest */
+static void _draw_sample_peaks(struct vgamem_overlay *r, struct sample_peaks *p)
+{
+	const int outputchans = (p->flags & CHN_STEREO) ? 2 : 1;
+	const int nh = r->height / outputchans;
+	const float range = (p->flags & CHN_16BIT) ? (float)UINT16_MAX : (float)UINT8_MAX;
+	int np = r->height - nh / 2;
+	int cc, x, min, max, ys, ye, last_ys = 0, last_ye = 0;
+	uint32_t start, end;
+
+	for (cc = 0; cc < outputchans; cc++) {
+		for (x = 0; x < r->width; x++) {
+			start = (uint64_t) x * p->length / r->width;
+			end = MAX(start + 1, (uint64_t) (x + 1) * p->length / r->width);
+			_sample_peaks_range(p, cc, start, end, &min, &max);
+
+			ys = CLAMP((np - 1) - (int) ceil(max * nh / range), 0, r->height - 1);
+			ye = CLAMP((np - 1) - (int) ceil(min * nh / range), 0, r->height - 1);
+			/* join up with the last column, like the line-drawing version does */
+			if (x) {
+				ys = MIN(ys, last_ye);
+				ye = MAX(ye, last_ys);
+			}
+			vgamem_ovl_drawline(r, x, ys, x, ye, SAMPLE_DATA_COLOR);
+			last_ys = ys;
+			last_ye = ye;
+		}
+		np -= nh;
+	}
+}
+
 /* --------------------------------------------------------------------- */
 /* these functions assume the screen is locked! */
 
@@ -868,18 +1101,16 @@ static void _draw_sample_play_marks(struct vgamem_overlay *r, song_sample_t * sa
 {
 	int n, x, y;
 	int c;
-	song_voice_t *channel;
-	unsigned int *channel_list;
+	static song_playing_voice_t voices[MAX_VOICES];
+	const song_playing_voice_t *channel;
 
 	if (song_get_mode() == MODE_STOPPED)
 		return;
 
-	song_lock_audio();
-
-	n = song_get_mix_state(&channel_list);
+	n = song_get_playing_voices(voices);
 	while (n--) {
-		channel = song_get_mix_channel(channel_list[n]);
-		if (channel->current_sample_data != sample->data)
+		channel = voices + n;
+		if (channel->sample_data != sample->data)
 			continue;
 		if (!channel->final_volume) continue;
 		c = (channel->flags & (CHN_KEYOFF | CHN_NOTEFADE)) ? SAMPLE_BGMARK_COLOR : SAMPLE_MARK_COLOR;
@@ -901,8 +1132,6 @@ static void _draw_sample_play_marks(struct vgamem_overlay *r, song_sample_t * sa
 			vgamem_ovl_drawpixel(r, x, y++, c);
 		} while (y < r->height);
 	}
-
-	song_unlock_audio();
 }
 
 /* --------------------------------------------------------------------- */
@@ -949,7 +1178,9 @@ void draw_sample_data(struct vgamem_overlay *r, song_sample_t *sample)
 
 	/* do the actual drawing */
 	int chans = sample->flags & CHN_STEREO ? 2 : 1;
-	if (sample->flags & CHN_16BIT)
+	if (sample->length / r->width >= SAMPLE_PEAK_MIN_FRAMES)
+		_draw_sample_peaks(r, _sample_peaks_get(sample));
+	else if (sample->flags & CHN_16BIT)
 		_draw_sample_data_16(r, (signed short *) sample->data,
 				sample->length * chans,
 				chans, chans);
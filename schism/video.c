@@ -101,6 +101,15 @@ struct video_cf {
 		int visible;
 	} mouse;
 
+	/* where the cursor was last drawn into the framebuffer, so those rows can be cleaned up after it moves */
+	struct {
+		unsigned int x, y;
+		int shown;
+	} drawn_mouse;
+
+	/* set when the whole framebuffer is stale (new palette, new texture) */
+	int redraw_all;
+
 #ifdef SCHISM_WIN32
 	struct {
 		/* TODO: need to save the state of the menu bar or else
@@ -122,7 +131,8 @@ struct video_cf {
 static struct video_cf video = {
 	.mouse = {
 		.visible = MOUSE_EMULATED
-	}
+	},
+	.redraw_all = 1
 };
 
 int video_is_fullscreen(void)
@@ -169,6 +179,7 @@ void video_redraw_texture(void)
 {
 	SDL_DestroyTexture(video.texture);
 	video.texture = SDL_CreateTexture(video.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, NATIVE_SCREEN_WIDTH, NATIVE_SCREEN_HEIGHT);
+	video.redraw_all = 1;
 }
 
 void video_shutdown(void)
@@ -313,6 +324,7 @@ void video_colors(unsigned char palette[16][3])
 		_gl_pal(i, rgb);
 		_bgr32_pal(i, rgb);
 	}
+	video.redraw_all = 1;
 }
 
 void video_refresh(void)
@@ -363,7 +375,15 @@ static inline void make_mouseline(unsigned int x, unsigned int v, unsigned int y
 	}
 }
 
-static void _blit11(unsigned char *pixels, unsigned int pitch, unsigned int *tpal)
+static void _mark_mouse_rows(uint8_t dirty[50], unsigned int y)
+{
+	unsigned int row;
+
+	for (row = y / 8; row <= (y + MOUSE_HEIGHT - 1) / 8 && row < 50; row++)
+		dirty[row] = 1;
+}
+
+static void _blit11(unsigned char *pixels, unsigned int pitch, unsigned int *tpal, uint8_t dirty[50])
 {
 	unsigned int mouseline_x = (video.mouse.x / 8);
 	unsigned int mouseline_v = (video.mouse.x % 8);
@@ -374,6 +394,10 @@ static void _blit11(unsigned char *pixels, unsigned int pitch, unsigned int *tpa
 	int pitch24;
 
 	for (y = 0; y < NATIVE_SCREEN_HEIGHT; y++) {
+		if (!dirty[y / 8]) {
+			pixels += pitch;
+			continue;
+		}
 		make_mouseline(mouseline_x, mouseline_v, y, mouseline, mouseline_mask);
 		vgamem_scan32(y, (unsigned int *)pixels, tpal, mouseline, mouseline_mask);
 		pixels += pitch;
@@ -391,11 +415,45 @@ void video_blit(void)
 
 	unsigned char *pixels = video.framebuf;
 	unsigned int pitch = NATIVE_SCREEN_WIDTH * sizeof(Uint32);
+	int mouse_shown = (video.mouse.visible == MOUSE_EMULATED && video_is_focused());
+	uint8_t dirty[50];
+	unsigned int y, end;
+
+	/* only the character rows that changed get rescanned and sent to the texture; the texture keeps the
+	rest from last time. the cursor isn't in vgamem, so its old and new rows are added by hand. */
+	vgamem_dirty_rows(dirty);
+	if (video.redraw_all) {
+		memset(dirty, 1, sizeof(dirty));
+		video.redraw_all = 0;
+	}
+	if (mouse_shown != video.drawn_mouse.shown
+	    || (mouse_shown && (video.mouse.x != video.drawn_mouse.x || video.mouse.y != video.drawn_mouse.y))) {
+		if (video.drawn_mouse.shown)
+			_mark_mouse_rows(dirty, video.drawn_mouse.y);
+		if (mouse_shown)
+			_mark_mouse_rows(dirty, video.mouse.y);
+		video.drawn_mouse.x = video.mouse.x;
+		video.drawn_mouse.y = video.mouse.y;
+		video.drawn_mouse.shown = mouse_shown;
+	}
 
-	_blit11(pixels, pitch, video.pal);
+	_blit11(pixels, pitch, video.pal, dirty);
 
 	SDL_RenderClear(video.renderer);
-	SDL_UpdateTexture(video.texture, NULL, pixels, pitch);
+	for (y = 0; y < 50; y = end) {
+		SDL_Rect rect;
+
+		for (; y < 50 && !dirty[y]; y++);
+		for (end = y; end < 50 && dirty[end]; end++);
+		if (y == end)
+			break;
+
+		rect.x = 0;
+		rect.y = y * 8;
+		rect.w = NATIVE_SCREEN_WIDTH;
+		rect.h = (end - y) * 8;
+		SDL_UpdateTexture(video.texture, &rect, pixels + (rect.y * pitch), pitch);
+	}
 	SDL_RenderCopy(video.renderer, video.texture, NULL, (cfg_video_want_fixed) ? &dstrect : NULL);
 	SDL_RenderPresent(video.renderer);
 }